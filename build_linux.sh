@@ -1 +1,3 @@
 g++ -o mini_video_vulkan.exe mini_video_vulkan.cpp -lX11
+g++ -o mini_video_remux.exe mini_video_remux.cpp
+g++ -o mini_video_null.exe mini_video_null.cpp
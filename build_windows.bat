@@ -8,3 +8,7 @@ cl.exe /permissive- /W3 /Gy /Zc:inline /D "NDEBUG" /D "_CONSOLE" /D "_UNICODE" /
 cl.exe /permissive- /W3 /Gy /Zc:inline /D "NDEBUG" /D "_CONSOLE" /D "_UNICODE" /D "UNICODE" /Oi /O2 /MT /FC /EHsc /nologo mini_video_vulkan.cpp /link user32.lib kernel32.lib
 
 cl.exe /permissive- /W3 /Gy /Zc:inline /D "NDEBUG" /D "_CONSOLE" /D "_UNICODE" /D "UNICODE" /Oi /O2 /MT /FC /EHsc /nologo mini_video_dx11.cpp /link user32.lib kernel32.lib
+
+cl.exe /permissive- /W3 /Gy /Zc:inline /D "NDEBUG" /D "_CONSOLE" /D "_UNICODE" /D "UNICODE" /Oi /O2 /MT /FC /EHsc /nologo mini_video_remux.cpp /link kernel32.lib
+
+cl.exe /permissive- /W3 /Gy /Zc:inline /D "NDEBUG" /D "_CONSOLE" /D "_UNICODE" /D "UNICODE" /Oi /O2 /MT /FC /EHsc /nologo mini_video_null.cpp /link kernel32.lib
@@ -0,0 +1,114 @@
+// Headless decode benchmark
+//
+// What this does:
+//	- measures the time of loading and indexing the video, and the wall time of decoding it without presenting anything
+//	- records the CPU time of every frame submission (decoder core logic + command recording + queue submit), and reports the median and the 99th percentile
+//	- prints the results as one JSON object, so it can be collected by scripts and compared between versions
+//
+// How to use:
+//	DecodeBenchmark benchmark;
+//	benchmark.begin_load();
+//	video.Load_mp4(filename);
+//	benchmark.end_load();
+//	while (benchmark.can_submit())
+//	{
+//		benchmark.begin_submit();
+//		if (core.begin_decode(decode))
+//		{
+//			// submit the decode
+//			core.end_decode(decode);
+//			benchmark.end_submit(decode.frame_info.size);
+//		}
+//	}
+//	benchmark.print_json("vulkan", filename, frames_in_flight);
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+
+struct DecodeBenchmark
+{
+	uint64_t frame_limit = ~0ull; // submission stops after this many frames, live streams are benchmarked until they end
+	uint64_t frame_count = 0;
+	uint64_t bitstream_bytes = 0;
+	uint64_t load_nanoseconds = 0;
+	uint64_t decode_begin = 0; // time of the first submission
+	uint64_t decode_end = 0; // time of the last submission or completion
+	uint64_t submit_begin = 0;
+	std::vector<uint32_t> submit_nanoseconds; // CPU time of each frame submission
+	Video::Timer timer;
+
+	void begin_load()
+	{
+		timer.record();
+	}
+	void end_load()
+	{
+		load_nanoseconds = timer.elapsed_nanoseconds();
+		timer.record();
+	}
+
+	bool can_submit() const
+	{
+		return frame_count < frame_limit;
+	}
+	void begin_submit()
+	{
+		submit_begin = timer.elapsed_nanoseconds();
+		if (frame_count == 0)
+		{
+			decode_begin = submit_begin;
+		}
+	}
+	void end_submit(uint64_t bitstream_size)
+	{
+		decode_end = timer.elapsed_nanoseconds();
+		submit_nanoseconds.push_back(uint32_t(std::min(decode_end - submit_begin, uint64_t(UINT32_MAX))));
+		bitstream_bytes += bitstream_size;
+		frame_count++;
+	}
+	// Call when the decoded frames completed on the GPU, so the decode time includes the GPU work:
+	void end_decode()
+	{
+		decode_end = timer.elapsed_nanoseconds();
+	}
+
+	// Returns the submission time that is larger than the given fraction of the submissions:
+	uint32_t percentile(double fraction) const
+	{
+		if (submit_nanoseconds.empty())
+			return 0;
+		std::vector<uint32_t> sorted = submit_nanoseconds;
+		const size_t index = std::min(sorted.size() - 1, size_t(fraction * double(sorted.size())));
+		std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+		return sorted[index];
+	}
+
+	void print_json(const char* backend, const char* filename, uint32_t frames_in_flight) const
+	{
+		const double decode_seconds = double(decode_end - decode_begin) / 1000000000.0;
+		const double safe_seconds = std::max(decode_seconds, 1e-9);
+		printf("{\"backend\": \"%s\", \"file\": \"", backend);
+		for (const char* c = filename; *c != 0; ++c)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				putchar('\\');
+			}
+			putchar(*c);
+		}
+		printf("\", \"frames\": %llu, \"frames_in_flight\": %u, \"load_ms\": %.3f, \"decode_seconds\": %.6f, \"fps\": %.1f, \"bitstream_mb_per_s\": %.3f, \"submit_ns_p50\": %u, \"submit_ns_p99\": %u}\n",
+			(unsigned long long)frame_count,
+			frames_in_flight,
+			double(load_nanoseconds) / 1000000.0,
+			decode_seconds,
+			double(frame_count) / safe_seconds,
+			double(bitstream_bytes) / 1000000.0 / safe_seconds,
+			percentile(0.5),
+			percentile(0.99)
+		);
+	}
+};
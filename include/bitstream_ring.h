@@ -0,0 +1,178 @@
+// Fixed size ring buffer for uploading the bitstream of the decoded frames just in time
+//
+// What this does:
+//	- instead of copying the whole video into one GPU visible buffer at startup, every frame is copied into the ring right before its decode is recorded, so the buffer size only depends on the largest frame and the number of decodes in flight, not on the video length
+//	- every allocation is tagged with the completion value of its decode (a timeline semaphore or fence value that increases with every submit), and the allocations are reclaimed in order when the GPU reached their value
+//	- the offsets are aligned to the minimum bitstream offset alignment, and the sizes to the minimum bitstream size alignment of the decoder, a frame is never split at the end of the buffer, it's placed at the beginning instead
+//	- with the capacity of configure(), the decodes in flight always leave room for the next frame, so the allocation only fails (and the caller waits for the oldest decode) if the capacity was set smaller
+//
+// How to use:
+//	BitstreamRing ring;
+//	ring.configure(video, frames_in_flight, offset_alignment, size_alignment); // then create a mappable buffer of ring.capacity bytes
+//	...
+//	ring.reclaim(completed_value); // the highest completed value of the decode timeline
+//	uint64_t offset = 0;
+//	while (!ring.allocate(frame_info.size, submit_value, offset))
+//	{
+//		wait_for(ring.oldest_completion_value());
+//		ring.reclaim(ring.oldest_completion_value());
+//	}
+//	std::memcpy(mapped_data + offset, video.h264_data.data() + frame_info.offset, frame_info.size); // decode range: ring.aligned_size(frame_info.size)
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+
+struct BitstreamRing
+{
+	// Settings:
+	uint64_t capacity = 0; // bytes
+	uint64_t offset_alignment = 1; // the allocations start at a multiple of this
+	uint64_t size_alignment = 1; // the allocation sizes are rounded up to a multiple of this
+
+	// State:
+	struct Allocation
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0; // aligned size
+		uint64_t completion_value = 0; // the allocation can be reused when the decode timeline reached this
+	};
+	std::vector<Allocation> allocations; // the allocations in use, oldest first, there are only as many as the decodes in flight
+	uint64_t tail = 0; // the next allocation starts here, or at the beginning if it doesn't fit before the end
+
+	// Statistics:
+	uint64_t allocation_count = 0;
+	uint64_t allocated_bytes = 0; // unaligned bytes that were allocated, the bytes that are copied to the GPU
+	uint64_t wrap_count = 0; // allocations that didn't fit before the end of the buffer, so they were placed at the beginning
+	uint64_t full_count = 0; // allocations that failed, because the decodes in flight used too much of the buffer
+	uint64_t peak_used = 0; // the most bytes that were used at the same time, including the unused space before a wrap
+
+	static constexpr uint64_t align(uint64_t value, uint64_t alignment)
+	{
+		return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+	}
+
+	// Returns the number of bytes that an allocation of the size occupies, the decode range of a frame
+	uint64_t aligned_size(uint64_t size) const
+	{
+		return align(size, size_alignment);
+	}
+
+	// Sets the alignments, and the capacity that is needed for frames_in_flight decodes of the video's largest frame
+	//	before the next allocation, at most frames_in_flight - 1 decodes are in flight, and they use at most that many frames and less than one frame of unused space before a wrap. Two more frames of capacity leave one contiguous free range for the next frame, either before the end or at the beginning
+	//	returns the capacity
+	uint64_t configure(const Video& video, uint32_t frames_in_flight, uint64_t offset_alignment_, uint64_t size_alignment_)
+	{
+		offset_alignment = std::max(uint64_t(1), offset_alignment_);
+		size_alignment = std::max(uint64_t(1), size_alignment_);
+		uint64_t max_frame_size = video.live ? video.live_bitstream_size : 0; // live streams don't know their frame sizes in advance, but they have an upper limit
+		for (uint32_t size : video.frame_infos.sizes)
+		{
+			max_frame_size = std::max(max_frame_size, (uint64_t)size);
+		}
+		capacity = (uint64_t(frames_in_flight) + 2) * align(aligned_size(max_frame_size), offset_alignment);
+		allocations.clear();
+		tail = 0;
+		return capacity;
+	}
+
+	// Returns the offset of the oldest allocation in use
+	uint64_t head() const
+	{
+		return allocations.empty() ? tail : allocations.front().offset;
+	}
+
+	// Returns the number of bytes in use, including the unused space at the end of the buffer before a wrap
+	uint64_t used() const
+	{
+		if (allocations.empty())
+			return 0;
+		const uint64_t begin = head();
+		return tail > begin ? tail - begin : capacity - begin + tail;
+	}
+
+	// Returns the completion value that must be waited for to free the oldest allocation
+	uint64_t oldest_completion_value() const
+	{
+		assert(!allocations.empty());
+		return allocations.front().completion_value;
+	}
+
+	// Frees the allocations of the completed decodes, in allocation order
+	void reclaim(uint64_t completed_value)
+	{
+		size_t count = 0;
+		while (count < allocations.size() && allocations[count].completion_value <= completed_value)
+		{
+			count++;
+		}
+		allocations.erase(allocations.begin(), allocations.begin() + count);
+		if (allocations.empty())
+		{
+			tail = 0; // the whole buffer is free, the next frame starts at the beginning so it doesn't need to wrap
+		}
+	}
+
+	// Allocates an aligned range for a frame of the size, that is used by the decode that completes with completion_value
+	//	returns false if the buffer is full, then the oldest allocation must be waited for and reclaimed
+	bool allocate(uint64_t size, uint64_t completion_value, uint64_t& offset)
+	{
+		const uint64_t occupied = aligned_size(size);
+		assert(occupied <= capacity); // the frame is larger than the buffer, the capacity must be configured for the largest frame
+		assert(allocations.empty() || completion_value >= allocations.back().completion_value); // the decodes complete in submission order
+		uint64_t start = align(tail, offset_alignment);
+		if (!allocations.empty())
+		{
+			const uint64_t begin = head();
+			if (tail > begin)
+			{
+				// The used range doesn't wrap, the free space is after it and before it:
+				if (start + occupied > capacity)
+				{
+					if (occupied > begin)
+					{
+						full_count++;
+						return false;
+					}
+					start = 0;
+					wrap_count++;
+				}
+			}
+			else if (start + occupied > begin)
+			{
+				// The used range wraps, the free space is between its end and its beginning:
+				full_count++;
+				return false;
+			}
+		}
+		else if (start + occupied > capacity)
+		{
+			start = 0;
+		}
+
+		Allocation allocation;
+		allocation.offset = start;
+		allocation.size = occupied;
+		allocation.completion_value = completion_value;
+		allocations.push_back(allocation);
+		tail = start + occupied;
+		if (tail >= capacity)
+		{
+			tail = 0;
+		}
+		offset = start;
+		allocation_count++;
+		allocated_bytes += size;
+		peak_used = std::max(peak_used, used());
+		return true;
+	}
+
+	void print_statistics() const
+	{
+		printf("Bitstream ring: capacity: %.1f KB, peak used: %.1f KB, allocations: %llu, copied: %.1f KB, wraps: %llu, full: %llu\n", double(capacity) / 1024.0, double(peak_used) / 1024.0, (unsigned long long)allocation_count, double(allocated_bytes) / 1024.0, (unsigned long long)wrap_count, (unsigned long long)full_count);
+	}
+};
@@ -0,0 +1,284 @@
+// Decode capacity calculator and admission control for multiple streams
+//
+// What this does:
+//	- computes the decode load of each loaded video: macroblocks per second (from the frame size and the actual frame rate of the file, or the VUI timing of a live stream), DPB memory and bitstream bandwidth (the HRD bit rate if the SPS has one, otherwise the average of the file)
+//	- checks the streams against the limits of their H264 level (MaxMBPS, MaxFS, MaxDpbMbs and MaxBR of Table A-1, see h264::get_level())
+//	- admission control: the streams are admitted in the order they were added while their totals fit into a device budget; a stream that doesn't fit at its full frame rate is degraded to a lower frame rate if its reference frames still fit (the non-reference frames are skipped by VideoDecoderCore::enable_decimation), otherwise it is rejected
+//	- so oversubscription is refused before playback, instead of every stream stuttering when the decoder can't keep up
+//
+// How to use:
+//	CapacityPlanner planner;
+//	planner.budget = CapacityPlanner::Budget::from_level(51); // or set the macroblocks/s, DPB memory, bandwidth and stream count of the device
+//	planner.add_stream(video0);
+//	planner.add_stream(video1);
+//	planner.admit();
+//	planner.print();
+//	for (const CapacityPlanner::Stream& stream : planner.streams)
+//	{
+//		if (stream.decision == CapacityPlanner::Decision::reject)
+//			continue;
+//		const uint32_t index = scheduler.add_stream(stream.video, now);
+//		if (stream.decision == CapacityPlanner::Decision::degrade)
+//		{
+//			scheduler.streams[index].core.enable_decimation(stream.max_frame_rate, false);
+//		}
+//	}
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+
+struct CapacityPlanner
+{
+	// Returns the bits/s of one MaxBR unit of h264::Level in the profile (cpbBrVclFactor of Table A-2)
+	static uint32_t bit_rate_factor(int profile_idc)
+	{
+		switch (profile_idc)
+		{
+		case 100:
+			return 1250;
+		case 110:
+			return 3000;
+		case 122:
+		case 244:
+			return 4000;
+		default:
+			return 1000;
+		}
+	}
+
+	// Decode resources of a device, a zero value is not limited:
+	struct Budget
+	{
+		uint64_t macroblocks_per_second = 0;
+		uint64_t dpb_bytes = 0;
+		uint64_t bitstream_bits_per_second = 0;
+		uint32_t max_streams = 0;
+		uint32_t max_level_idc = 0; // the highest level that the decoder supports
+
+		// Returns the budget of a decoder that can decode exactly one stream of the level in the high profile
+		static Budget from_level(uint32_t level_idc)
+		{
+			Budget budget;
+			const h264::Level* level = h264::get_level((int)level_idc);
+			if (level == nullptr)
+				return budget;
+			budget.macroblocks_per_second = level->max_mbps;
+			budget.dpb_bytes = uint64_t(level->max_dpb_mbs) * 384; // 256 luma and 128 chroma bytes per 8-bit 4:2:0 macroblock
+			budget.bitstream_bits_per_second = uint64_t(level->max_br) * bit_rate_factor(100);
+			budget.max_level_idc = level_idc;
+			return budget;
+		}
+	};
+	Budget budget;
+
+	enum class Decision
+	{
+		admit, // decoded at the full frame rate
+		degrade, // decoded at most at max_frame_rate, by skipping non-reference frames
+		reject,
+	};
+
+	struct Stream
+	{
+		Video* video = nullptr;
+		uint32_t level_idc = 0; // the highest level of the SPSs, 9 for level 1b
+		uint32_t frame_macroblocks = 0; // macroblocks of one decoded frame
+		double frame_rate = 0; // frames per second
+		double reference_ratio = 1; // the part of the frames that are reference frames, they can't be skipped
+		uint64_t macroblocks_per_second = 0; // at the full frame rate
+		uint64_t dpb_bytes = 0; // the DPB slots of the stream
+		uint64_t bitstream_bits_per_second = 0;
+		bool hrd_bit_rate = false; // bitstream_bits_per_second is from the HRD parameters of the SPS, not measured from the file
+
+		// Limits of the level that the stream exceeds:
+		bool exceeds_frame_size = false;
+		bool exceeds_macroblock_rate = false;
+		bool exceeds_dpb = false;
+		bool exceeds_bit_rate = false;
+
+		// Result of admit():
+		Decision decision = Decision::reject;
+		double max_frame_rate = 0; // the frame rate cap of a degraded stream, for VideoDecoderCore::enable_decimation()
+		const char* reason = ""; // why the stream was degraded or rejected
+
+		bool exceeds_level() const { return exceeds_frame_size || exceeds_macroblock_rate || exceeds_dpb || exceeds_bit_rate; }
+	};
+	std::vector<Stream> streams;
+
+	// Totals of the admitted and degraded streams after admit():
+	uint64_t used_macroblocks_per_second = 0;
+	uint64_t used_dpb_bytes = 0;
+	uint64_t used_bitstream_bits_per_second = 0;
+	uint32_t used_streams = 0;
+
+	// Computes the decode load of a loaded video and adds it to the streams, returns its index
+	uint32_t add_stream(Video& video)
+	{
+		streams.emplace_back();
+		Stream& stream = streams.back();
+		stream.video = &video;
+		const h264::SPS* sps = nullptr;
+		for (const h264::SPS& x : video.sps_array)
+		{
+			const h264::Level* level = h264::get_level(&x);
+			const uint32_t level_idc = level != nullptr ? level->level_idc : (uint32_t)x.level_idc;
+			if (sps == nullptr || level_idc > stream.level_idc)
+			{
+				sps = &x;
+				stream.level_idc = level_idc;
+			}
+		}
+		assert(sps != nullptr);
+
+		stream.frame_macroblocks = (video.padded_width / 16) * (video.padded_height / 16);
+
+		// The frame rate of a file comes from its timestamps, a live stream has the frame duration that was parsed from the VUI:
+		if (!video.live && video.duration > 0)
+		{
+			stream.frame_rate = double(video.frame_infos.size()) * double(video.timescale) / double(video.duration);
+		}
+		else if (video.live && video.live_frame_duration > 0)
+		{
+			stream.frame_rate = double(video.timescale) / double(video.live_frame_duration);
+		}
+		else if (sps->vui.timing_info_present_flag && sps->vui.num_units_in_tick > 0)
+		{
+			stream.frame_rate = double(sps->vui.time_scale) / double(2 * sps->vui.num_units_in_tick);
+		}
+
+		uint64_t total_size = 0;
+		if (!video.live && !video.frame_infos.empty())
+		{
+			uint32_t reference_count = 0;
+			for (size_t i = 0; i < video.frame_infos.size(); ++i)
+			{
+				reference_count += video.frame_infos[i].reference_priority > 0 ? 1 : 0;
+			}
+			for (uint32_t size : video.frame_infos.sizes)
+			{
+				total_size += size;
+			}
+			stream.reference_ratio = double(reference_count) / double(video.frame_infos.size());
+		}
+		stream.macroblocks_per_second = uint64_t(double(stream.frame_macroblocks) * stream.frame_rate + 0.5);
+
+		// Every DPB slot is a full picture, with the chroma format and bit depth of the stream:
+		const uint64_t chroma_samples[] = { 0, 2, 4, 8 }; // in quarters of the luma samples, for chroma_format_idc 0 (monochrome), 1 (4:2:0), 2 (4:2:2), 3 (4:4:4)
+		const uint64_t sample_bytes = sps->bit_depth_luma_minus8 > 0 || sps->bit_depth_chroma_minus8 > 0 ? 2 : 1;
+		const uint64_t luma_samples = uint64_t(video.padded_width) * uint64_t(video.padded_height);
+		stream.dpb_bytes = uint64_t(video.num_dpb_slots) * sample_bytes * (luma_samples + luma_samples * chroma_samples[sps->chroma_format_idc & 3] / 4);
+
+		// The HRD bit rate is the rate that the stream can reach, the average of the file is used when there is none:
+		if (sps->vui.nal_hrd_parameters_present_flag || sps->vui.vcl_hrd_parameters_present_flag)
+		{
+			stream.bitstream_bits_per_second = uint64_t(sps->hrd.bit_rate_value_minus1[0] + 1) << (6 + sps->hrd.bit_rate_scale);
+			stream.hrd_bit_rate = true;
+		}
+		else if (!video.live && video.duration > 0)
+		{
+			stream.bitstream_bits_per_second = uint64_t(double(total_size) * 8 * double(video.timescale) / double(video.duration) + 0.5);
+		}
+
+		const h264::Level* level = h264::get_level((int)stream.level_idc);
+		if (level != nullptr)
+		{
+			stream.exceeds_frame_size = stream.frame_macroblocks > uint32_t(level->max_fs);
+			stream.exceeds_macroblock_rate = stream.macroblocks_per_second > uint64_t(level->max_mbps);
+			stream.exceeds_dpb = uint64_t(video.num_dpb_slots - 1) * stream.frame_macroblocks > uint64_t(level->max_dpb_mbs); // one slot is the current picture, it's not part of MaxDpbMbs
+			stream.exceeds_bit_rate = stream.bitstream_bits_per_second > uint64_t(level->max_br) * bit_rate_factor(sps->profile_idc);
+		}
+		return uint32_t(streams.size() - 1);
+	}
+
+	// Decides for each stream in the order they were added whether it is admitted, degraded or rejected, so that the admitted and degraded streams fit into the budget
+	void admit()
+	{
+		used_macroblocks_per_second = 0;
+		used_dpb_bytes = 0;
+		used_bitstream_bits_per_second = 0;
+		used_streams = 0;
+		for (Stream& stream : streams)
+		{
+			stream.decision = Decision::reject;
+			stream.max_frame_rate = 0;
+			stream.reason = "";
+
+			// The DPB memory and the bitstream bandwidth can't be reduced by skipping frames:
+			if (budget.max_streams > 0 && used_streams >= budget.max_streams)
+			{
+				stream.reason = "no free decoder session";
+				continue;
+			}
+			if (budget.max_level_idc > 0 && stream.level_idc > budget.max_level_idc)
+			{
+				stream.reason = "level is not supported";
+				continue;
+			}
+			if (budget.dpb_bytes > 0 && used_dpb_bytes + stream.dpb_bytes > budget.dpb_bytes)
+			{
+				stream.reason = "DPB memory";
+				continue;
+			}
+			if (budget.bitstream_bits_per_second > 0 && used_bitstream_bits_per_second + stream.bitstream_bits_per_second > budget.bitstream_bits_per_second)
+			{
+				stream.reason = "bitstream bandwidth";
+				continue;
+			}
+
+			uint64_t macroblocks_per_second = stream.macroblocks_per_second;
+			if (budget.macroblocks_per_second == 0 || used_macroblocks_per_second + macroblocks_per_second <= budget.macroblocks_per_second)
+			{
+				stream.decision = Decision::admit;
+			}
+			else
+			{
+				// The rest of the macroblock rate is given to the stream if at least its reference frames fit, decimation never decodes more than this frame rate:
+				const uint64_t available = budget.macroblocks_per_second - std::min(budget.macroblocks_per_second, used_macroblocks_per_second);
+				const double reference_rate = stream.frame_rate * stream.reference_ratio;
+				const double max_frame_rate = stream.frame_macroblocks > 0 ? double(available) / double(stream.frame_macroblocks) : 0;
+				if (stream.reference_ratio >= 1 || stream.video->live || max_frame_rate < reference_rate || max_frame_rate <= 0)
+				{
+					stream.reason = "macroblock rate";
+					continue;
+				}
+				stream.decision = Decision::degrade;
+				stream.max_frame_rate = max_frame_rate;
+				stream.reason = "macroblock rate";
+				macroblocks_per_second = available;
+			}
+			used_macroblocks_per_second += macroblocks_per_second;
+			used_dpb_bytes += stream.dpb_bytes;
+			used_bitstream_bits_per_second += stream.bitstream_bits_per_second;
+			used_streams++;
+		}
+	}
+
+	void print() const
+	{
+		static const char* decisions[] = { "admit", "degrade", "reject" };
+		for (uint32_t i = 0; i < (uint32_t)streams.size(); ++i)
+		{
+			const Stream& stream = streams[i];
+			printf("Capacity stream %u: level: %u.%u%s, %.2f fps (reference frames: %.0f%%), %llu macroblocks/s, DPB: %.2f MB, bitstream: %.2f Mbit/s (%s)", i, stream.level_idc == 9 ? 1 : stream.level_idc / 10, stream.level_idc == 9 ? 0 : stream.level_idc % 10, stream.level_idc == 9 ? "b" : "", stream.frame_rate, stream.reference_ratio * 100, (unsigned long long)stream.macroblocks_per_second, double(stream.dpb_bytes) / 1000000.0, double(stream.bitstream_bits_per_second) / 1000000.0, stream.hrd_bit_rate ? "HRD" : "average");
+			if (stream.exceeds_level())
+			{
+				printf(", exceeds the level:%s%s%s%s", stream.exceeds_frame_size ? " MaxFS" : "", stream.exceeds_macroblock_rate ? " MaxMBPS" : "", stream.exceeds_dpb ? " MaxDpbMbs" : "", stream.exceeds_bit_rate ? " MaxBR" : "");
+			}
+			printf(" -> %s", decisions[(int)stream.decision]);
+			if (stream.decision == Decision::degrade)
+			{
+				printf(" to %.2f fps", stream.max_frame_rate);
+			}
+			if (stream.reason[0] != 0)
+			{
+				printf(" (%s)", stream.reason);
+			}
+			printf("\n");
+		}
+		printf("Capacity used: %llu / %llu macroblocks/s, DPB: %.2f / %.2f MB, bitstream: %.2f / %.2f Mbit/s, streams: %u / %u (0: not limited)\n", (unsigned long long)used_macroblocks_per_second, (unsigned long long)budget.macroblocks_per_second, double(used_dpb_bytes) / 1000000.0, double(budget.dpb_bytes) / 1000000.0, double(used_bitstream_bits_per_second) / 1000000.0, double(budget.bitstream_bits_per_second) / 1000000.0, used_streams, budget.max_streams);
+	}
+};
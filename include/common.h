@@ -13,6 +13,9 @@ static_assert(sizeof(void*) == sizeof(uint64_t), "Error: only 64-bit build is su
 #define MINIMP4_IMPLEMENTATION
 #include "minimp4.h"	// mp4 -> h264 extraction
 #include "h264.h"		// h264 parsing
+#include "frame_index.h"	// compact storage of frame informations
+#include "file_reader.h"	// file reading with many reads in flight
+#include "stream_reader.h"	// live stream reading from stdin or pipe
 
 // Video management utility:
 struct Video
@@ -26,79 +29,114 @@ struct Video
 	uint32_t num_dpb_slots = 0; // maximum number of texture array slices in the Decoded Picture Buffer (DPB)
 	std::vector<h264::SPS> sps_array; // array of h264 Picture Parameter Sets, usually there is only one
 	std::vector<h264::PPS> pps_array; // array of h264 Sequence Parameter Sets, usually there is only one
-	std::vector<h264::SliceHeader> slice_headers; // array of h264 Slice Headers, there are as many of them as video frames
-	float duration_seconds = 0; // whole video duration in seconds
-	struct FrameInfo
+	uint32_t timescale = 1; // number of time units (ticks) per second, all timestamps and durations are stored in this unit
+	uint64_t duration = 0; // whole video duration in timescale ticks
+	using FrameInfo = FrameIndex::FrameInfo;
+	FrameIndex frame_infos; // information and slice header of every frame in the order they were encontered inside the h264 stream (so they are in decode order, not display order)
+
+	// Converts timescale ticks to seconds, only use this at the edges (printing, UI), never to accumulate time:
+	inline double to_seconds(uint64_t ticks) const { return double(ticks) / double(timescale); }
+
+	// Calculates the PictureOrderCount of frames incrementally, frames must be given in decode order:
+	struct PictureOrderCounter
 	{
-		uint64_t offset = 0;
-		uint64_t size = 0;
-		float timestamp_seconds = 0;
-		float duration_seconds = 0;
-		uint32_t reference_priority = 0;
-		int poc = 0;
-		int gop = 0;
-		int display_order = 0;
-		bool is_intra = false;
+		int prev_pic_order_cnt_lsb = 0;
+		int prev_pic_order_cnt_msb = 0;
+		int poc_cycle = 0;
+
+		void calculate(FrameInfo& frame_info, const h264::SliceHeader& slice_header, const h264::SPS& sps)
+		{
+			// Rec. ITU-T H.264 (08/2021) page 77
+			int max_pic_order_cnt_lsb = 1 << (sps.log2_max_pic_order_cnt_lsb_minus4 + 4);
+			int pic_order_cnt_lsb = slice_header.pic_order_cnt_lsb;
+
+			if (pic_order_cnt_lsb == 0)
+			{
+				poc_cycle++;
+			}
+
+			// Rec. ITU-T H.264 (08/2021) page 115
+			// Also: https://www.ramugedia.com/negative-pocs
+			int pic_order_cnt_msb = 0;
+			if (pic_order_cnt_lsb < prev_pic_order_cnt_lsb && (prev_pic_order_cnt_lsb - pic_order_cnt_lsb) >= max_pic_order_cnt_lsb / 2)
+			{
+				pic_order_cnt_msb = prev_pic_order_cnt_msb + max_pic_order_cnt_lsb; // pic_order_cnt_lsb wrapped around
+			}
+			else if (pic_order_cnt_lsb > prev_pic_order_cnt_lsb && (pic_order_cnt_lsb - prev_pic_order_cnt_lsb) > max_pic_order_cnt_lsb / 2)
+			{
+				pic_order_cnt_msb = prev_pic_order_cnt_msb - max_pic_order_cnt_lsb; // here negative POC might occur
+			}
+			else
+			{
+				pic_order_cnt_msb = prev_pic_order_cnt_msb;
+			}
+			//pic_order_cnt_msb = pic_order_cnt_msb % 256;
+			prev_pic_order_cnt_lsb = pic_order_cnt_lsb;
+			prev_pic_order_cnt_msb = pic_order_cnt_msb;
+
+			// https://www.vcodex.com/h264avc-picture-management/
+			frame_info.poc = pic_order_cnt_msb + pic_order_cnt_lsb; // poc = TopFieldOrderCount
+			frame_info.gop = poc_cycle - 1;
+		}
 	};
-	std::vector<FrameInfo> frame_infos; // information about every frame in the order they were encontered inside the h264 stream (so they are in decode order, not display order)
 
 	// Decoder timing state:
 	int frameIndex = 0; // currently decoding h264 slice
-	float time_until_next_frame = 0; // this is used to track when we need to swap displayed images, if it reaches 0 then we swap to the next one that can be displayed
 	struct Timer
 	{
 		std::chrono::high_resolution_clock::time_point timestamp = std::chrono::high_resolution_clock::now();
 		inline void record() { timestamp = std::chrono::high_resolution_clock::now(); }
-		inline float elapsed_seconds() { return std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - timestamp).count(); }
-	} timer; // the timer is used to time the swapping of displayed pictures
-	int target_display_order = 0; // the next FrameInfo::display_order that must be displayed
-
-	// Decoded Picture Buffer (DPB) state:
-	int poc_status[17] = {}; // tracking the PictureOrderCount for every used DPB slot
-	int framenum_status[17] = {}; // tracking the frame index for every used DPB slot
-	std::vector<uint8_t> reference_usage; // tracking the state of reference frames
-	uint8_t next_ref = 0;
-	uint8_t next_slot = 0;
-	uint8_t current_slot = 0;
+		inline uint64_t elapsed_nanoseconds() const { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - timestamp).count(); }
+		// The conversion is integer only, so the precision doesn't degrade with long playback time:
+		inline uint64_t elapsed_ticks(uint32_t timescale) const { return nanoseconds_to_ticks(elapsed_nanoseconds(), timescale); }
+		static constexpr uint64_t nanoseconds_to_ticks(uint64_t ns, uint32_t timescale)
+		{
+			return (ns / 1000000000ull) * timescale + (ns % 1000000000ull) * timescale / 1000000000ull;
+		}
+		static constexpr uint64_t ticks_to_nanoseconds(uint64_t ticks, uint32_t timescale)
+		{
+			return (ticks / timescale) * 1000000000ull + (ticks % timescale) * 1000000000ull / timescale;
+		}
+	} timer; // the timer is recorded at playback start and used to time the swapping of displayed pictures
 
 	// File loading helpers:
+	bool allow_io_uring = true; // file reading will use io_uring on Linux when it's supported by the kernel, otherwise it falls back to pread
+	static constexpr uint64_t sample_window_size = 64ull * 1024ull * 1024ull; // MP4 samples are read in windows of this many bytes
+	static constexpr uint64_t raw_read_block_size = 1024ull * 1024ull; // raw H264 files are read in blocks of this many bytes
+
+	// Live stream state:
+	bool live = false; // the video is received from a stream (stdin, pipe), frames are appended while playing and the decoded ones are released
+	uint64_t live_bitstream_size = 0; // upper bound for the size of one access unit in a live stream, the GPU bitstream ring (Vulkan) or the bitstream regions of the decodes in flight (DX12) are sized for this
+	StreamReader stream;
+	std::vector<uint8_t> live_nal; // the NAL unit that is currently being processed
+	PictureOrderCounter live_poc_counter;
+	std::vector<int> live_pending; // frames that are complete but their display order is not known yet, they can already be decoded
+	uint64_t live_released_count = 0; // frames that ReleaseDecodedFrames() removed from the front, a frame stays identified by live_released_count + its index
+	int live_reorder_depth = 0; // how many frames can precede a frame in decode order but follow it in display order
+	int live_display_order = 0; // next display order that will be assigned
+	uint64_t live_frame_duration = 0; // in timescale ticks
+	bool live_picture_open = false; // the last frame is still receiving slices
+	bool live_ended = false;
 
 	// Extract the H264 data from an MP4 video file using the minimp4 library:
 	bool Load_mp4(const char* filename)
 	{
-		std::vector<uint8_t> filedata;
-		std::ifstream file(filename, std::ios::binary | std::ios::ate);
-		if (file.is_open())
-		{
-			size_t dataSize = (size_t)file.tellg();
-			file.seekg((std::streampos)0);
-			filedata.resize(dataSize);
-			file.read((char*)filedata.data(), dataSize);
-			file.close();
-		}
-		if (filedata.empty())
+		FileReader reader;
+		reader.allow_io_uring = allow_io_uring;
+		if (!reader.open(filename) || reader.size() == 0)
 		{
 			printf("File not found: %s\n", filename);
 			return false;
 		}
 
-		bool success = false;
-		const uint8_t* input_buf = filedata.data();
-		struct INPUT_BUFFER
-		{
-			const uint8_t* buffer;
-			size_t size;
-		} input_buffer = { input_buf,filedata.size() };
+		// The MP4 boxes are parsed with synchronous reads, the sample data will be read later with many reads in flight:
 		MP4D_demux_t mp4 = {};
-		int token = 0;
 		auto read_callback = [](int64_t offset, void* buffer, size_t size, void* token) -> int
 			{
-				INPUT_BUFFER* buf = (INPUT_BUFFER*)token;
-				size_t to_copy = MINIMP4_MIN(size, buf->size - offset - size);
-				std::memcpy(buffer, buf->buffer + offset, to_copy);
-				return to_copy != size;
+				FileReader* reader = (FileReader*)token;
+				return reader->read((uint64_t)offset, buffer, size) ? 0 : 1;
 			};
-		int result = MP4D_open(&mp4, read_callback, &input_buffer, (int64_t)filedata.size());
+		int result = MP4D_open(&mp4, read_callback, &reader, (int64_t)reader.size());
 		if (result != 1)
 		{
 			printf("MP4 parsing failure! MP4D_open result = %d", result);
@@ -121,10 +159,10 @@ struct Video
 				const void* data = nullptr;
 				while (data = MP4D_read_sps(&mp4, ntrack, index, &size))
 				{
-					const uint8_t* sps_data = (const uint8_t*)data;
+					std::vector<uint8_t> rbsp(size);
 
 					h264::Bitstream bs = {};
-					bs.init(sps_data, size);
+					bs.init(rbsp.data(), h264::nal_to_rbsp((const uint8_t*)data, size, rbsp.data()));
 					h264::NALHeader nal = {};
 					h264::read_nal_header(&nal, &bs);
 					assert(nal.type == h264::NAL_UNIT_TYPE_SPS);
@@ -141,7 +179,7 @@ struct Video
 					assert(track.SampleDescription.video.height == height);
 					padded_width = (sps.pic_width_in_mbs_minus1 + 1) * 16;
 					padded_height = (sps.pic_height_in_map_units_minus1 + 1) * 16;
-					num_dpb_slots = std::max(num_dpb_slots, uint32_t(sps.num_ref_frames + 1));
+					num_dpb_slots = std::max(num_dpb_slots, uint32_t(Get_dpb_sizing(sps).dpb_slots));
 
 					index++;
 				}
@@ -154,10 +192,10 @@ struct Video
 				const void* data = nullptr;
 				while (data = MP4D_read_pps(&mp4, ntrack, index, &size))
 				{
-					const uint8_t* pps_data = (const uint8_t*)data;
+					std::vector<uint8_t> rbsp(size);
 
 					h264::Bitstream bs = {};
-					bs.init(pps_data, size);
+					bs.init(rbsp.data(), h264::nal_to_rbsp((const uint8_t*)data, size, rbsp.data()));
 					h264::NALHeader nal = {};
 					h264::read_nal_header(&nal, &bs);
 					assert(nal.type == h264::NAL_UNIT_TYPE_PPS);
@@ -170,90 +208,209 @@ struct Video
 				}
 			}
 
-			double timescale_rcp = 1.0 / double(track.timescale);
-
-			uint32_t track_duration = 0;
-			for (uint32_t i = 0; i < track.sample_count; i++)
-			{
-				unsigned frame_bytes, timestamp, duration;
-				MP4D_file_offset_t ofs = MP4D_frame_offset(&mp4, ntrack, i, &frame_bytes, &timestamp, &duration);
-				track_duration += duration;
+			timescale = track.timescale;
 
-				frame_infos.emplace_back();
-				Video::FrameInfo& frame_info = frame_infos.back();
+			// The timestamps are accumulated from durations in 64-bit, because minimp4 reports 32-bit timestamps that could wrap around for long videos:
+			uint64_t track_duration = 0;
+			PictureOrderCounter poc_counter;
 
-				const uint8_t* src_buffer = input_buf + ofs;
-				while (frame_bytes > 0)
+			// The samples are indexed in decode order:
+			const bool read = Read_mp4_samples(reader, mp4, ntrack, [&](const uint8_t* src_buffer, uint32_t frame_bytes, uint32_t sample_duration)
 				{
-					uint32_t size = ((uint32_t)src_buffer[0] << 24) | ((uint32_t)src_buffer[1] << 16) | ((uint32_t)src_buffer[2] << 8) | src_buffer[3];
-					size += 4;
-					assert(frame_bytes >= size);
-
-					h264::Bitstream bs = {};
-					bs.init(&src_buffer[4], frame_bytes);
-					h264::NALHeader nal = {};
-					h264::read_nal_header(&nal, &bs);
+					Video::FrameInfo frame_info;
+					h264::SliceHeader slice_header = {};
+					frame_info.timestamp = track_duration;
+					frame_info.duration = sample_duration;
+					track_duration += frame_info.duration;
 
-					if (nal.type == h264::NAL_UNIT_TYPE_CODED_SLICE_IDR)
-					{
-						frame_info.is_intra = true;
-					}
-					else if (nal.type == h264::NAL_UNIT_TYPE_CODED_SLICE_NON_IDR)
+					while (frame_bytes > 0)
 					{
-						frame_info.is_intra = false;
-					}
-					else
-					{
-						// Continue search for frame beginning NAL unit:
-						frame_bytes -= size;
-						src_buffer += size;
-						continue;
+						uint32_t size = ((uint32_t)src_buffer[0] << 24) | ((uint32_t)src_buffer[1] << 16) | ((uint32_t)src_buffer[2] << 8) | src_buffer[3];
+						size += 4;
+						assert(frame_bytes >= size);
+
+						h264::Bitstream bs = {};
+						bs.init(&src_buffer[4], frame_bytes);
+						h264::NALHeader nal = {};
+						h264::read_nal_header(&nal, &bs);
+
+						if (nal.type == h264::NAL_UNIT_TYPE_CODED_SLICE_IDR)
+						{
+							frame_info.is_intra = true;
+						}
+						else if (nal.type == h264::NAL_UNIT_TYPE_CODED_SLICE_NON_IDR)
+						{
+							frame_info.is_intra = false;
+						}
+						else
+						{
+							// Continue search for frame beginning NAL unit:
+							frame_bytes -= size;
+							src_buffer += size;
+							continue;
+						}
+
+						h264::read_slice_header(&slice_header, &nal, pps_array.data(), sps_array.data(), &bs);
+						const h264::PPS& pps = pps_array[slice_header.pic_parameter_set_id];
+						poc_counter.calculate(frame_info, slice_header, sps_array[pps.seq_parameter_set_id]);
+
+						// Accept frame beginning NAL unit:
+						frame_info.reference_priority = nal.idc;
+
+						frame_info.offset = h264_data.size();
+						frame_info.size = sizeof(h264::nal_start_code) + size - 4;
+						h264_data.resize(h264_data.size() + frame_info.size);
+						std::memcpy(h264_data.data() + frame_info.offset, h264::nal_start_code, sizeof(h264::nal_start_code));
+						std::memcpy(h264_data.data() + frame_info.offset + sizeof(h264::nal_start_code), src_buffer + 4, size - 4);
+
+						break;
 					}
 
-					slice_headers.emplace_back();
-					h264::SliceHeader& slice_header = slice_headers.back();
-					h264::read_slice_header(&slice_header, &nal, pps_array.data(), sps_array.data(), &bs);
+					frame_infos.push_back(frame_info, slice_header);
+					slice_size += frame_info.size;
+					return true;
+				});
+			if (!read)
+			{
+				printf("Failed to read video samples from file: %s\n", filename);
+				MP4D_close(&mp4);
+				return false;
+			}
+			duration = track_duration;
+		}
+		MP4D_close(&mp4);
+		CalculateFrameDisplayOrder();
+		return true;
+	}
 
-					// Accept frame beginning NAL unit:
-					frame_info.reference_priority = nal.idc;
+	// Returns true if the file name has a raw H264 extension (.h264, .264, .h26l), these are loaded with Load_h264_raw(), the others with Load_mp4()
+	static bool Is_h264_raw(const char* filename)
+	{
+		const char* extension = std::strrchr(filename, '.');
+		return extension != nullptr && (std::strcmp(extension, ".h264") == 0 || std::strcmp(extension, ".264") == 0 || std::strcmp(extension, ".h26l") == 0);
+	}
 
-					frame_info.offset = h264_data.size();
-					frame_info.size = sizeof(h264::nal_start_code) + size - 4;
-					h264_data.resize(h264_data.size() + frame_info.size);
-					std::memcpy(h264_data.data() + frame_info.offset, h264::nal_start_code, sizeof(h264::nal_start_code));
-					std::memcpy(h264_data.data() + frame_info.offset + sizeof(h264::nal_start_code), src_buffer + 4, size - 4);
+	// Converts a framerate to a rational timebase: the rates that are 1000/1001 of an integer rate (23.976, 29.97, 59.94) become exactly N * 1000 / 1001, so for example 29.97 fps becomes 30000 / 1001, the others are kept with millisecond precision, so 12.5 fps becomes 12500 / 1000
+	static void Framerate_to_timebase(float framerate, uint32_t& timescale, uint64_t& frame_duration)
+	{
+		const uint32_t integer_rate = uint32_t(double(framerate) * 1.001 + 0.5);
+		const double error = double(integer_rate) * 1000.0 / 1001.0 - double(framerate);
+		if (integer_rate > 0 && error > -0.001 && error < 0.001)
+		{
+			timescale = integer_rate * 1000;
+			frame_duration = 1001;
+			return;
+		}
+		frame_duration = 1000;
+		timescale = std::max(1u, uint32_t(framerate * frame_duration + 0.5f));
+	}
 
-					break;
-				}
+	// Returns true if the SPS has VUI timing info, and converts it to a timebase, it's exact, for example time_scale 60000 and num_units_in_tick 1001 is 30000/1001 fps, because a frame is two field ticks (E.2.1)
+	static bool Get_vui_timebase(const h264::SPS& sps, uint32_t& timescale, uint64_t& frame_duration)
+	{
+		if (!sps.vui_parameters_present_flag || !sps.vui.timing_info_present_flag || sps.vui.num_units_in_tick <= 0 || sps.vui.time_scale <= 0)
+			return false;
+		timescale = (uint32_t)sps.vui.time_scale;
+		frame_duration = 2ull * (uint64_t)sps.vui.num_units_in_tick;
+		return true;
+	}
+
+	// Returns the size of the NAL unit that begins at data, it ends at the next start code (0x000001, or the zero bytes before it), or at the end of the data
+	static size_t Nal_unit_size(const uint8_t* data, size_t size)
+	{
+		int zero_count = 0;
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (zero_count >= 2 && data[i] <= 1)
+				return i - 2;
+			zero_count = data[i] == 0 ? zero_count + 1 : 0;
+		}
+		return size;
+	}
 
-				slice_size += frame_info.size;
-				frame_info.timestamp_seconds = float(double(timestamp) * timescale_rcp);
-				frame_info.duration_seconds = float(double(duration) * timescale_rcp);
+	// Reads the samples of an MP4 track in order, and calls sample_callback(data, size, duration) for each, stops and returns false if a read failed or the callback returned false:
+	//	the samples are read in windows of sample_window_size bytes into staging memory, each window is requested at once so the storage device can work on many reads in parallel
+	template<typename SampleCallback>
+	static bool Read_mp4_samples(FileReader& reader, MP4D_demux_t& mp4, uint32_t ntrack, SampleCallback&& sample_callback)
+	{
+		const MP4D_track_t& track = mp4.track[ntrack];
+		std::vector<uint8_t> staging;
+		std::vector<FileReader::Request> requests;
+		std::vector<unsigned> durations;
+		uint32_t i = 0;
+		while (i < track.sample_count)
+		{
+			requests.clear();
+			durations.clear();
+			uint64_t window_size = 0;
+			while (i + requests.size() < track.sample_count)
+			{
+				unsigned frame_bytes, timestamp, duration;
+				MP4D_file_offset_t ofs = MP4D_frame_offset(&mp4, ntrack, i + (uint32_t)requests.size(), &frame_bytes, &timestamp, &duration);
+				if (!requests.empty() && window_size + frame_bytes > sample_window_size)
+					break;
+				FileReader::Request& request = requests.emplace_back();
+				request.offset = (uint64_t)ofs;
+				request.size = frame_bytes;
+				request.dst = (void*)window_size; // offset within the staging memory, it is resolved to a pointer below when staging size is final
+				durations.push_back(duration);
+				window_size += frame_bytes;
+			}
+			if (staging.size() < window_size)
+			{
+				staging.resize(window_size);
+				reader.register_buffer(staging.data(), staging.size());
+			}
+			for (FileReader::Request& request : requests)
+			{
+				request.dst = staging.data() + (uint64_t)request.dst;
+			}
+			if (!reader.read_batch(requests.data(), requests.size()))
+				return false;
+			for (size_t window_index = 0; window_index < requests.size(); ++window_index, ++i)
+			{
+				if (!sample_callback((const uint8_t*)requests[window_index].dst, (uint32_t)requests[window_index].size, (uint32_t)durations[window_index]))
+					return false;
 			}
 		}
-		MP4D_close(&mp4);
-		CalculateFrameDisplayOrder();
 		return true;
 	}
 
 	// Load from raw H264 data file (prefixed with 0,0,0,1 or 0,0,1 NAL unit start codes)
 	bool Load_h264_raw(const char* filename, float framerate = 60.0f)
 	{
-		std::ifstream file(filename, std::ios::binary | std::ios::ate);
-		if (file.is_open())
+		FileReader reader;
+		reader.allow_io_uring = allow_io_uring;
+		if (!reader.open(filename) || reader.size() == 0)
 		{
-			size_t dataSize = (size_t)file.tellg();
-			file.seekg((std::streampos)0);
-			h264_data.resize(dataSize);
-			file.read((char*)h264_data.data(), dataSize);
-			file.close();
+			printf("File not found: %s\n", filename);
+			return false;
 		}
-		if (h264_data.empty())
+
+		// The whole file is read in blocks that are all requested at once, so the storage device can work on many reads in parallel:
+		h264_data.resize(reader.size());
+		reader.register_buffer(h264_data.data(), h264_data.size());
+		std::vector<FileReader::Request> requests;
+		for (uint64_t offset = 0; offset < h264_data.size(); offset += raw_read_block_size)
 		{
-			printf("File not found: %s\n", filename);
+			FileReader::Request& request = requests.emplace_back();
+			request.offset = offset;
+			request.size = std::min(raw_read_block_size, h264_data.size() - offset);
+			request.dst = h264_data.data() + offset;
+		}
+		if (!reader.read_batch(requests.data(), requests.size()))
+		{
+			printf("Failed to read file: %s\n", filename);
+			h264_data.clear();
 			return false;
 		}
 
+		// The framerate is only used if the SPS doesn't contain timing info:
+		uint64_t frame_duration = 0;
+		Framerate_to_timebase(framerate, timescale, frame_duration);
+		duration = 0;
+
+		PictureOrderCounter poc_counter;
 		h264::Bitstream bs;
 		bs.init(h264_data.data(), h264_data.size());
 		while (h264::find_next_nal(&bs))
@@ -262,10 +419,9 @@ struct Video
 			if (!frame_infos.empty())
 			{
 				// patch size of previous frame:
-				Video::FrameInfo& frame_info = frame_infos.back();
-				if (frame_info.size == 0)
+				if (frame_infos.sizes.back() == 0)
 				{
-					frame_info.size = nal_offset - frame_info.offset;
+					frame_infos.sizes.back() = uint32_t(nal_offset - frame_infos.offsets.back());
 				}
 			}
 
@@ -275,43 +431,40 @@ struct Video
 				switch (nal.type)
 				{
 				case h264::NAL_UNIT_TYPE_CODED_SLICE_NON_IDR:
-				{
-					frame_infos.emplace_back();
-					Video::FrameInfo& frame_info = frame_infos.back();
-					frame_info.offset = nal_offset;
-					frame_info.is_intra = false;
-					frame_info.reference_priority = nal.idc;
-					slice_headers.emplace_back();
-					h264::SliceHeader& slice_header = slice_headers.back();
-					h264::read_slice_header(&slice_header, &nal, pps_array.data(), sps_array.data(), &bs);
-				}
-				break;
 				case h264::NAL_UNIT_TYPE_CODED_SLICE_IDR:
 				{
-					frame_infos.emplace_back();
-					Video::FrameInfo& frame_info = frame_infos.back();
+					Video::FrameInfo frame_info;
 					frame_info.offset = nal_offset;
-					frame_info.is_intra = true;
+					frame_info.is_intra = nal.type == h264::NAL_UNIT_TYPE_CODED_SLICE_IDR;
 					frame_info.reference_priority = nal.idc;
-					slice_headers.emplace_back();
-					h264::SliceHeader& slice_header = slice_headers.back();
+					frame_info.duration = frame_duration;
+					frame_info.timestamp = duration;
+					duration += frame_info.duration;
+					h264::SliceHeader slice_header = {};
 					h264::read_slice_header(&slice_header, &nal, pps_array.data(), sps_array.data(), &bs);
+					const h264::PPS& pps = pps_array[slice_header.pic_parameter_set_id];
+					poc_counter.calculate(frame_info, slice_header, sps_array[pps.seq_parameter_set_id]);
+					frame_infos.push_back(frame_info, slice_header);
 				}
 				break;
 				case h264::NAL_UNIT_TYPE_SPS:
 				{
 					if (sps_array.empty()) // TODO: multiple SPS fix
 					{
+						std::vector<uint8_t> rbsp(Nal_unit_size(bs.p, size_t(bs.end - bs.p))); // only this NAL unit, not the rest of the file
+						h264::Bitstream rbsp_bs = {};
+						rbsp_bs.init(rbsp.data(), h264::nal_to_rbsp(bs.p, rbsp.size(), rbsp.data()));
 						sps_array.emplace_back();
 						h264::SPS& sps = sps_array.back();
-						h264::read_sps(&sps, &bs);
+						h264::read_sps(&sps, &rbsp_bs);
 
 						width = ((sps.pic_width_in_mbs_minus1 + 1) * 16) - sps.frame_crop_left_offset * 2 - sps.frame_crop_right_offset * 2;
 						height = ((2 - sps.frame_mbs_only_flag) * (sps.pic_height_in_map_units_minus1 + 1) * 16) - (sps.frame_crop_top_offset * 2) - (sps.frame_crop_bottom_offset * 2);
 						padded_width = (sps.pic_width_in_mbs_minus1 + 1) * 16;
 						padded_height = (sps.pic_height_in_map_units_minus1 + 1) * 16;
-						num_dpb_slots = std::max(num_dpb_slots, uint32_t(sps.num_ref_frames + 1));
+						num_dpb_slots = std::max(num_dpb_slots, uint32_t(Get_dpb_sizing(sps).dpb_slots));
 						printf("Resolution = %d x %d (padded: %d x %d)\nDPB slots: %d\n", (int)width, (int)height, (int)padded_width, (int)padded_height, (int)num_dpb_slots);
+						Get_vui_timebase(sps, timescale, frame_duration); // the timing info of the stream replaces the framerate, the SPS precedes the slices that use it
 					}
 				}
 				break;
@@ -319,9 +472,12 @@ struct Video
 				{
 					if (pps_array.empty()) // TODO: multiple PPS fix
 					{
+						std::vector<uint8_t> rbsp(Nal_unit_size(bs.p, size_t(bs.end - bs.p))); // only this NAL unit, not the rest of the file
+						h264::Bitstream rbsp_bs = {};
+						rbsp_bs.init(rbsp.data(), h264::nal_to_rbsp(bs.p, rbsp.size(), rbsp.data()));
 						pps_array.emplace_back();
 						h264::PPS& pps = pps_array.back();
-						h264::read_pps(&pps, &bs);
+						h264::read_pps(&pps, &rbsp_bs);
 					}
 				}
 				break;
@@ -338,69 +494,280 @@ struct Video
 		if (!frame_infos.empty())
 		{
 			// patch size of last frame:
-			Video::FrameInfo& frame_info = frame_infos.back();
-			if (frame_info.size == 0)
+			if (frame_infos.sizes.back() == 0)
 			{
-				frame_info.size = bs.byte_offset() - frame_info.offset;
+				frame_infos.sizes.back() = uint32_t(bs.byte_offset() - frame_infos.offsets.back());
 			}
 		}
 
-		const float frame_duration = 1.0f / framerate;
-		duration_seconds = 0;
-		for (Video::FrameInfo& frame_info : frame_infos)
-		{
-			frame_info.duration_seconds = frame_duration;
-			frame_info.timestamp_seconds = duration_seconds;
-			duration_seconds += frame_info.duration_seconds;
-		}
-
 		CalculateFrameDisplayOrder();
 		return true;
 	}
 
-	// Calculate the frame reordering based on the H264 info:
-	void CalculateFrameDisplayOrder()
+	// Open a live raw H264 stream (Annex-B, prefixed with 0,0,0,1 or 0,0,1 NAL unit start codes) from stdin ("-"), a pipe or a FIFO
+	//	This blocks until the parameter sets and the first picture are received, because the decoder can't be created without them
+	//	Then Update_h264_stream() must be called regularly to receive the next frames, every access unit becomes decodable as soon as it is complete
+	bool Open_h264_stream(const char* filename, float framerate = 60.0f)
 	{
-		int prev_pic_order_cnt_lsb = 0;
-		int prev_pic_order_cnt_msb = 0;
-		int poc_cycle = 0;
-		for (size_t i = 0; i < frame_infos.size(); ++i)
+		if (!stream.open(filename))
 		{
-			const h264::SliceHeader& slice_header = slice_headers[i];
-			const h264::PPS& pps = pps_array[slice_header.pic_parameter_set_id];
-			const h264::SPS& sps = sps_array[pps.seq_parameter_set_id];
+			printf("Stream could not be opened: %s\n", filename);
+			return false;
+		}
+		live = true;
 
-			// Rec. ITU-T H.264 (08/2021) page 77
-			int max_pic_order_cnt_lsb = 1 << (sps.log2_max_pic_order_cnt_lsb_minus4 + 4);
-			int pic_order_cnt_lsb = slice_header.pic_order_cnt_lsb;
+		// The framerate is only used if the stream doesn't contain timing info:
+		Framerate_to_timebase(framerate, timescale, live_frame_duration);
 
-			if (pic_order_cnt_lsb == 0)
+		while (frame_infos.empty())
+		{
+			if (!Update_h264_stream())
 			{
-				poc_cycle++;
+				printf("Stream ended before the first picture was received: %s\n", filename);
+				return false;
 			}
+			stream.wait(10);
+		}
+		return true;
+	}
 
-			// Rec. ITU-T H.264 (08/2021) page 115
-			// Also: https://www.ramugedia.com/negative-pocs
-			int pic_order_cnt_msb = 0;
-			if (pic_order_cnt_lsb < prev_pic_order_cnt_lsb && (prev_pic_order_cnt_lsb - pic_order_cnt_lsb) >= max_pic_order_cnt_lsb / 2)
+	// Receive the available data from the live stream without blocking, returns false if the stream ended
+	bool Update_h264_stream()
+	{
+		const int pending_begin = live_pending.empty() ? (int)frame_infos.size() : live_pending.front(); // the frames from here can get their display order in this update
+		const bool active = stream.update();
+		while (stream.next_nal(live_nal))
+		{
+			h264::Bitstream bs = {};
+			bs.init(live_nal.data(), live_nal.size());
+			h264::NALHeader nal = {};
+			if (!h264::read_nal_header(&nal, &bs))
 			{
-				pic_order_cnt_msb = prev_pic_order_cnt_msb + max_pic_order_cnt_lsb; // pic_order_cnt_lsb wrapped around
+				printf("found invalid NAL unit!\n");
+				live_nal.clear();
+				continue;
 			}
-			else if (pic_order_cnt_lsb > prev_pic_order_cnt_lsb && (pic_order_cnt_lsb - prev_pic_order_cnt_lsb) > max_pic_order_cnt_lsb / 2)
+
+			switch (nal.type)
 			{
-				pic_order_cnt_msb = prev_pic_order_cnt_msb - max_pic_order_cnt_lsb; // here negative POC might occur
+			case h264::NAL_UNIT_TYPE_CODED_SLICE_NON_IDR:
+			case h264::NAL_UNIT_TYPE_CODED_SLICE_IDR:
+			{
+				if (sps_array.empty() || pps_array.empty())
+					break; // joined the stream in the middle, wait for the parameter sets
+				h264::SliceHeader slice_header = {};
+				h264::read_slice_header(&slice_header, &nal, pps_array.data(), sps_array.data(), &bs);
+				if (slice_header.first_mb_in_slice == 0)
+				{
+					// First slice of a new picture, so the previous access unit is complete:
+					FinishLivePicture();
+					if (frame_infos.empty() && nal.type != h264::NAL_UNIT_TYPE_CODED_SLICE_IDR)
+						break; // decoding must start with an IDR picture
+
+					const h264::PPS& pps = pps_array[slice_header.pic_parameter_set_id];
+					const h264::SPS& sps = sps_array[pps.seq_parameter_set_id];
+					Video::FrameInfo frame_info;
+					frame_info.offset = h264_data.size();
+					frame_info.is_intra = nal.type == h264::NAL_UNIT_TYPE_CODED_SLICE_IDR;
+					frame_info.reference_priority = nal.idc;
+					frame_info.display_order = -1; // not known until enough frames are received
+					frame_info.timestamp = duration;
+					frame_info.duration = live_frame_duration;
+					duration += frame_info.duration;
+					live_poc_counter.calculate(frame_info, slice_header, sps);
+					frame_infos.push_back(frame_info, slice_header);
+					live_picture_open = true;
+				}
+				if (!live_picture_open)
+					break; // slice of a picture that was skipped
+
+				h264_data.insert(h264_data.end(), h264::nal_start_code, h264::nal_start_code + sizeof(h264::nal_start_code));
+				h264_data.insert(h264_data.end(), live_nal.begin(), live_nal.end());
+				frame_infos.sizes.back() = uint32_t(h264_data.size() - frame_infos.offsets.back());
 			}
-			else
+			break;
+			case h264::NAL_UNIT_TYPE_SPS:
 			{
-				pic_order_cnt_msb = prev_pic_order_cnt_msb;
+				FinishLivePicture();
+				if (sps_array.empty()) // TODO: multiple SPS fix
+				{
+					// The emulation prevention bytes are removed before parsing, because the VUI timing values frequently contain them (for example num_units_in_tick = 1 is coded as 0,0,3,0,1):
+					bs.init(live_nal.data(), h264::nal_to_rbsp(live_nal.data(), live_nal.size(), live_nal.data()));
+					h264::read_nal_header(&nal, &bs);
+
+					sps_array.emplace_back();
+					h264::SPS& sps = sps_array.back();
+					h264::read_sps(&sps, &bs);
+
+					width = ((sps.pic_width_in_mbs_minus1 + 1) * 16) - sps.frame_crop_left_offset * 2 - sps.frame_crop_right_offset * 2;
+					height = ((2 - sps.frame_mbs_only_flag) * (sps.pic_height_in_map_units_minus1 + 1) * 16) - (sps.frame_crop_top_offset * 2) - (sps.frame_crop_bottom_offset * 2);
+					padded_width = (sps.pic_width_in_mbs_minus1 + 1) * 16;
+					padded_height = (sps.pic_height_in_map_units_minus1 + 1) * 16;
+					num_dpb_slots = std::max(num_dpb_slots, uint32_t(Get_dpb_sizing(sps).dpb_slots));
+					printf("Resolution = %d x %d (padded: %d x %d)\nDPB slots: %d\n", (int)width, (int)height, (int)padded_width, (int)padded_height, (int)num_dpb_slots);
+
+					// A coded picture can't be larger than the uncompressed picture (PCM macroblocks) plus the headers:
+					live_bitstream_size = std::max(uint64_t(1024 * 1024), uint64_t(padded_width) * uint64_t(padded_height) * uint64_t(2));
+
+					// The reorder depth decides how many frames must be received before the display order of a frame is known:
+					live_reorder_depth = Get_dpb_sizing(sps).reorder_depth;
+
+					// The timing info of the stream replaces the framerate of Open_h264_stream():
+					Get_vui_timebase(sps, timescale, live_frame_duration);
+				}
 			}
-			//pic_order_cnt_msb = pic_order_cnt_msb % 256;
-			prev_pic_order_cnt_lsb = pic_order_cnt_lsb;
-			prev_pic_order_cnt_msb = pic_order_cnt_msb;
+			break;
+			case h264::NAL_UNIT_TYPE_PPS:
+			{
+				FinishLivePicture();
+				if (pps_array.empty()) // TODO: multiple PPS fix
+				{
+					bs.init(live_nal.data(), h264::nal_to_rbsp(live_nal.data(), live_nal.size(), live_nal.data()));
+					h264::read_nal_header(&nal, &bs);
+					pps_array.emplace_back();
+					h264::PPS& pps = pps_array.back();
+					h264::read_pps(&pps, &bs);
+				}
+			}
+			break;
+			case h264::NAL_UNIT_TYPE_SEI:
+			case h264::NAL_UNIT_TYPE_AUD:
+			case h264::NAL_UNIT_TYPE_END_OF_SEQUENCE:
+			case h264::NAL_UNIT_TYPE_END_OF_STREAM:
+				FinishLivePicture(); // these can only appear between access units
+				break;
+			default:
+				break;
+			}
+			live_nal.clear();
+		}
 
-			// https://www.vcodex.com/h264avc-picture-management/
-			frame_infos[i].poc = pic_order_cnt_msb + pic_order_cnt_lsb; // poc = TopFieldOrderCount
-			frame_infos[i].gop = poc_cycle - 1;
+		if (!active && !live_ended)
+		{
+			FinishLivePicture();
+			OutputLivePictures(0);
+			live_ended = true;
+			printf("Live stream ended, received %d frames\n", live_display_order);
+		}
+
+		ReleaseDecodedFrames(pending_begin);
+		return active;
+	}
+
+	// Decoded picture buffer and reorder window sizes of a stream:
+	struct DPBSizing
+	{
+		int max_dec_frame_buffering = 0; // frames that the decoder must hold at once, reference frames and frames that wait for output
+		int reorder_depth = 0; // how many frames can precede a frame in decode order but follow it in display order (num_reorder_frames)
+		int dpb_slots = 0; // DPB texture slices: the reference frames and the frame that is being decoded
+	};
+
+	// Returns the DPB sizing rules of the SPS:
+	//	- with the VUI bitstream restriction, max_dec_frame_buffering and num_reorder_frames are used as they are declared
+	//	- without it, max_dec_frame_buffering is MaxDpbFrames of the level (E.2.1, 0 for the intra profiles), and the reorder depth is inferred to be the same (E.2.1 max_num_reorder_frames), except that it's 0 if the output order is the decoding order (pic_order_cnt_type 2, or the baseline profile that has no B-frames)
+	//	- the reorder depth can't exceed max_dec_frame_buffering, and max_dec_frame_buffering can't be less than num_ref_frames, so a stream that declares too small values is still decoded correctly
+	static DPBSizing Get_dpb_sizing(const h264::SPS& sps)
+	{
+		DPBSizing sizing;
+		const bool intra_profile = sps.constraint_set3_flag && (sps.profile_idc == 44 || sps.profile_idc == 86 || sps.profile_idc == 100 || sps.profile_idc == 110 || sps.profile_idc == 122 || sps.profile_idc == 244);
+		if (sps.vui_parameters_present_flag && sps.vui.bitstream_restriction_flag)
+		{
+			sizing.max_dec_frame_buffering = sps.vui.max_dec_frame_buffering;
+			sizing.reorder_depth = sps.vui.num_reorder_frames;
+		}
+		else
+		{
+			sizing.max_dec_frame_buffering = intra_profile ? 0 : h264::get_max_dpb_frames(&sps);
+			sizing.reorder_depth = sps.pic_order_cnt_type == 2 || sps.profile_idc == 66 ? 0 : sizing.max_dec_frame_buffering;
+		}
+		sizing.max_dec_frame_buffering = std::max(sizing.max_dec_frame_buffering, sps.num_ref_frames);
+		sizing.reorder_depth = std::max(0, std::min(sizing.reorder_depth, sizing.max_dec_frame_buffering));
+		sizing.dpb_slots = std::max(sps.num_ref_frames, 1) + 1;
+		return sizing;
+	}
+
+	// Returns true if the frame at frameIndex can be decoded, this is only false for live streams when the access unit was not received completely yet
+	//	a complete live frame can be decoded before its display order is known (it's -1 until the later frames resolve it), only its display has to wait for that
+	bool Is_frame_ready() const
+	{
+		return frameIndex < (int)frame_infos.size() - (live_picture_open ? 1 : 0);
+	}
+
+	// The last received picture of the live stream is complete, so its display order can be resolved:
+	void FinishLivePicture()
+	{
+		if (!live_picture_open)
+			return;
+		live_picture_open = false;
+
+		const size_t index = frame_infos.size() - 1;
+		if (frame_infos.sizes[index] > live_bitstream_size)
+		{
+			printf("Access unit is larger than the bitstream buffer, it will be truncated (%d > %d bytes)\n", (int)frame_infos.sizes[index], (int)live_bitstream_size);
+			frame_infos.sizes[index] = uint32_t(live_bitstream_size);
+		}
+
+		// The display order is resolved like the bumping process of the decoded picture buffer (C.4.5.3): the frame with the smallest POC is output as soon as more frames wait than the reorder depth of Get_dpb_sizing() allows, and every waiting frame is output when a new gop begins:
+		if (!live_pending.empty() && frame_infos[live_pending.front()].gop != frame_infos[index].gop)
+		{
+			OutputLivePictures(0);
+		}
+		live_pending.push_back(int(index));
+		OutputLivePictures((size_t)live_reorder_depth);
+	}
+
+	// Assign display order to pending live frames until only the specified number of them remain:
+	void OutputLivePictures(size_t remaining)
+	{
+		while (live_pending.size() > remaining)
+		{
+			size_t first = 0;
+			for (size_t i = 1; i < live_pending.size(); ++i)
+			{
+				if (frame_infos[live_pending[i]].poc < frame_infos[live_pending[first]].poc)
+				{
+					first = i;
+				}
+			}
+			frame_infos.display_orders[live_pending[first]] = live_display_order++;
+			live_pending.erase(live_pending.begin() + first);
+		}
+	}
+
+	// Frames of the live stream that were already decoded are removed, so memory usage doesn't grow with playback time:
+	//	pending_begin: the frames from this index are kept, because they were waiting for their display order at the beginning of the update, the decoder core reads it from them later
+	void ReleaseDecodedFrames(int pending_begin)
+	{
+		// The last decoded frame is kept, so frameIndex doesn't return to zero, that would mean restarting the video:
+		const int count = std::min(frameIndex - 1, pending_begin);
+		if (count <= 0)
+			return;
+		const uint64_t data_offset = frame_infos.offsets[count];
+		h264_data.erase(h264_data.begin(), h264_data.begin() + data_offset);
+		frame_infos.release_front(count);
+		for (uint64_t& offset : frame_infos.offsets)
+		{
+			offset -= data_offset;
+		}
+		for (int& index : live_pending)
+		{
+			index -= count;
+		}
+		frameIndex -= count;
+		live_released_count += (uint64_t)count;
+	}
+
+	// Calculate the frame reordering based on the H264 info, the picture order counts were already calculated while loading:
+	void CalculateFrameDisplayOrder()
+	{
+		frame_infos.shrink_to_fit(); // all frames were loaded
+
+		// The sorting keys are extracted first, so the frame index is only decoded sequentially:
+		std::vector<int64_t> frame_priorities(frame_infos.size());
+		for (size_t i = 0; i < frame_infos.size(); ++i)
+		{
+			const Video::FrameInfo frame_info = frame_infos[i];
+			frame_priorities[i] = (int64_t(frame_info.gop) << 32ll) | int64_t(frame_info.poc);
 		}
 
 		std::vector<size_t> frame_display_order(frame_infos.size());
@@ -409,15 +776,11 @@ struct Video
 			frame_display_order[i] = i;
 		}
 		std::sort(frame_display_order.begin(), frame_display_order.end(), [&](size_t a, size_t b) {
-			const Video::FrameInfo& frameA = frame_infos[a];
-			const Video::FrameInfo& frameB = frame_infos[b];
-			int64_t prioA = (int64_t(frameA.gop) << 32ll) | int64_t(frameA.poc);
-			int64_t prioB = (int64_t(frameB.gop) << 32ll) | int64_t(frameB.poc);
-			return prioA < prioB;
+			return frame_priorities[a] < frame_priorities[b];
 			});
 		for (size_t i = 0; i < frame_display_order.size(); ++i)
 		{
-			frame_infos[frame_display_order[i]].display_order = (int)i;
+			frame_infos.display_orders[frame_display_order[i]] = (int)i;
 		}
 	}
 };
@@ -0,0 +1,1004 @@
+// Graphics API independent decoding logic, shared by all the mini_video backends
+//
+// What this does:
+//	- decides when a new frame must be decoded, so that the next picture in display order will be available
+//	- selects the Decoded Picture Buffer (DPB) slot of every decoded frame, and the slots that it references
+//	- manages the reordering pictures: decoded frames are copied into these, and they are displayed in display order when their time comes
+//	- the reordering pictures can be reserved up front from the reorder depth of the stream, then no pictures are created during playback, and the next picture in display order is found in constant time
+//	- can decode ahead: up to max_frames_in_flight decodes can be submitted without waiting for their completion, and up to decode_ahead pictures can be decoded before they are needed, only completed pictures are displayed
+//	- loops seamlessly: the display order and the display time continue across the video loops, and with loop pre-roll, the first GOP of the next loop is decoded ahead while the end of the current loop is displayed, so the expensive intra frame at the loop start doesn't stall the display
+//	- can scan (fast forward): only the intra frames are decoded, they are selected by their timestamps so that one intra frame is decoded per displayed frame at most, regardless of the speed
+//	- can seek to any frame: the SeekPlanner finds the frames that the target really needs from its IDR frame, the others are skipped, or only their reference marking is performed
+//	- can decimate: the non-reference frames are assigned to temporal layers, and the higher layers are skipped when a frame rate cap is set or the display deadlines are missed, the reference frames are always decoded so the DPB stays consistent
+//	- the backend only needs to execute the decode and display commands with a graphics API, either inline in the display loop (like the mini_video_*.cpp do), or by implementing the VideoDecoderCore::Backend interface
+//
+// How to use:
+//	VideoDecoderCore core;
+//	core.video = &video;
+//	core.enable_decode_ahead(4); // optional, before the DPB is created
+//	core.enable_loop_preroll(16); // optional, before reserve_pictures(), decodes the first GOP of the next loop (at most 16 pictures) ahead at the end of the loop
+//	const uint32_t picture_count = core.reserve_pictures(); // optional, the backend can create this many reordering images up front
+//	core.enable_decimation(30, true); // optional, decodes at most 30 frames per second, and skips more frames when the display falls behind
+//	core.set_scan_speed(8); // optional, also during playback, fast forwards 8x by decoding only the intra frames, 0 returns to normal playback
+//	core.seek(display_order); // optional, also during playback, the playback continues from the frame that has this FrameInfo::display_order
+//	while (running)
+//	{
+//		while (!core.decoding_pictures.empty() && decode_is_completed(core.decoding_pictures.front())) // completions are reported in submission order
+//		{
+//			core.finish_decode();
+//		}
+//		VideoDecoderCore::DecodeCommand decode;
+//		while (core.begin_decode(decode)) // returns true if a frame must be decoded now
+//		{
+//			// decode decode.frame_index into DPB slot decode.current_slot, referencing decode.reference_slots, then copy it to the reordering picture decode.picture
+//			core.end_decode(decode);
+//		}
+//		if (core.update_display(playback_time)) // returns true if the displayed picture changed
+//		{
+//			// core.displayed_picture will be presented from now on
+//		}
+//	}
+//
+//	Or with a Backend implementation, one iteration of the display loop is:
+//	core.update(backend, playback_time);
+#pragma once
+#include <climits>
+
+#include "common.h"
+#include "dpb.h"
+#include "seek_planner.h"
+
+struct VideoDecoderCore
+{
+	Video* video = nullptr;
+
+	// Decode-ahead configuration, the defaults decode one frame at a time, only when the next displayed picture is missing:
+	uint32_t max_frames_in_flight = 1; // number of submitted decodes that can be waiting for completion, the backend needs separate decode resources for each
+	uint32_t decode_ahead = 0; // number of pictures that can be decoded (or decoding) before they are needed for display
+	uint32_t loop_preroll = 0; // number of pictures that can be decoded ahead in the last loop_preroll pictures of a video loop, so the first GOP of the next loop is ready when the loop ends
+	uint32_t loop_count = 0; // number of times the video is played, 0: it loops until the playback is stopped
+
+	// Decoded Picture Buffer (DPB) state, the reference info of the slots is in dpb.poc_status, dpb.framenum_status and dpb.longterm_status:
+	DecodedPictureBuffer dpb;
+
+	// Reordering pictures, the backend must create one image for each of these, the pictures are never removed so they can be identified by index:
+	struct Picture
+	{
+		int display_order = -1; // increases across video loops, so pictures of the next loop are displayed after the current loop
+		int frame_index = 0;
+		uint32_t slot = 0; // DPB slot that the picture was decoded into, it can't be reused while the decode is in flight
+		uint64_t duration = 0; // stored here because the frame info might be released for live streams by the time this is displayed
+		bool decoded = false; // the decode completed, so it can be displayed
+	};
+	std::vector<Picture> pictures;
+	std::vector<int> free_pictures; // pictures that can be reused
+	std::vector<int> decoding_pictures; // submitted decodes that are not completed yet, in submission order
+	std::vector<int> display_order_lookup; // decoding and decoded pictures that are waiting to be displayed, indexed by display_order & (size - 1), -1 if empty
+	uint32_t working_count = 0; // number of decoded pictures that are waiting to be displayed
+	int displayed_picture = -1; // the latest reordered picture, -1 before the first picture was displayed
+	struct UnorderedPicture
+	{
+		int picture = 0;
+		uint64_t frame = 0; // Video::live_released_count + the frame index, the frame index changes when the decoded live frames are released
+	};
+	std::vector<UnorderedPicture> unordered_pictures; // live pictures that were decoded before their display order was known, they are displayed when the later frames resolve it
+
+	// Temporal decimation state, by default every frame is decoded:
+	static constexpr uint32_t max_temporal_layers = 8;
+	uint32_t temporal_layer_limit = ~0u; // frames of higher temporal layers are skipped, 0 only decodes the reference frames
+	uint32_t temporal_layer_cap = ~0u; // highest layer that is allowed by the frame rate cap, adaptive decimation doesn't go above this
+	bool adaptive_decimation = false; // a missed display deadline skips one more temporal layer
+	uint32_t decimation_recovery = 120; // number of pictures that must be displayed on time before a skipped layer is decoded again
+	uint32_t on_time_count = 0;
+	int missed_display_order = -1; // the picture that missed its display deadline, so it's only counted once
+	uint64_t missed_count = 0; // number of pictures that missed their display deadline
+	uint64_t skipped_count = 0; // number of frames that were not decoded
+	std::vector<uint8_t> temporal_layers; // per frame, only for non-live videos, live streams put the non-reference frames into layer 1
+	uint32_t decimation_run = 0; // the most consecutive non-reference frames in display order, all of them can be skipped between two decoded pictures
+	struct SkippedFrame
+	{
+		int display_order = 0;
+		uint64_t duration = 0;
+	};
+	std::vector<SkippedFrame> skipped_frames; // skipped frames whose display time didn't come yet, there are only a few, because frames are only skipped instead of decoding them
+
+	// Scan (fast forward) state, by default every frame is decoded in order:
+	double scan_speed = 0; // 0: normal playback, otherwise the video time advances this many times faster than the display time
+	std::vector<int> intra_frames; // frame indices of the intra frames, in decode order
+	size_t scan_intra = 0; // index of intra_frames that is decoded next
+	int scan_display_order = 0; // the display order of the next scanned picture
+	bool dpb_reset_pending = false; // the decoding jumped to an intra frame, so the reference pictures must be reset
+
+	// Reverse playback state, the GOPs are decoded forward, and their pictures are displayed backwards:
+	bool reverse = false;
+	uint32_t reverse_cache_budget = 32; // number of decoded pictures that can wait for display, half of them are for prefetching the previous segment
+	size_t reverse_gop = 0; // index of intra_frames, the GOP that is decoded
+	int reverse_begin = 0; // the FrameInfo::display_order range of the GOP that is kept from this decoding
+	int reverse_end = 0;
+	int reverse_last_frame = 0; // the last kept frame in decode order, the decoding moves to the previous segment after it
+	int reverse_display_order = 0; // Picture::display_order of the frame before reverse_end, the earlier frames follow it
+
+	// Seek state, the frames of the plan are decoded, skipped or only marked as references until the target frame:
+	SeekPlanner seek_planner;
+	SeekPlanner::Plan seek_plan;
+	bool seek_pending = false; // the decoding didn't reach the target frame of seek_plan yet
+	uint32_t marked_slots = 0; // bitmask of the DPB slots of frames that were only marked by the seek, these slots don't have a decoded picture
+
+	// Display timing state:
+	uint64_t next_frame_time = 0; // playback time in timescale ticks when we need to swap displayed images, if the timer reaches it then we swap to the next one that can be displayed
+	int target_display_order = 0; // the next Picture::display_order that must be displayed
+	int display_order_offset = 0; // added to FrameInfo::display_order, incremented by the frame count when the video loops
+
+	struct DecodeCommand
+	{
+		int frame_index = 0;
+		Video::FrameInfo frame_info;
+		h264::SliceHeader slice_header = {};
+		const h264::PPS* pps = nullptr;
+		const h264::SPS* sps = nullptr;
+		uint32_t current_slot = 0; // DPB slot that receives the decoded frame
+		uint32_t reference_count = 0;
+		uint8_t reference_slots[16] = {}; // DPB slots of the decoded reference frames, their reference info is in dpb.poc_status, dpb.framenum_status and dpb.longterm_status, the frames that were only marked by a seek are left out (they are in dpb_frame)
+		DecodedPictureBuffer::Frame dpb_frame;
+		int picture = -1; // reordering picture that receives a copy of the decoded frame
+		bool picture_created = false; // the picture was not used before, so the backend must create its image
+	};
+
+	struct DisplayCommand
+	{
+		int picture = -1; // reordering picture that must be presented, -1 if nothing was decoded yet
+		bool changed = false; // the picture is different from the previously presented one
+	};
+
+	// Graphics API interface for update(), the commands must be executed in the order they are given:
+	struct Backend
+	{
+		virtual ~Backend() = default;
+		virtual void decode(const DecodeCommand& command) = 0;
+		virtual void display(const DisplayCommand& command) = 0;
+		// Returns true if the decode of the picture completed, only called for the oldest decode in flight, backends that decode synchronously don't need to implement it:
+		virtual bool is_decode_completed(int /*picture*/) { return true; }
+	};
+
+	// Enables decoding ahead, must be called before the backend creates its DPB, because every decode in flight needs a DPB slot for its output
+	//	frame_count: number of frames that can be decoded ahead of display, and also be in flight at the same time, 0 disables decoding ahead
+	//	max_dpb_slots: the DPB slot limit of the backend, fewer frames are in flight if there are not enough slots
+	//	returns the number of frames that can be in flight, the backend needs this many separate decode resources (command buffers, bitstream regions)
+	//	video->num_dpb_slots is recomputed from the SPSs, so calling it again replaces the slots of the previous call instead of adding more
+	uint32_t enable_decode_ahead(uint32_t frame_count, uint32_t max_dpb_slots = DecodedPictureBuffer::max_slots)
+	{
+		max_frames_in_flight = 1;
+		decode_ahead = frame_count;
+		if (video->sps_array.empty())
+			return max_frames_in_flight; // the SPS of the live stream was not received yet, its DPB can't be sized
+		uint32_t base_slots = 0;
+		for (const h264::SPS& sps : video->sps_array)
+		{
+			base_slots = std::max(base_slots, uint32_t(Video::Get_dpb_sizing(sps).dpb_slots));
+		}
+		uint32_t extra_slots = 0;
+		if (frame_count > 1)
+		{
+			max_dpb_slots = std::min(max_dpb_slots, DecodedPictureBuffer::max_slots);
+			extra_slots = std::min(frame_count - 1, max_dpb_slots > base_slots ? max_dpb_slots - base_slots : 0u);
+		}
+		video->num_dpb_slots = base_slots + extra_slots;
+		max_frames_in_flight += extra_slots;
+		return max_frames_in_flight;
+	}
+
+	// Enables decoding the first GOP of the next video loop ahead of time, while the end of the current loop is displayed, must be called before reserve_pictures()
+	//	the intra frame that starts a short clip is often much larger than the other frames, and decode ahead alone doesn't leave enough time to decode it, so the display would stall at every loop
+	//	max_frame_count: the pre-roll is the frames of the first GOP (until the second intra frame in decode order, or the whole video), but at most this many
+	//	returns the number of pictures that are pre-rolled, the reordering pictures are reserved for them
+	uint32_t enable_loop_preroll(uint32_t max_frame_count)
+	{
+		loop_preroll = 0;
+		if (video->live)
+			return 0; // live streams don't loop
+		const uint32_t frame_count = (uint32_t)video->frame_infos.size();
+		uint32_t gop_length = 1;
+		while (gop_length < frame_count && !video->frame_infos[gop_length].is_intra)
+		{
+			gop_length++;
+		}
+		loop_preroll = std::min(gop_length, max_frame_count);
+		return loop_preroll;
+	}
+
+	// Creates all the reordering pictures that the stream needs, so that none are created during playback, must be called after enable_decode_ahead(), and after set_reverse() if the playback starts in reverse
+	//	returns the number of pictures, the backend can create their images up front, then picture_created is only set if the stream reorders more frames than its SPS declares
+	uint32_t reserve_pictures()
+	{
+		int reorder_depth = 0;
+		for (const h264::SPS& sps : video->sps_array)
+		{
+			reorder_depth = std::max(reorder_depth, Video::Get_dpb_sizing(sps).reorder_depth);
+		}
+		reorder_depth = std::max(reorder_depth, video->live_reorder_depth);
+
+		// A frame is only decoded if fewer than decode_ahead pictures are waiting, or the next picture is not decoded yet, which means that all the waiting ones follow it in display order, so there are at most reorder_depth of them.
+		// One more picture is being displayed:
+		uint32_t count = std::max(std::max(decode_ahead, loop_preroll), uint32_t(reorder_depth) + 1) + 1;
+		if (reverse)
+		{
+			count = std::max(count, reverse_cache_budget + 1); // the reverse cache is full, and one more picture is displayed
+		}
+		while (pictures.size() < count)
+		{
+			free_pictures.insert(free_pictures.begin(), (int)pictures.size()); // the lowest indices are used first, like without reserving
+			pictures.emplace_back();
+		}
+		decoding_pictures.reserve(max_frames_in_flight);
+		reserve_display_order_lookup();
+		return (uint32_t)pictures.size();
+	}
+
+	// Returns how many display orders a frame can be displayed after a frame that follows it in decode order, so the picture that must be displayed next can be this far behind a decoded one
+	int display_order_lead() const
+	{
+		if (video->live)
+			return video->live_reorder_depth; // the frames are not known in advance, the SPS declaration is trusted
+		int lead = 0;
+		int min_display_order = INT_MAX;
+		for (size_t i = video->frame_infos.size(); i-- > 0;)
+		{
+			const int display_order = video->frame_infos.display_orders[i];
+			min_display_order = std::min(min_display_order, display_order);
+			lead = std::max(lead, display_order - min_display_order);
+		}
+		return lead;
+	}
+
+	// Sizes display_order_lookup, so that the waiting pictures never collide in it:
+	//	a frame is only decoded ahead while its display order is less than target_display_order + display_order_lookup.size() (see begin_decode()), and a frame that must be decoded for the target picture is at most display_order_lead() after it
+	//	the waiting, skipped and not yet decoded frames cover the display orders from the target, so the size is the span of the reserved pictures with the skipped runs of decimation between them, and the decoding doesn't need to wait for the display below that
+	//	called by reserve_pictures() and enable_decimation(), so only at startup and at a rendition switch, the waiting pictures are moved if it grows
+	void reserve_display_order_lookup()
+	{
+		const uint32_t count = std::max((uint32_t)pictures.size(), std::max(decode_ahead, loop_preroll) + 1);
+		const uint32_t span = std::max((count + (uint32_t)display_order_lead() + 1) * (decimation_run + 1), reverse ? reverse_cache_budget + 1 : 0);
+		uint32_t capacity = 1;
+		while (capacity < span)
+		{
+			capacity *= 2;
+		}
+		skipped_frames.reserve(capacity);
+		if (display_order_lookup.size() >= capacity)
+			return;
+
+		// The entries that were different modulo the old size stay different modulo the new size:
+		std::vector<int> entries;
+		entries.swap(display_order_lookup);
+		display_order_lookup.resize(capacity, -1);
+		for (int entry : entries)
+		{
+			if (entry >= 0)
+			{
+				display_order_lookup[pictures[entry].display_order & (capacity - 1)] = entry;
+			}
+		}
+	}
+
+	// Returns the decoding or decoded picture that has the display order, or -1 if there is none
+	int find_picture(int display_order) const
+	{
+		if (display_order_lookup.empty())
+			return -1;
+		const int picture = display_order_lookup[display_order & (display_order_lookup.size() - 1)];
+		return picture >= 0 && pictures[picture].display_order == display_order ? picture : -1;
+	}
+
+	// Enables temporal decimation, the temporal layers are derived from the reference structure: the reference frames are layer 0, and the non-reference frames between two reference frames in display order are split in halves, the middle one is layer 1, the middles of the halves are layer 2 and so on
+	//	max_frame_rate: frames per second that are decoded at most, the layers that would exceed it are always skipped, 0: no cap
+	//	adaptive: a missed display deadline skips one more layer, and after decimation_recovery pictures that were displayed on time, one layer is decoded again
+	//	returns the highest temporal layer that is decoded at first
+	uint32_t enable_decimation(double max_frame_rate, bool adaptive)
+	{
+		uint32_t layer_counts[max_temporal_layers] = {};
+		double frame_rate = 0;
+		if (video->live)
+		{
+			temporal_layers.clear();
+			layer_counts[0] = layer_counts[1] = 1; // the frame types of the stream are not known in advance
+			decimation_run = 1;
+			if (video->live_frame_duration > 0)
+			{
+				frame_rate = double(video->timescale) / double(video->live_frame_duration);
+			}
+		}
+		else
+		{
+			const size_t frame_count = video->frame_infos.size();
+			temporal_layers.assign(frame_count, 0);
+			std::vector<int> frames_in_display_order(frame_count);
+			uint64_t total_duration = 0;
+			for (size_t i = 0; i < frame_count; ++i)
+			{
+				const int display_order = video->frame_infos.display_orders[i];
+				assert(display_order >= 0 && display_order < (int)frame_count);
+				frames_in_display_order[display_order] = (int)i;
+				total_duration += video->frame_infos[i].duration;
+			}
+			std::vector<int> run; // consecutive non-reference frames in display order
+			decimation_run = 0;
+			for (size_t i = 0; i <= frame_count; ++i)
+			{
+				if (i < frame_count && video->frame_infos[frames_in_display_order[i]].reference_priority == 0)
+				{
+					run.push_back(frames_in_display_order[i]);
+					continue;
+				}
+				decimation_run = std::max(decimation_run, (uint32_t)run.size());
+				assign_temporal_layers(run, 0, run.size(), 1);
+				run.clear();
+			}
+			for (uint8_t layer : temporal_layers)
+			{
+				layer_counts[layer]++;
+			}
+			if (total_duration > 0)
+			{
+				frame_rate = double(frame_count) * double(video->timescale) / double(total_duration);
+			}
+		}
+
+		// The highest layer that has frames, and the highest one that fits in the frame rate cap:
+		uint32_t top_layer = 0;
+		uint32_t frame_count = 0;
+		for (uint32_t i = 0; i < max_temporal_layers; ++i)
+		{
+			frame_count += layer_counts[i];
+			top_layer = layer_counts[i] > 0 ? i : top_layer;
+		}
+		temporal_layer_cap = top_layer;
+		if (max_frame_rate > 0 && frame_rate > max_frame_rate)
+		{
+			uint32_t decoded_count = frame_count;
+			while (temporal_layer_cap > 0 && frame_rate * double(decoded_count) / double(frame_count) > max_frame_rate)
+			{
+				decoded_count -= layer_counts[temporal_layer_cap];
+				temporal_layer_cap--;
+			}
+		}
+		temporal_layer_limit = temporal_layer_cap;
+		adaptive_decimation = adaptive;
+		on_time_count = 0;
+		if (!display_order_lookup.empty())
+		{
+			reserve_display_order_lookup(); // the skipped frames widen the span of the waiting pictures
+		}
+		return temporal_layer_limit;
+	}
+
+	// Returns the temporal layer of a frame, 0 for reference frames
+	uint32_t temporal_layer(int frame_index) const
+	{
+		if (frame_index < (int)temporal_layers.size())
+			return temporal_layers[frame_index];
+		return video->frame_infos[frame_index].reference_priority > 0 ? 0 : 1;
+	}
+
+	// Returns true if the display order is decoding, decoded or skipped, so no more frames need to be decoded for it
+	bool is_frame_pending(int display_order) const
+	{
+		if (find_picture(display_order) >= 0)
+			return true;
+		for (const SkippedFrame& skipped : skipped_frames)
+		{
+			if (skipped.display_order == display_order)
+				return true;
+		}
+		return false;
+	}
+
+	// Returns the number of pictures that can be decoded before they are needed, more at the end of a video loop with loop pre-roll
+	uint32_t ahead_limit() const
+	{
+		if (loop_preroll <= decode_ahead || scan_speed > 0 || reverse)
+			return decode_ahead;
+		const int frame_count = (int)video->frame_infos.size();
+		const int loop_end = (target_display_order / frame_count + 1) * frame_count; // the display order of the first picture of the next loop
+		return target_display_order + (int)loop_preroll >= loop_end ? loop_preroll : decode_ahead;
+	}
+
+	// Returns true if every frame of the last loop was decoded and completed, only with a loop_count
+	bool is_decoding_finished() const
+	{
+		return loop_count > 0 && !video->live && display_order_offset >= int(loop_count) * (int)video->frame_infos.size() && decoding_pictures.empty();
+	}
+
+	// Returns true if the last picture of the last loop was displayed (or skipped), only with a loop_count, it stays on display until next_frame_time
+	bool is_display_finished() const
+	{
+		return loop_count > 0 && !video->live && target_display_order >= int(loop_count) * (int)video->frame_infos.size();
+	}
+
+	// Returns true if a new frame must be decoded now, and fills the command that describes it
+	bool begin_decode(DecodeCommand& command)
+	{
+		if (loop_count > 0 && !video->live && display_order_offset >= int(loop_count) * (int)video->frame_infos.size())
+			return false; // every loop was decoded
+		if (display_order_lookup.empty())
+		{
+			reserve_display_order_lookup(); // reserve_pictures() was not called
+		}
+		resolve_display_orders();
+		for (;;)
+		{
+			if (video->frameIndex == 0 || dpb.num_slots != video->num_dpb_slots || dpb_reset_pending || scan_speed > 0)
+			{
+				// At video beginning, and when jumping to an intra frame, the reference pictures are reset:
+				dpb.reset(video->num_dpb_slots);
+				dpb_reset_pending = false;
+				marked_slots = 0;
+			}
+
+			if (decoding_pictures.size() >= max_frames_in_flight)
+				return false; // all the decode resources of the backend are in use
+			if (reverse)
+			{
+				if (decoding_pictures.size() + working_count >= reverse_cache_budget)
+					return false; // the reverse cache is full
+				if (is_reverse_kept(video->frameIndex) || video->frame_infos[video->frameIndex].reference_priority > 0)
+					break;
+				next_reverse_frame(); // not displayed and not referenced
+				continue;
+			}
+			if (decoding_pictures.size() + working_count >= ahead_limit() && is_frame_pending(target_display_order))
+				return false; // the next picture is already decoding, decoded or skipped, and enough frames are decoded ahead
+			if (!video->Is_frame_ready())
+				return false; // the next access unit of the live stream was not received yet
+			if (scan_speed == 0 && !video->live && video->frame_infos.display_orders[video->frameIndex] + display_order_offset < target_display_order && video->frame_infos[video->frameIndex].reference_priority == 0)
+			{
+				next_frame_index(); // after a jump, this precedes the displayed picture and it's not referenced
+				continue;
+			}
+			if (seek_pending && video->frameIndex >= seek_plan.begin && video->frameIndex <= seek_plan.target)
+			{
+				const SeekPlanner::Action action = seek_plan.actions[video->frameIndex - seek_plan.begin];
+				seek_pending = video->frameIndex < seek_plan.target;
+				if (action != SeekPlanner::Action::decode)
+				{
+					if (action == SeekPlanner::Action::mark && !mark_frame())
+						return false; // not needed for the target, but the frames after it must see the same reference marking, which waits for a free DPB slot
+					next_frame_index();
+					continue;
+				}
+			}
+			if (scan_speed > 0 || temporal_layer_limit >= max_temporal_layers - 1 || temporal_layer(video->frameIndex) <= temporal_layer_limit)
+				break;
+
+			// The frame is in a decimated temporal layer, it is not referenced by any other frame, so it can be skipped without touching the DPB. Its display time is spent showing the previous picture:
+			const Video::FrameInfo frame_info = video->frame_infos[video->frameIndex];
+			assert(frame_info.reference_priority == 0);
+			if (frame_info.display_order < 0)
+				return false; // the live frame can only be skipped when its display order is known, the display needs it
+			SkippedFrame skipped;
+			skipped.display_order = frame_info.display_order + display_order_offset;
+			skipped.duration = frame_info.duration;
+			skipped_frames.push_back(skipped);
+			skipped_count++;
+			next_frame_index();
+		}
+
+		if (!reverse && scan_speed == 0 && video->frame_infos.display_orders[video->frameIndex] + display_order_offset - target_display_order >= (int)display_order_lookup.size() && is_frame_pending(target_display_order))
+			return false; // the picture would wait too far ahead of the display for display_order_lookup, the decoding continues when the display catches up
+
+		command.frame_index = video->frameIndex;
+		command.frame_info = video->frame_infos[video->frameIndex];
+		command.slice_header = video->frame_infos.slice_header(video->frameIndex);
+		command.pps = &video->pps_array[command.slice_header.pic_parameter_set_id];
+		command.sps = &video->sps_array[command.pps->seq_parameter_set_id];
+
+		if (!dpb.begin_frame(*command.sps, command.slice_header, command.frame_info.is_intra, command.frame_info.reference_priority > 0, command.frame_info.poc, command.dpb_frame, busy_slots()))
+			return false; // every DPB slot is used by a decode in flight, the frame is decoded when one of them completes
+		command.current_slot = command.dpb_frame.current_slot;
+		command.reference_count = 0;
+		for (uint32_t i = 0; i < command.dpb_frame.reference_count; ++i)
+		{
+			// The slots of marked frames are never read, the SeekPlanner made sure that they are outside the active reference lists, which stay the same without them. They were never activated in the backend, or they still have an older picture, so they are not given to it:
+			const uint8_t slot = command.dpb_frame.reference_slots[i];
+			if ((marked_slots & (1u << slot)) == 0)
+			{
+				command.reference_slots[command.reference_count++] = slot;
+			}
+		}
+		marked_slots &= ~(1u << command.current_slot);
+
+		command.picture_created = free_pictures.empty();
+		if (command.picture_created)
+		{
+			// Request new picture, because there is no more free ones that we can use:
+			free_pictures.push_back((int)pictures.size());
+			pictures.emplace_back();
+		}
+		command.picture = free_pictures.back();
+		Picture& picture = pictures[command.picture];
+		picture.display_order = command.frame_info.display_order + display_order_offset;
+		picture.frame_index = command.frame_index;
+		picture.slot = command.current_slot;
+		picture.duration = command.frame_info.duration;
+		if (reverse)
+		{
+			// The kept pictures of the segment are displayed backwards, the others are only decoded because they are referenced:
+			picture.display_order = is_reverse_kept(command.frame_index) ? reverse_display_order + reverse_end - 1 - command.frame_info.display_order : -1;
+		}
+		else if (scan_speed > 0)
+		{
+			// The scanned pictures are displayed in decode order, each until the video time of the next one is reached with the scan speed:
+			picture.display_order = scan_display_order;
+			picture.duration = uint64_t(double(scan_distance(scan_intra, next_scan_intra())) / scan_speed);
+		}
+		else if (command.frame_info.display_order < 0)
+		{
+			// The later frames of the live stream didn't resolve the display order yet, the picture is decoded now and only its display waits for it:
+			picture.display_order = -1;
+			UnorderedPicture unordered;
+			unordered.picture = command.picture;
+			unordered.frame = video->live_released_count + (uint64_t)command.frame_index;
+			unordered_pictures.push_back(unordered);
+		}
+		picture.decoded = false;
+		return true;
+	}
+
+	// Must be called after the frame of begin_decode() was submitted for decoding
+	void end_decode(const DecodeCommand& command)
+	{
+		// Reference picture marking, this decides which frames can be referenced by the next frames:
+		dpb.end_frame(command.slice_header, command.dpb_frame);
+
+		// Current latest reordered is in flight until the backend reports its completion:
+		assert(!free_pictures.empty() && free_pictures.back() == command.picture);
+		free_pictures.pop_back();
+		decoding_pictures.push_back(command.picture);
+		if (pictures[command.picture].display_order >= target_display_order)
+		{
+			insert_picture(command.picture);
+		}
+
+		if (reverse)
+		{
+			next_reverse_frame();
+		}
+		else if (scan_speed > 0)
+		{
+			scan_intra = next_scan_intra();
+			video->frameIndex = intra_frames[scan_intra];
+			scan_display_order++;
+		}
+		else
+		{
+			next_frame_index();
+		}
+	}
+
+	// Must be called when the oldest decode in flight (decoding_pictures.front()) completed, then it can be displayed
+	void finish_decode()
+	{
+		assert(!decoding_pictures.empty());
+		const int picture = decoding_pictures.front();
+		decoding_pictures.erase(decoding_pictures.begin());
+		if (pictures[picture].display_order < target_display_order && !is_unordered(picture))
+		{
+			// The picture was discarded by a jump, or it precedes the intra frame that the playback jumped to, so it's never displayed:
+			free_pictures.push_back(picture);
+			return;
+		}
+		pictures[picture].decoded = true;
+		working_count++;
+	}
+
+	// Starts or stops scanning, the pictures that are waiting to be displayed are discarded, and the decoding continues from an intra frame:
+	//	speed: the video time advances this many times faster than the display time, 0 returns to normal playback after the displayed picture
+	void set_scan_speed(double speed)
+	{
+		assert(!video->live); // live streams can't jump
+		if (video->live || speed == scan_speed)
+			return;
+		const bool was_scanning = scan_speed > 0;
+		scan_speed = std::max(0.0, speed);
+		if (was_scanning && scan_speed > 0)
+			return; // only the speed changed, the pictures that are waiting will be displayed
+		if (scan_speed == 0)
+		{
+			resume_forward();
+			return;
+		}
+
+		// The scanning starts from the last intra frame at or before the current position:
+		reverse = false;
+		find_intra_frames();
+		discard_pictures();
+		scan_intra = find_intra_before(position_frame());
+		video->frameIndex = intra_frames[scan_intra];
+		dpb_reset_pending = true;
+		scan_display_order = target_display_order;
+	}
+
+	// Starts or stops reverse playback, the pictures that are waiting to be displayed are discarded:
+	//	the GOPs are decoded forward once from their intra frame, the pictures are kept in the reordering pictures (at most reverse_cache_budget of them), and they are displayed backwards
+	//	GOPs that have more frames than half of the budget are decoded in multiple segments, each segment decodes the GOP from its beginning, but only keeps a part of it
+	void set_reverse(bool enable)
+	{
+		assert(!video->live); // live streams can't jump
+		if (video->live || enable == reverse)
+			return;
+		reverse = enable;
+		if (!reverse)
+		{
+			resume_forward();
+			return;
+		}
+
+		// The playback continues backwards from the frame before the displayed one:
+		scan_speed = 0;
+		find_intra_frames();
+		discard_pictures();
+		const int frame = position_frame();
+		reverse_display_order = target_display_order;
+		begin_reverse_segment(find_intra_before(frame), video->frame_infos.display_orders[frame]);
+	}
+
+	// Jumps to the frame that has the display_order (FrameInfo::display_order), the pictures that are waiting to be displayed are discarded:
+	//	the decoding restarts from the IDR frame before it, but only the frames that the target and the playback after it need are decoded, see SeekPlanner
+	//	the displayed picture stays until the target is decoded, then the playback continues from the target
+	void seek(int display_order)
+	{
+		assert(!video->live); // live streams can't jump
+		if (video->live)
+			return;
+		scan_speed = 0;
+		reverse = false;
+		discard_pictures();
+		int target_frame = 0;
+		while (target_frame + 1 < (int)video->frame_infos.size() && video->frame_infos.display_orders[target_frame] != display_order)
+		{
+			target_frame++;
+		}
+		if (!seek_planner.plan(*video, target_frame, seek_plan))
+			return;
+		video->frameIndex = seek_plan.begin;
+		dpb_reset_pending = true;
+		seek_pending = true;
+		display_order_offset = target_display_order - video->frame_infos.display_orders[target_frame];
+	}
+
+	// Returns the frame index of the displayed picture, or the next decoded one before the first display
+	int position_frame() const
+	{
+		return displayed_picture >= 0 ? pictures[displayed_picture].frame_index : video->frameIndex;
+	}
+
+	// Collects the intra frames, that can be jumped to
+	void find_intra_frames()
+	{
+		if (!intra_frames.empty())
+			return;
+		for (int i = 0; i < (int)video->frame_infos.size(); ++i)
+		{
+			if (video->frame_infos[i].is_intra)
+			{
+				intra_frames.push_back(i);
+			}
+		}
+		assert(!intra_frames.empty()); // the first frame is always intra
+	}
+
+	// Returns the index of intra_frames that is the last one at or before the frame in decode order
+	size_t find_intra_before(int frame_index) const
+	{
+		const auto it = std::upper_bound(intra_frames.begin(), intra_frames.end(), frame_index);
+		return it == intra_frames.begin() ? 0 : size_t(it - intra_frames.begin()) - 1;
+	}
+
+	// Continues normal playback after the displayed picture, the decoding restarts from its intra frame
+	void resume_forward()
+	{
+		find_intra_frames();
+		discard_pictures();
+		const int frame = position_frame();
+		video->frameIndex = intra_frames[find_intra_before(frame)];
+		dpb_reset_pending = true;
+
+		// The frames that precede the displayed one in display order are only decoded if they are referenced, and they are not displayed:
+		const int next_display_order = video->frame_infos.display_orders[frame] + (displayed_picture >= 0 ? 1 : 0);
+		display_order_offset = target_display_order - next_display_order;
+	}
+
+	// Starts decoding the segment of a GOP that precedes the end display order, or the last segment of the previous GOP if the end is the first frame of the GOP
+	void begin_reverse_segment(size_t gop, int end)
+	{
+		for (;;)
+		{
+			const int first_frame = intra_frames[gop];
+			const int end_frame = gop + 1 < intra_frames.size() ? intra_frames[gop + 1] : (int)video->frame_infos.size();
+			int gop_begin = INT_MAX;
+			int gop_end = INT_MIN;
+			for (int i = first_frame; i < end_frame; ++i)
+			{
+				gop_begin = std::min(gop_begin, video->frame_infos.display_orders[i]);
+				gop_end = std::max(gop_end, video->frame_infos.display_orders[i] + 1);
+			}
+			if (end <= gop_begin)
+			{
+				// The previous GOP, the first GOP is preceded by the last one, so the reverse playback loops:
+				gop = gop > 0 ? gop - 1 : intra_frames.size() - 1;
+				end = INT_MAX;
+				continue;
+			}
+			end = std::min(end, gop_end);
+			reverse_gop = gop;
+			reverse_end = end;
+			reverse_begin = std::max(gop_begin, end - (int)std::max(1u, reverse_cache_budget / 2)); // the other half of the budget is for the next segment that is prefetched
+			for (int i = first_frame; i < end_frame; ++i)
+			{
+				if (is_reverse_kept(i))
+				{
+					reverse_last_frame = i;
+				}
+			}
+			video->frameIndex = first_frame;
+			dpb_reset_pending = true;
+			return;
+		}
+	}
+
+	// Returns true if the frame is displayed from the reverse segment that is decoded
+	bool is_reverse_kept(int frame_index) const
+	{
+		const int display_order = video->frame_infos.display_orders[frame_index];
+		return display_order >= reverse_begin && display_order < reverse_end;
+	}
+
+	// Moves to the next frame of the reverse segment in decode order, or to the previous segment after its last kept frame
+	void next_reverse_frame()
+	{
+		if (video->frameIndex == reverse_last_frame)
+		{
+			reverse_display_order += reverse_end - reverse_begin;
+			begin_reverse_segment(reverse_gop, reverse_begin);
+		}
+		else
+		{
+			video->frameIndex++;
+		}
+	}
+
+	// Discards the decoded and decoding pictures that are waiting to be displayed, the decoding ones are freed when they complete
+	void discard_pictures()
+	{
+		for (int& entry : display_order_lookup)
+		{
+			if (entry < 0)
+				continue;
+			if (pictures[entry].decoded)
+			{
+				free_pictures.push_back(entry);
+				working_count--;
+			}
+			pictures[entry].display_order = -1;
+			entry = -1;
+		}
+		skipped_frames.clear();
+		seek_pending = false;
+		assert(working_count == 0);
+	}
+
+	// Returns the index of the intra frame that is scanned after intra_frames[intra], it's the first one that is at least one displayed frame later in video time with the scan speed
+	size_t next_scan_intra() const
+	{
+		const int frame = intra_frames[scan_intra];
+		const Video::FrameInfo frame_info = video->frame_infos[frame];
+		const uint64_t target = frame_info.timestamp + uint64_t(double(frame_info.duration) * scan_speed);
+		for (size_t i = scan_intra + 1; i < intra_frames.size(); ++i)
+		{
+			if (video->frame_infos[intra_frames[i]].timestamp >= target)
+				return i;
+		}
+		// The video loops, the scanning continues from the beginning:
+		const uint64_t loop_target = target > video->duration ? target - video->duration : 0;
+		for (size_t i = 0; i <= scan_intra; ++i)
+		{
+			if (video->frame_infos[intra_frames[i]].timestamp >= loop_target)
+				return i;
+		}
+		return scan_intra;
+	}
+
+	// Returns the video time between two scanned intra frames, the second one is in the next video loop if it's not after the first one
+	uint64_t scan_distance(size_t from, size_t to) const
+	{
+		const uint64_t from_time = video->frame_infos[intra_frames[from]].timestamp;
+		const uint64_t to_time = video->frame_infos[intra_frames[to]].timestamp;
+		return to > from ? to_time - from_time : to_time + video->duration - from_time;
+	}
+
+	// Swaps the displayed picture if its time has come, returns true if displayed_picture changed
+	bool update_display(uint64_t playback_time)
+	{
+		if (playback_time < next_frame_time)
+			return false;
+		resolve_display_orders();
+
+		// Look up the next displayable:
+		const int next_picture = find_picture(target_display_order);
+		if (next_picture < 0 || !pictures[next_picture].decoded)
+		{
+			for (size_t i = 0; i < skipped_frames.size(); ++i)
+			{
+				if (skipped_frames[i].display_order == target_display_order)
+				{
+					// The frame was skipped, the current picture stays on display for its duration:
+					advance_frame_time(skipped_frames[i].duration, playback_time);
+					skipped_frames[i] = skipped_frames.back();
+					skipped_frames.pop_back();
+					target_display_order++;
+					return update_display(playback_time);
+				}
+			}
+			if (displayed_picture >= 0 && missed_display_order != target_display_order)
+			{
+				// Missed display deadline, the decoding can't keep up, so one more temporal layer is skipped:
+				missed_display_order = target_display_order;
+				missed_count++;
+				on_time_count = 0;
+				if (adaptive_decimation && temporal_layer_limit > 0)
+				{
+					temporal_layer_limit--;
+				}
+			}
+			return false;
+		}
+		if (adaptive_decimation && missed_display_order != target_display_order && temporal_layer_limit < temporal_layer_cap && ++on_time_count >= decimation_recovery)
+		{
+			temporal_layer_limit++;
+			on_time_count = 0;
+		}
+
+		// Free current output picture:
+		if (displayed_picture >= 0)
+		{
+			free_pictures.push_back(displayed_picture);
+		}
+		// Take this used picture as current output:
+		displayed_picture = next_picture;
+		// Remove this used picture:
+		display_order_lookup[target_display_order & (display_order_lookup.size() - 1)] = -1;
+		working_count--;
+
+		advance_frame_time(pictures[displayed_picture].duration, playback_time);
+		target_display_order++;
+		return true;
+	}
+
+	// The swap time is accumulated in integer ticks, so it doesn't drift. If playback fell behind by more than a frame, it resyncs instead of fast forwarding:
+	void advance_frame_time(uint64_t frame_duration, uint64_t playback_time)
+	{
+		next_frame_time += frame_duration;
+		if (next_frame_time <= playback_time)
+		{
+			next_frame_time = playback_time + frame_duration;
+		}
+	}
+
+	// Returns the DPB slots of the decodes in flight, these are not reused, because their output copy might still read them
+	uint32_t busy_slots() const
+	{
+		uint32_t slots = 0;
+		for (int picture : decoding_pictures)
+		{
+			slots |= 1u << pictures[picture].slot;
+		}
+		return slots;
+	}
+
+	// Performs the reference marking of the frame at video->frameIndex without decoding it, its slot is reserved in the DPB, but the SeekPlanner made sure that no decoded frame reads it, and it's left out of the reference slots of the decode commands, returns false if every DPB slot is busy
+	bool mark_frame()
+	{
+		const Video::FrameInfo frame_info = video->frame_infos[video->frameIndex];
+		const h264::SliceHeader slice_header = video->frame_infos.slice_header(video->frameIndex);
+		const h264::SPS& sps = video->sps_array[video->pps_array[slice_header.pic_parameter_set_id].seq_parameter_set_id];
+		DecodedPictureBuffer::Frame frame;
+		if (!dpb.begin_frame(sps, slice_header, frame_info.is_intra, frame_info.reference_priority > 0, frame_info.poc, frame, busy_slots()))
+			return false;
+		dpb.end_frame(slice_header, frame);
+		marked_slots |= 1u << frame.current_slot;
+		return true;
+	}
+
+	// Moves to the next frame in decode order
+	void next_frame_index()
+	{
+		if (video->live)
+		{
+			video->frameIndex++; // live streams don't loop
+		}
+		else
+		{
+			video->frameIndex = (video->frameIndex + 1) % video->frame_infos.size();
+			if (video->frameIndex == 0)
+			{
+				display_order_offset += (int)video->frame_infos.size();
+			}
+		}
+	}
+
+	// Assigns the layers of non-reference frames that are consecutive in display order: the middle frame gets the layer, the two halves get the next layer
+	void assign_temporal_layers(const std::vector<int>& run, size_t begin, size_t end, uint32_t layer)
+	{
+		if (begin >= end)
+			return;
+		const size_t middle = (begin + end) / 2;
+		temporal_layers[run[middle]] = (uint8_t)std::min(layer, max_temporal_layers - 1);
+		assign_temporal_layers(run, begin, middle, layer + 1);
+		assign_temporal_layers(run, middle + 1, end, layer + 1);
+	}
+
+	// Adds a submitted picture to display_order_lookup
+	void insert_picture(int picture)
+	{
+		const int display_order = pictures[picture].display_order;
+		assert(display_order >= target_display_order && display_order - target_display_order < (int)display_order_lookup.size()); // see reserve_display_order_lookup()
+		int& entry = display_order_lookup[display_order & (display_order_lookup.size() - 1)];
+		assert(entry < 0);
+		entry = picture;
+	}
+
+	// Returns true if the picture is a live picture that waits for its display order
+	bool is_unordered(int picture) const
+	{
+		for (const UnorderedPicture& unordered : unordered_pictures)
+		{
+			if (unordered.picture == picture)
+				return true;
+		}
+		return false;
+	}
+
+	// The live pictures that the later frames put in display order are inserted in display_order_lookup:
+	void resolve_display_orders()
+	{
+		for (size_t i = 0; i < unordered_pictures.size();)
+		{
+			assert(unordered_pictures[i].frame >= video->live_released_count); // Video::Update_h264_stream() keeps the frames that got their display order until the next update, this is called between them by begin_decode() and update_display()
+			const int frame_index = int(unordered_pictures[i].frame - video->live_released_count);
+			const int display_order = video->frame_infos.display_orders[frame_index];
+			if (display_order < 0)
+			{
+				++i;
+				continue;
+			}
+			const int picture = unordered_pictures[i].picture;
+			pictures[picture].display_order = display_order + display_order_offset;
+			insert_picture(picture);
+			unordered_pictures[i] = unordered_pictures.back();
+			unordered_pictures.pop_back();
+		}
+	}
+
+	// One iteration of the display loop with a backend, returns the number of decoded frames
+	uint32_t update(Backend& backend, uint64_t playback_time)
+	{
+		uint32_t decode_count = 0;
+		for (;;)
+		{
+			while (!decoding_pictures.empty() && backend.is_decode_completed(decoding_pictures.front()))
+			{
+				finish_decode();
+			}
+			DecodeCommand command;
+			if (decode_count >= max_frames_in_flight || !begin_decode(command))
+				break;
+			backend.decode(command);
+			end_decode(command);
+			decode_count++;
+		}
+		DisplayCommand display;
+		display.changed = update_display(playback_time);
+		display.picture = displayed_picture;
+		backend.display(display);
+		return decode_count;
+	}
+};
@@ -0,0 +1,393 @@
+// H264 Decoded Picture Buffer (DPB) reference management
+//
+// What this does:
+//	- implements the decoded reference picture marking process of the H264 specification (8.2.5): sliding window marking, adaptive marking with memory management control operations (MMCO), long-term references and frame_num gaps
+//	- assigns a DPB slot to every decoded frame, and gives the exact set of slots that the frame can reference, so frames that are no longer used for reference are never kept or referenced
+//	- at most max(num_ref_frames, 1) frames are used for reference at once, so num_ref_frames + 1 DPB slots are always enough (one more for the frame that is being decoded)
+//		- when frames are decoded ahead, the slots of the decodes in flight can be excluded, then one more slot is needed for each of them
+//		- if num_slots is still too small, begin_frame() evicts the oldest reference that is not busy and logs it, or fails when every slot is busy, a referenced slot is never overwritten
+//	- it doesn't depend on any graphics API, so it can be run and checked on the CPU (mini_video_null.exe prints the reference slots of every frame)
+//	- only frame pictures are supported (no field pairs), like in the rest of mini_video
+//
+// How to use:
+//	DecodedPictureBuffer dpb;
+//	dpb.reset(num_dpb_slots);
+//	// For every frame in decode order:
+//	DecodedPictureBuffer::Frame frame;
+//	dpb.begin_frame(sps, slice_header, is_idr, nal_ref_idc != 0, poc, frame);
+//	// decode into frame.current_slot, referencing frame.reference_slots, the reference info of each slot is in poc_status, framenum_status and longterm_status
+//	dpb.end_frame(slice_header, frame); // performs the reference marking after the frame was decoded
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+
+#include "h264.h"
+
+struct DecodedPictureBuffer
+{
+	static constexpr uint32_t max_references = 16;
+	static constexpr uint32_t max_slots = max_references + 1;
+
+	// Reference info of every DPB slot, valid for the current frame and the slots that it references:
+	int poc_status[max_slots] = {}; // PictureOrderCount
+	int framenum_status[max_slots] = {}; // FrameNum for short-term references, LongTermFrameIdx for long-term references
+	bool longterm_status[max_slots] = {}; // used for long-term reference
+
+	struct Frame
+	{
+		uint32_t current_slot = 0; // DPB slot that receives the decoded frame
+		uint32_t reference_count = 0;
+		uint8_t reference_slots[max_references] = {}; // all DPB slots that are marked as used for reference, short-term references first
+		uint32_t gap_count = 0; // number of "non-existing" frames that were inferred for a frame_num gap before this frame
+		int frame_num = 0;
+		int poc = 0;
+		bool is_idr = false;
+		bool is_reference = false;
+	};
+
+	uint32_t num_slots = 0;
+	uint32_t evicted_count = 0; // references that were evicted in begin_frame() because no slot was free
+
+	// Removes all references, must be called before the first frame, and when the number of slots changes
+	void reset(uint32_t slot_count)
+	{
+		assert(slot_count <= max_slots);
+		num_slots = std::min(slot_count, max_slots);
+		count = 0;
+		max_long_term_frame_idx = no_long_term_frame_indices;
+		prev_ref_frame_num = -1;
+	}
+
+	// Prepares the DPB for decoding a frame, and fills its DPB slot and references, returns false if every slot is busy (only possible with busy_slots)
+	//	busy_slots: bitmask of slots that must not be selected for the current frame, for example because the output of an earlier decode is still read from them, num_slots must be large enough for these too
+	bool begin_frame(const h264::SPS& sps, const h264::SliceHeader& slice_header, bool is_idr, bool is_reference, int poc, Frame& frame, uint32_t busy_slots = 0)
+	{
+		max_frame_num = 1 << (sps.log2_max_frame_num_minus4 + 4);
+		max_num_ref_frames = std::max(1, std::min(sps.num_ref_frames, (int)max_references));
+		assert(num_slots > (uint32_t)max_num_ref_frames); // num_ref_frames + 1 slots are required
+
+		frame = {};
+		frame.frame_num = slice_header.frame_num;
+		frame.poc = poc;
+		frame.is_idr = is_idr;
+		frame.is_reference = is_reference;
+
+		if (is_idr)
+		{
+			// All reference pictures are marked as "unused for reference" (8.2.5.1):
+			count = 0;
+			max_long_term_frame_idx = no_long_term_frame_indices;
+		}
+		else if (prev_ref_frame_num >= 0 && frame.frame_num != prev_ref_frame_num && frame.frame_num != (prev_ref_frame_num + 1) % max_frame_num)
+		{
+			// Gaps in frame_num (8.2.5.2): the missing frame numbers are inserted as "non-existing" short-term reference frames with sliding window marking
+			//	These don't have a DPB slot and are never referenced, but they push out older short-term references like real frames would
+			//	If the SPS doesn't allow gaps, then frames were lost, and this is the best that can be done without them
+			for (int unused_frame_num = (prev_ref_frame_num + 1) % max_frame_num; unused_frame_num != frame.frame_num; unused_frame_num = (unused_frame_num + 1) % max_frame_num)
+			{
+				make_room(unused_frame_num);
+				Reference& reference = references[count++];
+				reference = {};
+				reference.slot = -1;
+				reference.frame_num = unused_frame_num;
+				prev_ref_frame_num = unused_frame_num;
+				frame.gap_count++;
+			}
+		}
+
+		// The current frame goes into the first slot that isn't used for reference, or by a decode in flight:
+		frame.current_slot = free_slot(busy_slots);
+		if (frame.current_slot >= num_slots)
+		{
+			// Every slot is used, so num_slots is too small for the references of the SPS and busy_slots
+			//	The oldest reference that isn't busy is evicted, like the sliding window would, it can't be referenced anymore
+			//	If every slot is busy, nothing is evicted, and begin_frame() can be called again for this frame when a busy slot is released
+			const int evicted_slot = evict(frame.frame_num, busy_slots);
+			if (evicted_slot < 0)
+				return false;
+			evicted_count++;
+			printf("DPB: no free slot for frame_num %d, the reference in slot %d was evicted\n", frame.frame_num, evicted_slot);
+			frame.current_slot = free_slot(busy_slots);
+			assert(frame.current_slot < num_slots);
+		}
+
+		// The references that exist before the marking of this frame:
+		for (uint32_t pass = 0; pass < 2; ++pass)
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const Reference& reference = references[i];
+				if (reference.slot < 0 || reference.long_term != (pass == 1))
+					continue;
+				frame.reference_slots[frame.reference_count++] = (uint8_t)reference.slot;
+			}
+		}
+
+		poc_status[frame.current_slot] = frame.poc;
+		framenum_status[frame.current_slot] = frame.frame_num;
+		longterm_status[frame.current_slot] = false;
+		return true;
+	}
+
+	// Decoded reference picture marking (8.2.5), must be called after the frame of begin_frame() was submitted for decoding
+	void end_frame(const h264::SliceHeader& slice_header, const Frame& frame)
+	{
+		if (!frame.is_reference)
+			return;
+
+		Reference current = {};
+		current.slot = (int)frame.current_slot;
+		current.frame_num = frame.frame_num;
+		current.poc = frame.poc;
+
+		if (frame.is_idr)
+		{
+			if (slice_header.drpm.long_term_reference_flag)
+			{
+				current.long_term = true;
+				current.long_term_frame_idx = 0;
+				max_long_term_frame_idx = 0;
+			}
+			else
+			{
+				max_long_term_frame_idx = no_long_term_frame_indices;
+			}
+		}
+		else if (slice_header.drpm.adaptive_ref_pic_marking_mode_flag)
+		{
+			// Adaptive memory control (8.2.5.4), for frames the picture numbers are the same as the frame numbers:
+			const int curr_pic_num = frame.frame_num;
+			for (int n = 0; n < (int)arraysize_of(slice_header.drpm.memory_management_control_operation); ++n)
+			{
+				const int operation = slice_header.drpm.memory_management_control_operation[n];
+				if (operation == 0)
+					break;
+				const int pic_num_x = curr_pic_num - (slice_header.drpm.difference_of_pic_nums_minus1[n] + 1);
+				switch (operation)
+				{
+				case 1:
+					// Mark a short-term reference as unused:
+					remove_short_term(pic_num_x, curr_pic_num);
+					break;
+				case 2:
+					// Mark a long-term reference as unused:
+					remove_long_term(slice_header.drpm.long_term_pic_num[n]);
+					break;
+				case 3:
+				{
+					// Convert a short-term reference to long-term:
+					const int long_term_frame_idx = slice_header.drpm.long_term_frame_idx[n];
+					remove_long_term(long_term_frame_idx);
+					for (uint32_t i = 0; i < count; ++i)
+					{
+						Reference& reference = references[i];
+						if (!reference.long_term && frame_num_wrap(reference.frame_num, curr_pic_num) == pic_num_x)
+						{
+							reference.long_term = true;
+							reference.long_term_frame_idx = long_term_frame_idx;
+							if (reference.slot >= 0)
+							{
+								framenum_status[reference.slot] = long_term_frame_idx;
+								longterm_status[reference.slot] = true;
+							}
+							break;
+						}
+					}
+					break;
+				}
+				case 4:
+					// Limit the long-term frame indices, the ones above the limit are marked as unused:
+					max_long_term_frame_idx = slice_header.drpm.max_long_term_frame_idx_plus1[n] - 1;
+					for (uint32_t i = 0; i < count;)
+					{
+						if (references[i].long_term && references[i].long_term_frame_idx > max_long_term_frame_idx)
+						{
+							remove(i);
+						}
+						else
+						{
+							i++;
+						}
+					}
+					break;
+				case 5:
+					// Mark all references as unused, the current frame is treated as if it had frame_num = 0 and poc = 0 from now on:
+					count = 0;
+					max_long_term_frame_idx = no_long_term_frame_indices;
+					current.frame_num = 0;
+					current.poc = 0;
+					break;
+				case 6:
+					// Mark the current frame as long-term:
+					remove_long_term(slice_header.drpm.long_term_frame_idx[n]);
+					current.long_term = true;
+					current.long_term_frame_idx = slice_header.drpm.long_term_frame_idx[n];
+					break;
+				default:
+					assert(0); // invalid memory_management_control_operation
+					break;
+				}
+			}
+		}
+		else
+		{
+			sliding_window(frame.frame_num);
+		}
+
+		make_room(frame.frame_num); // a conforming stream never needs this after the marking
+
+		references[count++] = current;
+		poc_status[current.slot] = current.poc;
+		framenum_status[current.slot] = current.long_term ? current.long_term_frame_idx : current.frame_num;
+		longterm_status[current.slot] = current.long_term;
+		prev_ref_frame_num = current.frame_num;
+	}
+
+	// Returns the number of frames that are currently marked as used for reference, including the non-existing frames of frame_num gaps
+	inline uint32_t reference_frame_count() const { return count; }
+
+	// Fills the DPB slots of the frames that are currently marked as used for reference (without the non-existing frames), returns their count
+	uint32_t current_reference_slots(uint8_t slots[max_references]) const
+	{
+		uint32_t slot_count = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (references[i].slot >= 0)
+			{
+				slots[slot_count++] = (uint8_t)references[i].slot;
+			}
+		}
+		return slot_count;
+	}
+
+private:
+	static constexpr int no_long_term_frame_indices = -1;
+
+	struct Reference
+	{
+		int slot = -1; // -1 for the non-existing frames of frame_num gaps
+		int frame_num = 0;
+		int poc = 0;
+		int long_term_frame_idx = 0;
+		bool long_term = false;
+	};
+	Reference references[max_references] = {}; // the frames marked as used for reference, in marking order
+	uint32_t count = 0;
+	int max_long_term_frame_idx = no_long_term_frame_indices;
+	int prev_ref_frame_num = -1; // -1 until the first reference frame, so a stream that doesn't start with an IDR frame has no frame_num gap at the beginning
+	int max_frame_num = 16;
+	int max_num_ref_frames = 1;
+
+	template<typename T, size_t N>
+	static constexpr size_t arraysize_of(const T(&)[N]) { return N; }
+
+	// FrameNumWrap (8.2.4.1): frame numbers above the current one were used before frame_num wrapped around
+	int frame_num_wrap(int frame_num, int current_frame_num) const
+	{
+		return frame_num > current_frame_num ? frame_num - max_frame_num : frame_num;
+	}
+
+	void remove(uint32_t index)
+	{
+		assert(index < count);
+		std::move(references + index + 1, references + count, references + index); // keeps the marking order
+		count--;
+	}
+
+	void remove_short_term(int pic_num, int current_frame_num)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (!references[i].long_term && frame_num_wrap(references[i].frame_num, current_frame_num) == pic_num)
+			{
+				remove(i);
+				return;
+			}
+		}
+	}
+
+	void remove_long_term(int long_term_frame_idx)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (references[i].long_term && references[i].long_term_frame_idx == long_term_frame_idx)
+			{
+				remove(i);
+				return;
+			}
+		}
+	}
+
+	// Sliding window marking (8.2.5.3): when the DPB is full of references, the short-term reference with the smallest FrameNumWrap is marked as unused, returns false if there was no short-term reference to remove
+	bool sliding_window(int current_frame_num)
+	{
+		if (count < (uint32_t)max_num_ref_frames)
+			return true;
+		int oldest = -1;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (!references[i].long_term && (oldest < 0 || frame_num_wrap(references[i].frame_num, current_frame_num) < frame_num_wrap(references[oldest].frame_num, current_frame_num)))
+			{
+				oldest = (int)i;
+			}
+		}
+		if (oldest < 0)
+			return false;
+		remove((uint32_t)oldest);
+		return true;
+	}
+
+	// Returns the first slot that isn't used for reference and isn't busy, or num_slots if there is none
+	uint32_t free_slot(uint32_t busy_slots) const
+	{
+		bool used_slots[max_slots] = {};
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (references[i].slot >= 0)
+			{
+				used_slots[references[i].slot] = true;
+			}
+		}
+		uint32_t slot = 0;
+		while (slot < num_slots && (used_slots[slot] || (busy_slots & (1u << slot))))
+		{
+			slot++;
+		}
+		return slot;
+	}
+
+	// Removes the short-term reference with the smallest FrameNumWrap whose slot isn't busy, or the oldest such long-term reference if there is none, returns its slot, or -1 if every reference slot is busy
+	int evict(int current_frame_num, uint32_t busy_slots)
+	{
+		int oldest = -1;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const Reference& reference = references[i];
+			if (reference.slot < 0 || (busy_slots & (1u << reference.slot)))
+				continue;
+			if (oldest < 0 || (references[oldest].long_term && !reference.long_term) || (!references[oldest].long_term && !reference.long_term && frame_num_wrap(reference.frame_num, current_frame_num) < frame_num_wrap(references[oldest].frame_num, current_frame_num)))
+			{
+				oldest = (int)i;
+			}
+		}
+		if (oldest < 0)
+			return -1;
+		const int slot = references[oldest].slot;
+		remove((uint32_t)oldest);
+		return slot;
+	}
+
+	// Makes sure that one more reference fits, a broken stream could have too many references after the marking, then the oldest ones are dropped
+	void make_room(int current_frame_num)
+	{
+		while (count >= (uint32_t)max_num_ref_frames)
+		{
+			if (!sliding_window(current_frame_num))
+			{
+				remove(0); // only long-term references are left
+			}
+		}
+	}
+};
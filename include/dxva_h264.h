@@ -0,0 +1,308 @@
+// DXVA H264 picture parameter builder for the DX11 and DX12 backends
+//
+// What this does:
+//	- fills DXVA_PicParams_H264, DXVA_Qmatrix_H264 and DXVA_Slice_H264_Short for the decode commands of the VideoDecoderCore
+//	- the fields that only depend on the SPS and PPS are filled once for every PPS, the inverse quantization matrix is built once too
+//	- for every frame only the current slot, POC, frame_num, picture flags and the used entries of the reference list are patched, so the per-frame work scales with the number of references
+//	- the DX11 and DX12 backends still fill the parameters field by field, they switch to the builder when it was built and run with them on Windows, until then only mini_video_null.exe uses it
+//	- on other platforms than Windows the DXVA structures are declared here with the same layout as in dxva.h, so the builder can be compiled and checked without DirectX (mini_video_null.exe -dxva compares it with the field by field filling)
+//
+// How to use:
+//	DXVAPictureParametersH264 dxva;
+//	// For every decode command:
+//	const DXVA_PicParams_H264& pic_params = dxva.build(*core.video, decode, core.dpb);
+//	const DXVA_Qmatrix_H264& qmatrix = dxva.qmatrix(*core.video, decode);
+//	const DXVA_Slice_H264_Short slice = DXVAPictureParametersH264::slice_control(decode);
+//	// copy them to the decoder buffers, the references stay valid until the next build() call
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+
+#include "common.h"
+#include "decoder_core.h"
+
+#if defined(_WIN32)
+#include <dxva.h> // it needs the Windows types, so on Windows this header is included after the DirectX headers
+#else
+// The same layout as the declarations in dxva.h (DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010)
+#pragma pack(push, 1)
+struct DXVA_PicEntry_H264
+{
+	union
+	{
+		struct
+		{
+			uint8_t Index7Bits : 7;
+			uint8_t AssociatedFlag : 1;
+		};
+		uint8_t bPicEntry;
+	};
+};
+struct DXVA_PicParams_H264
+{
+	uint16_t wFrameWidthInMbsMinus1;
+	uint16_t wFrameHeightInMbsMinus1;
+	DXVA_PicEntry_H264 CurrPic;
+	uint8_t num_ref_frames;
+	union
+	{
+		struct
+		{
+			uint16_t field_pic_flag : 1;
+			uint16_t MbaffFrameFlag : 1;
+			uint16_t residual_colour_transform_flag : 1;
+			uint16_t sp_for_switch_flag : 1;
+			uint16_t chroma_format_idc : 2;
+			uint16_t RefPicFlag : 1;
+			uint16_t constrained_intra_pred_flag : 1;
+			uint16_t weighted_pred_flag : 1;
+			uint16_t weighted_bipred_idc : 2;
+			uint16_t MbsConsecutiveFlag : 1;
+			uint16_t frame_mbs_only_flag : 1;
+			uint16_t transform_8x8_mode_flag : 1;
+			uint16_t MinLumaBipredSize8x8Flag : 1;
+			uint16_t IntraPicFlag : 1;
+		};
+		uint16_t wBitFields;
+	};
+	uint8_t bit_depth_luma_minus8;
+	uint8_t bit_depth_chroma_minus8;
+	uint16_t Reserved16Bits;
+	uint32_t StatusReportFeedbackNumber;
+	DXVA_PicEntry_H264 RefFrameList[16];
+	int32_t CurrFieldOrderCnt[2];
+	int32_t FieldOrderCntList[16][2];
+	int8_t pic_init_qs_minus26;
+	int8_t chroma_qp_index_offset;
+	int8_t second_chroma_qp_index_offset;
+	uint8_t ContinuationFlag;
+	int8_t pic_init_qp_minus26;
+	uint8_t num_ref_idx_l0_active_minus1;
+	uint8_t num_ref_idx_l1_active_minus1;
+	uint8_t Reserved8BitsA;
+	uint16_t FrameNumList[16];
+	uint32_t UsedForReferenceFlags;
+	uint16_t NonExistingFrameFlags;
+	uint16_t frame_num;
+	uint8_t log2_max_frame_num_minus4;
+	uint8_t pic_order_cnt_type;
+	uint8_t log2_max_pic_order_cnt_lsb_minus4;
+	uint8_t delta_pic_order_always_zero_flag;
+	uint8_t direct_8x8_inference_flag;
+	uint8_t entropy_coding_mode_flag;
+	uint8_t pic_order_present_flag;
+	uint8_t num_slice_groups_minus1;
+	uint8_t slice_group_map_type;
+	uint8_t deblocking_filter_control_present_flag;
+	uint8_t redundant_pic_cnt_present_flag;
+	uint8_t Reserved8BitsB;
+	uint16_t slice_group_change_rate_minus1;
+	uint8_t SliceGroupMap[810];
+};
+struct DXVA_Qmatrix_H264
+{
+	uint8_t bScalingLists4x4[6][16];
+	uint8_t bScalingLists8x8[2][64];
+};
+struct DXVA_Slice_H264_Short
+{
+	uint32_t BSNALunitDataLocation;
+	uint32_t SliceBytesInBuffer;
+	uint16_t wBadSliceChopping;
+};
+#pragma pack(pop)
+#endif // _WIN32
+
+struct DXVAPictureParametersH264
+{
+	// The frame invariant parameters of a PPS and its SPS:
+	struct Template
+	{
+		bool valid = false;
+		DXVA_PicParams_H264 pic_params = {};
+		DXVA_Qmatrix_H264 qmatrix = {};
+	};
+	std::vector<Template> templates; // per PPS id, they are filled when a frame first uses the PPS, because live streams receive their parameter sets during playback
+
+	DXVA_PicParams_H264 pic_params = {}; // the parameters of the last built frame
+	int current_pps = -1; // the PPS that pic_params was started from
+	uint32_t previous_reference_count = 0; // the reference list entries that are filled in pic_params
+
+	// Fills the frame invariant parts of the parameters of a PPS:
+	static void fill_template(const h264::SPS& sps, const h264::PPS& pps, Template& tmp)
+	{
+		DXVA_PicParams_H264& pic_params_h264 = tmp.pic_params;
+		DXVA_Qmatrix_H264& qmatrix_h264 = tmp.qmatrix;
+		pic_params_h264 = {};
+		qmatrix_h264 = {};
+
+		// DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010, Page 21
+		//	https://www.microsoft.com/en-us/download/details.aspx?id=11323
+		//	Also: https://gitlab.freedesktop.org/mesa/mesa/-/blob/main/src/gallium/drivers/d3d12/d3d12_video_dec_h264.cpp
+		//	Also: https://github.com/mofo7777/H264Dxva2Decoder
+		pic_params_h264.wFrameWidthInMbsMinus1 = sps.pic_width_in_mbs_minus1;
+		pic_params_h264.wFrameHeightInMbsMinus1 = sps.pic_height_in_map_units_minus1;
+		pic_params_h264.MbaffFrameFlag = 0 /*sps->mb_adaptive_frame_field_flag && !slice_header->field_pic_flag*/;
+		pic_params_h264.field_pic_flag = 0 /*slice_header->field_pic_flag*/; // 0 = full frame (top and bottom field), so CurrPic.AssociatedFlag (bottom field) is always 0
+		pic_params_h264.chroma_format_idc = 1; // sps->chroma_format_idc; // only 1 is supported (YUV420)
+		pic_params_h264.bit_depth_chroma_minus8 = sps.bit_depth_chroma_minus8;
+		assert(pic_params_h264.bit_depth_chroma_minus8 == 0);   // Only support for NV12 now
+		pic_params_h264.bit_depth_luma_minus8 = sps.bit_depth_luma_minus8;
+		assert(pic_params_h264.bit_depth_luma_minus8 == 0);   // Only support for NV12 now
+		pic_params_h264.residual_colour_transform_flag = sps.separate_colour_plane_flag; // https://gitlab.freedesktop.org/mesa/mesa/-/blob/main/src/gallium/drivers/d3d12/d3d12_video_dec_h264.cpp#L328
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			pic_params_h264.RefFrameList[i].bPicEntry = 0xFF;
+		}
+		pic_params_h264.weighted_pred_flag = pps.weighted_pred_flag;
+		pic_params_h264.weighted_bipred_idc = pps.weighted_bipred_idc;
+		pic_params_h264.sp_for_switch_flag = 0;
+
+		pic_params_h264.transform_8x8_mode_flag = pps.transform_8x8_mode_flag;
+		pic_params_h264.constrained_intra_pred_flag = pps.constrained_intra_pred_flag;
+		pic_params_h264.num_ref_frames = sps.num_ref_frames;
+		pic_params_h264.MbsConsecutiveFlag = 1; // The value shall be 1 unless the restricted-mode profile in use explicitly supports the value 0.
+		pic_params_h264.frame_mbs_only_flag = sps.frame_mbs_only_flag;
+		pic_params_h264.MinLumaBipredSize8x8Flag = sps.level_idc >= 31;
+		pic_params_h264.pic_init_qp_minus26 = pps.pic_init_qp_minus26;
+		pic_params_h264.pic_init_qs_minus26 = pps.pic_init_qs_minus26;
+		pic_params_h264.chroma_qp_index_offset = pps.chroma_qp_index_offset;
+		pic_params_h264.second_chroma_qp_index_offset = pps.second_chroma_qp_index_offset;
+		pic_params_h264.log2_max_frame_num_minus4 = sps.log2_max_frame_num_minus4;
+		pic_params_h264.pic_order_cnt_type = sps.pic_order_cnt_type;
+		pic_params_h264.log2_max_pic_order_cnt_lsb_minus4 = sps.log2_max_pic_order_cnt_lsb_minus4;
+		pic_params_h264.delta_pic_order_always_zero_flag = sps.delta_pic_order_always_zero_flag;
+		pic_params_h264.direct_8x8_inference_flag = sps.direct_8x8_inference_flag;
+		pic_params_h264.entropy_coding_mode_flag = pps.entropy_coding_mode_flag;
+		pic_params_h264.pic_order_present_flag = pps.pic_order_present_flag;
+		pic_params_h264.num_slice_groups_minus1 = pps.num_slice_groups_minus1;
+		assert(pic_params_h264.num_slice_groups_minus1 == 0);   // FMO Not supported by VA
+		pic_params_h264.slice_group_map_type = pps.slice_group_map_type;
+		pic_params_h264.deblocking_filter_control_present_flag = pps.deblocking_filter_control_present_flag;
+		pic_params_h264.redundant_pic_cnt_present_flag = pps.redundant_pic_cnt_present_flag;
+		pic_params_h264.slice_group_change_rate_minus1 = pps.slice_group_change_rate_minus1;
+		pic_params_h264.Reserved16Bits = 3; // DXVA spec
+		pic_params_h264.ContinuationFlag = 1;
+		pic_params_h264.num_ref_idx_l0_active_minus1 = pps.num_ref_idx_l0_active_minus1;
+		pic_params_h264.num_ref_idx_l1_active_minus1 = pps.num_ref_idx_l1_active_minus1;
+
+		// DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010, Page 29
+		//	Also: https://gitlab.freedesktop.org/mesa/mesa/-/blob/main/src/gallium/drivers/d3d12/d3d12_video_dec_h264.cpp#L548
+		if (sps.seq_scaling_matrix_present_flag)
+		{
+			static constexpr int vl_zscan_normal_16[] =
+			{
+				/* Zig-Zag scan pattern */
+				0, 1, 4, 8, 5, 2, 3, 6,
+				9, 12, 13, 10, 7, 11, 14, 15
+			};
+			static constexpr int vl_zscan_normal[] =
+			{
+				/* Zig-Zag scan pattern */
+				 0, 1, 8,16, 9, 2, 3,10,
+				17,24,32,25,18,11, 4, 5,
+				12,19,26,33,40,48,41,34,
+				27,20,13, 6, 7,14,21,28,
+				35,42,49,56,57,50,43,36,
+				29,22,15,23,30,37,44,51,
+				58,59,52,45,38,31,39,46,
+				53,60,61,54,47,55,62,63
+			};
+			for (int i = 0; i < 6; ++i)
+			{
+				for (int j = 0; j < 16; ++j)
+				{
+					qmatrix_h264.bScalingLists4x4[i][j] = pps.ScalingList4x4[i][vl_zscan_normal_16[j]];
+				}
+			}
+			for (int i = 0; i < 64; ++i)
+			{
+				qmatrix_h264.bScalingLists8x8[0][i] = pps.ScalingList8x8[0][vl_zscan_normal[i]];
+				qmatrix_h264.bScalingLists8x8[1][i] = pps.ScalingList8x8[1][vl_zscan_normal[i]];
+			}
+		}
+		else
+		{
+			// I don't know why it needs to be filled with 16, but otherwise it gets corrupted output
+			//	Source: https://github.com/mofo7777/H264Dxva2Decoder
+			std::memset(&qmatrix_h264, 16, sizeof(DXVA_Qmatrix_H264));
+		}
+	}
+
+	const Template& get_template(const Video& video, uint32_t pps_id)
+	{
+		if (pps_id >= templates.size())
+		{
+			templates.resize(pps_id + 1);
+		}
+		Template& tmp = templates[pps_id];
+		if (!tmp.valid)
+		{
+			const h264::PPS& pps = video.pps_array[pps_id];
+			fill_template(video.sps_array[pps.seq_parameter_set_id], pps, tmp);
+			tmp.valid = true;
+		}
+		return tmp;
+	}
+
+	// Returns the picture parameters of the decode command, the reference info of its slots comes from the DPB of the decoder core
+	const DXVA_PicParams_H264& build(const Video& video, const VideoDecoderCore::DecodeCommand& decode, const DecodedPictureBuffer& dpb)
+	{
+		const int pps_id = decode.slice_header.pic_parameter_set_id;
+		if (pps_id != current_pps)
+		{
+			std::memcpy(&pic_params, &get_template(video, (uint32_t)pps_id).pic_params, sizeof(pic_params));
+			current_pps = pps_id;
+			previous_reference_count = 0;
+		}
+
+		pic_params.IntraPicFlag = decode.frame_info.is_intra ? 1 : 0;
+		pic_params.RefPicFlag = decode.frame_info.reference_priority > 0 ? 1 : 0;
+		pic_params.CurrPic.Index7Bits = (uint8_t)decode.current_slot;
+		pic_params.CurrFieldOrderCnt[0] = decode.frame_info.poc;
+		pic_params.CurrFieldOrderCnt[1] = decode.frame_info.poc;
+		pic_params.frame_num = decode.slice_header.frame_num;
+		pic_params.StatusReportFeedbackNumber = (uint32_t)decode.frame_index + 1; // shall not be 0
+		assert(pic_params.StatusReportFeedbackNumber > 0);
+
+		// Only the used entries of the reference list are written, and the ones that the previous frame used but this one doesn't are cleared:
+		for (uint32_t i = 0; i < decode.reference_count; ++i)
+		{
+			const uint32_t ref_slot = decode.reference_slots[i];
+			pic_params.RefFrameList[i].AssociatedFlag = dpb.longterm_status[ref_slot] ? 1 : 0; // 0 = short term, 1 = long term reference
+			pic_params.RefFrameList[i].Index7Bits = (uint8_t)ref_slot;
+			pic_params.FieldOrderCntList[i][0] = dpb.poc_status[ref_slot];
+			pic_params.FieldOrderCntList[i][1] = dpb.poc_status[ref_slot];
+			pic_params.FrameNumList[i] = (uint16_t)dpb.framenum_status[ref_slot];
+		}
+		for (uint32_t i = decode.reference_count; i < previous_reference_count; ++i)
+		{
+			pic_params.RefFrameList[i].bPicEntry = 0xFF;
+			pic_params.FieldOrderCntList[i][0] = 0;
+			pic_params.FieldOrderCntList[i][1] = 0;
+			pic_params.FrameNumList[i] = 0;
+		}
+		previous_reference_count = decode.reference_count;
+		pic_params.UsedForReferenceFlags = uint32_t((1ull << (decode.reference_count * 2)) - 1); // top and bottom field of every reference
+		return pic_params;
+	}
+
+	// Returns the inverse quantization matrix of the decode command:
+	const DXVA_Qmatrix_H264& qmatrix(const Video& video, const VideoDecoderCore::DecodeCommand& decode)
+	{
+		return get_template(video, decode.slice_header.pic_parameter_set_id).qmatrix;
+	}
+
+	// Returns the slice control of the decode command, the whole frame is in the bitstream buffer:
+	static DXVA_Slice_H264_Short slice_control(const VideoDecoderCore::DecodeCommand& decode)
+	{
+		// DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010, Page 31
+		DXVA_Slice_H264_Short sliceinfo_h264 = {};
+		sliceinfo_h264.BSNALunitDataLocation = 0;
+		sliceinfo_h264.SliceBytesInBuffer = (uint32_t)decode.frame_info.size;
+		sliceinfo_h264.wBadSliceChopping = 0; // whole slice is in the buffer
+		return sliceinfo_h264;
+	}
+};
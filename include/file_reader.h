@@ -0,0 +1,475 @@
+// Minimal file reader utility for loading video files
+//
+// What this does:
+//	- synchronous reads through a small block cache (the mp4 box parser reads the file byte by byte)
+//	- batched reads that keep many requests in flight (for reading video samples)
+//		- Linux: io_uring is used if the kernel supports it, registered (fixed) buffers are used where possible
+//		- Linux without io_uring: pread fallback
+//		- other platforms: std::ifstream fallback
+//
+// How to use:
+//	FileReader reader;
+//	reader.open("video.mp4");
+//	reader.read(offset, dst, size); // synchronous
+//	FileReader::Request requests[] = { { offset0, size0, dst0 }, { offset1, size1, dst1 } };
+//	reader.read_batch(requests, arraysize(requests)); // asynchronous internally, returns when all requests completed
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define FILE_READER_IO_URING
+#endif // __has_include(<linux/io_uring.h>)
+#else
+#include <fstream>
+#endif // __linux__
+
+struct FileReader
+{
+	struct Request
+	{
+		uint64_t offset = 0; // file offset
+		uint64_t size = 0; // number of bytes to read
+		void* dst = nullptr; // destination memory
+	};
+
+	uint32_t queue_depth = 64; // maximum number of reads in flight with read_batch(), must be set before open()
+	bool allow_io_uring = true; // if false, the synchronous fallback is used even if io_uring is available, must be set before open()
+
+	FileReader() = default;
+	FileReader(const FileReader&) = delete;
+	FileReader& operator=(const FileReader&) = delete;
+	~FileReader() { close(); }
+
+	bool open(const char* filename)
+	{
+		close();
+#ifdef __linux__
+		fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		struct stat st = {};
+		if (fstat(fd, &st) != 0)
+		{
+			close();
+			return false;
+		}
+		file_size = (uint64_t)st.st_size;
+#ifdef FILE_READER_IO_URING
+		if (allow_io_uring)
+		{
+			ring.init(std::max(1u, queue_depth));
+		}
+#endif // FILE_READER_IO_URING
+#else
+		file.open(filename, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		file_size = (uint64_t)file.tellg();
+		file.seekg((std::streampos)0);
+#endif // __linux__
+		cache_offset = 0;
+		cache_size = 0;
+		return true;
+	}
+
+	void close()
+	{
+#ifdef __linux__
+#ifdef FILE_READER_IO_URING
+		ring.destroy();
+#endif // FILE_READER_IO_URING
+		if (fd >= 0)
+		{
+			::close(fd);
+			fd = -1;
+		}
+#else
+		if (file.is_open())
+		{
+			file.close();
+		}
+#endif // __linux__
+		file_size = 0;
+		cache_size = 0;
+	}
+
+	constexpr uint64_t size() const { return file_size; }
+
+	// Returns true if reads are served by io_uring, false if the synchronous fallback is used:
+	bool is_async() const
+	{
+#ifdef FILE_READER_IO_URING
+		return ring.fd >= 0;
+#else
+		return false;
+#endif // FILE_READER_IO_URING
+	}
+
+	// Synchronous read, small reads are served from a block cache:
+	bool read(uint64_t offset, void* dst, uint64_t size)
+	{
+		if (offset + size > file_size)
+			return false;
+		if (size > cache_block_size / 2)
+			return read_direct(offset, dst, size);
+		uint8_t* dst_bytes = (uint8_t*)dst;
+		while (size > 0)
+		{
+			if (offset < cache_offset || offset >= cache_offset + cache_size)
+			{
+				cache.resize(cache_block_size);
+				cache_offset = offset - offset % cache_block_size;
+				cache_size = std::min(cache_block_size, file_size - cache_offset);
+				if (!read_direct(cache_offset, cache.data(), cache_size))
+				{
+					cache_size = 0;
+					return false;
+				}
+			}
+			const uint64_t cache_pos = offset - cache_offset;
+			const uint64_t to_copy = std::min(size, cache_size - cache_pos);
+			std::memcpy(dst_bytes, cache.data() + cache_pos, to_copy);
+			dst_bytes += to_copy;
+			offset += to_copy;
+			size -= to_copy;
+		}
+		return true;
+	}
+
+	// Registers a memory region that will be used as destination for read_batch(), this lets io_uring skip mapping the pages for every read
+	//	This is only an optimization hint, it can fail (for example because of RLIMIT_MEMLOCK), then the reads will work without it
+	bool register_buffer(void* data, uint64_t size)
+	{
+#ifdef FILE_READER_IO_URING
+		return ring.register_buffer(data, size);
+#else
+		return false;
+#endif // FILE_READER_IO_URING
+	}
+
+	// Reads all requests, keeping up to queue_depth of them in flight, returns when all of them are completed
+	//	returns false if any of the requests failed
+	bool read_batch(const Request* requests, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (requests[i].offset + requests[i].size > file_size)
+				return false;
+		}
+#ifdef FILE_READER_IO_URING
+		if (ring.fd >= 0)
+			return ring.read_batch(fd, requests, count);
+#endif // FILE_READER_IO_URING
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!read_direct(requests[i].offset, requests[i].dst, requests[i].size))
+				return false;
+		}
+		return true;
+	}
+
+private:
+	static constexpr uint64_t cache_block_size = 64 * 1024;
+	uint64_t file_size = 0;
+	std::vector<uint8_t> cache;
+	uint64_t cache_offset = 0;
+	uint64_t cache_size = 0;
+
+#ifdef __linux__
+	int fd = -1;
+
+	bool read_direct(uint64_t offset, void* dst, uint64_t size)
+	{
+		uint8_t* dst_bytes = (uint8_t*)dst;
+		while (size > 0)
+		{
+			ssize_t result = pread(fd, dst_bytes, (size_t)std::min(size, uint64_t(1ull << 30)), (off_t)offset);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+				return false;
+			dst_bytes += result;
+			offset += (uint64_t)result;
+			size -= (uint64_t)result;
+		}
+		return true;
+	}
+
+#ifdef FILE_READER_IO_URING
+	// Minimal io_uring implementation with raw system calls, so there is no dependency on liburing:
+	struct Ring
+	{
+		int fd = -1;
+		void* sq_ptr = nullptr;
+		void* cq_ptr = nullptr;
+		size_t sq_ptr_size = 0;
+		size_t cq_ptr_size = 0;
+		io_uring_sqe* sqes = nullptr;
+		size_t sqes_size = 0;
+		unsigned* sq_head = nullptr;
+		unsigned* sq_tail = nullptr;
+		unsigned* sq_mask = nullptr;
+		unsigned* sq_array = nullptr;
+		unsigned* cq_head = nullptr;
+		unsigned* cq_tail = nullptr;
+		unsigned* cq_mask = nullptr;
+		io_uring_cqe* cqes = nullptr;
+		unsigned entries = 0;
+		const uint8_t* registered_data = nullptr;
+		uint64_t registered_size = 0;
+
+		bool init(unsigned queue_depth)
+		{
+			io_uring_params params = {};
+			fd = (int)syscall(__NR_io_uring_setup, queue_depth, &params);
+			if (fd < 0)
+				return false; // kernel without io_uring support (or it is disabled), pread fallback will be used
+			entries = params.sq_entries;
+			sq_ptr_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cq_ptr_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+			if (single_mmap)
+			{
+				sq_ptr_size = cq_ptr_size = std::max(sq_ptr_size, cq_ptr_size);
+			}
+			sq_ptr = mmap(nullptr, sq_ptr_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (sq_ptr == MAP_FAILED)
+			{
+				sq_ptr = nullptr;
+				destroy();
+				return false;
+			}
+			if (single_mmap)
+			{
+				cq_ptr = sq_ptr;
+			}
+			else
+			{
+				cq_ptr = mmap(nullptr, cq_ptr_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+				if (cq_ptr == MAP_FAILED)
+				{
+					cq_ptr = nullptr;
+					destroy();
+					return false;
+				}
+			}
+			sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+			if (sqes == MAP_FAILED)
+			{
+				sqes = nullptr;
+				destroy();
+				return false;
+			}
+			sq_head = (unsigned*)((uint8_t*)sq_ptr + params.sq_off.head);
+			sq_tail = (unsigned*)((uint8_t*)sq_ptr + params.sq_off.tail);
+			sq_mask = (unsigned*)((uint8_t*)sq_ptr + params.sq_off.ring_mask);
+			sq_array = (unsigned*)((uint8_t*)sq_ptr + params.sq_off.array);
+			cq_head = (unsigned*)((uint8_t*)cq_ptr + params.cq_off.head);
+			cq_tail = (unsigned*)((uint8_t*)cq_ptr + params.cq_off.tail);
+			cq_mask = (unsigned*)((uint8_t*)cq_ptr + params.cq_off.ring_mask);
+			cqes = (io_uring_cqe*)((uint8_t*)cq_ptr + params.cq_off.cqes);
+			return true;
+		}
+
+		void destroy()
+		{
+			if (sqes != nullptr)
+			{
+				munmap(sqes, sqes_size);
+				sqes = nullptr;
+			}
+			if (cq_ptr != nullptr && cq_ptr != sq_ptr)
+			{
+				munmap(cq_ptr, cq_ptr_size);
+			}
+			cq_ptr = nullptr;
+			if (sq_ptr != nullptr)
+			{
+				munmap(sq_ptr, sq_ptr_size);
+				sq_ptr = nullptr;
+			}
+			if (fd >= 0)
+			{
+				::close(fd);
+				fd = -1;
+			}
+			registered_data = nullptr;
+			registered_size = 0;
+		}
+
+		bool register_buffer(void* data, uint64_t size)
+		{
+			if (fd < 0)
+				return false;
+			if (registered_data != nullptr)
+			{
+				syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+				registered_data = nullptr;
+				registered_size = 0;
+			}
+			if (data == nullptr || size == 0 || size > (1ull << 30)) // the kernel limits a registered buffer to 1 GB
+				return false;
+			iovec iov = {};
+			iov.iov_base = data;
+			iov.iov_len = (size_t)size;
+			if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+				return false;
+			registered_data = (const uint8_t*)data;
+			registered_size = size;
+			return true;
+		}
+
+		bool read_batch(int file, const Request* requests, size_t count)
+		{
+			// Every request is tracked until fully read, because io_uring can complete reads partially:
+			struct Operation
+			{
+				uint64_t offset;
+				uint64_t remaining;
+				uint8_t* dst;
+			};
+			std::vector<Operation> operations(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				operations[i].offset = requests[i].offset;
+				operations[i].remaining = requests[i].size;
+				operations[i].dst = (uint8_t*)requests[i].dst;
+			}
+			std::vector<uint32_t> resubmit;
+			size_t next = 0;
+			unsigned inflight = 0; // consumed by the kernel, waiting for completion
+			unsigned queued = 0; // written to the submission queue, but not yet consumed by the kernel
+			bool success = true;
+			while (success && (next < count || !resubmit.empty() || inflight > 0 || queued > 0))
+			{
+				unsigned tail = *sq_tail;
+				while (inflight + queued < entries && (next < count || !resubmit.empty()))
+				{
+					uint32_t id = 0;
+					if (!resubmit.empty())
+					{
+						id = resubmit.back();
+						resubmit.pop_back();
+					}
+					else
+					{
+						id = (uint32_t)next++;
+					}
+					Operation& operation = operations[id];
+					if (operation.remaining == 0)
+						continue;
+					const unsigned index = tail & *sq_mask;
+					io_uring_sqe& sqe = sqes[index];
+					std::memset(&sqe, 0, sizeof(sqe));
+					const uint32_t len = (uint32_t)std::min(operation.remaining, uint64_t(64ull * 1024ull * 1024ull));
+					if (registered_data != nullptr && operation.dst >= registered_data && operation.dst + len <= registered_data + registered_size)
+					{
+						sqe.opcode = IORING_OP_READ_FIXED;
+						sqe.buf_index = 0;
+					}
+					else
+					{
+						sqe.opcode = IORING_OP_READ;
+					}
+					sqe.fd = file;
+					sqe.off = operation.offset;
+					sqe.addr = (uint64_t)operation.dst;
+					sqe.len = len;
+					sqe.user_data = id;
+					sq_array[index] = index;
+					tail++;
+					queued++;
+				}
+				__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+				if (queued == 0 && inflight == 0)
+					continue; // only zero sized requests were left, waiting for a completion would block forever
+
+				int result = (int)syscall(__NR_io_uring_enter, fd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (result < 0 && errno != EINTR)
+				{
+					success = false;
+					break;
+				}
+				if (result > 0)
+				{
+					inflight += (unsigned)result;
+					queued -= (unsigned)result;
+				}
+
+				unsigned head = *cq_head;
+				while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+				{
+					const io_uring_cqe& cqe = cqes[head & *cq_mask];
+					Operation& operation = operations[cqe.user_data];
+					if (cqe.res == -EAGAIN || cqe.res == -EINTR)
+					{
+						resubmit.push_back((uint32_t)cqe.user_data);
+					}
+					else if (cqe.res <= 0)
+					{
+						success = false; // read error or unexpected end of file
+					}
+					else
+					{
+						operation.offset += (uint64_t)cqe.res;
+						operation.dst += cqe.res;
+						operation.remaining -= (uint64_t)cqe.res;
+						if (operation.remaining > 0)
+						{
+							resubmit.push_back((uint32_t)cqe.user_data); // short read, continue with the remainder
+						}
+					}
+					inflight--;
+					head++;
+				}
+				__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+			}
+			// In case of failure, the entries that the kernel didn't consume are taken back, otherwise the next batch would submit them with the destinations of this one:
+			if (queued > 0)
+			{
+				__atomic_store_n(sq_tail, __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+				queued = 0;
+			}
+			// Drain the remaining completions in case of failure, so the destination memory is not written after returning:
+			while (inflight > 0)
+			{
+				if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+					break;
+				unsigned head = *cq_head;
+				while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+				{
+					inflight--;
+					head++;
+				}
+				__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+			}
+			return success;
+		}
+	} ring;
+#endif // FILE_READER_IO_URING
+
+#else
+	std::ifstream file;
+
+	bool read_direct(uint64_t offset, void* dst, uint64_t size)
+	{
+		file.clear();
+		file.seekg((std::streampos)offset);
+		file.read((char*)dst, (std::streamsize)size);
+		return file.good() || (uint64_t)file.gcount() == size;
+	}
+#endif // __linux__
+};
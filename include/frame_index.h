@@ -0,0 +1,410 @@
+// Compact index of video frames
+//
+// What this does:
+//	- the fields that are needed for every decoded frame (offset, size, display order) are stored in separate arrays (hot data), these can be modified directly
+//	- everything else (timestamps, picture order count, slice header fields, reference list sizes, reference picture marking) is delta encoded with variable length integers (cold data)
+//		- the cold data is split into blocks of frames, each block can be decoded on its own, so random access only decodes one block
+//		- a small block directory stores where each block begins, the last decoded block is cached
+//	- this costs around 16 bytes hot + 10 bytes cold per frame, instead of storing a FrameInfo and a whole h264::SliceHeader (more than 7 KB) for every frame
+//
+// How to use:
+//	FrameIndex index;
+//	index.push_back(frame_info, slice_header); // frames must be added in decode order
+//	FrameIndex::FrameInfo frame_info = index[i];
+//	h264::SliceHeader slice_header = index.slice_header(i);
+//	index.offsets[i] = new_offset;
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "h264.h"
+
+struct FrameIndex
+{
+	struct FrameInfo
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint64_t timestamp = 0; // in timescale ticks
+		uint64_t duration = 0; // in timescale ticks
+		uint32_t reference_priority = 0;
+		int poc = 0;
+		int gop = 0;
+		int display_order = 0;
+		bool is_intra = false;
+	};
+
+	// Hot data, indexed by frame:
+	std::vector<uint64_t> offsets;
+	std::vector<uint32_t> sizes;
+	std::vector<int> display_orders;
+
+	static constexpr uint32_t block_size = 64; // number of frames in one block of cold data
+
+	inline size_t size() const { return offsets.size(); }
+	inline bool empty() const { return offsets.empty(); }
+
+	void clear()
+	{
+		offsets.clear();
+		sizes.clear();
+		display_orders.clear();
+		directory.clear();
+		data.clear();
+		released = 0;
+		first_block = 0;
+		cache_block = ~0ull;
+	}
+
+	// Appends a frame, only the slice header fields that are used for decoding and reference picture management are stored
+	void push_back(const FrameInfo& frame_info, const h264::SliceHeader& slice_header)
+	{
+		assert(frame_info.size <= UINT32_MAX);
+		const uint64_t absolute = released + offsets.size();
+		if (absolute % block_size == 0)
+		{
+			// New block, the delta encoding restarts from zero, so the block can be decoded on its own:
+			directory.push_back(data.size());
+			encoder = {};
+		}
+		offsets.push_back(frame_info.offset);
+		sizes.push_back((uint32_t)frame_info.size);
+		display_orders.push_back(frame_info.display_order);
+
+		const bool has_marking = slice_header.drpm.no_output_of_prior_pics_flag || slice_header.drpm.long_term_reference_flag || slice_header.drpm.adaptive_ref_pic_marking_mode_flag;
+		uint8_t flags = 0;
+		flags |= frame_info.is_intra ? flag_intra : 0;
+		flags |= uint8_t(std::min(frame_info.reference_priority, 3u)) << flag_reference_priority_shift;
+		flags |= slice_header.field_pic_flag ? flag_field_pic : 0;
+		flags |= slice_header.bottom_field_flag ? flag_bottom_field : 0;
+		flags |= frame_info.gop == encoder.gop + 1 ? flag_next_gop : (frame_info.gop != encoder.gop ? flag_gop : 0);
+		flags |= has_marking ? flag_marking : 0;
+		data.push_back(flags);
+
+		write_signed(int64_t(frame_info.timestamp - (encoder.timestamp + encoder.duration)));
+		write_signed(int64_t(frame_info.duration - encoder.duration));
+		write_signed(int64_t(frame_info.poc) - int64_t(encoder.poc));
+		if (flags & flag_gop)
+		{
+			write_signed(int64_t(frame_info.gop) - int64_t(encoder.gop));
+		}
+		// The override and reordering flags share the byte of slice_type, the reordering commands are not stored, the reference list sizes are stored as the slice header has them (the PPS defaults when not overridden):
+		const uint32_t ref_list_flags = (slice_header.num_ref_idx_active_override_flag ? 1 : 0) | (slice_header.rplr.ref_pic_list_reordering_flag_l0 ? 2 : 0) | (slice_header.rplr.ref_pic_list_reordering_flag_l1 ? 4 : 0);
+		write_unsigned(((uint32_t)slice_header.slice_type << 3) | ref_list_flags);
+		write_unsigned((uint32_t)slice_header.num_ref_idx_l0_active_minus1);
+		write_unsigned((uint32_t)slice_header.num_ref_idx_l1_active_minus1);
+		write_unsigned((uint32_t)slice_header.pic_parameter_set_id);
+		write_unsigned((uint32_t)slice_header.frame_num);
+		write_unsigned((uint32_t)slice_header.idr_pic_id);
+		write_unsigned((uint32_t)slice_header.pic_order_cnt_lsb);
+		write_signed(slice_header.delta_pic_order_cnt_bottom);
+		write_signed(slice_header.delta_pic_order_cnt[0]);
+		write_signed(slice_header.delta_pic_order_cnt[1]);
+		if (has_marking)
+		{
+			write_unsigned((slice_header.drpm.no_output_of_prior_pics_flag ? 1 : 0) | (slice_header.drpm.long_term_reference_flag ? 2 : 0) | (slice_header.drpm.adaptive_ref_pic_marking_mode_flag ? 4 : 0));
+			uint32_t count = 0;
+			if (slice_header.drpm.adaptive_ref_pic_marking_mode_flag)
+			{
+				while (count < arraysize_of(slice_header.drpm.memory_management_control_operation) && slice_header.drpm.memory_management_control_operation[count] != 0)
+				{
+					count++;
+				}
+			}
+			write_unsigned(count);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				write_unsigned((uint32_t)slice_header.drpm.memory_management_control_operation[i]);
+				write_unsigned((uint32_t)slice_header.drpm.difference_of_pic_nums_minus1[i]);
+				write_unsigned((uint32_t)slice_header.drpm.long_term_pic_num[i]);
+				write_unsigned((uint32_t)slice_header.drpm.long_term_frame_idx[i]);
+				write_unsigned((uint32_t)slice_header.drpm.max_long_term_frame_idx_plus1[i]);
+			}
+		}
+
+		encoder.timestamp = frame_info.timestamp;
+		encoder.duration = frame_info.duration;
+		encoder.poc = frame_info.poc;
+		encoder.gop = frame_info.gop;
+		if (cache_block == directory.size() - 1 + first_block)
+		{
+			cache_block = ~0ull; // the cached block was extended
+		}
+	}
+
+	// Returns all the information about a frame:
+	FrameInfo operator[](size_t index) const
+	{
+		const Cold& cold = get_cold(index);
+		FrameInfo frame_info;
+		frame_info.offset = offsets[index];
+		frame_info.size = sizes[index];
+		frame_info.display_order = display_orders[index];
+		frame_info.timestamp = cold.timestamp;
+		frame_info.duration = cold.duration;
+		frame_info.reference_priority = cold.reference_priority;
+		frame_info.poc = cold.poc;
+		frame_info.gop = cold.gop;
+		frame_info.is_intra = cold.is_intra;
+		return frame_info;
+	}
+
+	// Returns the slice header of a frame, only the stored fields are filled, the others are zero:
+	h264::SliceHeader slice_header(size_t index) const
+	{
+		const Cold& cold = get_cold(index);
+		h264::SliceHeader slice_header = {};
+		slice_header.slice_type = cold.slice_type;
+		slice_header.num_ref_idx_active_override_flag = (cold.ref_list_flags & 1) ? 1 : 0;
+		slice_header.num_ref_idx_l0_active_minus1 = cold.num_ref_idx_l0_active_minus1;
+		slice_header.num_ref_idx_l1_active_minus1 = cold.num_ref_idx_l1_active_minus1;
+		slice_header.rplr.ref_pic_list_reordering_flag_l0 = (cold.ref_list_flags & 2) ? 1 : 0;
+		slice_header.rplr.ref_pic_list_reordering_flag_l1 = (cold.ref_list_flags & 4) ? 1 : 0;
+		slice_header.pic_parameter_set_id = cold.pic_parameter_set_id;
+		slice_header.frame_num = cold.frame_num;
+		slice_header.field_pic_flag = cold.field_pic_flag ? 1 : 0;
+		slice_header.bottom_field_flag = cold.bottom_field_flag ? 1 : 0;
+		slice_header.idr_pic_id = cold.idr_pic_id;
+		slice_header.pic_order_cnt_lsb = cold.pic_order_cnt_lsb;
+		slice_header.delta_pic_order_cnt_bottom = cold.delta_pic_order_cnt_bottom;
+		slice_header.delta_pic_order_cnt[0] = cold.delta_pic_order_cnt[0];
+		slice_header.delta_pic_order_cnt[1] = cold.delta_pic_order_cnt[1];
+		slice_header.drpm.no_output_of_prior_pics_flag = (cold.marking_flags & 1) ? 1 : 0;
+		slice_header.drpm.long_term_reference_flag = (cold.marking_flags & 2) ? 1 : 0;
+		slice_header.drpm.adaptive_ref_pic_marking_mode_flag = (cold.marking_flags & 4) ? 1 : 0;
+		for (uint32_t i = 0; i < cold.marking_count; ++i)
+		{
+			const MarkingOperation& operation = cache_marking[cold.marking_begin + i];
+			slice_header.drpm.memory_management_control_operation[i] = (int)operation.memory_management_control_operation;
+			slice_header.drpm.difference_of_pic_nums_minus1[i] = (int)operation.difference_of_pic_nums_minus1;
+			slice_header.drpm.long_term_pic_num[i] = (int)operation.long_term_pic_num;
+			slice_header.drpm.long_term_frame_idx[i] = (int)operation.long_term_frame_idx;
+			slice_header.drpm.max_long_term_frame_idx_plus1[i] = (int)operation.max_long_term_frame_idx_plus1;
+		}
+		return slice_header;
+	}
+
+	// Removes frames from the beginning, the remaining frames will be indexed from zero
+	//	The cold data is only freed in whole blocks
+	void release_front(size_t count)
+	{
+		count = std::min(count, offsets.size());
+		offsets.erase(offsets.begin(), offsets.begin() + count);
+		sizes.erase(sizes.begin(), sizes.begin() + count);
+		display_orders.erase(display_orders.begin(), display_orders.begin() + count);
+		released += count;
+		size_t dropped_blocks = 0;
+		while (dropped_blocks + 1 < directory.size() && (first_block + dropped_blocks + 1) * block_size <= released)
+		{
+			dropped_blocks++;
+		}
+		if (dropped_blocks > 0)
+		{
+			const uint64_t data_offset = directory[dropped_blocks];
+			data.erase(data.begin(), data.begin() + data_offset);
+			directory.erase(directory.begin(), directory.begin() + dropped_blocks);
+			for (uint64_t& block_offset : directory)
+			{
+				block_offset -= data_offset;
+			}
+			first_block += dropped_blocks;
+			cache_block = ~0ull;
+		}
+	}
+
+	// Frees the unused capacity after all frames were added
+	void shrink_to_fit()
+	{
+		offsets.shrink_to_fit();
+		sizes.shrink_to_fit();
+		display_orders.shrink_to_fit();
+		directory.shrink_to_fit();
+		data.shrink_to_fit();
+	}
+
+	// Returns the number of bytes allocated by the index
+	size_t memory_usage() const
+	{
+		return
+			offsets.capacity() * sizeof(uint64_t) +
+			sizes.capacity() * sizeof(uint32_t) +
+			display_orders.capacity() * sizeof(int) +
+			directory.capacity() * sizeof(uint64_t) +
+			data.capacity() +
+			cache.capacity() * sizeof(Cold) +
+			cache_marking.capacity() * sizeof(MarkingOperation)
+			;
+	}
+
+private:
+	static constexpr uint8_t flag_intra = 1 << 0;
+	static constexpr uint8_t flag_reference_priority_shift = 1; // 2 bits
+	static constexpr uint8_t flag_field_pic = 1 << 3;
+	static constexpr uint8_t flag_bottom_field = 1 << 4;
+	static constexpr uint8_t flag_next_gop = 1 << 5; // gop is incremented by one
+	static constexpr uint8_t flag_gop = 1 << 6; // gop delta is stored
+	static constexpr uint8_t flag_marking = 1 << 7; // reference picture marking is stored
+
+	template<typename T, size_t N>
+	static constexpr size_t arraysize_of(const T(&)[N]) { return N; }
+
+	struct Cold
+	{
+		uint64_t timestamp = 0;
+		uint64_t duration = 0;
+		int poc = 0;
+		int gop = 0;
+		uint32_t reference_priority = 0;
+		bool is_intra = false;
+		bool field_pic_flag = false;
+		bool bottom_field_flag = false;
+		int slice_type = 0;
+		uint32_t ref_list_flags = 0; // 1: num_ref_idx_active_override_flag, 2: ref_pic_list_reordering_flag_l0, 4: ref_pic_list_reordering_flag_l1
+		int num_ref_idx_l0_active_minus1 = 0;
+		int num_ref_idx_l1_active_minus1 = 0;
+		int pic_parameter_set_id = 0;
+		int frame_num = 0;
+		int idr_pic_id = 0;
+		int pic_order_cnt_lsb = 0;
+		int delta_pic_order_cnt_bottom = 0;
+		int delta_pic_order_cnt[2] = {};
+		uint32_t marking_flags = 0;
+		uint32_t marking_begin = 0; // index into cache_marking
+		uint32_t marking_count = 0;
+	};
+	struct MarkingOperation
+	{
+		uint32_t memory_management_control_operation;
+		uint32_t difference_of_pic_nums_minus1;
+		uint32_t long_term_pic_num;
+		uint32_t long_term_frame_idx;
+		uint32_t max_long_term_frame_idx_plus1;
+	};
+	struct EncoderState
+	{
+		uint64_t timestamp = 0;
+		uint64_t duration = 0;
+		int poc = 0;
+		int gop = 0;
+	} encoder;
+
+	std::vector<uint64_t> directory; // byte offset of every block in the data
+	std::vector<uint8_t> data; // cold data of all blocks
+	uint64_t released = 0; // number of frames that were removed from the beginning
+	uint64_t first_block = 0; // number of blocks that were removed from the beginning
+
+	// The last decoded block is cached:
+	mutable uint64_t cache_block = ~0ull;
+	mutable std::vector<Cold> cache;
+	mutable std::vector<MarkingOperation> cache_marking;
+
+	void write_unsigned(uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			data.push_back(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		data.push_back(uint8_t(value));
+	}
+	void write_signed(int64_t value)
+	{
+		write_unsigned((uint64_t(value) << 1) ^ uint64_t(value >> 63)); // zigzag encoding, so small negative values are also short
+	}
+	static uint64_t read_unsigned(const uint8_t*& p)
+	{
+		uint64_t value = 0;
+		int shift = 0;
+		while (*p & 0x80)
+		{
+			value |= uint64_t(*p++ & 0x7F) << shift;
+			shift += 7;
+		}
+		value |= uint64_t(*p++) << shift;
+		return value;
+	}
+	static int64_t read_signed(const uint8_t*& p)
+	{
+		const uint64_t value = read_unsigned(p);
+		return int64_t(value >> 1) ^ -int64_t(value & 1);
+	}
+
+	const Cold& get_cold(size_t index) const
+	{
+		assert(index < offsets.size());
+		const uint64_t absolute = released + index;
+		const uint64_t block = absolute / block_size;
+		if (block != cache_block)
+		{
+			decode_block(block);
+		}
+		return cache[absolute % block_size];
+	}
+
+	void decode_block(uint64_t block) const
+	{
+		const size_t local_block = size_t(block - first_block);
+		assert(local_block < directory.size());
+		const uint8_t* p = data.data() + directory[local_block];
+		const uint8_t* end = local_block + 1 < directory.size() ? data.data() + directory[local_block + 1] : data.data() + data.size();
+		cache.clear();
+		cache_marking.clear();
+		EncoderState state;
+		while (p < end)
+		{
+			Cold& cold = cache.emplace_back();
+			const uint8_t flags = *p++;
+			cold.is_intra = flags & flag_intra;
+			cold.reference_priority = (flags >> flag_reference_priority_shift) & 3;
+			cold.field_pic_flag = flags & flag_field_pic;
+			cold.bottom_field_flag = flags & flag_bottom_field;
+			cold.timestamp = state.timestamp + state.duration + uint64_t(read_signed(p));
+			cold.duration = state.duration + uint64_t(read_signed(p));
+			cold.poc = int(state.poc + read_signed(p));
+			cold.gop = state.gop;
+			if (flags & flag_next_gop)
+			{
+				cold.gop++;
+			}
+			if (flags & flag_gop)
+			{
+				cold.gop = int(state.gop + read_signed(p));
+			}
+			const uint32_t slice_type = (uint32_t)read_unsigned(p);
+			cold.slice_type = int(slice_type >> 3);
+			cold.ref_list_flags = slice_type & 7;
+			cold.num_ref_idx_l0_active_minus1 = (int)read_unsigned(p);
+			cold.num_ref_idx_l1_active_minus1 = (int)read_unsigned(p);
+			cold.pic_parameter_set_id = (int)read_unsigned(p);
+			cold.frame_num = (int)read_unsigned(p);
+			cold.idr_pic_id = (int)read_unsigned(p);
+			cold.pic_order_cnt_lsb = (int)read_unsigned(p);
+			cold.delta_pic_order_cnt_bottom = (int)read_signed(p);
+			cold.delta_pic_order_cnt[0] = (int)read_signed(p);
+			cold.delta_pic_order_cnt[1] = (int)read_signed(p);
+			if (flags & flag_marking)
+			{
+				cold.marking_flags = (uint32_t)read_unsigned(p);
+				cold.marking_count = (uint32_t)read_unsigned(p);
+				cold.marking_begin = (uint32_t)cache_marking.size();
+				for (uint32_t i = 0; i < cold.marking_count; ++i)
+				{
+					MarkingOperation& operation = cache_marking.emplace_back();
+					operation.memory_management_control_operation = (uint32_t)read_unsigned(p);
+					operation.difference_of_pic_nums_minus1 = (uint32_t)read_unsigned(p);
+					operation.long_term_pic_num = (uint32_t)read_unsigned(p);
+					operation.long_term_frame_idx = (uint32_t)read_unsigned(p);
+					operation.max_long_term_frame_idx_plus1 = (uint32_t)read_unsigned(p);
+				}
+			}
+			state.timestamp = cold.timestamp;
+			state.duration = cold.duration;
+			state.poc = cold.poc;
+			state.gop = cold.gop;
+		}
+		cache_block = block;
+	}
+};
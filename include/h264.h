@@ -404,6 +404,28 @@ namespace h264 {
 		}
 		return false;
 	}
+	// Removes the emulation prevention bytes (0x000003 becomes 0x0000) from a NAL unit, the parameter sets must be parsed from this RBSP, because their VUI values frequently contain such bytes
+	//	the NAL unit ends at size, or at the next start code (0x000001, or trailing zero bytes), dst can be the same as src
+	//	returns the number of RBSP bytes written to dst
+	constexpr unsigned long long nal_to_rbsp(const unsigned char* src, unsigned long long size, unsigned char* dst)
+	{
+		unsigned long long rbsp_size = 0;
+		int zero_count = 0;
+		for (unsigned long long i = 0; i < size; ++i)
+		{
+			const unsigned char value = src[i];
+			if (zero_count >= 2 && value <= 1)
+				return rbsp_size - 2; // the next start code
+			if (zero_count >= 2 && value == 3)
+			{
+				zero_count = 0;
+				continue;
+			}
+			zero_count = value == 0 ? zero_count + 1 : 0;
+			dst[rbsp_size++] = value;
+		}
+		return rbsp_size;
+	}
 	// returns true if a valid nal header was read, false otherwise
 	constexpr bool read_nal_header(NALHeader* nal, Bitstream* b)
 	{
@@ -583,6 +605,7 @@ namespace h264 {
 		sps->level_idc = b->u(8);
 		sps->seq_parameter_set_id = b->ue();
 
+		sps->chroma_format_idc = 1; // when not present, it is inferred to be 4:2:0
 		if (sps->profile_idc == 100 || sps->profile_idc == 110 ||
 			sps->profile_idc == 122 || sps->profile_idc == 144)
 		{
@@ -808,7 +831,7 @@ namespace h264 {
 		{
 			sh->pwt.chroma_log2_weight_denom = b->ue();
 		}
-		for (int i = 0; i <= pps->num_ref_idx_l0_active_minus1; i++)
+		for (int i = 0; i <= sh->num_ref_idx_l0_active_minus1; i++)
 		{
 			sh->pwt.luma_weight_l0_flag[i] = b->u1();
 			if (sh->pwt.luma_weight_l0_flag[i])
@@ -831,7 +854,7 @@ namespace h264 {
 		}
 		if (is_slice_type(sh->slice_type, SH_SLICE_TYPE_B))
 		{
-			for (int i = 0; i <= pps->num_ref_idx_l1_active_minus1; i++)
+			for (int i = 0; i <= sh->num_ref_idx_l1_active_minus1; i++)
 			{
 				sh->pwt.luma_weight_l1_flag[i] = b->u1();
 				if (sh->pwt.luma_weight_l1_flag[i])
@@ -939,6 +962,8 @@ namespace h264 {
 		{
 			sh->direct_spatial_mv_pred_flag = b->u1();
 		}
+		sh->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_active_minus1; // the defaults, unless they are overridden by the slice
+		sh->num_ref_idx_l1_active_minus1 = pps->num_ref_idx_l1_active_minus1;
 		if (is_slice_type(sh->slice_type, SH_SLICE_TYPE_P) || is_slice_type(sh->slice_type, SH_SLICE_TYPE_SP) || is_slice_type(sh->slice_type, SH_SLICE_TYPE_B))
 		{
 			sh->num_ref_idx_active_override_flag = b->u1();
@@ -991,6 +1016,69 @@ namespace h264 {
 		}
 	}
 
+	// Limits of a level (Table A-1):
+	struct Level
+	{
+		int level_idc; // 9 is level 1b
+		int max_mbps; // MaxMBPS: macroblocks per second
+		int max_fs; // MaxFS: frame size in macroblocks
+		int max_dpb_mbs; // MaxDpbMbs: decoded picture buffer size in macroblocks
+		int max_br; // MaxBR: in 1000 bits/s for the Baseline, Main and Extended profiles, cpbBrVclFactor bits/s for the others (Table A-2)
+	};
+	static constexpr Level levels[] = {
+		{ 9, 1485, 99, 396, 128 },
+		{ 10, 1485, 99, 396, 64 },
+		{ 11, 3000, 396, 900, 192 },
+		{ 12, 6000, 396, 2376, 384 },
+		{ 13, 11880, 396, 2376, 768 },
+		{ 20, 11880, 396, 2376, 2000 },
+		{ 21, 19800, 792, 4752, 4000 },
+		{ 22, 20250, 1620, 8100, 4000 },
+		{ 30, 40500, 1620, 8100, 10000 },
+		{ 31, 108000, 3600, 18000, 14000 },
+		{ 32, 216000, 5120, 20480, 20000 },
+		{ 40, 245760, 8192, 32768, 20000 },
+		{ 41, 245760, 8192, 32768, 50000 },
+		{ 42, 522240, 8704, 34816, 50000 },
+		{ 50, 589824, 22080, 110400, 135000 },
+		{ 51, 983040, 36864, 184320, 240000 },
+		{ 52, 2073600, 36864, 184320, 240000 },
+		{ 60, 4177920, 139264, 696320, 240000 },
+		{ 61, 8355840, 139264, 696320, 480000 },
+		{ 62, 16711680, 139264, 696320, 800000 },
+	};
+
+	// Returns the limits of the level_idc, or nullptr if it's unknown:
+	constexpr const Level* get_level(int level_idc)
+	{
+		for (const Level& level : levels)
+		{
+			if (level.level_idc == level_idc)
+				return &level;
+		}
+		return nullptr;
+	}
+
+	// Returns the limits of the level of the SPS, or nullptr if it's unknown
+	//	level 1b is level_idc 9, or level_idc 11 with constraint_set3_flag in the Baseline, Main and Extended profiles
+	constexpr const Level* get_level(const SPS* sps)
+	{
+		if (sps->level_idc == 11 && sps->constraint_set3_flag && (sps->profile_idc == 66 || sps->profile_idc == 77 || sps->profile_idc == 88))
+			return get_level(9);
+		return get_level(sps->level_idc);
+	}
+
+	// Returns MaxDpbFrames, the number of frames that the decoded picture buffer of the level can hold at the frame size of the SPS (A.3.1), 16 if the level is unknown
+	constexpr int get_max_dpb_frames(const SPS* sps)
+	{
+		const Level* level = get_level(sps);
+		if (level == nullptr)
+			return 16;
+		const int frame_mbs = (sps->pic_width_in_mbs_minus1 + 1) * (2 - sps->frame_mbs_only_flag) * (sps->pic_height_in_map_units_minus1 + 1);
+		const int frames = level->max_dpb_mbs / (frame_mbs > 0 ? frame_mbs : 1);
+		return frames < 16 ? frames : 16;
+	}
+
 }
 
 #endif // H264_H
@@ -0,0 +1,320 @@
+// Gapless playlist that loads the next video in the background
+//
+// What this does:
+//	- plays the videos one after the other on one timeline: the next item starts exactly at the end time of the current item (when its last picture was displayed for its duration), so there is no gap and no repeated picture between the items
+//	- the next item is loaded and indexed on a background thread while the current item plays, and the backend can prepare it there too (for example copy its bitstream into an upload buffer)
+//	- the next item starts decoding as soon as the decodes of the current item completed, while the end of the current item is still displayed, so its first pictures are ready at the switch. The decoder session of the current item is free by then, so the next item can reuse it if it's compatible (see SessionPool)
+//	- the memory of a finished item is released in steps: its bitstream when its decoding finished, its reordering pictures when its last picture was displayed, and the rest on the background thread before the item after the next one is loaded, so at most about two items are in memory
+//
+// How to use:
+//	Playlist playlist;
+//	playlist.items = { "a.mp4", "b.mp4", "c.h264" }; // MP4 files, and raw H264 files that are played with playlist.raw_framerate
+//	playlist.decode_ahead = 4; // optional, VideoDecoderCore::enable_decode_ahead() of the items
+//	while (playlist.update(backend, now_nanoseconds)) // backend implements Playlist::Backend, returns false when the last item finished
+//	{
+//		present();
+//	}
+//	playlist.print_statistics();
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include "common.h"
+#include "decoder_core.h"
+
+struct Playlist
+{
+	struct Item
+	{
+		uint32_t id = 0; // increases with every loaded item, at most two items are used at the same time (also in prepare_item()), so id % 2 can select the resources of the backend
+		uint32_t index = 0; // index in items
+		std::string filename;
+		Video video;
+		VideoDecoderCore core;
+		uint64_t start_nanoseconds = 0; // playlist time when the first picture is displayed
+		uint64_t memory = 0; // bytes of the bitstream and the frame index that are loaded
+		bool failed = false; // the video couldn't be loaded, it's skipped
+		bool decoding = false; // Backend::begin_item() was called
+		bool decoded = false; // Backend::end_decoding() was called
+	};
+
+	// Graphics API interface for update(), the commands of each item must be executed in the order they are given:
+	struct Backend
+	{
+		virtual ~Backend() = default;
+		// Called on the background thread when the item was loaded, the backend can prepare the resources that don't need the display thread:
+		virtual void prepare_item(Item& /*item*/) {}
+		// Called when the item starts decoding, the decodes of the previous item completed, and its decoder session was released with end_decoding(). The backend creates the item.core.pictures.size() reordering pictures of the item:
+		virtual void begin_item(Item& item) = 0;
+		// Called when every frame of the item was decoded and completed, its decoder session can be reused by the next item, but its pictures are still displayed:
+		virtual void end_decoding(Item& /*item*/) {}
+		// Called when the last picture of the item is not displayed anymore, its reordering pictures can be released:
+		virtual void end_item(Item& /*item*/) {}
+		virtual void decode(Item& item, const VideoDecoderCore::DecodeCommand& command) = 0;
+		virtual void display(Item& item, const VideoDecoderCore::DisplayCommand& command) = 0;
+		// Returns true if the decode of the picture completed, only called for the oldest decode in flight of the item:
+		virtual bool is_decode_completed(Item& /*item*/, int /*picture*/) { return true; }
+	};
+
+	// Settings:
+	std::vector<std::string> items; // video file names
+	uint32_t decode_ahead = 2; // VideoDecoderCore::enable_decode_ahead() of every item
+	float raw_framerate = 60.0f; // the raw H264 items (see Video::Is_h264_raw()) have no timestamps, they are played with this framerate
+	bool repeat = false; // the playlist starts again after the last item
+
+	// State:
+	std::unique_ptr<Item> current; // the displayed item
+	std::unique_ptr<Item> next; // the item that is loading, loaded or decoding ahead
+	std::unique_ptr<Item> finished; // the item that is released on the background thread before the next load
+	std::thread loader;
+	std::atomic<bool> loading{ false }; // the loader thread is running, it must be joined before next is used
+	uint32_t next_index = 0; // index in items that is loaded next
+	uint32_t next_id = 0;
+	bool waiting = false; // the current item ended, but the next one was not ready, so the last picture stays on display
+
+	// Statistics:
+	uint32_t played_count = 0;
+	uint32_t failed_count = 0;
+	uint32_t gap_count = 0; // switches where the first picture of the next item was not displayed at the end time of the previous item
+	uint64_t load_wait_count = 0; // updates where the decoding waited for the next item to be loaded
+	std::mutex memory_lock; // the loader thread also updates the memory statistics
+	uint64_t memory = 0; // bytes of the loaded items
+	uint64_t peak_memory = 0;
+	uint32_t loaded_count = 0; // items that are loaded and not released
+	uint32_t peak_loaded_count = 0;
+
+	~Playlist()
+	{
+		if (loader.joinable())
+		{
+			loader.join();
+		}
+	}
+
+	// One iteration of the display loop, decodes and displays the items, returns false when the last item finished
+	bool update(Backend& backend, uint64_t now_nanoseconds)
+	{
+		if (loader.joinable() && !loading)
+		{
+			loader.join();
+		}
+		if (current == nullptr && next == nullptr && !loader.joinable())
+		{
+			if (played_count + failed_count > 0)
+				return false; // every item was played
+			start_load(backend);
+			if (next == nullptr)
+				return false; // the playlist is empty
+		}
+		if (next != nullptr && next->failed && !loader.joinable())
+		{
+			printf("Playlist item load failure: %s, skipped.\n", next->filename.c_str());
+			failed_count++;
+			next_id--; // the id is given to the next loaded item, so the ids of the used items stay consecutive
+			finished = std::move(next);
+			start_load(backend);
+			return true;
+		}
+		const bool next_loaded = next != nullptr && !loader.joinable();
+		if (current == nullptr)
+		{
+			// The first item starts when it's loaded:
+			if (!next_loaded)
+				return true;
+			current = std::move(next);
+			begin_item(backend, *current);
+			current->start_nanoseconds = now_nanoseconds;
+			start_load(backend);
+		}
+
+		// The next item starts decoding when the decodes of the current item completed, so it can take over its decoder session:
+		decode(backend, *current);
+		if (current->decoded && next != nullptr)
+		{
+			if (!next_loaded)
+			{
+				load_wait_count++;
+			}
+			else
+			{
+				if (!next->decoding)
+				{
+					begin_item(backend, *next);
+				}
+				decode(backend, *next);
+			}
+		}
+
+		// The current item ends when its last picture was displayed for its duration, then the next item continues the timeline:
+		VideoDecoderCore& core = current->core;
+		if (core.is_display_finished() && now_nanoseconds >= end_nanoseconds(*current))
+		{
+			if (next == nullptr && !loader.joinable())
+			{
+				backend.end_item(*current);
+				played_count++;
+				release(std::move(current));
+				return false;
+			}
+			if (next == nullptr || !next->decoding)
+			{
+				waiting = true; // the last picture stays on display until the next item is ready
+			}
+			else
+			{
+				const bool late = waiting;
+				next->start_nanoseconds = late ? now_nanoseconds : end_nanoseconds(*current);
+				waiting = false;
+				backend.end_item(*current);
+				played_count++;
+				finished = std::move(current);
+				current = std::move(next);
+				start_load(backend);
+				const bool displayed = display(backend, *current, now_nanoseconds);
+				gap_count += late || !displayed ? 1 : 0; // the next item was not loaded, or its first picture was not decoded yet
+				return true;
+			}
+		}
+		display(backend, *current, now_nanoseconds);
+		return true;
+	}
+
+	// Blocks until the loading of the next item finished, for example for simulations where the playlist time doesn't follow the real time
+	void wait_for_load()
+	{
+		if (loader.joinable())
+		{
+			loader.join();
+		}
+	}
+
+	// Returns the playlist time when the last picture of the item stops being displayed
+	uint64_t end_nanoseconds(const Item& item) const
+	{
+		return item.start_nanoseconds + Video::Timer::ticks_to_nanoseconds(item.core.next_frame_time, item.video.timescale);
+	}
+
+	// Starts loading the next item on the background thread, the finished item is released there first
+	void start_load(Backend& backend)
+	{
+		assert(!loader.joinable() && next == nullptr);
+		if (next_index >= items.size())
+		{
+			if (!repeat || items.empty())
+			{
+				release(std::move(finished));
+				return;
+			}
+			next_index = 0;
+		}
+		next = std::make_unique<Item>();
+		next->id = next_id++;
+		next->index = next_index++;
+		next->filename = items[next->index];
+		Item* item = next.get();
+		loading = true;
+		loader = std::thread([this, &backend, item, released = std::move(finished)]() mutable {
+			release(std::move(released));
+			load(backend, *item);
+			loading = false;
+		});
+	}
+
+	// Loads and indexes the item, runs on the loader thread
+	void load(Backend& backend, Item& item)
+	{
+		const char* filename = item.filename.c_str();
+		if (!(Video::Is_h264_raw(filename) ? item.video.Load_h264_raw(filename, raw_framerate) : item.video.Load_mp4(filename)) || item.video.frame_infos.empty())
+		{
+			item.failed = true;
+			return;
+		}
+		item.memory = item.video.h264_data.capacity() + item.video.frame_infos.memory_usage();
+		{
+			std::lock_guard<std::mutex> lock(memory_lock);
+			memory += item.memory;
+			loaded_count++;
+			peak_memory = std::max(peak_memory, memory);
+			peak_loaded_count = std::max(peak_loaded_count, loaded_count);
+		}
+		backend.prepare_item(item);
+	}
+
+	// Frees the item, and removes it from the memory statistics
+	void release(std::unique_ptr<Item> item)
+	{
+		if (item == nullptr)
+			return;
+		const uint64_t item_memory = item->memory;
+		const bool loaded = !item->failed;
+		item.reset();
+		std::lock_guard<std::mutex> lock(memory_lock);
+		memory -= item_memory;
+		loaded_count -= loaded ? 1 : 0;
+	}
+
+	// The item starts decoding, it's played once
+	void begin_item(Backend& backend, Item& item)
+	{
+		item.core.video = &item.video;
+		item.core.loop_count = 1;
+		item.core.enable_decode_ahead(decode_ahead);
+		item.core.reserve_pictures();
+		backend.begin_item(item);
+		item.decoding = true;
+	}
+
+	// Completes and submits the decodes of the item, like VideoDecoderCore::update()
+	void decode(Backend& backend, Item& item)
+	{
+		VideoDecoderCore& core = item.core;
+		while (!core.decoding_pictures.empty() && backend.is_decode_completed(item, core.decoding_pictures.front()))
+		{
+			core.finish_decode();
+		}
+		VideoDecoderCore::DecodeCommand command;
+		for (uint32_t count = 0; count < core.max_frames_in_flight && core.begin_decode(command); ++count)
+		{
+			backend.decode(item, command);
+			core.end_decode(command);
+		}
+		if (!item.decoded && core.is_decoding_finished())
+		{
+			// The bitstream is not needed anymore, only the frame index is used until the last picture is displayed:
+			const uint64_t bitstream_memory = item.video.h264_data.capacity();
+			std::vector<uint8_t>().swap(item.video.h264_data);
+			{
+				std::lock_guard<std::mutex> lock(memory_lock);
+				memory -= bitstream_memory;
+				item.memory -= bitstream_memory;
+			}
+			item.decoded = true;
+			backend.end_decoding(item);
+		}
+	}
+
+	// Displays the picture of the item for the playlist time, returns true if the displayed picture changed
+	bool display(Backend& backend, Item& item, uint64_t now_nanoseconds)
+	{
+		const uint64_t playback_time = now_nanoseconds > item.start_nanoseconds ? Video::Timer::nanoseconds_to_ticks(now_nanoseconds - item.start_nanoseconds, item.video.timescale) : 0;
+		VideoDecoderCore::DisplayCommand command;
+		command.changed = item.core.update_display(playback_time);
+		command.picture = item.core.displayed_picture;
+		backend.display(item, command);
+		return command.changed;
+	}
+
+	void print_statistics()
+	{
+		std::lock_guard<std::mutex> lock(memory_lock);
+		printf("Playlist: played items: %u, failed items: %u, gaps at the switches: %u, updates waiting for loading: %llu, most loaded items: %u, peak loaded memory: %.1f KB\n", played_count, failed_count, gap_count, (unsigned long long)load_wait_count, peak_loaded_count, double(peak_memory) / 1024.0);
+	}
+};
@@ -0,0 +1,153 @@
+// Presentation clock that maps the media time to the display refreshes
+//
+// What this does:
+//	- the display loop doesn't run exactly at the refreshes (the CPU wakes up a bit later each time), and the picture that it selects is only shown at the next refresh, so selecting by the time of the loop shows pictures one refresh late and with uneven cadence (for example 3:2:2:3 instead of 3:2:3:2 for 24 fps content on a 60 Hz display)
+//	- instead, the media time is taken at the predicted time of the next refresh (vsync), plus half a refresh period, so every picture is shown at the refresh that is nearest to its timestamp, which gives the least judder that the refresh rate allows
+//	- the vsync timeline is predicted from the refresh period and the phase of the latest vsync; measured vsync times (for example the time when a blocking present or swapchain acquire returns) correct the phase and the period, so the prediction doesn't drift away from the display
+//	- the clock is measured in the master clock (the time source of the playback, like the CPU timer or the audio clock), so the media time follows the master clock even if the display runs a bit faster or slower than its nominal refresh rate
+//	- CadenceStatistics measures how far the pictures were shown from their ideal time, and how many of them were not shown at the refresh nearest to it
+//
+// How to use:
+//	PresentationClock clock;
+//	clock.refresh_period = 16666667; // nanoseconds, 0 if it's not known, then it's measured from the vsyncs
+//	clock.start(now_nanoseconds); // the media time 0 is shown at the next vsync
+//	while (running)
+//	{
+//		core.update_display(Video::Timer::nanoseconds_to_ticks(clock.media_time(now_nanoseconds), video.timescale));
+//		present();
+//		clock.vsync(now_nanoseconds); // optional, if present() blocks until a vsync
+//	}
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+struct PresentationClock
+{
+	// Settings:
+	uint64_t refresh_period = 16666667; // nominal refresh period of the display in nanoseconds, 0: unknown, measured from the vsyncs
+	double phase_correction = 0.02; // part of the error of a measured vsync that is corrected in the phase, when it was measured later than predicted
+	double early_correction = 0.5; // part of the error that is corrected in the phase, when it was measured earlier than predicted
+	double period_correction = 0.01; // part of the error of a measured vsync that is corrected in the period
+
+	// State:
+	double period = 16666667.0; // estimated refresh period in nanoseconds of the master clock
+	double vsync_time = 0; // master clock time of a vsync that the predictions count from
+	uint64_t start_time = 0; // master clock time when the media time 0 is shown
+	bool measured = false; // a vsync was measured, so vsync_time is on the display's timeline
+	double measured_time = 0; // the latest measured vsync
+
+	// Statistics:
+	uint64_t vsync_count = 0;
+	double max_vsync_error = 0; // the largest difference between a measured and a predicted vsync, in nanoseconds
+
+	// Starts the playback, the media time 0 is shown at the next vsync
+	void start(uint64_t now)
+	{
+		period = refresh_period > 0 ? double(refresh_period) : 16666667.0;
+		if (!measured)
+		{
+			vsync_time = double(now);
+		}
+		start_time = next_vsync(now);
+	}
+
+	// Returns the master clock time of the vsync that follows the one that the loop woke up from
+	//	the loop runs after a vsync (but not before it), with a delay that can be most of a refresh period, a quarter period of tolerance is given for the drift of the prediction
+	uint64_t next_vsync(uint64_t now) const
+	{
+		const double elapsed = double(now) - vsync_time;
+		const double count = std::floor(elapsed / period + 0.25) + 1;
+		return uint64_t(std::max(0.0, vsync_time + count * period + 0.5));
+	}
+
+	// Returns the media time in nanoseconds that the displayed picture must be selected with, now is the master clock time of the display loop
+	//	the picture that is selected now is shown at the next vsync, half a refresh period is added so the picture whose timestamp is nearest to that vsync is selected
+	uint64_t media_time(uint64_t now) const
+	{
+		const uint64_t vsync = next_vsync(now);
+		return vsync > start_time ? vsync - start_time + uint64_t(period / 2) : uint64_t(period / 2);
+	}
+
+	// Corrects the vsync timeline with a measured vsync time, in master clock time
+	void vsync(uint64_t time)
+	{
+		vsync_count++;
+		if (!measured)
+		{
+			vsync_time = double(time);
+			measured_time = double(time);
+			measured = true;
+			return;
+		}
+		if (refresh_period == 0)
+		{
+			// The period is not known, it's learned from the intervals of the measured vsyncs, the ones that skipped a vsync are not used:
+			const double interval = double(time) - measured_time;
+			if (interval > period * 0.25 && interval < period * 1.5)
+			{
+				period += (interval - period) * 0.1;
+			}
+		}
+		measured_time = double(time);
+
+		const double count = std::round((double(time) - vsync_time) / period);
+		if (count < 1)
+			return; // the same vsync was measured again
+		const double predicted = vsync_time + count * period;
+		const double error = double(time) - predicted;
+		max_vsync_error = std::max(max_vsync_error, std::abs(error));
+		// The measurements are later than the real vsyncs by the wake-up delay of the thread, which is never negative, so the earliest ones are the most accurate:
+		//	the prediction follows the lower envelope of the measurements, it moves earlier quickly, and later slowly (which follows the drift, but not the delays)
+		const double correction = error * (error < 0 ? early_correction : phase_correction);
+		vsync_time = predicted + correction;
+		period += correction * period_correction / count;
+
+		if (refresh_period > 0)
+		{
+			// The display can drift from its nominal refresh rate a little, but larger errors are measurement noise:
+			period = std::min(std::max(period, double(refresh_period) * 0.99), double(refresh_period) * 1.01);
+		}
+	}
+
+	// Measures the judder of the displayed pictures
+	//	a constant offset of every picture (like the display latency) is not judder, so the pictures are compared to their ideal time plus the average offset
+	struct CadenceStatistics
+	{
+		uint64_t frame_count = 0;
+		uint64_t judder_count = 0; // pictures that were not shown at the refresh that is nearest to their ideal time (either one when they are halfway, like every second picture of 24 fps content on a 60 Hz display)
+		double offset_sum = 0; // the sum of the differences between the times when the pictures were shown and their ideal times, in nanoseconds
+		double error_sum = 0; // the sum of the absolute differences from the average offset
+		double error_max = 0;
+		double origin = 0; // the master clock time when the first picture was shown, the ideal times are counted from it
+		double ideal_time = 0; // the ideal time of the latest picture, relative to origin
+		double duration = 0; // the duration of the latest picture
+
+		// A picture with the duration (in nanoseconds) was shown at the time (in master clock time), refresh_period is the real refresh period of the display
+		void add(uint64_t time, uint64_t picture_duration, double refresh_period)
+		{
+			if (frame_count == 0)
+			{
+				origin = double(time);
+			}
+			else
+			{
+				ideal_time += duration;
+			}
+			const double offset = double(time) - origin - ideal_time;
+			offset_sum += offset;
+			frame_count++;
+			const double error = std::abs(offset - offset_sum / double(frame_count));
+			error_sum += error;
+			error_max = std::max(error_max, error);
+			judder_count += error > refresh_period * 0.55 ? 1 : 0; // a small tolerance for the pictures that are halfway between two refreshes
+			duration = double(picture_duration);
+		}
+
+		void print() const
+		{
+			printf("Cadence: pictures: %llu, judder (not at the nearest refresh): %llu, presentation error: %.2f ms average, %.2f ms max\n", (unsigned long long)frame_count, (unsigned long long)judder_count, frame_count > 0 ? error_sum / double(frame_count) / 1000000.0 : 0.0, error_max / 1000000.0);
+		}
+	};
+};
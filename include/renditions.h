@@ -0,0 +1,310 @@
+// Switching between aligned renditions (bitrates and resolutions) of the same content
+//
+// What this does:
+//	- loads multiple encodings of the same video, and checks that their IDR frames are at the same times on the timeline: the switch points are the IDR times that every rendition has, a rendition whose IDR frames don't match the ones of the first rendition is reported as misaligned (it can still be switched at the common ones, at least at the loop start)
+//	- a switch can be requested at any time, it takes effect when the decoding reaches the next switch point, so the new rendition starts with an IDR frame that doesn't reference anything that was decoded from the previous one
+//	- the frames before the switch point are decoded from the previous rendition, the ones after it from the new one, and they are displayed on one continuous timeline: the display order and the display time continue across the switch, even if the renditions have different timescales or frame orders
+//	- the DPB only needs to be reconfigured if the resolution or the number of DPB slots changes, then the decodes in flight complete first, so the backend can recreate its DPB. Otherwise the DPB (and the decoder session) is reused, the IDR frame only resets its reference pictures
+//
+// How to use:
+//	RenditionSet set;
+//	set.load({ "1080p.mp4", "720p.mp4", "360p.mp4" }); // returns false if a rendition can't be loaded
+//	set.check_alignment(); // finds the switch points, and prints the misaligned renditions
+//	set.enable_decode_ahead(4); // optional, instead of core.enable_decode_ahead(), for every rendition
+//	set.reserve_pictures(); // the reordering pictures of every rendition, they must be created with the largest resolution (max_width, max_height), because the pictures of both renditions are displayed around a switch
+//	while (running)
+//	{
+//		if (bandwidth_changed)
+//			set.request_switch(rendition);
+//		set.update(backend, now_nanoseconds); // backend implements RenditionSet::Backend, it's also the VideoDecoderCore::Backend of set.core
+//	}
+//	set.print_statistics();
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+
+#include "common.h"
+#include "decoder_core.h"
+
+struct RenditionSet
+{
+	// Graphics API interface for update(), the decoding and display commands are the ones of VideoDecoderCore:
+	struct Backend : VideoDecoderCore::Backend
+	{
+		// Called when the switch takes effect, before the first frame of the new rendition (core.video) is decoded
+		//	reconfigure: the coded size or the DPB slot count changed, the backend must recreate its DPB for the new rendition, the decodes in flight already completed. Otherwise it can keep its DPB and decoder session
+		virtual void switch_rendition(uint32_t rendition, bool reconfigure) = 0;
+	};
+
+	std::vector<std::unique_ptr<Video>> renditions; // unique_ptr, because core.video points to one of them
+	VideoDecoderCore core;
+	uint32_t current = 0; // the rendition that is decoded
+	int requested = -1; // the rendition that is switched to at the next switch point, -1 if there is no request
+	uint32_t max_width = 0; // the largest padded size of the renditions, for the reordering pictures
+	uint32_t max_height = 0;
+
+	// Alignment, filled by check_alignment():
+	std::vector<std::vector<int>> switch_frames; // per rendition, the frame indices of the switch points in decode order, the same switch point has the same index in every rendition
+	std::vector<uint32_t> misaligned_counts; // per rendition, the IDR frames that don't have a match in the first rendition, and the IDR frames of the first rendition that don't have a match in this one
+	std::vector<uint32_t> base_dpb_slots; // per rendition, the DPB slots that the stream needs, without the slots of decoding ahead
+
+	// Statistics:
+	uint32_t switch_count = 0;
+	uint32_t reconfigure_count = 0; // switches that changed the coded size or the DPB slot count
+	uint64_t drain_wait_count = 0; // decode attempts that waited for the decodes in flight to complete before a reconfiguring switch
+
+	// Loads the renditions, the first one is decoded at first
+	bool load(const std::vector<std::string>& filenames)
+	{
+		renditions.clear();
+		for (const std::string& filename : filenames)
+		{
+			std::unique_ptr<Video> video = std::make_unique<Video>();
+			if (!video->Load_mp4(filename.c_str()) || video->frame_infos.empty())
+			{
+				printf("Rendition load failure: %s\n", filename.c_str());
+				return false;
+			}
+			max_width = std::max(max_width, video->padded_width);
+			max_height = std::max(max_height, video->padded_height);
+			base_dpb_slots.push_back(video->num_dpb_slots);
+			renditions.push_back(std::move(video));
+		}
+		current = 0;
+		core.video = renditions.empty() ? nullptr : renditions[0].get();
+		return !renditions.empty();
+	}
+
+	// Returns the time of a frame in nanoseconds, the decode timestamp of an IDR frame is also its display time, because every frame before it in decode order is displayed before it
+	static uint64_t frame_nanoseconds(const Video& video, int frame_index)
+	{
+		return Video::Timer::ticks_to_nanoseconds(video.frame_infos[frame_index].timestamp, video.timescale);
+	}
+
+	// Finds the switch points: the IDR frames of the first rendition that every other rendition also has within half a frame duration
+	//	returns the number of switch points, there is at least one (the first frame), if the renditions have the same duration
+	uint32_t check_alignment()
+	{
+		const size_t count = renditions.size();
+		switch_frames.assign(count, {});
+		misaligned_counts.assign(count, 0);
+		if (count == 0)
+			return 0;
+		std::vector<std::vector<int>> idr_frames(count);
+		for (size_t r = 0; r < count; ++r)
+		{
+			const Video& video = *renditions[r];
+			for (int i = 0; i < (int)video.frame_infos.size(); ++i)
+			{
+				if (video.frame_infos[i].is_intra)
+				{
+					idr_frames[r].push_back(i);
+				}
+			}
+		}
+
+		std::vector<size_t> cursors(count, 0); // the IDR frames are in timestamp order, so each rendition is walked once
+		std::vector<uint32_t> matched_counts(count, 0);
+		for (int frame : idr_frames[0])
+		{
+			const Video& first = *renditions[0];
+			const uint64_t time = frame_nanoseconds(first, frame);
+			const uint64_t tolerance = Video::Timer::ticks_to_nanoseconds(first.frame_infos[frame].duration, first.timescale) / 2;
+			std::vector<int> matches(count, frame);
+			bool common = true;
+			for (size_t r = 1; r < count; ++r)
+			{
+				const Video& video = *renditions[r];
+				size_t& cursor = cursors[r];
+				while (cursor < idr_frames[r].size() && frame_nanoseconds(video, idr_frames[r][cursor]) + tolerance < time)
+				{
+					cursor++;
+				}
+				if (cursor >= idr_frames[r].size() || frame_nanoseconds(video, idr_frames[r][cursor]) > time + tolerance)
+				{
+					common = false;
+					continue;
+				}
+				matches[r] = idr_frames[r][cursor];
+				matched_counts[r]++;
+			}
+			if (!common)
+				continue;
+			for (size_t r = 0; r < count; ++r)
+			{
+				switch_frames[r].push_back(matches[r]);
+			}
+		}
+
+		const uint64_t duration = Video::Timer::ticks_to_nanoseconds(renditions[0]->duration, renditions[0]->timescale);
+		for (size_t r = 0; r < count; ++r)
+		{
+			const Video& video = *renditions[r];
+			misaligned_counts[r] = r > 0 ? uint32_t(idr_frames[r].size() + idr_frames[0].size() - 2 * matched_counts[r]) : 0;
+			const uint64_t rendition_duration = Video::Timer::ticks_to_nanoseconds(video.duration, video.timescale);
+			const uint64_t difference = rendition_duration > duration ? rendition_duration - duration : duration - rendition_duration;
+			if (difference > Video::Timer::ticks_to_nanoseconds(video.frame_infos[0].duration, video.timescale))
+			{
+				printf("Rendition %u has a different duration: %.3f ms instead of %.3f ms, it can't be switched to\n", (uint32_t)r, double(rendition_duration) / 1000000.0, double(duration) / 1000000.0);
+				switch_frames[r].clear(); // the display order after a loop would not continue
+			}
+			else if (misaligned_counts[r] > 0)
+			{
+				printf("Rendition %u is misaligned with rendition 0: %u IDR frames are not at the same time in both, it can only be switched at the common IDR frames\n", (uint32_t)r, misaligned_counts[r]);
+			}
+		}
+		return (uint32_t)switch_frames[0].size();
+	}
+
+	// Enables decoding ahead for every rendition, like VideoDecoderCore::enable_decode_ahead(), the renditions get the same number of extra DPB slots, so the same number of frames can be in flight in each
+	uint32_t enable_decode_ahead(uint32_t frame_count, uint32_t max_dpb_slots = DecodedPictureBuffer::max_slots)
+	{
+		uint32_t frames_in_flight = ~0u;
+		for (size_t r = 0; r < renditions.size(); ++r)
+		{
+			renditions[r]->num_dpb_slots = base_dpb_slots[r];
+			core.video = renditions[r].get();
+			frames_in_flight = std::min(frames_in_flight, core.enable_decode_ahead(frame_count, max_dpb_slots));
+		}
+		for (size_t r = 0; r < renditions.size(); ++r)
+		{
+			renditions[r]->num_dpb_slots = base_dpb_slots[r] + frames_in_flight - 1;
+		}
+		core.video = renditions[current].get();
+		core.max_frames_in_flight = frames_in_flight;
+		return frames_in_flight;
+	}
+
+	// Reserves the reordering pictures for the deepest reordering of the renditions, returns the number of pictures
+	uint32_t reserve_pictures()
+	{
+		for (const std::unique_ptr<Video>& video : renditions)
+		{
+			core.video = video.get();
+			core.reserve_pictures();
+		}
+		core.video = renditions[current].get();
+		return (uint32_t)core.pictures.size();
+	}
+
+	// Requests switching to the rendition at the next switch point, returns false if it can't be switched to
+	bool request_switch(uint32_t rendition)
+	{
+		assert(!core.reverse && core.scan_speed == 0); // the switch points are only searched in forward playback
+		if (rendition >= renditions.size() || switch_frames.size() != renditions.size() || switch_frames[rendition].empty())
+			return false;
+		requested = rendition == current ? -1 : (int)rendition; // requesting the current rendition cancels a pending switch
+		return true;
+	}
+
+	// Returns the index of the switch point at the frame of the current rendition, or -1 if it's not a switch point
+	int find_switch_point(int frame_index) const
+	{
+		const std::vector<int>& frames = switch_frames[current];
+		const auto it = std::lower_bound(frames.begin(), frames.end(), frame_index);
+		return it != frames.end() && *it == frame_index ? int(it - frames.begin()) : -1;
+	}
+
+	// Applies the requested switch if the next decoded frame is a switch point, must be called before every VideoDecoderCore::begin_decode()
+	//	returns false if the decoding must wait, because a switch that reconfigures the DPB waits for the decodes in flight
+	bool prepare_decode(Backend& backend)
+	{
+		if (requested < 0)
+			return true;
+		const int point = find_switch_point(core.video->frameIndex);
+		if (point < 0)
+			return true;
+		const Video& from = *core.video;
+		Video& to = *renditions[requested];
+		const bool reconfigure = from.padded_width != to.padded_width || from.padded_height != to.padded_height || from.num_dpb_slots != to.num_dpb_slots;
+		if (reconfigure && !core.decoding_pictures.empty())
+		{
+			drain_wait_count++;
+			return false;
+		}
+
+		// The display order continues from the switch point, the frames before it were decoded from the previous rendition:
+		const int from_frame = from.frameIndex;
+		const int to_frame = switch_frames[requested][point];
+		core.display_order_offset += from.frame_infos.display_orders[from_frame] - to.frame_infos.display_orders[to_frame];
+
+		// The waiting pictures and the swap time are converted to the timescale of the new rendition:
+		if (from.timescale != to.timescale)
+		{
+			for (VideoDecoderCore::Picture& picture : core.pictures)
+			{
+				picture.duration = convert_ticks(picture.duration, from.timescale, to.timescale);
+			}
+			for (VideoDecoderCore::SkippedFrame& skipped : core.skipped_frames)
+			{
+				skipped.duration = convert_ticks(skipped.duration, from.timescale, to.timescale);
+			}
+			core.next_frame_time = convert_ticks(core.next_frame_time, from.timescale, to.timescale);
+		}
+
+		to.frameIndex = to_frame;
+		core.video = &to;
+		core.dpb_reset_pending = true;
+		core.seek_pending = false; // the plan was made for the frames of the previous rendition
+		core.intra_frames.clear();
+		if (!core.temporal_layers.empty())
+		{
+			// The temporal layers are derived again from the reference structure of the new rendition, the decoded layers stay the same:
+			const uint32_t limit = core.temporal_layer_limit;
+			const uint32_t cap = core.temporal_layer_cap;
+			core.enable_decimation(0, core.adaptive_decimation);
+			core.temporal_layer_cap = std::min(cap, core.temporal_layer_cap);
+			core.temporal_layer_limit = std::min(limit, core.temporal_layer_cap);
+		}
+		current = (uint32_t)requested;
+		requested = -1;
+		switch_count++;
+		reconfigure_count += reconfigure ? 1 : 0;
+		backend.switch_rendition(current, reconfigure);
+		return true;
+	}
+
+	static uint64_t convert_ticks(uint64_t ticks, uint32_t from_timescale, uint32_t to_timescale)
+	{
+		return Video::Timer::nanoseconds_to_ticks(Video::Timer::ticks_to_nanoseconds(ticks, from_timescale), to_timescale);
+	}
+
+	// One iteration of the display loop, like VideoDecoderCore::update(), but the playback time is in nanoseconds, because the timescale changes with the rendition, returns the number of decoded frames
+	uint32_t update(Backend& backend, uint64_t now_nanoseconds)
+	{
+		uint32_t decode_count = 0;
+		for (;;)
+		{
+			while (!core.decoding_pictures.empty() && backend.is_decode_completed(core.decoding_pictures.front()))
+			{
+				core.finish_decode();
+			}
+			VideoDecoderCore::DecodeCommand command;
+			if (decode_count >= core.max_frames_in_flight || !prepare_decode(backend) || !core.begin_decode(command))
+				break;
+			backend.decode(command);
+			core.end_decode(command);
+			decode_count++;
+		}
+		VideoDecoderCore::DisplayCommand display;
+		display.changed = core.update_display(Video::Timer::nanoseconds_to_ticks(now_nanoseconds, core.video->timescale));
+		display.picture = core.displayed_picture;
+		backend.display(display);
+		return decode_count;
+	}
+
+	void print_statistics() const
+	{
+		for (size_t r = 0; r < renditions.size(); ++r)
+		{
+			const Video& video = *renditions[r];
+			printf("Rendition %u: %u x %u, DPB slots: %u, frames: %u, switch points: %u, IDR frames misaligned with rendition 0: %u\n", (uint32_t)r, video.padded_width, video.padded_height, video.num_dpb_slots, (uint32_t)video.frame_infos.size(), r < switch_frames.size() ? (uint32_t)switch_frames[r].size() : 0u, r < misaligned_counts.size() ? misaligned_counts[r] : 0u);
+		}
+		printf("Rendition switches: %u, DPB reconfigurations: %u, decode attempts waiting for the decodes in flight: %llu\n", switch_count, reconfigure_count, (unsigned long long)drain_wait_count);
+	}
+};
@@ -0,0 +1,215 @@
+// Decode scheduler for multiple video streams that share the decode queues of one device
+//
+// What this does:
+//	- owns a VideoDecoderCore for each stream, and interleaves their decode submissions, so that the streams don't need their own device and video queue
+//	- earliest deadline first: when the shared queue has room for a decode, the stream whose next missing picture must be presented soonest is decoded
+//	- priority: each priority level moves the deadlines of a stream one priority step earlier, so more important streams win when the decoder is overloaded
+//	- skip policy: a stream that can't keep up either waits (its pictures are presented late), or decimates (skips temporal layers of non-reference frames, see VideoDecoderCore::enable_decimation)
+//	- statistics: decoded, displayed, missed and skipped frames per stream, and a fairness index of the on-time ratios of the streams
+//	- only mini_video_null.exe drives it for now (-streams, with a simulated shared queue), the Vulkan, DX11 and DX12 samples still decode a single stream with their own VideoDecoderCore, a real backend would implement DecodeScheduler::Backend on its shared video queue
+//
+// How to use:
+//	DecodeScheduler scheduler;
+//	scheduler.max_frames_in_flight = 8; // decodes that can be in flight on the shared queue
+//	const uint32_t stream = scheduler.add_stream(&video, now_nanoseconds); // optional: priority, skip policy, decode ahead
+//	// the backend creates scheduler.streams[stream].core.pictures.size() reordering pictures for the stream, and more if a decode command has picture_created
+//	while (running)
+//	{
+//		scheduler.update(backend, now_nanoseconds); // backend implements DecodeScheduler::Backend
+//	}
+//	scheduler.print_statistics();
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "decoder_core.h"
+
+struct DecodeScheduler
+{
+	enum class SkipPolicy
+	{
+		wait, // every frame is decoded, the pictures are presented late when the decoding can't keep up
+		decimate, // a missed deadline skips one more temporal layer of non-reference frames, it's restored when the stream keeps up again
+	};
+
+	struct Stream
+	{
+		Video* video = nullptr;
+		VideoDecoderCore core;
+		int priority = 0; // higher is more important
+		SkipPolicy skip_policy = SkipPolicy::wait;
+		uint64_t start_nanoseconds = 0; // scheduler time when the playback of the stream started
+		uint64_t frame_duration = 0; // average frame duration in timescale ticks, for estimating the deadlines of pictures that are decoded ahead
+
+		// Statistics:
+		uint64_t decode_count = 0;
+		uint64_t display_count = 0;
+		uint64_t max_lateness_nanoseconds = 0; // the worst difference between the deadline and the submission of a decode
+	};
+	std::vector<Stream> streams;
+
+	// Graphics API interface for update(), the commands of each stream must be executed in the order they are given:
+	struct Backend
+	{
+		virtual ~Backend() = default;
+		virtual void decode(uint32_t stream, const VideoDecoderCore::DecodeCommand& command) = 0;
+		virtual void display(uint32_t stream, const VideoDecoderCore::DisplayCommand& command) = 0;
+		// Returns true if the decode of the picture completed, only called for the oldest decode in flight of the stream:
+		virtual bool is_decode_completed(uint32_t /*stream*/, int /*picture*/) { return true; }
+	};
+
+	uint32_t max_frames_in_flight = 4; // decodes that can be in flight on the shared queue, summed over all the streams
+	uint64_t priority_step_nanoseconds = 16666667; // one priority level moves the deadlines this much earlier, one 60 Hz display refresh by default
+	uint32_t in_flight = 0;
+	uint64_t submit_count = 0;
+	std::vector<uint8_t> blocked; // per stream, the stream had nothing to decode in this update
+
+	// Adds a stream, the video must be loaded, and it must stay alive while the stream is scheduled
+	//	start_nanoseconds: scheduler time when the playback starts
+	//	priority: higher is more important, each level moves the deadlines priority_step_nanoseconds earlier
+	//	decode_ahead: pictures that the stream can decode before they are needed (VideoDecoderCore::enable_decode_ahead)
+	//	returns the index of the stream
+	uint32_t add_stream(Video* video, uint64_t start_nanoseconds, int priority = 0, SkipPolicy skip_policy = SkipPolicy::wait, uint32_t decode_ahead = 2)
+	{
+		streams.emplace_back();
+		Stream& stream = streams.back();
+		stream.video = video;
+		stream.priority = priority;
+		stream.skip_policy = skip_policy;
+		stream.start_nanoseconds = start_nanoseconds;
+		stream.frame_duration = video->live ? video->live_frame_duration : video->duration / std::max(size_t(1), video->frame_infos.size());
+		stream.core.video = video;
+		stream.core.enable_decode_ahead(decode_ahead);
+		if (skip_policy == SkipPolicy::decimate)
+		{
+			stream.core.enable_decimation(0, true);
+		}
+		stream.core.reserve_pictures();
+		blocked.push_back(0);
+		return uint32_t(streams.size() - 1);
+	}
+
+	// Returns the playback time of the stream in its timescale ticks
+	uint64_t playback_ticks(const Stream& stream, uint64_t now_nanoseconds) const
+	{
+		return now_nanoseconds > stream.start_nanoseconds ? Video::Timer::nanoseconds_to_ticks(now_nanoseconds - stream.start_nanoseconds, stream.video->timescale) : 0;
+	}
+
+	// Returns the scheduler time when the next picture that is not decoding yet must be presented
+	uint64_t deadline_nanoseconds(const Stream& stream) const
+	{
+		const VideoDecoderCore& core = stream.core;
+		uint64_t ticks = core.next_frame_time;
+		if (core.is_frame_pending(core.target_display_order))
+		{
+			// The next picture is decoding or decoded, the next decode is for a later picture:
+			ticks += (core.decoding_pictures.size() + core.working_count) * stream.frame_duration;
+		}
+		return stream.start_nanoseconds + Video::Timer::ticks_to_nanoseconds(ticks, stream.video->timescale);
+	}
+
+	// One iteration of the display loop, submits the decodes in deadline order and displays the pictures of all the streams
+	void update(Backend& backend, uint64_t now_nanoseconds)
+	{
+		for (uint32_t i = 0; i < (uint32_t)streams.size(); ++i)
+		{
+			VideoDecoderCore& core = streams[i].core;
+			while (!core.decoding_pictures.empty() && backend.is_decode_completed(i, core.decoding_pictures.front()))
+			{
+				core.finish_decode();
+				in_flight--;
+			}
+			blocked[i] = now_nanoseconds < streams[i].start_nanoseconds ? 1 : 0;
+		}
+
+		// Earliest deadline first, a stream that doesn't need a decode now is not asked again in this update:
+		while (in_flight < max_frames_in_flight)
+		{
+			int best = -1;
+			int64_t best_key = INT64_MAX;
+			for (uint32_t i = 0; i < (uint32_t)streams.size(); ++i)
+			{
+				if (blocked[i])
+					continue;
+				const int64_t key = int64_t(deadline_nanoseconds(streams[i])) - int64_t(streams[i].priority) * int64_t(priority_step_nanoseconds);
+				if (key < best_key)
+				{
+					best_key = key;
+					best = (int)i;
+				}
+			}
+			if (best < 0)
+				break;
+			Stream& stream = streams[best];
+			const uint64_t deadline = deadline_nanoseconds(stream);
+			VideoDecoderCore::DecodeCommand command;
+			if (!stream.core.begin_decode(command))
+			{
+				blocked[best] = 1;
+				continue;
+			}
+			backend.decode((uint32_t)best, command);
+			stream.core.end_decode(command);
+			stream.decode_count++;
+			stream.max_lateness_nanoseconds = std::max(stream.max_lateness_nanoseconds, now_nanoseconds > deadline ? now_nanoseconds - deadline : 0);
+			in_flight++;
+			submit_count++;
+		}
+
+		for (uint32_t i = 0; i < (uint32_t)streams.size(); ++i)
+		{
+			Stream& stream = streams[i];
+			if (now_nanoseconds < stream.start_nanoseconds)
+				continue;
+			VideoDecoderCore::DisplayCommand display;
+			display.changed = stream.core.update_display(playback_ticks(stream, now_nanoseconds));
+			display.picture = stream.core.displayed_picture;
+			stream.display_count += display.changed ? 1 : 0;
+			backend.display(i, display);
+		}
+	}
+
+	// Returns the fraction of the pictures of the stream that were displayed on time
+	double on_time_ratio(const Stream& stream) const
+	{
+		if (stream.display_count == 0)
+			return 1.0;
+		return double(stream.display_count - std::min(stream.display_count, stream.core.missed_count)) / double(stream.display_count); // the missed pictures are displayed late
+	}
+
+	// Jain's fairness index of the on-time ratios, 1: every stream is served equally, 1/stream count: one stream gets everything
+	double fairness() const
+	{
+		double sum = 0;
+		double square_sum = 0;
+		for (const Stream& stream : streams)
+		{
+			const double x = on_time_ratio(stream);
+			sum += x;
+			square_sum += x * x;
+		}
+		return square_sum > 0 ? sum * sum / (double(streams.size()) * square_sum) : 1.0;
+	}
+
+	void print_statistics() const
+	{
+		for (size_t i = 0; i < streams.size(); ++i)
+		{
+			const Stream& stream = streams[i];
+			printf("Stream %zu: priority: %d, decoded: %llu, displayed: %llu, missed deadlines: %llu, skipped: %llu, on time: %.1f%%, max lateness: %.2f ms\n",
+				i,
+				stream.priority,
+				(unsigned long long)stream.decode_count,
+				(unsigned long long)stream.display_count,
+				(unsigned long long)stream.core.missed_count,
+				(unsigned long long)stream.core.skipped_count,
+				on_time_ratio(stream) * 100.0,
+				double(stream.max_lateness_nanoseconds) / 1000000.0
+			);
+		}
+		printf("Streams: %zu, submitted decodes: %llu, fairness: %.3f\n", streams.size(), (unsigned long long)submit_count, fairness());
+	}
+};
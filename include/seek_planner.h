@@ -0,0 +1,291 @@
+// Seek planner: finds the smallest set of frames that must be decoded to display a target frame
+//
+// What this does:
+//	- a seek starts decoding at the last IDR frame before the target in decode order, but most frames between them are not needed for the target:
+//		- non-reference frames (nal_ref_idc == 0) are never referenced, so only the target itself is decoded from them
+//		- reference frames are only needed if the target, or a needed frame, can reference them
+//	- the dependencies come from simulating the reference picture marking of the DPB (sliding window, MMCO, frame_num gaps) from the IDR frame to the target: a frame can reference every frame that is marked as used for reference when it's decoded, which is also the reference set that the backends give to the decoder
+//		- intra pictures don't reference anything, these are only recognized by slice_type 7 (I) and 9 (SI), which mean that every slice of the picture has that type, because the index only stores the slice header of the first slice
+//		- a predicted frame only depends on the frames in the first num_ref_idx_l0_active (and for B frames num_ref_idx_l1_active) entries of its initial reference lists (8.2.4.2), the sizes come from the slice header, which has the PPS defaults when they are not overridden
+//		- the reordering commands are not stored in the index, so a list with reordering is assumed to contain every marked frame, and the index only has the first slice header of a frame, so the other slices are assumed to use the same lists
+//	- the needed frames are collected backwards from the target, and from the frames that the playback after the seek still needs: the references that remain marked after the target, and the frames before the target in decode order that are displayed after it
+//	- the reference frames that are not needed are still run through the DPB marking without decoding them (Action::mark), so frame_num continuity and the sliding window stay the same as in a full decode, and their slots are never referenced by a decoded frame
+//	- the cost is estimated in average frame decodes: every decode costs fixed_cost for the submission and setup, and the rest proportionally to its bitstream size
+//	- the plan also has the cost of the simpler strategies for comparison: decoding every frame from the IDR frame, and decoding every reference frame from the IDR frame (what VideoDecoderCore did before after a jump)
+//
+// How to use:
+//	SeekPlanner planner;
+//	SeekPlanner::Plan plan;
+//	if (planner.plan(video, target_frame_index, plan))
+//	{
+//		// for each frame from plan.begin to plan.target in decode order: plan.actions[frame - plan.begin] is decode, mark or skip
+//		// VideoDecoderCore::seek() does this
+//	}
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "dpb.h"
+
+struct SeekPlanner
+{
+	enum class Action : uint8_t
+	{
+		skip, // not referenced, not decoded
+		mark, // reference frame that is not needed, only its reference marking is performed
+		decode,
+	};
+
+	struct Cost
+	{
+		uint32_t frames = 0; // decoded frames
+		uint64_t bytes = 0; // decoded bitstream bytes
+		double estimate = 0; // in average frame decodes
+	};
+
+	struct Plan
+	{
+		int begin = 0; // frame index of the IDR frame where the decoding starts
+		int target = 0; // frame index of the target frame
+		std::vector<Action> actions; // per frame from begin to target in decode order
+		Cost minimal; // the decoded frames of the plan
+		Cost references_only; // decoding the reference frames and the target from the IDR frame
+		Cost all_frames; // decoding every frame from the IDR frame
+	};
+
+	// Settings:
+	double fixed_cost = 0.25; // the part of an average frame decode that doesn't depend on the frame size
+
+	// Scratch state, kept between the plans so they don't allocate:
+	DecodedPictureBuffer dpb;
+	std::vector<uint32_t> dependency_offsets; // per planned frame, its dependencies begin here in dependencies
+	std::vector<uint32_t> dependencies; // frames relative to the plan begin
+	std::vector<uint8_t> needed;
+	const Video* average_video = nullptr;
+	double average_frame_size = 1;
+
+	// Returns true for pictures that can be decoded without references
+	static bool is_intra_picture(const h264::SliceHeader& slice_header)
+	{
+		return slice_header.slice_type == h264::SH_SLICE_TYPE_I_ONLY || slice_header.slice_type == h264::SH_SLICE_TYPE_SI_ONLY;
+	}
+
+	// Fills the slots that the reference lists of a predicted frame can contain after begin_frame() and returns their count, these are the frames that it can depend on:
+	static uint32_t active_reference_slots(const h264::SPS& sps, const h264::SliceHeader& slice_header, const DecodedPictureBuffer& dpb, const DecodedPictureBuffer::Frame& frame, uint8_t* slots)
+	{
+		if (is_intra_picture(slice_header))
+			return 0;
+		const int slice_type = slice_header.slice_type % 5;
+		bool active[DecodedPictureBuffer::max_slots] = {};
+		if (slice_type != h264::SH_SLICE_TYPE_P && slice_type != h264::SH_SLICE_TYPE_B && slice_type != h264::SH_SLICE_TYPE_SP)
+		{
+			// I or SI first slice, but the others can be predicted with unknown lists:
+			std::fill(active, active + DecodedPictureBuffer::max_slots, true);
+		}
+		else
+		{
+			// Initial reference lists (8.2.4.2.1 for P and SP, 8.2.4.2.3 for B), frame.reference_slots has the short-term references first:
+			const int max_frame_num = 1 << (sps.log2_max_frame_num_minus4 + 4);
+			uint8_t short_term[DecodedPictureBuffer::max_references];
+			uint8_t long_term[DecodedPictureBuffer::max_references];
+			uint32_t short_term_count = 0;
+			uint32_t long_term_count = 0;
+			for (uint32_t r = 0; r < frame.reference_count; ++r)
+			{
+				const uint8_t slot = frame.reference_slots[r];
+				if (dpb.longterm_status[slot])
+				{
+					long_term[long_term_count++] = slot;
+				}
+				else
+				{
+					short_term[short_term_count++] = slot;
+				}
+			}
+			std::sort(long_term, long_term + long_term_count, [&](uint8_t a, uint8_t b) {
+				return dpb.framenum_status[a] < dpb.framenum_status[b]; // ascending LongTermPicNum
+			});
+
+			uint8_t lists[2][DecodedPictureBuffer::max_references];
+			uint32_t list_count = 0;
+			if (slice_type != h264::SH_SLICE_TYPE_B)
+			{
+				std::sort(short_term, short_term + short_term_count, [&](uint8_t a, uint8_t b) {
+					const int wrap_a = dpb.framenum_status[a] > frame.frame_num ? dpb.framenum_status[a] - max_frame_num : dpb.framenum_status[a];
+					const int wrap_b = dpb.framenum_status[b] > frame.frame_num ? dpb.framenum_status[b] - max_frame_num : dpb.framenum_status[b];
+					return wrap_a > wrap_b; // descending PicNum
+				});
+				std::copy(short_term, short_term + short_term_count, lists[0]);
+				list_count = 1;
+			}
+			else
+			{
+				// Short-term references before the current frame in display order come first in list 0, the ones after it come first in list 1, both ordered by the distance from the current frame:
+				std::sort(short_term, short_term + short_term_count, [&](uint8_t a, uint8_t b) {
+					return dpb.poc_status[a] < dpb.poc_status[b];
+				});
+				const uint32_t before_count = uint32_t(std::partition_point(short_term, short_term + short_term_count, [&](uint8_t a) { return dpb.poc_status[a] < frame.poc; }) - short_term);
+				std::reverse_copy(short_term, short_term + before_count, lists[0]);
+				std::copy(short_term + before_count, short_term + short_term_count, lists[0] + before_count);
+				std::copy(short_term + before_count, short_term + short_term_count, lists[1]);
+				std::reverse_copy(short_term, short_term + before_count, lists[1] + short_term_count - before_count);
+				list_count = 2;
+			}
+			const uint32_t total_count = short_term_count + long_term_count;
+			const int num_ref_idx_active[2] = { slice_header.num_ref_idx_l0_active_minus1 + 1, slice_header.num_ref_idx_l1_active_minus1 + 1 };
+			const bool reordering[2] = { slice_header.rplr.ref_pic_list_reordering_flag_l0 != 0, slice_header.rplr.ref_pic_list_reordering_flag_l1 != 0 };
+			for (uint32_t l = 0; l < list_count; ++l)
+			{
+				std::copy(long_term, long_term + long_term_count, lists[l] + short_term_count);
+			}
+			if (list_count == 2 && total_count > 1 && std::equal(lists[0], lists[0] + total_count, lists[1]))
+			{
+				std::swap(lists[1][0], lists[1][1]); // list 1 must differ from list 0 when it has more than one entry
+			}
+			for (uint32_t l = 0; l < list_count; ++l)
+			{
+				const uint32_t active_count = reordering[l] ? total_count : std::min(total_count, (uint32_t)std::max(num_ref_idx_active[l], 0));
+				for (uint32_t i = 0; i < active_count; ++i)
+				{
+					active[lists[l][i]] = true;
+				}
+			}
+		}
+
+		uint32_t count = 0;
+		for (uint32_t r = 0; r < frame.reference_count; ++r)
+		{
+			if (active[frame.reference_slots[r]])
+			{
+				slots[count++] = frame.reference_slots[r];
+			}
+		}
+		return count;
+	}
+
+	// Returns the estimated cost of decoding a frame of the size
+	double frame_cost(uint64_t size) const
+	{
+		return fixed_cost + (1.0 - fixed_cost) * double(size) / average_frame_size;
+	}
+
+	// Fills the plan for displaying the frame at target_frame (frame index in decode order), returns false for live streams, their frames are not indexed in advance
+	bool plan(const Video& video, int target_frame, Plan& plan)
+	{
+		if (video.live || target_frame < 0 || target_frame >= (int)video.frame_infos.size())
+			return false;
+		if (average_video != &video)
+		{
+			uint64_t total_size = 0;
+			for (uint32_t size : video.frame_infos.sizes)
+			{
+				total_size += size;
+			}
+			average_frame_size = std::max(1.0, double(total_size) / double(video.frame_infos.size()));
+			average_video = &video;
+		}
+
+		int begin = target_frame;
+		while (begin > 0 && !video.frame_infos[begin].is_intra)
+		{
+			begin--;
+		}
+		const uint32_t count = uint32_t(target_frame - begin + 1);
+		plan.begin = begin;
+		plan.target = target_frame;
+		plan.actions.assign(count, Action::skip);
+		plan.minimal = {};
+		plan.references_only = {};
+		plan.all_frames = {};
+
+		// The DPB marking is simulated with the most slots, so a slot is only reused when its frame is no longer marked:
+		int slot_frames[DecodedPictureBuffer::max_slots];
+		std::fill(slot_frames, slot_frames + DecodedPictureBuffer::max_slots, -1);
+		dpb.reset(DecodedPictureBuffer::max_slots);
+		dependency_offsets.resize(count + 1);
+		dependencies.clear();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const int frame_index = begin + (int)i;
+			const Video::FrameInfo frame_info = video.frame_infos[frame_index];
+			const h264::SliceHeader slice_header = video.frame_infos.slice_header(frame_index);
+			const h264::PPS& pps = video.pps_array[slice_header.pic_parameter_set_id];
+			const h264::SPS& sps = video.sps_array[pps.seq_parameter_set_id];
+			DecodedPictureBuffer::Frame frame;
+			dpb.begin_frame(sps, slice_header, frame_info.is_intra, frame_info.reference_priority > 0, frame_info.poc, frame);
+			dependency_offsets[i] = (uint32_t)dependencies.size();
+			uint8_t reference_slots[DecodedPictureBuffer::max_references];
+			const uint32_t reference_count = active_reference_slots(sps, slice_header, dpb, frame, reference_slots);
+			for (uint32_t r = 0; r < reference_count; ++r)
+			{
+				assert(slot_frames[reference_slots[r]] >= 0);
+				dependencies.push_back((uint32_t)slot_frames[reference_slots[r]]);
+			}
+			dpb.end_frame(slice_header, frame);
+			slot_frames[frame.current_slot] = (int)i;
+
+			if (frame_info.reference_priority > 0)
+			{
+				plan.actions[i] = Action::mark; // until it's found to be needed
+			}
+
+			const double cost = frame_cost(frame_info.size);
+			plan.all_frames.frames++;
+			plan.all_frames.bytes += frame_info.size;
+			plan.all_frames.estimate += cost;
+			if (frame_info.reference_priority > 0 || frame_index == target_frame)
+			{
+				plan.references_only.frames++;
+				plan.references_only.bytes += frame_info.size;
+				plan.references_only.estimate += cost;
+			}
+		}
+		dependency_offsets[count] = (uint32_t)dependencies.size();
+
+		// The target, the references that the frames after it can still use, and the frames that are displayed after it:
+		needed.assign(count, 0);
+		needed[count - 1] = 1;
+		uint8_t reference_slots[DecodedPictureBuffer::max_references];
+		const uint32_t reference_count = dpb.current_reference_slots(reference_slots);
+		for (uint32_t r = 0; r < reference_count; ++r)
+		{
+			assert(slot_frames[reference_slots[r]] >= 0);
+			needed[slot_frames[reference_slots[r]]] = 1;
+		}
+		const int target_display_order = video.frame_infos.display_orders[target_frame];
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (video.frame_infos.display_orders[begin + i] > target_display_order)
+			{
+				needed[i] = 1;
+			}
+		}
+
+		// Every dependency precedes its frame in decode order, so one backward pass collects them all:
+		for (uint32_t i = count; i-- > 0;)
+		{
+			if (!needed[i])
+				continue;
+			for (uint32_t d = dependency_offsets[i]; d < dependency_offsets[i + 1]; ++d)
+			{
+				assert(dependencies[d] < i);
+				needed[dependencies[d]] = 1;
+			}
+		}
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (!needed[i])
+				continue;
+			const uint32_t size = video.frame_infos.sizes[begin + i];
+			plan.actions[i] = Action::decode;
+			plan.minimal.frames++;
+			plan.minimal.bytes += size;
+			plan.minimal.estimate += frame_cost(size);
+		}
+		return true;
+	}
+};
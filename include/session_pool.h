@@ -0,0 +1,224 @@
+// Pool of video decoder sessions that are reused across videos
+//
+// What this does:
+//	- keeps the decoder sessions of finished videos (and the resources that are sized with them, like the DPB texture), so opening the next video doesn't need to destroy and create them again
+//	- a session is compatible with a video if it has the same profile and picture format, and its level, maximum coded extent and DPB slot count are at least what the video needs; only the session parameters (SPS, PPS) have to be updated for a compatible video
+//	- the smallest compatible session is chosen, so a small video doesn't take the session that a larger video could use
+//	- the number of sessions is limited, when a new session doesn't fit, the least recently used free session is destroyed
+//
+// How to use:
+//	SessionPool pool;
+//	pool.max_sessions = 2;
+//	bool reused = false;
+//	const uint32_t session = pool.acquire(backend, SessionPool::Key::from_video(video, profile_idc, picture_format), &reused); // backend implements SessionPool::Backend
+//	// update or create the session parameters of the video, then decode with the session
+//	pool.release(session); // the video finished, the session can be reused
+//	pool.clear(backend); // destroys every session, at exit
+//
+//	Backends that create the sessions inline can use find(), evict() and add() instead of acquire(), they do the same steps
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+
+struct SessionPool
+{
+	// The properties that a session is created with, a session can decode every video whose key is not larger:
+	struct Key
+	{
+		uint32_t profile_idc = 0;
+		uint32_t level_idc = 0;
+		uint32_t max_width = 0; // maximum coded extent
+		uint32_t max_height = 0;
+		uint32_t dpb_slots = 0;
+		uint32_t picture_format = 0; // backend specific format of the decoded pictures, for example VkFormat or DXGI_FORMAT
+
+		// Returns the key that a session needs to decode the video
+		//	profile_idc: the profile that the backend creates the session with, it can be higher than the profile of the SPS (for example a high profile session can decode main profile videos)
+		static Key from_video(const Video& video, uint32_t profile_idc, uint32_t picture_format)
+		{
+			Key key;
+			key.profile_idc = profile_idc;
+			for (const h264::SPS& sps : video.sps_array)
+			{
+				key.level_idc = std::max(key.level_idc, uint32_t(sps.level_idc));
+			}
+			key.max_width = video.padded_width;
+			key.max_height = video.padded_height;
+			key.dpb_slots = video.num_dpb_slots;
+			key.picture_format = picture_format;
+			return key;
+		}
+
+		// Returns true if a session created with this key can decode a video that needs the other key:
+		bool is_compatible(const Key& other) const
+		{
+			return profile_idc == other.profile_idc &&
+				picture_format == other.picture_format &&
+				level_idc >= other.level_idc &&
+				max_width >= other.max_width &&
+				max_height >= other.max_height &&
+				dpb_slots >= other.dpb_slots;
+		}
+
+		// The size of the DPB that the session needs, in pixels:
+		uint64_t capacity() const
+		{
+			return uint64_t(max_width) * uint64_t(max_height) * uint64_t(dpb_slots);
+		}
+	};
+
+	// Graphics API interface for acquire() and clear(), a session is identified by its index in the pool:
+	struct Backend
+	{
+		virtual ~Backend() = default;
+		virtual void create_session(uint32_t session, const Key& key) = 0;
+		virtual void destroy_session(uint32_t session) = 0;
+	};
+
+	struct Entry
+	{
+		Key key;
+		bool valid = false; // the backend has a session at this index
+		bool in_use = false;
+		uint64_t last_use = 0; // larger is more recent
+	};
+	std::vector<Entry> entries;
+	uint32_t max_sessions = 2; // sessions that are kept, the sessions in use are never destroyed, so more can exist if more videos are playing at the same time
+	uint64_t use_counter = 0;
+
+	// Statistics:
+	uint64_t created_count = 0;
+	uint64_t reused_count = 0;
+	uint64_t evicted_count = 0;
+
+	// Returns the number of sessions that exist, in use or free
+	uint32_t session_count() const
+	{
+		uint32_t count = 0;
+		for (const Entry& entry : entries)
+		{
+			count += entry.valid ? 1 : 0;
+		}
+		return count;
+	}
+
+	// Returns the smallest free session that is compatible with the key and marks it in use, or -1 if there is none
+	int find(const Key& key)
+	{
+		int best = -1;
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i)
+		{
+			const Entry& entry = entries[i];
+			if (!entry.valid || entry.in_use || !entry.key.is_compatible(key))
+				continue;
+			if (best < 0 || entry.key.capacity() < entries[best].key.capacity())
+			{
+				best = (int)i;
+			}
+		}
+		if (best >= 0)
+		{
+			entries[best].in_use = true;
+			entries[best].last_use = ++use_counter;
+			reused_count++;
+		}
+		return best;
+	}
+
+	// Returns the least recently used free session that the backend must destroy before a new session is added, or -1 if the new session fits
+	int evict()
+	{
+		if (session_count() < max_sessions)
+			return -1;
+		int oldest = -1;
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i)
+		{
+			const Entry& entry = entries[i];
+			if (!entry.valid || entry.in_use)
+				continue;
+			if (oldest < 0 || entry.last_use < entries[oldest].last_use)
+			{
+				oldest = (int)i;
+			}
+		}
+		if (oldest >= 0)
+		{
+			entries[oldest].valid = false;
+			evicted_count++;
+		}
+		return oldest;
+	}
+
+	// Registers a session that the backend created with the key, and marks it in use
+	//	returns the index of the session, this is where the backend must store it
+	uint32_t add(const Key& key)
+	{
+		uint32_t index = 0;
+		while (index < (uint32_t)entries.size() && entries[index].valid)
+		{
+			index++;
+		}
+		if (index == (uint32_t)entries.size())
+		{
+			entries.emplace_back();
+		}
+		Entry& entry = entries[index];
+		entry.key = key;
+		entry.valid = true;
+		entry.in_use = true;
+		entry.last_use = ++use_counter;
+		created_count++;
+		return index;
+	}
+
+	// Returns a compatible session that is marked in use, the backend creates a new one if there is no free compatible session
+	//	reused: optional, set to true if an existing session was returned, then only the session parameters need to be updated
+	uint32_t acquire(Backend& backend, const Key& key, bool* reused = nullptr)
+	{
+		const int found = find(key);
+		if (reused != nullptr)
+		{
+			*reused = found >= 0;
+		}
+		if (found >= 0)
+			return (uint32_t)found;
+		for (int evicted = evict(); evicted >= 0; evicted = evict())
+		{
+			backend.destroy_session((uint32_t)evicted);
+		}
+		const uint32_t session = add(key);
+		backend.create_session(session, key);
+		return session;
+	}
+
+	// The video that used the session finished, the session can be reused by the next compatible video
+	void release(uint32_t session)
+	{
+		assert(session < entries.size() && entries[session].valid && entries[session].in_use);
+		entries[session].in_use = false;
+		entries[session].last_use = ++use_counter;
+	}
+
+	// Destroys every session, none of them can be in use
+	void clear(Backend& backend)
+	{
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i)
+		{
+			if (!entries[i].valid)
+				continue;
+			assert(!entries[i].in_use);
+			backend.destroy_session(i);
+		}
+		entries.clear();
+	}
+
+	void print_statistics() const
+	{
+		printf("Session pool: sessions: %u (limit: %u), created: %llu, reused: %llu, evicted: %llu\n", session_count(), max_sessions, (unsigned long long)created_count, (unsigned long long)reused_count, (unsigned long long)evicted_count);
+	}
+};
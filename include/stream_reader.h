@@ -0,0 +1,316 @@
+// Minimal non-seekable stream reader utility for live Annex-B H264 input
+//
+// What this does:
+//	- reads from stdin ("-"), a pipe or a FIFO without blocking the caller
+//	- received bytes are stored in a ring buffer, the NAL unit start codes are searched incrementally, so every byte is scanned only once
+//	- complete NAL units are copied out of the ring buffer, a NAL unit is complete when the next start code arrives (or the stream ends)
+//
+// How to use:
+//	StreamReader stream;
+//	stream.open("-"); // stdin
+//	while (stream.update()) // read what is available without blocking, returns false when the stream ended and everything was consumed
+//	{
+//		std::vector<uint8_t> nal;
+//		while (stream.next_nal(nal)) // appends the NAL unit payload (without start code) to the vector
+//		{
+//			...
+//			nal.clear();
+//		}
+//		stream.wait(10); // optionally sleep until more data arrives
+//	}
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#endif // _WIN32
+
+struct StreamReader
+{
+	uint64_t capacity = 4ull * 1024ull * 1024ull; // initial ring buffer size, it must be a power of two and it is doubled if a single NAL unit doesn't fit, must be set before open()
+
+	StreamReader() = default;
+	StreamReader(const StreamReader&) = delete;
+	StreamReader& operator=(const StreamReader&) = delete;
+	~StreamReader() { close(); }
+
+	// Returns true if the file name refers to a stream that can't be seeked: "-" means stdin, otherwise pipes and FIFOs are detected
+	static bool is_stream(const char* filename)
+	{
+		if (std::strcmp(filename, "-") == 0)
+			return true;
+#ifdef _WIN32
+		return std::strncmp(filename, "\\\\.\\pipe\\", 9) == 0;
+#else
+		struct stat st = {};
+		return stat(filename, &st) == 0 && S_ISFIFO(st.st_mode);
+#endif // _WIN32
+	}
+
+	bool open(const char* filename)
+	{
+		close();
+		const bool use_stdin = std::strcmp(filename, "-") == 0;
+#ifdef _WIN32
+		if (use_stdin)
+		{
+			handle = GetStdHandle(STD_INPUT_HANDLE);
+			owns_handle = false;
+		}
+		else
+		{
+			handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			owns_handle = true;
+		}
+		if (handle == INVALID_HANDLE_VALUE || handle == nullptr)
+		{
+			handle = INVALID_HANDLE_VALUE;
+			return false;
+		}
+#else
+		if (use_stdin)
+		{
+			fd = STDIN_FILENO;
+			owns_fd = false;
+		}
+		else
+		{
+			// Opening a FIFO blocks until the writer side is also opened, this is intended because the stream can't start without it:
+			fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+			owns_fd = true;
+		}
+		if (fd < 0)
+			return false;
+		const int flags = fcntl(fd, F_GETFL);
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif // _WIN32
+		capacity = std::max(uint64_t(4096), capacity);
+		assert((capacity & (capacity - 1)) == 0);
+		ring.resize(capacity);
+		read_pos = 0;
+		write_pos = 0;
+		scan_pos = 0;
+		zero_count = 0;
+		nal_begin = 0;
+		nal_found = false;
+		ended = false;
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (handle != INVALID_HANDLE_VALUE && owns_handle)
+		{
+			CloseHandle(handle);
+		}
+		handle = INVALID_HANDLE_VALUE;
+#else
+		if (fd >= 0)
+		{
+			const int flags = fcntl(fd, F_GETFL);
+			fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+			if (owns_fd)
+			{
+				::close(fd);
+			}
+		}
+		fd = -1;
+#endif // _WIN32
+		ring.clear();
+		ended = true;
+	}
+
+	// Reads all the data that is available without blocking, returns false when the stream ended and all NAL units were consumed
+	bool update()
+	{
+		while (!ended)
+		{
+			if (write_pos - read_pos == ring.size())
+			{
+				if (scan_pos != write_pos)
+					break; // the consumer needs to call next_nal() to make space
+				grow(); // everything was scanned but there is no complete NAL unit, so a single NAL unit is larger than the whole ring buffer
+			}
+			const uint64_t mask = ring.size() - 1;
+			const uint64_t write_index = write_pos & mask;
+			const uint64_t free_size = ring.size() - (write_pos - read_pos);
+			const uint64_t contiguous_size = std::min(free_size, ring.size() - write_index);
+			const int64_t result = read_some(ring.data() + write_index, contiguous_size);
+			if (result <= 0)
+				break;
+			write_pos += (uint64_t)result;
+		}
+		return !ended || nal_found || scan_pos != write_pos;
+	}
+
+	// Waits until there is data to read or the timeout expires
+	void wait(uint32_t milliseconds)
+	{
+		if (ended)
+			return;
+#ifdef _WIN32
+		// Anonymous pipes can't be waited on, so this only yields for a short time and the caller will poll again:
+		Sleep(std::min(milliseconds, 1u));
+#else
+		pollfd pfd = {};
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		poll(&pfd, 1, (int)milliseconds);
+#endif // _WIN32
+	}
+
+	// Finds the next complete NAL unit and appends its payload to dst, returns false if there is no complete NAL unit yet
+	bool next_nal(std::vector<uint8_t>& dst)
+	{
+		const uint64_t mask = ring.size() - 1;
+		while (scan_pos < write_pos)
+		{
+			const uint8_t value = ring[scan_pos & mask];
+			scan_pos++;
+			if (value == 0)
+			{
+				zero_count++;
+				continue;
+			}
+			const bool start_code = value == 1 && zero_count >= 2;
+			const uint32_t zeros = zero_count;
+			zero_count = 0;
+			if (!start_code)
+				continue;
+
+			// The zero bytes before the start code are either part of a 4 byte start code or trailing zeros, they are not part of the NAL unit:
+			const bool complete = nal_found;
+			const uint64_t nal_end = scan_pos - 1 - zeros;
+			if (complete)
+			{
+				copy_out(dst, nal_begin, nal_end);
+			}
+			nal_begin = scan_pos;
+			nal_found = true;
+			read_pos = nal_begin;
+			if (complete)
+				return true;
+		}
+		if (!nal_found)
+		{
+			// Garbage before the first start code is discarded:
+			read_pos = scan_pos - std::min(uint64_t(zero_count), scan_pos - read_pos);
+		}
+		if (ended && nal_found && scan_pos == write_pos)
+		{
+			// The last NAL unit is completed by the end of stream:
+			copy_out(dst, nal_begin, write_pos - zero_count);
+			nal_found = false;
+			read_pos = write_pos;
+			return true;
+		}
+		return false;
+	}
+
+	// Returns true if the writer side of the stream was closed
+	constexpr bool is_ended() const { return ended; }
+
+	// Total number of bytes that were received from the stream
+	constexpr uint64_t received() const { return write_pos; }
+
+private:
+	std::vector<uint8_t> ring;
+	uint64_t read_pos = 0; // bytes before this were consumed, everything is an absolute stream position, they are masked when accessing the ring
+	uint64_t write_pos = 0; // bytes are received up to this
+	uint64_t scan_pos = 0; // start codes were searched up to this
+	uint32_t zero_count = 0; // number of consecutive zero bytes before scan_pos
+	uint64_t nal_begin = 0; // start of the current NAL unit payload, valid if nal_found is true
+	bool nal_found = false;
+	bool ended = true;
+
+	void copy_out(std::vector<uint8_t>& dst, uint64_t begin, uint64_t end)
+	{
+		if (end <= begin)
+			return;
+		const uint64_t mask = ring.size() - 1;
+		const uint64_t size = end - begin;
+		const uint64_t begin_index = begin & mask;
+		const uint64_t first_size = std::min(size, ring.size() - begin_index);
+		const size_t dst_offset = dst.size();
+		dst.resize(dst.size() + size);
+		std::memcpy(dst.data() + dst_offset, ring.data() + begin_index, first_size);
+		std::memcpy(dst.data() + dst_offset + first_size, ring.data(), size - first_size);
+	}
+
+	void grow()
+	{
+		// The absolute positions stay valid, only the data is rearranged to the new mask:
+		std::vector<uint8_t> bigger(ring.size() * 2);
+		const uint64_t mask = bigger.size() - 1;
+		for (uint64_t pos = read_pos; pos < write_pos; ++pos)
+		{
+			bigger[pos & mask] = ring[pos & (ring.size() - 1)];
+		}
+		ring.swap(bigger);
+	}
+
+#ifdef _WIN32
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	bool owns_handle = false;
+
+	int64_t read_some(uint8_t* dst, uint64_t size)
+	{
+		DWORD available = 0;
+		if (PeekNamedPipe(handle, nullptr, 0, nullptr, &available, nullptr))
+		{
+			if (available == 0)
+				return 0;
+			size = std::min(size, uint64_t(available));
+		}
+		else if (GetLastError() == ERROR_BROKEN_PIPE)
+		{
+			ended = true;
+			return 0;
+		}
+		// If the handle is not a pipe (redirected file), the read will block, but then the data is already available
+		DWORD read_size = 0;
+		if (!ReadFile(handle, dst, (DWORD)std::min(size, uint64_t(1u << 30)), &read_size, nullptr) || read_size == 0)
+		{
+			ended = true;
+			return 0;
+		}
+		return (int64_t)read_size;
+	}
+#else
+	int fd = -1;
+	bool owns_fd = false;
+
+	int64_t read_some(uint8_t* dst, uint64_t size)
+	{
+		for (;;)
+		{
+			const ssize_t result = ::read(fd, dst, (size_t)std::min(size, uint64_t(1u << 30)));
+			if (result > 0)
+				return (int64_t)result;
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return 0;
+			ended = true; // end of stream or error
+			return 0;
+		}
+	}
+#endif // _WIN32
+};
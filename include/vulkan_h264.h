@@ -0,0 +1,286 @@
+// Vulkan H264 parameter translation, without the Vulkan device
+//
+// What this does:
+//	- converts the h264::SPS and h264::PPS of a video to the StdVideoH264SequenceParameterSet and StdVideoH264PictureParameterSet of the Vulkan video session parameters once, when the video is loaded
+//	- keeps the reference slot arrays of the DPB (VkVideoReferenceSlotInfoKHR, VkVideoPictureResourceInfoKHR, VkVideoDecodeH264DpbSlotInfoKHR, StdVideoDecodeH264ReferenceInfo) alive for the whole playback, their pointers and constant fields are filled once
+//	- for every frame only the reference info of the slots that the frame references or writes is updated, so the per-frame work scales with the number of active references instead of the DPB size
+//	- it only uses the types of the Vulkan headers, no Vulkan functions, so it can be run without a Vulkan device (mini_video_null.exe -vulkan compares it with refilling every slot)
+//
+// How to use:
+//	VulkanParametersH264 parameters; // it contains pointers to itself, so it must not be copied or moved after init_slots()
+//	parameters.convert(video, max_level_idc);
+//	VkVideoDecodeH264SessionParametersAddInfoKHR add_info = parameters.add_info(); // for vkCreateVideoSessionParametersKHR
+//	parameters.init_slots(video.num_dpb_slots, coded_extent, dpb_image_view);
+//	// For every decode command:
+//	parameters.update_slots(decode, core.dpb);
+//	// begin coding with parameters.reference_slots (decode.reference_count + 1 slots, the last one is the setup slot with slotIndex = -1)
+//	// decode with parameters.reference_slots (decode.reference_count slots) and parameters.reference_slot_infos[decode.current_slot] as the setup slot
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#ifndef VK_NO_PROTOTYPES
+#define VK_NO_PROTOTYPES // only the types are used, the functions are loaded by volk in the Vulkan backend
+#endif // VK_NO_PROTOTYPES
+#include "vulkan/vulkan_core.h"
+
+#include "common.h"
+#include "decoder_core.h"
+
+struct VulkanParametersH264
+{
+	static constexpr uint32_t max_slots = DecodedPictureBuffer::max_slots;
+
+	// Parameter sets, the vectors are not resized after convert(), because the SPS and PPS point into them:
+	std::vector<StdVideoH264PictureParameterSet> pps_array_h264;
+	std::vector<StdVideoH264ScalingLists> scalinglist_array_h264;
+	std::vector<StdVideoH264SequenceParameterSet> sps_array_h264;
+	std::vector<StdVideoH264SequenceParameterSetVui> vui_array_h264;
+	std::vector<StdVideoH264HrdParameters> hrd_array_h264;
+
+	// Reference slots of the DPB, indexed by DPB slot:
+	VkVideoReferenceSlotInfoKHR reference_slot_infos[max_slots] = {};
+	VkVideoPictureResourceInfoKHR reference_slot_pictures[max_slots] = {};
+	VkVideoDecodeH264DpbSlotInfoKHR dpb_slots_h264[max_slots] = {};
+	StdVideoDecodeH264ReferenceInfo reference_infos_h264[max_slots] = {};
+
+	// The slots of the current frame: its references, then its setup slot with slotIndex = -1:
+	VkVideoReferenceSlotInfoKHR reference_slots[max_slots + 1] = {};
+
+	// Returns the Vulkan level of the level_idc of the SPS
+	static StdVideoH264LevelIdc level(int level_idc)
+	{
+		static constexpr int levels[] = { 10, 11, 12, 13, 20, 21, 22, 30, 31, 32, 40, 41, 42, 50, 51, 52, 60, 61, 62 }; // in the order of StdVideoH264LevelIdc
+		if (level_idc == 0 || level_idc == 9)
+			return STD_VIDEO_H264_LEVEL_IDC_1_0; // level 1b is decoded as level 1.0
+		for (uint32_t i = 0; i < arraysize(levels); ++i)
+		{
+			if (levels[i] == level_idc)
+				return (StdVideoH264LevelIdc)i;
+		}
+		assert(0);
+		return STD_VIDEO_H264_LEVEL_IDC_INVALID;
+	}
+
+	// Converts the parameter sets of the video
+	//	max_level_idc: the maximum level of the decoder, from VkVideoDecodeH264CapabilitiesKHR
+	void convert(const Video& video, StdVideoH264LevelIdc max_level_idc = STD_VIDEO_H264_LEVEL_IDC_6_2)
+	{
+		pps_array_h264.assign(video.pps_array.size(), {});
+		scalinglist_array_h264.assign(video.pps_array.size(), {});
+		for (uint32_t i = 0; i < pps_array_h264.size(); ++i)
+		{
+			const h264::PPS& pps = video.pps_array[i];
+			StdVideoH264PictureParameterSet& vk_pps = pps_array_h264[i];
+			StdVideoH264ScalingLists& vk_scalinglist = scalinglist_array_h264[i];
+
+			vk_pps.flags.transform_8x8_mode_flag = pps.transform_8x8_mode_flag;
+			vk_pps.flags.redundant_pic_cnt_present_flag = pps.redundant_pic_cnt_present_flag;
+			vk_pps.flags.constrained_intra_pred_flag = pps.constrained_intra_pred_flag;
+			vk_pps.flags.deblocking_filter_control_present_flag = pps.deblocking_filter_control_present_flag;
+			vk_pps.flags.weighted_pred_flag = pps.weighted_pred_flag;
+			vk_pps.flags.bottom_field_pic_order_in_frame_present_flag = pps.pic_order_present_flag;
+			vk_pps.flags.entropy_coding_mode_flag = pps.entropy_coding_mode_flag;
+			vk_pps.flags.pic_scaling_matrix_present_flag = pps.pic_scaling_matrix_present_flag;
+
+			vk_pps.seq_parameter_set_id = pps.seq_parameter_set_id;
+			vk_pps.pic_parameter_set_id = pps.pic_parameter_set_id;
+			vk_pps.num_ref_idx_l0_default_active_minus1 = pps.num_ref_idx_l0_active_minus1;
+			vk_pps.num_ref_idx_l1_default_active_minus1 = pps.num_ref_idx_l1_active_minus1;
+			vk_pps.weighted_bipred_idc = (StdVideoH264WeightedBipredIdc)pps.weighted_bipred_idc;
+			vk_pps.pic_init_qp_minus26 = pps.pic_init_qp_minus26;
+			vk_pps.pic_init_qs_minus26 = pps.pic_init_qs_minus26;
+			vk_pps.chroma_qp_index_offset = pps.chroma_qp_index_offset;
+			vk_pps.second_chroma_qp_index_offset = pps.second_chroma_qp_index_offset;
+
+			vk_pps.pScalingLists = &vk_scalinglist;
+			for (uint32_t j = 0; j < arraysize(pps.pic_scaling_list_present_flag); ++j)
+			{
+				vk_scalinglist.scaling_list_present_mask |= pps.pic_scaling_list_present_flag[j] << j;
+			}
+			for (uint32_t j = 0; j < arraysize(pps.UseDefaultScalingMatrix4x4Flag); ++j)
+			{
+				vk_scalinglist.use_default_scaling_matrix_mask |= pps.UseDefaultScalingMatrix4x4Flag[j] << j;
+			}
+			for (uint32_t j = 0; j < arraysize(pps.ScalingList4x4); ++j)
+			{
+				std::copy(pps.ScalingList4x4[j], pps.ScalingList4x4[j] + arraysize(pps.ScalingList4x4[j]), vk_scalinglist.ScalingList4x4[j]);
+			}
+			for (uint32_t j = 0; j < arraysize(pps.ScalingList8x8); ++j)
+			{
+				std::copy(pps.ScalingList8x8[j], pps.ScalingList8x8[j] + arraysize(pps.ScalingList8x8[j]), vk_scalinglist.ScalingList8x8[j]);
+			}
+		}
+
+		sps_array_h264.assign(video.sps_array.size(), {});
+		vui_array_h264.assign(video.sps_array.size(), {});
+		hrd_array_h264.assign(video.sps_array.size(), {});
+		for (uint32_t i = 0; i < sps_array_h264.size(); ++i)
+		{
+			const h264::SPS& sps = video.sps_array[i];
+			StdVideoH264SequenceParameterSet& vk_sps = sps_array_h264[i];
+
+			vk_sps.flags.constraint_set0_flag = sps.constraint_set0_flag;
+			vk_sps.flags.constraint_set1_flag = sps.constraint_set1_flag;
+			vk_sps.flags.constraint_set2_flag = sps.constraint_set2_flag;
+			vk_sps.flags.constraint_set3_flag = sps.constraint_set3_flag;
+			vk_sps.flags.constraint_set4_flag = sps.constraint_set4_flag;
+			vk_sps.flags.constraint_set5_flag = sps.constraint_set5_flag;
+			vk_sps.flags.direct_8x8_inference_flag = sps.direct_8x8_inference_flag;
+			vk_sps.flags.mb_adaptive_frame_field_flag = sps.mb_adaptive_frame_field_flag;
+			vk_sps.flags.frame_mbs_only_flag = sps.frame_mbs_only_flag;
+			vk_sps.flags.delta_pic_order_always_zero_flag = sps.delta_pic_order_always_zero_flag;
+			vk_sps.flags.separate_colour_plane_flag = sps.separate_colour_plane_flag;
+			vk_sps.flags.gaps_in_frame_num_value_allowed_flag = sps.gaps_in_frame_num_value_allowed_flag;
+			vk_sps.flags.qpprime_y_zero_transform_bypass_flag = sps.qpprime_y_zero_transform_bypass_flag;
+			vk_sps.flags.frame_cropping_flag = sps.frame_cropping_flag;
+			vk_sps.flags.seq_scaling_matrix_present_flag = sps.seq_scaling_matrix_present_flag;
+			vk_sps.flags.vui_parameters_present_flag = sps.vui_parameters_present_flag;
+
+			if (vk_sps.flags.vui_parameters_present_flag)
+			{
+				StdVideoH264SequenceParameterSetVui& vk_vui = vui_array_h264[i];
+				vk_sps.pSequenceParameterSetVui = &vk_vui;
+				vk_vui.flags.aspect_ratio_info_present_flag = sps.vui.aspect_ratio_info_present_flag;
+				vk_vui.flags.overscan_info_present_flag = sps.vui.overscan_info_present_flag;
+				vk_vui.flags.overscan_appropriate_flag = sps.vui.overscan_appropriate_flag;
+				vk_vui.flags.video_signal_type_present_flag = sps.vui.video_signal_type_present_flag;
+				vk_vui.flags.video_full_range_flag = sps.vui.video_full_range_flag;
+				vk_vui.flags.color_description_present_flag = sps.vui.colour_description_present_flag;
+				vk_vui.flags.chroma_loc_info_present_flag = sps.vui.chroma_loc_info_present_flag;
+				vk_vui.flags.timing_info_present_flag = sps.vui.timing_info_present_flag;
+				vk_vui.flags.fixed_frame_rate_flag = sps.vui.fixed_frame_rate_flag;
+				vk_vui.flags.bitstream_restriction_flag = sps.vui.bitstream_restriction_flag;
+				vk_vui.flags.nal_hrd_parameters_present_flag = sps.vui.nal_hrd_parameters_present_flag;
+				vk_vui.flags.vcl_hrd_parameters_present_flag = sps.vui.vcl_hrd_parameters_present_flag;
+
+				vk_vui.aspect_ratio_idc = (StdVideoH264AspectRatioIdc)sps.vui.aspect_ratio_idc;
+				vk_vui.sar_width = sps.vui.sar_width;
+				vk_vui.sar_height = sps.vui.sar_height;
+				vk_vui.video_format = sps.vui.video_format;
+				vk_vui.colour_primaries = sps.vui.colour_primaries;
+				vk_vui.transfer_characteristics = sps.vui.transfer_characteristics;
+				vk_vui.matrix_coefficients = sps.vui.matrix_coefficients;
+				vk_vui.num_units_in_tick = sps.vui.num_units_in_tick;
+				vk_vui.time_scale = sps.vui.time_scale;
+				vk_vui.max_num_reorder_frames = sps.vui.num_reorder_frames;
+				vk_vui.max_dec_frame_buffering = sps.vui.max_dec_frame_buffering;
+				vk_vui.chroma_sample_loc_type_top_field = sps.vui.chroma_sample_loc_type_top_field;
+				vk_vui.chroma_sample_loc_type_bottom_field = sps.vui.chroma_sample_loc_type_bottom_field;
+
+				StdVideoH264HrdParameters& vk_hrd = hrd_array_h264[i];
+				vk_vui.pHrdParameters = &vk_hrd;
+				vk_hrd.cpb_cnt_minus1 = sps.hrd.cpb_cnt_minus1;
+				vk_hrd.bit_rate_scale = sps.hrd.bit_rate_scale;
+				vk_hrd.cpb_size_scale = sps.hrd.cpb_size_scale;
+				for (uint32_t j = 0; j < arraysize(sps.hrd.bit_rate_value_minus1); ++j)
+				{
+					vk_hrd.bit_rate_value_minus1[j] = sps.hrd.bit_rate_value_minus1[j];
+					vk_hrd.cpb_size_value_minus1[j] = sps.hrd.cpb_size_value_minus1[j];
+					vk_hrd.cbr_flag[j] = sps.hrd.cbr_flag[j];
+				}
+				vk_hrd.initial_cpb_removal_delay_length_minus1 = sps.hrd.initial_cpb_removal_delay_length_minus1;
+				vk_hrd.cpb_removal_delay_length_minus1 = sps.hrd.cpb_removal_delay_length_minus1;
+				vk_hrd.dpb_output_delay_length_minus1 = sps.hrd.dpb_output_delay_length_minus1;
+				vk_hrd.time_offset_length = sps.hrd.time_offset_length;
+			}
+
+			vk_sps.profile_idc = (StdVideoH264ProfileIdc)sps.profile_idc;
+			vk_sps.level_idc = level(sps.level_idc);
+			assert(vk_sps.level_idc <= max_level_idc);
+			//vk_sps.chroma_format_idc = (StdVideoH264ChromaFormatIdc)sps.chroma_format_idc;
+			vk_sps.chroma_format_idc = STD_VIDEO_H264_CHROMA_FORMAT_IDC_420; // only one we support currently
+			vk_sps.seq_parameter_set_id = sps.seq_parameter_set_id;
+			vk_sps.bit_depth_luma_minus8 = sps.bit_depth_luma_minus8;
+			vk_sps.bit_depth_chroma_minus8 = sps.bit_depth_chroma_minus8;
+			vk_sps.log2_max_frame_num_minus4 = sps.log2_max_frame_num_minus4;
+			vk_sps.pic_order_cnt_type = (StdVideoH264PocType)sps.pic_order_cnt_type;
+			vk_sps.offset_for_non_ref_pic = sps.offset_for_non_ref_pic;
+			vk_sps.offset_for_top_to_bottom_field = sps.offset_for_top_to_bottom_field;
+			vk_sps.log2_max_pic_order_cnt_lsb_minus4 = sps.log2_max_pic_order_cnt_lsb_minus4;
+			vk_sps.num_ref_frames_in_pic_order_cnt_cycle = sps.num_ref_frames_in_pic_order_cnt_cycle;
+			vk_sps.max_num_ref_frames = sps.num_ref_frames;
+			vk_sps.pic_width_in_mbs_minus1 = sps.pic_width_in_mbs_minus1;
+			vk_sps.pic_height_in_map_units_minus1 = sps.pic_height_in_map_units_minus1;
+			vk_sps.frame_crop_left_offset = sps.frame_crop_left_offset;
+			vk_sps.frame_crop_right_offset = sps.frame_crop_right_offset;
+			vk_sps.frame_crop_top_offset = sps.frame_crop_top_offset;
+			vk_sps.frame_crop_bottom_offset = sps.frame_crop_bottom_offset;
+			vk_sps.pOffsetForRefFrame = sps.offset_for_ref_frame;
+		}
+	}
+
+	// Returns the parameter sets for the session parameters, the converted arrays must stay alive while it's used
+	VkVideoDecodeH264SessionParametersAddInfoKHR add_info() const
+	{
+		VkVideoDecodeH264SessionParametersAddInfoKHR info = {};
+		info.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_H264_SESSION_PARAMETERS_ADD_INFO_KHR;
+		info.stdPPSCount = (uint32_t)pps_array_h264.size();
+		info.pStdPPSs = pps_array_h264.data();
+		info.stdSPSCount = (uint32_t)sps_array_h264.size();
+		info.pStdSPSs = sps_array_h264.data();
+		return info;
+	}
+
+	// Fills the constant parts of the reference slots, every slot is a layer of the DPB image
+	void init_slots(uint32_t num_slots, VkExtent2D coded_extent, VkImageView image_view)
+	{
+		assert(num_slots <= max_slots);
+		for (uint32_t i = 0; i < num_slots; ++i)
+		{
+			VkVideoReferenceSlotInfoKHR& slot = reference_slot_infos[i];
+			VkVideoPictureResourceInfoKHR& pic = reference_slot_pictures[i];
+			VkVideoDecodeH264DpbSlotInfoKHR& dpb = dpb_slots_h264[i];
+			StdVideoDecodeH264ReferenceInfo& ref = reference_infos_h264[i];
+
+			slot = {};
+			slot.sType = VK_STRUCTURE_TYPE_VIDEO_REFERENCE_SLOT_INFO_KHR;
+			slot.pPictureResource = &pic;
+			slot.slotIndex = i;
+			slot.pNext = &dpb;
+
+			pic = {};
+			pic.sType = VK_STRUCTURE_TYPE_VIDEO_PICTURE_RESOURCE_INFO_KHR;
+			pic.codedOffset.x = 0;
+			pic.codedOffset.y = 0;
+			pic.codedExtent = coded_extent;
+			pic.baseArrayLayer = i;
+			pic.imageViewBinding = image_view;
+
+			dpb = {};
+			dpb.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_H264_DPB_SLOT_INFO_KHR;
+			dpb.pStdReferenceInfo = &ref;
+
+			ref = {};
+			ref.flags.bottom_field_flag = 0;
+			ref.flags.top_field_flag = 0;
+			ref.flags.is_non_existing = 0;
+		}
+	}
+
+	// Updates the reference info of one slot from the DPB:
+	void update_slot(uint32_t slot, const DecodedPictureBuffer& dpb)
+	{
+		StdVideoDecodeH264ReferenceInfo& ref = reference_infos_h264[slot];
+		ref.flags.used_for_long_term_reference = dpb.longterm_status[slot] ? 1 : 0;
+		ref.FrameNum = (uint16_t)dpb.framenum_status[slot];
+		ref.PicOrderCnt[0] = dpb.poc_status[slot];
+		ref.PicOrderCnt[1] = dpb.poc_status[slot];
+	}
+
+	// Updates the slots that the decode command references or writes, and fills reference_slots
+	void update_slots(const VideoDecoderCore::DecodeCommand& decode, const DecodedPictureBuffer& dpb)
+	{
+		for (uint32_t i = 0; i < decode.reference_count; ++i)
+		{
+			const uint32_t slot = decode.reference_slots[i];
+			update_slot(slot, dpb);
+			reference_slots[i] = reference_slot_infos[slot];
+		}
+		update_slot(decode.current_slot, dpb);
+		reference_slots[decode.reference_count] = reference_slot_infos[decode.current_slot];
+		reference_slots[decode.reference_count].slotIndex = -1;
+	}
+};
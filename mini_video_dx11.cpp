@@ -1,4 +1,6 @@
 #include "include/common.h"
+#include "include/decoder_core.h"
+#include "include/presentation_clock.h"
 
 #include <d3d11_3.h>
 #include <dxgi1_3.h>
@@ -21,8 +23,10 @@ int main(int argc, char* argv[])
 		printf("Loading test.mp4 because file name was not provided with a startup argument\n");
 	}
 
+	// The video is loaded from an MP4 file, or received as a raw H264 stream if the argument is "-" (stdin) or a pipe:
+	const char* filename = argc > 1 ? argv[argc - 1] : "test.mp4";
 	Video video;
-	if (!video.Load_mp4(argc > 1 ? argv[argc - 1] : "test.mp4"))
+	if (StreamReader::is_stream(filename) ? !video.Open_h264_stream(filename) : !video.Load_mp4(filename))
 	{
 		printf("Video load failure, exiting.\n");
 		return -1;
@@ -34,7 +38,14 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	printf("Video was loaded successfully and contains %d frames in total.\n", (int)video.frame_infos.size());
+	if (video.live)
+	{
+		printf("Live stream was opened successfully, frames will be decoded as they are received.\n");
+	}
+	else
+	{
+		printf("Video was loaded successfully and contains %d frames in total.\n", (int)video.frame_infos.size());
+	}
 
 	// Below this will be all the DirectX 12 code:
 	using namespace Microsoft::WRL;
@@ -225,8 +236,6 @@ int main(int argc, char* argv[])
 		ComPtr<ID3D11VideoDecoderOutputView> decoder_view;
 		ComPtr<ID3D11ShaderResourceView> decoder_srv_luminance;
 		ComPtr<ID3D11ShaderResourceView> decoder_srv_chrominance;
-		int display_order = -1;
-		int frame_index = 0;
 		void create(ID3D11Device* device, ID3D11VideoDevice* video_device, uint32_t padded_width, uint32_t padded_height)
 		{
 			D3D11_TEXTURE2D_DESC texture_desc = {};
@@ -260,9 +269,8 @@ int main(int argc, char* argv[])
 			assert(SUCCEEDED(hr));
 		}
 	};
-	std::vector<DecodeResultReordered> reordered_results_free; // free image slots that can be reused as reordering image displaying
-	std::vector<DecodeResultReordered> reordered_results_working; // image slots that are currently in use for reordering
-	DecodeResultReordered displayed_image; // the latest reordered picture
+	std::vector<DecodeResultReordered> reordered_pictures; // textures of the VideoDecoderCore::pictures, used for reordering decoded images to display order
+	const DecodeResultReordered no_picture; // used for displaying before the first picture is available
 
 	// Create constant buffer:
 	ComPtr<ID3D11Buffer> constant_buffer;
@@ -386,7 +394,33 @@ int main(int argc, char* argv[])
 		assert(SUCCEEDED(hr));
 	}
 
+	// The decoder core can decode ahead of the display, the completion of each decode in flight is tracked by an event query:
+	VideoDecoderCore core;
+	core.video = &video;
+	const uint32_t decode_frames_in_flight = core.enable_decode_ahead(4);
+	core.enable_loop_preroll(8); // the first GOP of the next loop is decoded ahead while the end of the loop is displayed, so looping doesn't stall on the intra frame
+	std::vector<ComPtr<ID3D11Query>> decode_queries(decode_frames_in_flight); // the index of these is the decode context
+	for (auto& x : decode_queries)
+	{
+		D3D11_QUERY_DESC query_desc = {};
+		query_desc.Query = D3D11_QUERY_EVENT;
+		hr = device->CreateQuery(&query_desc, &x);
+		assert(SUCCEEDED(hr));
+	}
+	uint32_t decode_submit_count = 0;
+
+	// All the reordering pictures that the stream needs are created up front, so that no textures are created during playback:
+	reordered_pictures.resize(core.reserve_pictures());
+	for (DecodeResultReordered& x : reordered_pictures)
+	{
+		x.create(device.Get(), video_device.Get(), video.padded_width, video.padded_height);
+	}
+
 	// Do the display frame loop:
+	video.timer.record();
+	PresentationClock presentation_clock;
+	presentation_clock.refresh_period = 0; // the refresh rate is not known, it's measured from the vsyncs
+	presentation_clock.start(0);
 	bool exiting = false;
 	while (!exiting)
 	{
@@ -404,42 +438,31 @@ int main(int argc, char* argv[])
 			continue;
 		}
 
-		if (video.frameIndex == 0)
+		if (video.live)
 		{
-			// At video beginning, reset the state of picture display reordering: 
-			for (DecodeResultReordered& used : reordered_results_working)
-			{
-				used.display_order = -1;
-				reordered_results_free.push_back(used);
-			}
-			reordered_results_working.clear();
-			video.target_display_order = 0;
+			// Receive the next access units of the live stream without blocking:
+			video.Update_h264_stream();
 		}
 
-		bool must_decode = true;
-		for (auto& x : reordered_results_working)
+		// The decodes in flight complete in submission order, the oldest one's context is the submit count minus the in flight count:
+		while (!core.decoding_pictures.empty())
 		{
-			if (x.display_order == video.target_display_order)
-				must_decode = false;
+			const uint32_t context = uint32_t((decode_submit_count - core.decoding_pictures.size()) % decode_frames_in_flight);
+			BOOL completed = FALSE;
+			if (immediate_context->GetData(decode_queries[context].Get(), &completed, sizeof(completed), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK || !completed)
+				break;
+			core.finish_decode();
 		}
 
-		if (must_decode)
+		// The decoder core decides whether new frames must be decoded, and which DPB slots they use:
+		VideoDecoderCore::DecodeCommand decode;
+		while (core.begin_decode(decode))
 		{
 			// Decoding a new video frame is required:
-			const Video::FrameInfo& frame_info = video.frame_infos[video.frameIndex];
-			const h264::SliceHeader& slice_header = video.slice_headers[video.frameIndex];
-			const h264::PPS& pps = video.pps_array[slice_header.pic_parameter_set_id];
-			const h264::SPS& sps = video.sps_array[pps.seq_parameter_set_id];
-
-			if (frame_info.is_intra)
-			{
-				video.reference_usage.clear();
-				video.next_ref = 0;
-				video.next_slot = 0;
-			}
-			video.current_slot = video.next_slot;
-			video.poc_status[video.current_slot] = frame_info.poc;
-			video.framenum_status[video.current_slot] = slice_header.frame_num;
+			const Video::FrameInfo& frame_info = decode.frame_info;
+			const h264::SliceHeader& slice_header = decode.slice_header;
+			const h264::PPS& pps = *decode.pps;
+			const h264::SPS& sps = *decode.sps;
 
 			DXVA_PicParams_H264 pic_params_h264 = {};
 			DXVA_Qmatrix_H264 qmatrix_h264 = {};
@@ -469,7 +492,7 @@ int main(int argc, char* argv[])
 			{
 				pic_params_h264.CurrPic.AssociatedFlag = 0;
 			}
-			pic_params_h264.CurrPic.Index7Bits = (UCHAR)video.current_slot;
+			pic_params_h264.CurrPic.Index7Bits = (UCHAR)decode.current_slot;
 			pic_params_h264.CurrFieldOrderCnt[0] = frame_info.poc;
 			pic_params_h264.CurrFieldOrderCnt[1] = frame_info.poc;
 			for (uint32_t i = 0; i < 16; ++i)
@@ -479,17 +502,16 @@ int main(int argc, char* argv[])
 				pic_params_h264.FieldOrderCntList[i][1] = 0;
 				pic_params_h264.FrameNumList[i] = 0;
 			}
-			for (size_t i = 0; i < video.reference_usage.size(); ++i)
+			for (uint32_t i = 0; i < decode.reference_count; ++i)
 			{
-				uint32_t ref_slot = video.reference_usage[i];
-				assert(ref_slot != video.current_slot);
-				pic_params_h264.RefFrameList[i].AssociatedFlag = 0; // 0 = short term, 1 = long term reference
+				const uint32_t ref_slot = decode.reference_slots[i];
+				pic_params_h264.RefFrameList[i].AssociatedFlag = core.dpb.longterm_status[ref_slot] ? 1 : 0; // 0 = short term, 1 = long term reference
 				pic_params_h264.RefFrameList[i].Index7Bits = (UCHAR)ref_slot;
-				pic_params_h264.FieldOrderCntList[i][0] = video.poc_status[ref_slot];
-				pic_params_h264.FieldOrderCntList[i][1] = video.poc_status[ref_slot];
+				pic_params_h264.FieldOrderCntList[i][0] = core.dpb.poc_status[ref_slot];
+				pic_params_h264.FieldOrderCntList[i][1] = core.dpb.poc_status[ref_slot];
 				pic_params_h264.UsedForReferenceFlags |= 1 << (i * 2 + 0);
 				pic_params_h264.UsedForReferenceFlags |= 1 << (i * 2 + 1);
-				pic_params_h264.FrameNumList[i] = video.framenum_status[ref_slot];
+				pic_params_h264.FrameNumList[i] = core.dpb.framenum_status[ref_slot];
 			}
 			pic_params_h264.weighted_pred_flag = pps.weighted_pred_flag;
 			pic_params_h264.weighted_bipred_idc = pps.weighted_bipred_idc;
@@ -521,7 +543,7 @@ int main(int argc, char* argv[])
 			pic_params_h264.redundant_pic_cnt_present_flag = pps.redundant_pic_cnt_present_flag;
 			pic_params_h264.slice_group_change_rate_minus1 = pps.slice_group_change_rate_minus1;
 			pic_params_h264.Reserved16Bits = 3; // DXVA spec
-			pic_params_h264.StatusReportFeedbackNumber = (UINT)video.frameIndex + 1; // shall not be 0
+			pic_params_h264.StatusReportFeedbackNumber = (UINT)decode.frame_index + 1; // shall not be 0
 			assert(pic_params_h264.StatusReportFeedbackNumber > 0);
 			pic_params_h264.ContinuationFlag = 1;
 			pic_params_h264.num_ref_idx_l0_active_minus1 = pps.num_ref_idx_l0_active_minus1;
@@ -576,21 +598,16 @@ int main(int argc, char* argv[])
 
 
 			// If decode happened this frame, then copy the latest output to the reordering picture queue:
-			if (reordered_results_free.empty())
+			if (decode.picture_created)
 			{
-				// Request new image, because there is no more free ones that we can use:
-				reordered_results_free.emplace_back();
-				reordered_results_free.back().create(device.Get(), video_device.Get(), video.padded_width, video.padded_height);
+				// Create new texture, because the stream reorders more frames than its SPS declares, so the reserved ones are all in use:
+				assert(decode.picture == (int)reordered_pictures.size());
+				reordered_pictures.emplace_back();
+				reordered_pictures.back().create(device.Get(), video_device.Get(), video.padded_width, video.padded_height);
 			}
 
-			// Copy will be done from decoder output to the newly allocated reordered picture:
-			DecodeResultReordered reordered_current = reordered_results_free.back();
-			reordered_results_free.pop_back();
-			reordered_current.display_order = video.frame_infos[video.frameIndex].display_order;
-			reordered_current.frame_index = video.frameIndex;
-
-			// Current latest reordered is pushed to the reorder working queue:
-			reordered_results_working.push_back(reordered_current);
+			// Decoding will be done directly into the reordered picture that was selected by the decoder core:
+			const DecodeResultReordered& reordered_current = reordered_pictures[decode.picture];
 
 			hr = video_context->DecoderBeginFrame(decoder.Get(), reordered_current.decoder_view.Get(), 0, nullptr);
 			assert(SUCCEEDED(hr));
@@ -645,57 +662,23 @@ int main(int argc, char* argv[])
 			hr = video_context->DecoderEndFrame(decoder.Get());
 			assert(SUCCEEDED(hr));
 
-			printf("Decoded frame_index = %d, display_order: %d\n", video.frameIndex, frame_info.display_order);
+			// The event query is signaled when the GPU finished this decode:
+			immediate_context->End(decode_queries[decode_submit_count % decode_frames_in_flight].Get());
+			decode_submit_count++;
 
-			// DPB slot management:
-			//	When current frame was a reference, then the next frame can not overwrite its DPB slot, so increment next_slot as a ring buffer
-			//	However, the ring buffer will wrap around so older reference frames can be overwritten by this
-			if (frame_info.reference_priority > 0)
-			{
-				if (video.next_ref >= video.reference_usage.size())
-				{
-					video.reference_usage.resize(video.next_ref + 1);
-				}
-				video.reference_usage[video.next_ref] = video.current_slot;
-				video.next_ref = (video.next_ref + 1) % (video.num_dpb_slots - 1);
-				video.next_slot = (video.next_slot + 1) % video.num_dpb_slots;
-			}
-			video.frameIndex = (video.frameIndex + 1) % video.frame_infos.size();
+			printf("Decoded frame_index = %d, display_order: %d\n", decode.frame_index, frame_info.display_order);
+
+			// Current latest reordered is in flight until its event query is signaled:
+			core.end_decode(decode);
 		}
 
-		video.time_until_next_frame -= video.timer.elapsed_seconds();
-		video.timer.record();
-		if (video.time_until_next_frame <= 0)
+		// The displayed picture is swapped when its time comes, the presentation clock selects the picture that is nearest to the next vsync:
+		if (core.update_display(Video::Timer::nanoseconds_to_ticks(presentation_clock.media_time(video.timer.elapsed_nanoseconds()), video.timescale)))
 		{
-			// Search for the next displayable with lowest display order:
-			int display_order_changed = -1;
-			for (int i = 0; i < (int)reordered_results_working.size(); ++i)
-			{
-				if (reordered_results_working[i].display_order == video.target_display_order)
-				{
-					display_order_changed = i;
-				}
-			}
-			if (display_order_changed >= 0)
-			{
-				// Free current output texture:
-				if (displayed_image.texture != nullptr)
-				{
-					reordered_results_free.push_back(displayed_image);
-				}
-				// Take this used texture as current output:
-				displayed_image = std::move(reordered_results_working[display_order_changed]);
-				// Remove this used texture:
-				std::swap(reordered_results_working[display_order_changed], reordered_results_working.back());
-				reordered_results_working.pop_back();
-
-				video.time_until_next_frame = video.frame_infos[displayed_image.frame_index].duration_seconds;
-
-				assert(displayed_image.texture != nullptr);
-				printf("\tDisplayed image changed, frame_index: %d, display_order: %d\n", displayed_image.frame_index, displayed_image.display_order);
-				video.target_display_order++;
-			}
+			const VideoDecoderCore::Picture& picture = core.pictures[core.displayed_picture];
+			printf("\tDisplayed image changed, frame_index: %d, display_order: %d\n", picture.frame_index, picture.display_order);
 		}
+		const DecodeResultReordered& displayed_image = core.displayed_picture >= 0 ? reordered_pictures[core.displayed_picture] : no_picture;
 
 		// Bind shader resources and run the compute shader that resolves YUV to RGB:
 		{
@@ -726,6 +709,7 @@ int main(int argc, char* argv[])
 
 		hr = swapchain->Present(1, 0);
 		assert(SUCCEEDED(hr));
+		presentation_clock.vsync(video.timer.elapsed_nanoseconds()); // the vsync present returns when a vsync made room in the present queue, so it corrects the vsync timeline of the presentation clock
 	}
 
 	return 0;
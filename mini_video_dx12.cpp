@@ -1,4 +1,6 @@
 #include "include/common.h"
+#include "include/decoder_core.h"
+#include "include/presentation_clock.h"
 
 #include <d3d12.h>
 #include <d3d12video.h>
@@ -20,8 +22,10 @@ int main(int argc, char* argv[])
 		printf("Loading test.mp4 because file name was not provided with a startup argument\n");
 	}
 
+	// The video is loaded from an MP4 file, or received as a raw H264 stream if the argument is "-" (stdin) or a pipe:
+	const char* filename = argc > 1 ? argv[argc - 1] : "test.mp4";
 	Video video;
-	if (!video.Load_mp4(argc > 1 ? argv[argc - 1] : "test.mp4"))
+	if (StreamReader::is_stream(filename) ? !video.Open_h264_stream(filename) : !video.Load_mp4(filename))
 	{
 		printf("Video load failure, exiting.\n");
 		return -1;
@@ -33,7 +37,14 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	printf("Video was loaded successfully and contains %d frames in total.\n", (int)video.frame_infos.size());
+	if (video.live)
+	{
+		printf("Live stream was opened successfully, frames will be decoded as they are received.\n");
+	}
+	else
+	{
+		printf("Video was loaded successfully and contains %d frames in total.\n", (int)video.frame_infos.size());
+	}
 
 	// Below this will be all the DirectX 12 code:
 	using namespace Microsoft::WRL;
@@ -145,6 +156,13 @@ int main(int argc, char* argv[])
 		assert(SUCCEEDED(hr));
 	}
 
+	// The decoder core can decode ahead of the display, this returns how many decodes can be in flight on the GPU at the same time:
+	//	Each decode in flight will use its own command allocator, live bitstream region and decode output subresource
+	VideoDecoderCore core;
+	core.video = &video;
+	const uint32_t decode_frames_in_flight = core.enable_decode_ahead(4);
+	core.enable_loop_preroll(8); // the first GOP of the next loop is decoded ahead while the end of the loop is displayed, so looping doesn't stall on the intra frame
+
 	// Create video decoder:
 	ComPtr<ID3D12VideoDecoder> decoder;
 	ComPtr<ID3D12VideoDecoderHeap> decoder_heap;
@@ -221,11 +239,22 @@ int main(int argc, char* argv[])
 
 	// Create bitstream GPU buffer and copy the H264 data into it:
 	ComPtr<ID3D12Resource> bitstream_buffer;
+	void* bitstream_mapped_data = nullptr; // only kept mapped for live streams
+	const uint64_t live_bitstream_region_size = align(video.live_bitstream_size, (uint64_t)D3D12_VIDEO_DECODE_MIN_BITSTREAM_OFFSET_ALIGNMENT);
 	{
 		uint64_t aligned_size = 0;
-		for (Video::FrameInfo& frame_info : video.frame_infos)
+		if (video.live)
 		{
-			aligned_size += align(frame_info.size, (uint64_t)D3D12_VIDEO_DECODE_MIN_BITSTREAM_OFFSET_ALIGNMENT);
+			// For a live stream, the access units are copied one by one before decoding them, because they are not received yet.
+			//	Every decode in flight has its own region, so an access unit is not overwritten while the GPU is still reading it.
+			aligned_size = live_bitstream_region_size * decode_frames_in_flight;
+		}
+		else
+		{
+			for (uint32_t size : video.frame_infos.sizes)
+			{
+				aligned_size += align((uint64_t)size, (uint64_t)D3D12_VIDEO_DECODE_MIN_BITSTREAM_OFFSET_ALIGNMENT);
+			}
 		}
 
 		D3D12_RESOURCE_DESC desc = {};
@@ -247,19 +276,27 @@ int main(int argc, char* argv[])
 		hr = bitstream_buffer->Map(0, nullptr, &mapped_data);
 		assert(SUCCEEDED(hr));
 
-		// Write the slice datas into the aligned offsets, and store the aligned offsets in frame_infos, from here they will be storing offsets into the bitstream buffer, and not the source file:
-		uint64_t aligned_offset = 0;
-		for (Video::FrameInfo& frame_info : video.frame_infos)
+		if (video.live)
 		{
-			std::memcpy((uint8_t*)mapped_data + aligned_offset, video.h264_data.data() + frame_info.offset, frame_info.size); // copy into GPU buffer through mapped_data ptr
-			frame_info.offset = aligned_offset;
-			aligned_offset += align(frame_info.size, (uint64_t)D3D12_VIDEO_DECODE_MIN_BITSTREAM_OFFSET_ALIGNMENT);
+			bitstream_mapped_data = mapped_data; // upload heap can stay mapped
 		}
+		else
+		{
+			// Write the slice datas into the aligned offsets, and store the aligned offsets in frame_infos, from here they will be storing offsets into the bitstream buffer, and not the source file:
+			uint64_t aligned_offset = 0;
+			for (size_t i = 0; i < video.frame_infos.size(); ++i)
+			{
+				const uint64_t size = video.frame_infos.sizes[i];
+				std::memcpy((uint8_t*)mapped_data + aligned_offset, video.h264_data.data() + video.frame_infos.offsets[i], size); // copy into GPU buffer through mapped_data ptr
+				video.frame_infos.offsets[i] = aligned_offset;
+				aligned_offset += align(size, (uint64_t)D3D12_VIDEO_DECODE_MIN_BITSTREAM_OFFSET_ALIGNMENT);
+			}
 
-		// The h264_data is not required any longer to be in RAM because it has been copied to the GPU buffer, so I delete it:
-		video.h264_data.clear();
+			// The h264_data is not required any longer to be in RAM because it has been copied to the GPU buffer, so I delete it:
+			video.h264_data.clear();
 
-		bitstream_buffer->Unmap(0, nullptr);
+			bitstream_buffer->Unmap(0, nullptr);
+		}
 	}
 
 	// Create Decoded Picture Buffer (DPB) texture:
@@ -302,7 +339,7 @@ int main(int argc, char* argv[])
 		desc.Format = decode_format;
 		desc.Width = video.padded_width;
 		desc.Height = video.padded_height;
-		desc.DepthOrArraySize = 1;
+		desc.DepthOrArraySize = decode_frames_in_flight; // one output slice for each decode in flight
 		desc.SampleDesc.Count = 1;
 		desc.MipLevels = 1;
 		D3D12_HEAP_PROPERTIES heap_properties = {};
@@ -316,8 +353,6 @@ int main(int argc, char* argv[])
 	struct DecodeResultReordered
 	{
 		ComPtr<ID3D12Resource> texture;
-		int display_order = -1;
-		int frame_index = 0;
 		void create(ID3D12Device* device, uint32_t padded_width, uint32_t padded_height)
 		{
 			D3D12_RESOURCE_DESC desc = {};
@@ -337,9 +372,15 @@ int main(int argc, char* argv[])
 			assert(SUCCEEDED(hr));
 		}
 	};
-	std::vector<DecodeResultReordered> reordered_results_free; // free image slots that can be reused as reordering image displaying
-	std::vector<DecodeResultReordered> reordered_results_working; // image slots that are currently in use for reordering
-	DecodeResultReordered displayed_image; // the latest reordered picture
+	std::vector<DecodeResultReordered> reordered_pictures; // textures of the VideoDecoderCore::pictures, used for reordering decoded images to display order
+	const DecodeResultReordered no_picture; // used for displaying before the first picture is available
+
+	// All the reordering pictures that the stream needs are created up front, so that no textures are created during playback:
+	reordered_pictures.resize(core.reserve_pictures());
+	for (DecodeResultReordered& x : reordered_pictures)
+	{
+		x.create(device.Get(), video.padded_width, video.padded_height);
+	}
 
 	// Create shader:
 	ComPtr<ID3D12PipelineState> compute_pso;
@@ -444,11 +485,18 @@ int main(int argc, char* argv[])
 	ComPtr<ID3D12CommandQueue> graphics_queue;
 	ComPtr<ID3D12CommandQueue> video_queue;
 	ComPtr<ID3D12CommandAllocator> graphics_command_allocator;
-	ComPtr<ID3D12CommandAllocator> video_command_allocator;
+	std::vector<ComPtr<ID3D12CommandAllocator>> video_command_allocators(decode_frames_in_flight); // every decode in flight uses its own, the index of these is the decode context
 	ComPtr<ID3D12GraphicsCommandList> graphics_cmd;
 	ComPtr<ID3D12VideoDecodeCommandList> video_cmd;
 	ComPtr<ID3D12Fence> graphics_fence;
-	ComPtr<ID3D12Fence> video_fence;
+	ComPtr<ID3D12Fence> video_fence; // every video submit signals it with the number of submitted decodes
+	uint64_t decode_submit_count = 0;
+	struct DecodeInFlight
+	{
+		uint32_t context = 0;
+		uint64_t fence_value = 0; // the decode is completed when video_fence reached this value
+	};
+	std::vector<DecodeInFlight> decodes_in_flight; // in the same order as core.decoding_pictures
 	{
 		D3D12_COMMAND_QUEUE_DESC queue_desc = {};
 		queue_desc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
@@ -459,8 +507,11 @@ int main(int argc, char* argv[])
 		assert(SUCCEEDED(hr));
 		hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&graphics_command_allocator));
 		assert(SUCCEEDED(hr));
-		hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, IID_PPV_ARGS(&video_command_allocator));
-		assert(SUCCEEDED(hr));
+		for (auto& x : video_command_allocators)
+		{
+			hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, IID_PPV_ARGS(&x));
+			assert(SUCCEEDED(hr));
+		}
 		hr = device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&graphics_cmd));
 		assert(SUCCEEDED(hr));
 		hr = device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&video_cmd));
@@ -603,6 +654,10 @@ int main(int argc, char* argv[])
 	create_swapchain();
 
 	// Do the display frame loop:
+	video.timer.record();
+	PresentationClock presentation_clock;
+	presentation_clock.refresh_period = 0; // the refresh rate is not known, it's measured from the vsyncs
+	presentation_clock.start(0);
 	bool exiting = false;
 	while (!exiting)
 	{
@@ -620,49 +675,195 @@ int main(int argc, char* argv[])
 			continue;
 		}
 
-		if (video.frameIndex == 0)
+		if (video.live)
+		{
+			// Receive the next access units of the live stream without blocking:
+			video.Update_h264_stream();
+		}
+
+		hr = graphics_command_allocator->Reset();
+		assert(SUCCEEDED(hr));
+		hr = graphics_cmd->Reset(graphics_command_allocator.Get(), nullptr);
+		assert(SUCCEEDED(hr));
+
+		// The decodes in flight complete in submission order, the completed ones are copied to their reordering pictures:
+		const uint64_t decode_completed_value = video_fence->GetCompletedValue();
+		while (!decodes_in_flight.empty() && decodes_in_flight.front().fence_value <= decode_completed_value)
 		{
-			// At video beginning, reset the state of picture display reordering: 
-			for (DecodeResultReordered& used : reordered_results_working)
+			const DecodeInFlight& finished = decodes_in_flight.front();
+			const VideoDecoderCore::Picture& picture = core.pictures[core.decoding_pictures.front()];
+
+			// Copy will be done from decoder output to the reordered picture that was selected by the decoder core:
+			const DecodeResultReordered& reordered_current = reordered_pictures[core.decoding_pictures.front()];
+
+			if (reference_only_allocation)
+			{
+				D3D12_TEXTURE_COPY_LOCATION cpy_src = {};
+				cpy_src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+				cpy_src.pResource = dpb_output_texture.Get();
+				D3D12_TEXTURE_COPY_LOCATION cpy_dst = {};
+				cpy_dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+				cpy_dst.pResource = reordered_current.texture.Get();
+
+				cpy_src.SubresourceIndex = finished.context; // luma plane, each decode context has its own array slice
+				cpy_dst.SubresourceIndex = 0; // luma plane
+				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
+
+				cpy_src.SubresourceIndex = decode_frames_in_flight + finished.context; // chroma plane
+				cpy_dst.SubresourceIndex = 1; // chroma plane
+				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
+			}
+			else
 			{
-				used.display_order = -1;
-				reordered_results_free.push_back(used);
+				D3D12_TEXTURE_COPY_LOCATION cpy_src = {};
+				cpy_src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+				cpy_src.pResource = dpb_texture.Get();
+				D3D12_TEXTURE_COPY_LOCATION cpy_dst = {};
+				cpy_dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+				cpy_dst.pResource = reordered_current.texture.Get();
+
+				cpy_src.SubresourceIndex = picture.slot; // luma plane
+				cpy_dst.SubresourceIndex = 0; // luma plane
+				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
+
+				cpy_src.SubresourceIndex = video.num_dpb_slots + picture.slot; // chroma plane
+				cpy_dst.SubresourceIndex = 1; // chroma plane
+				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
 			}
-			reordered_results_working.clear();
-			video.target_display_order = 0;
+
+			// Current latest reordered is pushed to the reorder working queue:
+			core.finish_decode();
+			decodes_in_flight.erase(decodes_in_flight.begin());
+		}
+
+		// The displayed picture is swapped when its time comes, the presentation clock selects the picture that is nearest to the next vsync:
+		if (core.update_display(Video::Timer::nanoseconds_to_ticks(presentation_clock.media_time(video.timer.elapsed_nanoseconds()), video.timescale)))
+		{
+			const VideoDecoderCore::Picture& picture = core.pictures[core.displayed_picture];
+			printf("\tDisplayed image changed, frame_index: %d, display_order: %d\n", picture.frame_index, picture.display_order);
+		}
+		const DecodeResultReordered& displayed_image = core.displayed_picture >= 0 ? reordered_pictures[core.displayed_picture] : no_picture;
+
+		// Resolve video with compute shader:
+		{
+			// the displayed image's two planes are put into shader resource state, the swapchain_uav is put into unordered access state:
+			D3D12_RESOURCE_BARRIER barriers[3] = {};
+			barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+			barriers[0].Transition.pResource = displayed_image.texture.Get();
+			barriers[0].Transition.Subresource = 0; // luma plane
+			barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+			barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+			barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+			barriers[1].Transition.pResource = displayed_image.texture.Get();
+			barriers[1].Transition.Subresource = 1; // chroma plane
+			barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+			barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+			barriers[2].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+			barriers[2].Transition.pResource = swapchain_uav.Get();
+			barriers[2].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
+			barriers[2].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+			graphics_cmd->ResourceBarrier(arraysize(barriers), barriers);
+
+			graphics_cmd->DiscardResource(swapchain_uav.Get(), nullptr); // previous contents are not retained, UAV will be fully overwritten
+
+			// Set up all descriptors:
+			//	This setup is hardcoded for the yuv_to_rgbCS.hlsl shader's root signature layout
+			//	There is a single DescriptorTable, with 2 SRVs followed by 1 UAV
+			//	The descriptors are created into the shader visible descriptor heap every frame
+			ID3D12DescriptorHeap* descriptor_heaps[] = { descriptor_heap.Get() };
+			graphics_cmd->SetDescriptorHeaps(arraysize(descriptor_heaps), descriptor_heaps);
+			graphics_cmd->SetComputeRootSignature(rootsignature.Get());
+			graphics_cmd->SetPipelineState(compute_pso.Get());
+			D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle = descriptor_heap->GetCPUDescriptorHandleForHeapStart();
+			const UINT descriptor_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc = {};
+			srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+			srv_desc.Format = DXGI_FORMAT_R8_UNORM;
+			srv_desc.Texture2D.MipLevels = 1;
+			srv_desc.Texture2D.PlaneSlice = 0; // luma plane
+			device->CreateShaderResourceView(displayed_image.texture.Get(), &srv_desc, cpu_handle);	// Texture2D<float> input_luminance : register(t0);
+			srv_desc.Format = DXGI_FORMAT_R8G8_UNORM;
+			srv_desc.Texture2D.PlaneSlice = 1; // chroma plane
+			cpu_handle.ptr += descriptor_size;
+			device->CreateShaderResourceView(displayed_image.texture.Get(), &srv_desc, cpu_handle); // Texture2D<float2> input_chrominance : register(t1);
+			D3D12_UNORDERED_ACCESS_VIEW_DESC uav_desc = {};
+			uav_desc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+			uav_desc.Format = swapchain_format;
+			cpu_handle.ptr += descriptor_size;
+			device->CreateUnorderedAccessView(swapchain_uav.Get(), nullptr, &uav_desc, cpu_handle); // RWTexture2D<unorm float4> output : register(u0);
+			graphics_cmd->SetComputeRootDescriptorTable(1, descriptor_heap->GetGPUDescriptorHandleForHeapStart());
+			graphics_cmd->SetComputeRoot32BitConstants(0, 2, &video.width, 0); // set video width and height
+			graphics_cmd->Dispatch((swapchain_width + 7u) / 8u, (swapchain_height + 7u) / 8u, 1); // shader runs 8x8 threadgroup
+
+			// reverse barriers
+			std::swap(barriers[0].Transition.StateBefore, barriers[0].Transition.StateAfter);
+			std::swap(barriers[1].Transition.StateBefore, barriers[1].Transition.StateAfter);
+			std::swap(barriers[2].Transition.StateBefore, barriers[2].Transition.StateAfter);
+			graphics_cmd->ResourceBarrier(arraysize(barriers), barriers);
 		}
 
-		bool must_decode = true;
-		for (auto& x : reordered_results_working)
+		// Workaround the fact that we cannot render into swapchain from compute shader in DX12, instead we copy into it:
 		{
-			if (x.display_order == video.target_display_order)
-				must_decode = false;
+			ID3D12Resource* current_swapchain_resource = swapchain_resources[swapchain->GetCurrentBackBufferIndex()].Get();
+			graphics_cmd->CopyResource(current_swapchain_resource, swapchain_uav.Get());
+			D3D12_RESOURCE_BARRIER barrier = {};
+			barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+			barrier.Transition.pResource = current_swapchain_resource;
+			barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+			barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
+			graphics_cmd->ResourceBarrier(1, &barrier);
 		}
 
-		if (must_decode)
+		hr = graphics_cmd->Close();
+		assert(SUCCEEDED(hr));
+
+		// wait for the copied video queue outputs on the GPU:
+		hr = graphics_queue->Wait(video_fence.Get(), decode_completed_value);
+		assert(SUCCEEDED(hr));
+
+		ID3D12CommandList* commandlists[] = { graphics_cmd.Get() };
+		graphics_queue->ExecuteCommandLists(arraysize(commandlists), commandlists);
+		hr = graphics_queue->Signal(graphics_fence.Get(), 1);
+		assert(SUCCEEDED(hr));
+
+		hr = swapchain->Present(1, 0); // vsync
+		assert(SUCCEEDED(hr));
+		presentation_clock.vsync(video.timer.elapsed_nanoseconds()); // the vsync present returns when a vsync made room in the present queue, so it corrects the vsync timeline of the presentation clock
+
+		// In this sample, I always wait for GPU completion on the CPU to simplify command buffer and descriptor management:
+		hr = graphics_fence->SetEventOnCompletion(1, nullptr);
+		assert(SUCCEEDED(hr));
+		hr = graphics_fence->Signal(0);
+		assert(SUCCEEDED(hr));
+
+		// The decoder core decides whether new frames must be decoded, and which DPB slots they use:
+		//	Decoding is submitted after the graphics work completed, so the decode context and DPB slot of a copied picture can be reused
+		VideoDecoderCore::DecodeCommand decode;
+		while (core.begin_decode(decode))
 		{
 			// Decoding a new video frame is required:
-			const Video::FrameInfo& frame_info = video.frame_infos[video.frameIndex];
-			const h264::SliceHeader& slice_header = video.slice_headers[video.frameIndex];
-			const h264::PPS& pps = video.pps_array[slice_header.pic_parameter_set_id];
-			const h264::SPS& sps = video.sps_array[pps.seq_parameter_set_id];
+			const Video::FrameInfo& frame_info = decode.frame_info;
+			const h264::SliceHeader& slice_header = decode.slice_header;
+			const h264::PPS& pps = *decode.pps;
+			const h264::SPS& sps = *decode.sps;
 
-			if (frame_info.is_intra)
+			if (decode.picture_created)
 			{
-				video.reference_usage.clear();
-				video.next_ref = 0;
-				video.next_slot = 0;
+				// Create new texture, because the stream reorders more frames than its SPS declares, so the reserved ones are all in use:
+				assert(decode.picture == (int)reordered_pictures.size());
+				reordered_pictures.emplace_back();
+				reordered_pictures.back().create(device.Get(), video.padded_width, video.padded_height);
 			}
-			video.current_slot = video.next_slot;
-			video.poc_status[video.current_slot] = frame_info.poc;
-			video.framenum_status[video.current_slot] = slice_header.frame_num;
 
-			hr = video_command_allocator->Reset();
+			// The decodes complete in submission order, and there are never more than decode_frames_in_flight of them, so the context of the oldest one is free:
+			const uint32_t context = uint32_t(decode_submit_count % decode_frames_in_flight);
+			hr = video_command_allocators[context]->Reset();
 			assert(SUCCEEDED(hr));
-			hr = video_cmd->Reset(video_command_allocator.Get());
+			hr = video_cmd->Reset(video_command_allocators[context].Get());
 			assert(SUCCEEDED(hr));
 
-			if (dpb_layouts[video.current_slot] != D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE)
+			if (dpb_layouts[decode.current_slot] != D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE)
 			{
 				// if current DPB slot is not in DPB layout, transition it now:
 				D3D12_RESOURCE_BARRIER barriers[2] = {};
@@ -670,23 +871,28 @@ int main(int argc, char* argv[])
 				{
 					barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
 					barrier.Transition.pResource = dpb_texture.Get();
-					barrier.Transition.StateBefore = dpb_layouts[video.current_slot];
+					barrier.Transition.StateBefore = dpb_layouts[decode.current_slot];
 					barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
 				}
-				barriers[0].Transition.Subresource = video.current_slot; // luma plane
-				barriers[1].Transition.Subresource = video.num_dpb_slots + video.current_slot; // chroma plane
+				barriers[0].Transition.Subresource = decode.current_slot; // luma plane
+				barriers[1].Transition.Subresource = video.num_dpb_slots + decode.current_slot; // chroma plane
 				video_cmd->ResourceBarrier(arraysize(barriers), barriers);
-				dpb_layouts[video.current_slot] = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
+				dpb_layouts[decode.current_slot] = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
 			}
 			if (reference_only_allocation)
 			{
-				D3D12_RESOURCE_BARRIER barrier = {};
-				barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-				barrier.Transition.pResource = dpb_output_texture.Get();
-				barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COMMON;
-				barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
-				barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-				video_cmd->ResourceBarrier(1, &barrier);
+				// only the output slice of this decode context is transitioned, the others might be in use by other decodes in flight:
+				D3D12_RESOURCE_BARRIER barriers[2] = {};
+				for (auto& barrier : barriers)
+				{
+					barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+					barrier.Transition.pResource = dpb_output_texture.Get();
+					barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COMMON;
+					barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
+				}
+				barriers[0].Transition.Subresource = context; // luma plane
+				barriers[1].Transition.Subresource = decode_frames_in_flight + context; // chroma plane
+				video_cmd->ResourceBarrier(arraysize(barriers), barriers);
 			}
 
 			D3D12_VIDEO_DECODE_INPUT_STREAM_ARGUMENTS input = {};
@@ -694,15 +900,15 @@ int main(int argc, char* argv[])
 			if (reference_only_allocation)
 			{
 				output.pOutputTexture2D = dpb_output_texture.Get();
-				output.OutputSubresource = 0;
+				output.OutputSubresource = context;
 				output.ConversionArguments.Enable = TRUE;
 				output.ConversionArguments.pReferenceTexture2D = dpb_texture.Get();
-				output.ConversionArguments.ReferenceSubresource = video.current_slot;
+				output.ConversionArguments.ReferenceSubresource = decode.current_slot;
 			}
 			else
 			{
 				output.pOutputTexture2D = dpb_texture.Get();
-				output.OutputSubresource = video.current_slot;
+				output.OutputSubresource = decode.current_slot;
 			}
 
 			ID3D12Resource* reference_frames[16] = {};
@@ -718,6 +924,12 @@ int main(int argc, char* argv[])
 
 			input.CompressedBitstream.pBuffer = bitstream_buffer.Get();
 			input.CompressedBitstream.Offset = frame_info.offset;
+			if (video.live)
+			{
+				// The access unit of the live stream is copied to the bitstream region of the decode context, the previous one in it was already consumed by the GPU:
+				input.CompressedBitstream.Offset = live_bitstream_region_size * context;
+				std::memcpy((uint8_t*)bitstream_mapped_data + input.CompressedBitstream.Offset, video.h264_data.data() + frame_info.offset, frame_info.size);
+			}
 			input.CompressedBitstream.Size = frame_info.size;
 			input.pHeap = decoder_heap.Get();
 
@@ -749,7 +961,7 @@ int main(int argc, char* argv[])
 			{
 				pic_params_h264.CurrPic.AssociatedFlag = 0;
 			}
-			pic_params_h264.CurrPic.Index7Bits = (UCHAR)video.current_slot;
+			pic_params_h264.CurrPic.Index7Bits = (UCHAR)decode.current_slot;
 			pic_params_h264.CurrFieldOrderCnt[0] = frame_info.poc;
 			pic_params_h264.CurrFieldOrderCnt[1] = frame_info.poc;
 			for (uint32_t i = 0; i < 16; ++i)
@@ -759,17 +971,16 @@ int main(int argc, char* argv[])
 				pic_params_h264.FieldOrderCntList[i][1] = 0;
 				pic_params_h264.FrameNumList[i] = 0;
 			}
-			for (size_t i = 0; i < video.reference_usage.size(); ++i)
+			for (uint32_t i = 0; i < decode.reference_count; ++i)
 			{
-				uint32_t ref_slot = video.reference_usage[i];
-				assert(ref_slot != video.current_slot);
-				pic_params_h264.RefFrameList[i].AssociatedFlag = 0; // 0 = short term, 1 = long term reference
+				const uint32_t ref_slot = decode.reference_slots[i];
+				pic_params_h264.RefFrameList[i].AssociatedFlag = core.dpb.longterm_status[ref_slot] ? 1 : 0; // 0 = short term, 1 = long term reference
 				pic_params_h264.RefFrameList[i].Index7Bits = (UCHAR)ref_slot;
-				pic_params_h264.FieldOrderCntList[i][0] = video.poc_status[ref_slot];
-				pic_params_h264.FieldOrderCntList[i][1] = video.poc_status[ref_slot];
+				pic_params_h264.FieldOrderCntList[i][0] = core.dpb.poc_status[ref_slot];
+				pic_params_h264.FieldOrderCntList[i][1] = core.dpb.poc_status[ref_slot];
 				pic_params_h264.UsedForReferenceFlags |= 1 << (i * 2 + 0);
 				pic_params_h264.UsedForReferenceFlags |= 1 << (i * 2 + 1);
-				pic_params_h264.FrameNumList[i] = video.framenum_status[ref_slot];
+				pic_params_h264.FrameNumList[i] = core.dpb.framenum_status[ref_slot];
 			}
 			pic_params_h264.weighted_pred_flag = pps.weighted_pred_flag;
 			pic_params_h264.weighted_bipred_idc = pps.weighted_bipred_idc;
@@ -801,7 +1012,7 @@ int main(int argc, char* argv[])
 			pic_params_h264.redundant_pic_cnt_present_flag = pps.redundant_pic_cnt_present_flag;
 			pic_params_h264.slice_group_change_rate_minus1 = pps.slice_group_change_rate_minus1;
 			pic_params_h264.Reserved16Bits = 3; // DXVA spec
-			pic_params_h264.StatusReportFeedbackNumber = (UINT)video.frameIndex + 1; // shall not be 0
+			pic_params_h264.StatusReportFeedbackNumber = (UINT)decode.frame_index + 1; // shall not be 0
 			assert(pic_params_h264.StatusReportFeedbackNumber > 0);
 			pic_params_h264.ContinuationFlag = 1;
 			pic_params_h264.num_ref_idx_l0_active_minus1 = pps.num_ref_idx_l0_active_minus1;
@@ -870,13 +1081,17 @@ int main(int argc, char* argv[])
 
 			if (reference_only_allocation)
 			{
-				D3D12_RESOURCE_BARRIER barrier = {};
-				barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-				barrier.Transition.pResource = dpb_output_texture.Get();
-				barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
-				barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COMMON;
-				barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-				video_cmd->ResourceBarrier(1, &barrier);
+				D3D12_RESOURCE_BARRIER barriers[2] = {};
+				for (auto& barrier : barriers)
+				{
+					barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+					barrier.Transition.pResource = dpb_output_texture.Get();
+					barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
+					barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COMMON;
+				}
+				barriers[0].Transition.Subresource = context; // luma plane
+				barriers[1].Transition.Subresource = decode_frames_in_flight + context; // chroma plane
+				video_cmd->ResourceBarrier(arraysize(barriers), barriers);
 			}
 			else
 			{
@@ -888,228 +1103,27 @@ int main(int argc, char* argv[])
 					barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE;
 					barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COMMON;
 				}
-				barriers[0].Transition.Subresource = video.current_slot; // luma plane
-				barriers[1].Transition.Subresource = video.num_dpb_slots + video.current_slot; // chroma plane
+				barriers[0].Transition.Subresource = decode.current_slot; // luma plane
+				barriers[1].Transition.Subresource = video.num_dpb_slots + decode.current_slot; // chroma plane
 				video_cmd->ResourceBarrier(arraysize(barriers), barriers);
-				dpb_layouts[video.current_slot] = D3D12_RESOURCE_STATE_COMMON;
+				dpb_layouts[decode.current_slot] = D3D12_RESOURCE_STATE_COMMON;
 			}
 
 			hr = video_cmd->Close();
 			assert(SUCCEEDED(hr));
 			ID3D12CommandList* commandlists[] = { video_cmd.Get() };
 			video_queue->ExecuteCommandLists(arraysize(commandlists), commandlists);
-			hr = video_queue->Signal(video_fence.Get(), 1); // signal for graphics queue, GPU will wait for this fence
-			assert(SUCCEEDED(hr)); 
-			
-			printf("Decoded frame_index = %d, display_order: %d\n", video.frameIndex, frame_info.display_order);
-
-			// DPB slot management:
-			//	When current frame was a reference, then the next frame can not overwrite its DPB slot, so increment next_slot as a ring buffer
-			//	However, the ring buffer will wrap around so older reference frames can be overwritten by this
-			if (frame_info.reference_priority > 0)
-			{
-				if (video.next_ref >= video.reference_usage.size())
-				{
-					video.reference_usage.resize(video.next_ref + 1);
-				}
-				video.reference_usage[video.next_ref] = video.current_slot;
-				video.next_ref = (video.next_ref + 1) % (video.num_dpb_slots - 1);
-				video.next_slot = (video.next_slot + 1) % video.num_dpb_slots;
-			}
-		}
-
-		hr = graphics_command_allocator->Reset();
-		assert(SUCCEEDED(hr));
-		hr = graphics_cmd->Reset(graphics_command_allocator.Get(), nullptr);
-		assert(SUCCEEDED(hr));
-
-		if (must_decode)
-		{
-			// If decode happened this frame, then copy the latest output to the reordering picture queue:
-			if (reordered_results_free.empty())
-			{
-				// Request new image, because there is no more free ones that we can use:
-				reordered_results_free.emplace_back();
-				reordered_results_free.back().create(device.Get(), video.padded_width, video.padded_height);
-			}
-
-			// Copy will be done from decoder output to the newly allocated reordered picture:
-			DecodeResultReordered reordered_current = reordered_results_free.back();
-			reordered_results_free.pop_back();
-			reordered_current.display_order = video.frame_infos[video.frameIndex].display_order;
-			reordered_current.frame_index = video.frameIndex;
-
-			if (reference_only_allocation)
-			{
-				D3D12_TEXTURE_COPY_LOCATION cpy_src = {};
-				cpy_src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-				cpy_src.pResource = dpb_output_texture.Get();
-				D3D12_TEXTURE_COPY_LOCATION cpy_dst = {};
-				cpy_dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-				cpy_dst.pResource = reordered_current.texture.Get();
-
-				cpy_src.SubresourceIndex = 0; // luma plane
-				cpy_dst.SubresourceIndex = 0; // luma plane
-				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
-
-				cpy_src.SubresourceIndex = 1; // chroma plane
-				cpy_dst.SubresourceIndex = 1; // chroma plane
-				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
-			}
-			else
-			{
-				D3D12_TEXTURE_COPY_LOCATION cpy_src = {};
-				cpy_src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-				cpy_src.pResource = dpb_texture.Get();
-				D3D12_TEXTURE_COPY_LOCATION cpy_dst = {};
-				cpy_dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-				cpy_dst.pResource = reordered_current.texture.Get();
-
-				cpy_src.SubresourceIndex = video.current_slot; // luma plane
-				cpy_dst.SubresourceIndex = 0; // luma plane
-				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
-
-				cpy_src.SubresourceIndex = video.num_dpb_slots + video.current_slot; // chroma plane
-				cpy_dst.SubresourceIndex = 1; // chroma plane
-				graphics_cmd->CopyTextureRegion(&cpy_dst, 0, 0, 0, &cpy_src, nullptr);
-			}
-
-			// Current latest reordered is pushed to the reorder working queue:
-			reordered_results_working.push_back(reordered_current);
-
-			video.frameIndex = (video.frameIndex + 1) % video.frame_infos.size();
-		}
-
-		video.time_until_next_frame -= video.timer.elapsed_seconds();
-		video.timer.record();
-		if (video.time_until_next_frame <= 0)
-		{
-			// Search for the next displayable with lowest display order:
-			int display_order_changed = -1;
-			for (int i = 0; i < (int)reordered_results_working.size(); ++i)
-			{
-				if (reordered_results_working[i].display_order == video.target_display_order)
-				{
-					display_order_changed = i;
-				}
-			}
-			if (display_order_changed >= 0)
-			{
-				// Free current output texture:
-				if (displayed_image.texture != nullptr)
-				{
-					reordered_results_free.push_back(displayed_image);
-				}
-				// Take this used texture as current output:
-				displayed_image = std::move(reordered_results_working[display_order_changed]);
-				// Remove this used texture:
-				std::swap(reordered_results_working[display_order_changed], reordered_results_working.back());
-				reordered_results_working.pop_back();
-
-				video.time_until_next_frame = video.frame_infos[displayed_image.frame_index].duration_seconds;
-
-				assert(displayed_image.texture != nullptr);
-				printf("\tDisplayed image changed, frame_index: %d, display_order: %d\n", displayed_image.frame_index, displayed_image.display_order);
-				video.target_display_order++;
-			}
-		}
-
-		// Resolve video with compute shader:
-		{
-			// the displayed image's two planes are put into shader resource state, the swapchain_uav is put into unordered access state:
-			D3D12_RESOURCE_BARRIER barriers[3] = {};
-			barriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-			barriers[0].Transition.pResource = displayed_image.texture.Get();
-			barriers[0].Transition.Subresource = 0; // luma plane
-			barriers[0].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-			barriers[0].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
-			barriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-			barriers[1].Transition.pResource = displayed_image.texture.Get();
-			barriers[1].Transition.Subresource = 1; // chroma plane
-			barriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-			barriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
-			barriers[2].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-			barriers[2].Transition.pResource = swapchain_uav.Get();
-			barriers[2].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
-			barriers[2].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-			graphics_cmd->ResourceBarrier(arraysize(barriers), barriers);
-
-			graphics_cmd->DiscardResource(swapchain_uav.Get(), nullptr); // previous contents are not retained, UAV will be fully overwritten
-
-			// Set up all descriptors:
-			//	This setup is hardcoded for the yuv_to_rgbCS.hlsl shader's root signature layout
-			//	There is a single DescriptorTable, with 2 SRVs followed by 1 UAV
-			//	The descriptors are created into the shader visible descriptor heap every frame
-			ID3D12DescriptorHeap* descriptor_heaps[] = { descriptor_heap.Get() };
-			graphics_cmd->SetDescriptorHeaps(arraysize(descriptor_heaps), descriptor_heaps);
-			graphics_cmd->SetComputeRootSignature(rootsignature.Get());
-			graphics_cmd->SetPipelineState(compute_pso.Get());
-			D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle = descriptor_heap->GetCPUDescriptorHandleForHeapStart();
-			const UINT descriptor_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-			D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc = {};
-			srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-			srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-			srv_desc.Format = DXGI_FORMAT_R8_UNORM;
-			srv_desc.Texture2D.MipLevels = 1;
-			srv_desc.Texture2D.PlaneSlice = 0; // luma plane
-			device->CreateShaderResourceView(displayed_image.texture.Get(), &srv_desc, cpu_handle);	// Texture2D<float> input_luminance : register(t0);
-			srv_desc.Format = DXGI_FORMAT_R8G8_UNORM;
-			srv_desc.Texture2D.PlaneSlice = 1; // chroma plane
-			cpu_handle.ptr += descriptor_size;
-			device->CreateShaderResourceView(displayed_image.texture.Get(), &srv_desc, cpu_handle); // Texture2D<float2> input_chrominance : register(t1);
-			D3D12_UNORDERED_ACCESS_VIEW_DESC uav_desc = {};
-			uav_desc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
-			uav_desc.Format = swapchain_format;
-			cpu_handle.ptr += descriptor_size;
-			device->CreateUnorderedAccessView(swapchain_uav.Get(), nullptr, &uav_desc, cpu_handle); // RWTexture2D<unorm float4> output : register(u0);
-			graphics_cmd->SetComputeRootDescriptorTable(1, descriptor_heap->GetGPUDescriptorHandleForHeapStart());
-			graphics_cmd->SetComputeRoot32BitConstants(0, 2, &video.width, 0); // set video width and height
-			graphics_cmd->Dispatch((swapchain_width + 7u) / 8u, (swapchain_height + 7u) / 8u, 1); // shader runs 8x8 threadgroup
-
-			// reverse barriers
-			std::swap(barriers[0].Transition.StateBefore, barriers[0].Transition.StateAfter);
-			std::swap(barriers[1].Transition.StateBefore, barriers[1].Transition.StateAfter);
-			std::swap(barriers[2].Transition.StateBefore, barriers[2].Transition.StateAfter);
-			graphics_cmd->ResourceBarrier(arraysize(barriers), barriers);
-		}
-
-		// Workaround the fact that we cannot render into swapchain from compute shader in DX12, instead we copy into it:
-		{
-			ID3D12Resource* current_swapchain_resource = swapchain_resources[swapchain->GetCurrentBackBufferIndex()].Get();
-			graphics_cmd->CopyResource(current_swapchain_resource, swapchain_uav.Get());
-			D3D12_RESOURCE_BARRIER barrier = {};
-			barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-			barrier.Transition.pResource = current_swapchain_resource;
-			barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-			barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
-			graphics_cmd->ResourceBarrier(1, &barrier);
-		}
-
-		hr = graphics_cmd->Close();
-		assert(SUCCEEDED(hr));
-
-		if (must_decode)
-		{
-			// wait for video queue completion on the GPU:
-			hr = graphics_queue->Wait(video_fence.Get(), 1);
+			decode_submit_count++;
+			hr = video_queue->Signal(video_fence.Get(), decode_submit_count); // the display loop polls this value to know when the decode completed
 			assert(SUCCEEDED(hr));
-		}
-
-		ID3D12CommandList* commandlists[] = { graphics_cmd.Get() };
-		graphics_queue->ExecuteCommandLists(arraysize(commandlists), commandlists);
-		hr = graphics_queue->Signal(graphics_fence.Get(), 1);
-		assert(SUCCEEDED(hr));
 
-		hr = swapchain->Present(1, 0); // vsync
-		assert(SUCCEEDED(hr));
-
-		// In this sample, I always wait for GPU completion on the CPU to simplify command buffer and descriptor management:
-		hr = graphics_fence->SetEventOnCompletion(1, nullptr);
-		assert(SUCCEEDED(hr));
-		hr = graphics_fence->Signal(0);
-		assert(SUCCEEDED(hr));
-		hr = video_fence->Signal(0);
-		assert(SUCCEEDED(hr));
+			DecodeInFlight in_flight;
+			in_flight.context = context;
+			in_flight.fence_value = decode_submit_count;
+			decodes_in_flight.push_back(in_flight);
+			core.end_decode(decode);
+			printf("Decoded frame_index = %d, display_order: %d\n", decode.frame_index, frame_info.display_order);
+		}
 	}
 
 	// Wait for GPU to become idle before exiting and ComPtrs are destroyed:
@@ -0,0 +1,2023 @@
+// Null backend: runs the decoding logic of VideoDecoderCore without a GPU
+//
+// What this does:
+//	- loads the video the same way as the other backends, then runs the display loop with a simulated display refresh rate
+//	- the decode and display commands are recorded instead of being executed, so the exact command sequence can be inspected and compared
+//	- the CPU time spent in the decoding logic is measured per frame
+//	- optionally the decodes take time on a simulated GPU, to see how decoding ahead hides the decode latency and the spikes of large frames
+//
+// How to use:
+//	mini_video_null.exe video.mp4 // prints every decode and display command
+//	mini_video_null.exe -quiet -loops 10 video.mp4 // only prints the timing summary
+//	mini_video_null.exe -refresh 144 video.mp4 // simulated display refresh rate in Hz (default: 60)
+//	mini_video_null.exe -latency 12 -ahead 4 video.mp4 // an average sized frame takes 12 ms to decode (larger frames take longer), and up to 4 frames are decoded ahead
+//	mini_video_null.exe -loops 4 -latency 12 -intracost 6 -ahead 2 -preroll 16 video.mp4 // intra frames take 6 times longer to decode, and the first GOP of the next loop is decoded ahead at the end of every loop, the stalls at the loops are printed
+//	mini_video_null.exe -quiet -jitter 8 -drift 500 -clock video.mp4 // the loop wakes up at most 8 ms after each refresh of a display that runs 500 ppm slow, the PresentationClock selects the pictures for the predicted vsyncs, and the cadence error is printed (without -clock, the pictures are selected with the time of the loop)
+//	mini_video_null.exe -latency 40 -decimate video.mp4 // skips temporal layers of non-reference frames when the simulated decodes miss their display deadlines
+//	mini_video_null.exe -maxfps 15 video.mp4 // skips the temporal layers that would decode more than 15 frames per second
+//	mini_video_null.exe -scan 8 video.mp4 // fast forwards 8x by decoding only the intra frames
+//	mini_video_null.exe -reverse -cache 16 video.mp4 // plays backwards, the GOPs are decoded forward into at most 16 cached pictures, and displayed backwards
+//	mini_video_null.exe -streams 8 -latency 3 -priority 2 video.mp4 // plays 8 copies of the video with the DecodeScheduler on one simulated GPU, the first one has priority 2, and prints the deadline statistics
+//	mini_video_null.exe -streams 8 -capacity 40000 -dpbmemory 1 video.mp4 // the CapacityPlanner admits, degrades or rejects the 8 copies of the video with a device budget of 40000 macroblocks/s and 1 MB of DPB memory, then the admitted and degraded ones are played
+//	mini_video_null.exe -sessions 2 a.mp4 b.mp4 c.mp4 // plays the videos as a gapless Playlist, the next one is loaded on a background thread, their decoder sessions come from a SessionPool that keeps at most 2 sessions, and prints which sessions were created, reused and evicted, the gaps at the switches and the peak memory of the loaded items
+//	mini_video_null.exe -switch 30 -ahead 4 1080p.mp4 720p.mp4 // plays the videos as renditions of the same content with a RenditionSet, prints their IDR alignment, requests a switch to the next rendition every 30 display loop iterations, and prints where the switches took effect and which ones reconfigured the DPB
+//	mini_video_null.exe -quiet -ring 256 -latency 12 -ahead 4 video.mp4 // checks the BitstreamRing allocator on its own cases, then uploads every frame through a ring with 256 byte alignment, and checks that no frame was overwritten while its decode was in flight
+//	mini_video_null.exe -quiet -seek 20 -latency 4 -ahead 4 video.mp4 // plans a seek to every frame with the SeekPlanner, checks the plans and prints their cost compared to decoding every frame or every reference frame from the IDR frame, then seeks to a random frame every 20 display loop iterations, and checks that the playback continues from the target
+//	mini_video_null.exe -quiet -pool video.mp4 // plays the video in several configurations (decode ahead, loop pre-roll, decimation, reverse, scan, seeks), checks display_order_lookup in every display loop iteration, and that the reordering pictures and their queues don't allocate after the first loop
+//	mini_video_null.exe -quiet -timebase -refresh 144 video.mp4 // checks that 29.97 fps and the VUI timing info convert to exact rational timebases (30000/1001, not 29970/1000), simulates 24 hours of a 30000/1001 fps video on a 144 Hz display with the integer timebase, and checks the presented frame count and that the frame swaps accumulate no drift
+//	mini_video_null.exe -quiet -dxva video.mp4 // checks that the DXVA parameters of the DXVAPictureParametersH264 builder match the field by field filling byte for byte, and compares their CPU time
+//	mini_video_null.exe -quiet -sizing video.mp4 // checks the DPB sizing rules of Video::Get_dpb_sizing() and the eviction of a DPB without a free slot, prints the sizes of the video and compares its declared reorder depth with the measured one
+//	mini_video_null.exe -quiet -vulkan -seek 20 video.mp4 // checks that the Vulkan reference slots updated by VulkanParametersH264 match refilling every slot, and that every reference slot is active with its picture, also after the seeks, and compares their CPU time
+//	mini_video_null.exe -readbench video.mp4 // reads the video samples sequentially and in a scattered order, with io_uring, with the pread fallback and with std::ifstream (the loader before FileReader), and prints the throughput of each in MB/s
+//	mini_video_null.exe -bench -loops 100 video.mp4 // decodes as fast as possible without display timing, and prints the throughput as JSON
+#include "include/common.h"
+#include "include/decoder_core.h"
+#include "include/bench.h"
+#include "include/scheduler.h"
+#include "include/session_pool.h"
+#include "include/playlist.h"
+#include "include/renditions.h"
+#include "include/capacity.h"
+#include "include/presentation_clock.h"
+#include "include/bitstream_ring.h"
+#include "include/dxva_h264.h"
+#include "include/vulkan_h264.h"
+
+#include <cstdlib>
+#include <fstream>
+
+// The DXVA parameters filled field by field, like the DX11 and DX12 backends do, for checking that the builder gives the same bytes:
+static void fill_dxva_reference(const VideoDecoderCore& core, const VideoDecoderCore::DecodeCommand& decode, DXVA_PicParams_H264& pic_params_h264, DXVA_Qmatrix_H264& qmatrix_h264, DXVA_Slice_H264_Short& sliceinfo_h264)
+{
+	const Video::FrameInfo& frame_info = decode.frame_info;
+	const h264::SliceHeader& slice_header = decode.slice_header;
+	const h264::PPS& pps = *decode.pps;
+	const h264::SPS& sps = *decode.sps;
+	pic_params_h264 = {};
+	qmatrix_h264 = {};
+	sliceinfo_h264 = {};
+
+	// DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010, Page 21
+	//	https://www.microsoft.com/en-us/download/details.aspx?id=11323
+	//	Also: https://gitlab.freedesktop.org/mesa/mesa/-/blob/main/src/gallium/drivers/d3d12/d3d12_video_dec_h264.cpp
+	//	Also: https://github.com/mofo7777/H264Dxva2Decoder
+	pic_params_h264.wFrameWidthInMbsMinus1 = sps.pic_width_in_mbs_minus1;
+	pic_params_h264.wFrameHeightInMbsMinus1 = sps.pic_height_in_map_units_minus1;
+	pic_params_h264.IntraPicFlag = frame_info.is_intra ? 1 : 0;
+	pic_params_h264.MbaffFrameFlag = 0 /*sps->mb_adaptive_frame_field_flag && !slice_header->field_pic_flag*/;
+	pic_params_h264.field_pic_flag = 0 /*slice_header->field_pic_flag*/; // 0 = full frame (top and bottom field)
+	//pic_params_h264.bottom_field_flag = 0; // missing??
+	pic_params_h264.chroma_format_idc = 1; // sps->chroma_format_idc; // only 1 is supported (YUV420)
+	pic_params_h264.bit_depth_chroma_minus8 = sps.bit_depth_chroma_minus8;
+	assert(pic_params_h264.bit_depth_chroma_minus8 == 0);   // Only support for NV12 now
+	pic_params_h264.bit_depth_luma_minus8 = sps.bit_depth_luma_minus8;
+	assert(pic_params_h264.bit_depth_luma_minus8 == 0);   // Only support for NV12 now
+	pic_params_h264.residual_colour_transform_flag = sps.separate_colour_plane_flag; // https://gitlab.freedesktop.org/mesa/mesa/-/blob/main/src/gallium/drivers/d3d12/d3d12_video_dec_h264.cpp#L328
+	if (pic_params_h264.field_pic_flag)
+	{
+		pic_params_h264.CurrPic.AssociatedFlag = slice_header.bottom_field_flag ? 1 : 0; // if pic_params_h264.field_pic_flag == 1, then this is 0 = top field, 1 = bottom_field
+	}
+	else
+	{
+		pic_params_h264.CurrPic.AssociatedFlag = 0;
+	}
+	pic_params_h264.CurrPic.Index7Bits = (uint8_t)decode.current_slot;
+	pic_params_h264.CurrFieldOrderCnt[0] = frame_info.poc;
+	pic_params_h264.CurrFieldOrderCnt[1] = frame_info.poc;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		pic_params_h264.RefFrameList[i].bPicEntry = 0xFF;
+		pic_params_h264.FieldOrderCntList[i][0] = 0;
+		pic_params_h264.FieldOrderCntList[i][1] = 0;
+		pic_params_h264.FrameNumList[i] = 0;
+	}
+	for (uint32_t i = 0; i < decode.reference_count; ++i)
+	{
+		const uint32_t ref_slot = decode.reference_slots[i];
+		pic_params_h264.RefFrameList[i].AssociatedFlag = core.dpb.longterm_status[ref_slot] ? 1 : 0; // 0 = short term, 1 = long term reference
+		pic_params_h264.RefFrameList[i].Index7Bits = (uint8_t)ref_slot;
+		pic_params_h264.FieldOrderCntList[i][0] = core.dpb.poc_status[ref_slot];
+		pic_params_h264.FieldOrderCntList[i][1] = core.dpb.poc_status[ref_slot];
+		pic_params_h264.UsedForReferenceFlags |= 1 << (i * 2 + 0);
+		pic_params_h264.UsedForReferenceFlags |= 1 << (i * 2 + 1);
+		pic_params_h264.FrameNumList[i] = core.dpb.framenum_status[ref_slot];
+	}
+	pic_params_h264.weighted_pred_flag = pps.weighted_pred_flag;
+	pic_params_h264.weighted_bipred_idc = pps.weighted_bipred_idc;
+	pic_params_h264.sp_for_switch_flag = 0;
+
+	pic_params_h264.transform_8x8_mode_flag = pps.transform_8x8_mode_flag;
+	pic_params_h264.constrained_intra_pred_flag = pps.constrained_intra_pred_flag;
+	pic_params_h264.num_ref_frames = sps.num_ref_frames;
+	pic_params_h264.MbsConsecutiveFlag = 1; // The value shall be 1 unless the restricted-mode profile in use explicitly supports the value 0.
+	pic_params_h264.frame_mbs_only_flag = sps.frame_mbs_only_flag;
+	pic_params_h264.MinLumaBipredSize8x8Flag = sps.level_idc >= 31;
+	pic_params_h264.RefPicFlag = frame_info.reference_priority > 0 ? 1 : 0;
+	pic_params_h264.frame_num = slice_header.frame_num;
+	pic_params_h264.pic_init_qp_minus26 = pps.pic_init_qp_minus26;
+	pic_params_h264.pic_init_qs_minus26 = pps.pic_init_qs_minus26;
+	pic_params_h264.chroma_qp_index_offset = pps.chroma_qp_index_offset;
+	pic_params_h264.second_chroma_qp_index_offset = pps.second_chroma_qp_index_offset;
+	pic_params_h264.log2_max_frame_num_minus4 = sps.log2_max_frame_num_minus4;
+	pic_params_h264.pic_order_cnt_type = sps.pic_order_cnt_type;
+	pic_params_h264.log2_max_pic_order_cnt_lsb_minus4 = sps.log2_max_pic_order_cnt_lsb_minus4;
+	pic_params_h264.delta_pic_order_always_zero_flag = sps.delta_pic_order_always_zero_flag;
+	pic_params_h264.direct_8x8_inference_flag = sps.direct_8x8_inference_flag;
+	pic_params_h264.entropy_coding_mode_flag = pps.entropy_coding_mode_flag;
+	pic_params_h264.pic_order_present_flag = pps.pic_order_present_flag;
+	pic_params_h264.num_slice_groups_minus1 = pps.num_slice_groups_minus1;
+	assert(pic_params_h264.num_slice_groups_minus1 == 0);   // FMO Not supported by VA
+	pic_params_h264.slice_group_map_type = pps.slice_group_map_type;
+	pic_params_h264.deblocking_filter_control_present_flag = pps.deblocking_filter_control_present_flag;
+	pic_params_h264.redundant_pic_cnt_present_flag = pps.redundant_pic_cnt_present_flag;
+	pic_params_h264.slice_group_change_rate_minus1 = pps.slice_group_change_rate_minus1;
+	pic_params_h264.Reserved16Bits = 3; // DXVA spec
+	pic_params_h264.StatusReportFeedbackNumber = (uint32_t)decode.frame_index + 1; // shall not be 0
+	assert(pic_params_h264.StatusReportFeedbackNumber > 0);
+	pic_params_h264.ContinuationFlag = 1;
+	pic_params_h264.num_ref_idx_l0_active_minus1 = pps.num_ref_idx_l0_active_minus1;
+	pic_params_h264.num_ref_idx_l1_active_minus1 = pps.num_ref_idx_l1_active_minus1;
+
+	// DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010, Page 29
+	//	Also: https://gitlab.freedesktop.org/mesa/mesa/-/blob/main/src/gallium/drivers/d3d12/d3d12_video_dec_h264.cpp#L548
+	if (sps.seq_scaling_matrix_present_flag)
+	{
+		static constexpr int vl_zscan_normal_16[] =
+		{
+			/* Zig-Zag scan pattern */
+			0, 1, 4, 8, 5, 2, 3, 6,
+			9, 12, 13, 10, 7, 11, 14, 15
+		};
+		static constexpr int vl_zscan_normal[] =
+		{
+			/* Zig-Zag scan pattern */
+			 0, 1, 8,16, 9, 2, 3,10,
+			17,24,32,25,18,11, 4, 5,
+			12,19,26,33,40,48,41,34,
+			27,20,13, 6, 7,14,21,28,
+			35,42,49,56,57,50,43,36,
+			29,22,15,23,30,37,44,51,
+			58,59,52,45,38,31,39,46,
+			53,60,61,54,47,55,62,63
+		};
+		for (int i = 0; i < 6; ++i)
+		{
+			for (int j = 0; j < 16; ++j)
+			{
+				qmatrix_h264.bScalingLists4x4[i][j] = pps.ScalingList4x4[i][vl_zscan_normal_16[j]];
+			}
+		}
+		for (int i = 0; i < 64; ++i)
+		{
+			qmatrix_h264.bScalingLists8x8[0][i] = pps.ScalingList8x8[0][vl_zscan_normal[i]];
+			qmatrix_h264.bScalingLists8x8[1][i] = pps.ScalingList8x8[1][vl_zscan_normal[i]];
+		}
+	}
+	else
+	{
+		// I don't know why it needs to be filled with 16, but otherwise it gets corrupted output
+		//	Source: https://github.com/mofo7777/H264Dxva2Decoder
+		std::memset(&qmatrix_h264, 16, sizeof(DXVA_Qmatrix_H264));
+	}
+
+	// DirectX Video Acceleration for H.264/MPEG-4 AVC Decoding, Microsoft, Updated 2010, Page 31
+	sliceinfo_h264.BSNALunitDataLocation = 0;
+	sliceinfo_h264.SliceBytesInBuffer = (uint32_t)frame_info.size;
+	sliceinfo_h264.wBadSliceChopping = 0; // whole slice is in the buffer
+}
+
+// The Vulkan reference slots refilled for every DPB slot in every frame, like the Vulkan backend did before VulkanParametersH264, for checking that the updated slots give the same values:
+static void fill_vulkan_slots_reference(const VideoDecoderCore& core, const VideoDecoderCore::DecodeCommand& decode, VkExtent2D codedExtent, VkImageView dpb_image_view, VulkanParametersH264& out)
+{
+	VkVideoReferenceSlotInfoKHR* reference_slot_infos = out.reference_slot_infos;
+	VkVideoPictureResourceInfoKHR* reference_slot_pictures = out.reference_slot_pictures;
+	VkVideoDecodeH264DpbSlotInfoKHR* dpb_slots_h264 = out.dpb_slots_h264;
+	StdVideoDecodeH264ReferenceInfo* reference_infos_h264 = out.reference_infos_h264;
+	for (uint32_t i = 0; i < core.video->num_dpb_slots; ++i)
+	{
+		VkVideoReferenceSlotInfoKHR& slot = reference_slot_infos[i];
+		VkVideoPictureResourceInfoKHR& pic = reference_slot_pictures[i];
+		VkVideoDecodeH264DpbSlotInfoKHR& dpb = dpb_slots_h264[i];
+		StdVideoDecodeH264ReferenceInfo& ref = reference_infos_h264[i];
+		slot = {};
+		pic = {};
+		dpb = {};
+		ref = {};
+
+		slot.sType = VK_STRUCTURE_TYPE_VIDEO_REFERENCE_SLOT_INFO_KHR;
+		slot.pPictureResource = &pic;
+		slot.slotIndex = i;
+		slot.pNext = &dpb;
+
+		pic.sType = VK_STRUCTURE_TYPE_VIDEO_PICTURE_RESOURCE_INFO_KHR;
+		pic.codedOffset.x = 0;
+		pic.codedOffset.y = 0;
+		pic.codedExtent = codedExtent;
+		pic.baseArrayLayer = i;
+		pic.imageViewBinding = dpb_image_view;
+
+		dpb.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_H264_DPB_SLOT_INFO_KHR;
+		dpb.pStdReferenceInfo = &ref;
+
+		ref.flags.bottom_field_flag = 0;
+		ref.flags.top_field_flag = 0;
+		ref.flags.is_non_existing = 0;
+		ref.flags.used_for_long_term_reference = core.dpb.longterm_status[i] ? 1 : 0;
+		ref.FrameNum = core.dpb.framenum_status[i];
+		ref.PicOrderCnt[0] = core.dpb.poc_status[i];
+		ref.PicOrderCnt[1] = core.dpb.poc_status[i];
+	}
+
+	VkVideoReferenceSlotInfoKHR* reference_slots = out.reference_slots;
+	for (uint32_t i = 0; i < decode.reference_count; ++i)
+	{
+		reference_slots[i] = reference_slot_infos[decode.reference_slots[i]];
+	}
+	reference_slots[decode.reference_count] = reference_slot_infos[decode.current_slot];
+	reference_slots[decode.reference_count].slotIndex = -1;
+}
+
+// Returns true if the Vulkan reference slots of a frame give the same values to the driver:
+static bool compare_vulkan_slots(const VkVideoReferenceSlotInfoKHR* a, const VkVideoReferenceSlotInfoKHR* b, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (a[i].sType != b[i].sType || a[i].slotIndex != b[i].slotIndex)
+			return false;
+		if (std::memcmp(a[i].pPictureResource, b[i].pPictureResource, sizeof(VkVideoPictureResourceInfoKHR)) != 0)
+			return false;
+		const VkVideoDecodeH264DpbSlotInfoKHR* dpb_a = (const VkVideoDecodeH264DpbSlotInfoKHR*)a[i].pNext;
+		const VkVideoDecodeH264DpbSlotInfoKHR* dpb_b = (const VkVideoDecodeH264DpbSlotInfoKHR*)b[i].pNext;
+		if (dpb_a->sType != dpb_b->sType || std::memcmp(dpb_a->pStdReferenceInfo, dpb_b->pStdReferenceInfo, sizeof(StdVideoDecodeH264ReferenceInfo)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Checks the DPB sizing rules of Video::Get_dpb_sizing() on SPSs that cover each rule, returns the number of failed cases:
+static uint32_t check_dpb_sizing_rules()
+{
+	struct Case
+	{
+		const char* name;
+		int profile_idc;
+		int constraint_set3_flag;
+		int level_idc;
+		int width_mbs;
+		int height_mbs;
+		int num_ref_frames;
+		int pic_order_cnt_type;
+		int bitstream_restriction; // -1: no VUI bitstream restriction, otherwise num_reorder_frames
+		int max_dec_frame_buffering;
+		// Expected:
+		int expected_max_dec_frame_buffering;
+		int expected_reorder_depth;
+		int expected_dpb_slots;
+	};
+	static const Case cases[] = {
+		{ "VUI declares the reorder depth", 100, 0, 40, 120, 68, 4, 0, 1, 4, 4, 1, 5 },
+		{ "VUI without reordering", 100, 0, 40, 120, 68, 4, 0, 0, 4, 4, 0, 5 },
+		{ "VUI reorder depth above max_dec_frame_buffering", 100, 0, 40, 120, 68, 2, 0, 5, 3, 3, 3, 3 },
+		{ "VUI max_dec_frame_buffering below num_ref_frames", 100, 0, 40, 120, 68, 4, 0, 2, 1, 4, 2, 5 },
+		{ "level fallback 1080p level 4.0", 100, 0, 40, 120, 68, 4, 0, -1, 0, 4, 4, 5 },
+		{ "level fallback 720p level 3.1", 77, 0, 31, 80, 45, 3, 0, -1, 0, 5, 5, 4 },
+		{ "level fallback is at most 16 frames", 100, 0, 51, 4, 4, 2, 0, -1, 0, 16, 16, 3 },
+		{ "level 1b", 66, 1, 11, 11, 9, 1, 0, -1, 0, 4, 0, 2 },
+		{ "baseline profile doesn't reorder", 66, 0, 30, 45, 36, 3, 0, -1, 0, 5, 0, 4 },
+		{ "pic_order_cnt_type 2 doesn't reorder", 100, 0, 40, 120, 68, 4, 2, -1, 0, 4, 0, 5 },
+		{ "intra profile", 100, 1, 40, 120, 68, 0, 0, -1, 0, 0, 0, 2 },
+		{ "unknown level", 100, 0, 0, 120, 68, 4, 0, -1, 0, 16, 16, 5 },
+	};
+	uint32_t failed = 0;
+	for (const Case& x : cases)
+	{
+		h264::SPS sps = {};
+		sps.profile_idc = x.profile_idc;
+		sps.constraint_set3_flag = x.constraint_set3_flag;
+		sps.level_idc = x.level_idc;
+		sps.pic_width_in_mbs_minus1 = x.width_mbs - 1;
+		sps.pic_height_in_map_units_minus1 = x.height_mbs - 1;
+		sps.frame_mbs_only_flag = 1;
+		sps.num_ref_frames = x.num_ref_frames;
+		sps.pic_order_cnt_type = x.pic_order_cnt_type;
+		if (x.bitstream_restriction >= 0)
+		{
+			sps.vui_parameters_present_flag = 1;
+			sps.vui.bitstream_restriction_flag = 1;
+			sps.vui.num_reorder_frames = x.bitstream_restriction;
+			sps.vui.max_dec_frame_buffering = x.max_dec_frame_buffering;
+		}
+		const Video::DPBSizing sizing = Video::Get_dpb_sizing(sps);
+		const bool passed = sizing.max_dec_frame_buffering == x.expected_max_dec_frame_buffering && sizing.reorder_depth == x.expected_reorder_depth && sizing.dpb_slots == x.expected_dpb_slots;
+		if (!passed)
+		{
+			printf("DPB sizing rule failed: %s: max_dec_frame_buffering: %d (expected: %d), reorder depth: %d (expected: %d), DPB slots: %d (expected: %d)\n", x.name, sizing.max_dec_frame_buffering, x.expected_max_dec_frame_buffering, sizing.reorder_depth, x.expected_reorder_depth, sizing.dpb_slots, x.expected_dpb_slots);
+			failed++;
+		}
+	}
+	printf("DPB sizing rules: %u cases, %u failed\n", (uint32_t)arraysize(cases), failed);
+	return failed;
+}
+
+// Checks that DecodedPictureBuffer::begin_frame() never reuses a referenced slot when busy slots leave none free, returns the number of failed steps:
+//	with 2 references in 3 slots and the free slot busy, the oldest short-term reference must be evicted, and when every slot is busy, begin_frame() must fail without changing the DPB
+static uint32_t check_dpb_full()
+{
+	h264::SPS sps = {};
+	sps.num_ref_frames = 2;
+	h264::SliceHeader slice_header = {};
+	DecodedPictureBuffer dpb;
+	dpb.reset(3);
+	DecodedPictureBuffer::Frame frame;
+	uint32_t failed = 0;
+	for (int frame_num = 0; frame_num < 2; ++frame_num)
+	{
+		slice_header.frame_num = frame_num;
+		failed += !dpb.begin_frame(sps, slice_header, frame_num == 0, true, frame_num * 2, frame) || frame.current_slot != (uint32_t)frame_num;
+		dpb.end_frame(slice_header, frame);
+	}
+	slice_header.frame_num = 2;
+	failed += !dpb.begin_frame(sps, slice_header, false, true, 4, frame, 1u << 2) || frame.current_slot != 0 || frame.reference_count != 1 || frame.reference_slots[0] != 1 || dpb.evicted_count != 1;
+	dpb.end_frame(slice_header, frame);
+	slice_header.frame_num = 3;
+	failed += dpb.begin_frame(sps, slice_header, false, true, 6, frame, 0x7) || dpb.evicted_count != 1;
+	failed += !dpb.begin_frame(sps, slice_header, false, true, 6, frame, (1u << 0) | (1u << 2)) || frame.current_slot != 1 || frame.reference_count != 1 || frame.reference_slots[0] != 0 || dpb.evicted_count != 2;
+	printf("DPB without a free slot: %u evicted references, %u failed\n", dpb.evicted_count, failed);
+	return failed;
+}
+
+// Checks the BitstreamRing with random frame sizes and simulated completions, returns the number of failed allocations:
+//	with the capacity of BitstreamRing::configure(), every allocation must succeed while fewer decodes are in flight than the limit, and with a small capacity, the allocations must succeed after enough decodes completed
+//	every allocation must be aligned, inside the buffer, and must not overlap the allocations of the decodes in flight
+static uint32_t check_bitstream_ring()
+{
+	struct Case
+	{
+		uint64_t offset_alignment;
+		uint64_t size_alignment;
+		uint32_t frames_in_flight;
+		uint32_t max_frame_size;
+		double capacity_scale; // 0: the configured capacity, otherwise the capacity is this many times the largest frame
+	};
+	static const Case cases[] = {
+		{ 1, 1, 1, 1000, 0 },
+		{ 256, 256, 4, 5000, 0 },
+		{ 256, 1, 4, 5000, 0 },
+		{ 64, 4096, 3, 100000, 0 },
+		{ 4096, 256, 16, 777, 0 },
+		{ 256, 256, 4, 5000, 1.0 },
+		{ 256, 128, 8, 5000, 1.7 },
+		{ 32, 32, 4, 10000, 3.3 },
+	};
+	uint32_t failed = 0;
+	uint64_t checked = 0;
+	uint32_t random = 0x12345678; // xorshift state, so the cases are the same in every run
+	auto next_random = [&]() {
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return random;
+	};
+	for (const Case& x : cases)
+	{
+		Video video;
+		video.frame_infos.sizes.push_back(x.max_frame_size);
+		BitstreamRing ring;
+		ring.configure(video, x.frames_in_flight, x.offset_alignment, x.size_alignment);
+		if (x.capacity_scale > 0)
+		{
+			ring.capacity = BitstreamRing::align(uint64_t(double(ring.aligned_size(x.max_frame_size)) * x.capacity_scale), x.offset_alignment);
+		}
+		uint64_t submitted = 0;
+		uint64_t completed = 0;
+		for (uint32_t i = 0; i < 10000; ++i)
+		{
+			// Some of the decodes in flight complete, or all of them if the limit is reached:
+			const uint64_t in_flight = submitted - completed;
+			const uint64_t completing = in_flight >= x.frames_in_flight ? 1 : next_random() % (in_flight + 1) / 2;
+			completed += completing;
+			ring.reclaim(completed);
+
+			const uint64_t size = 1 + next_random() % x.max_frame_size;
+			uint64_t offset = 0;
+			bool allocated = ring.allocate(size, submitted + 1, offset);
+			if (!allocated && x.capacity_scale == 0)
+			{
+				printf("Bitstream ring check failed: the configured capacity was full with %llu decodes in flight, alignments: %llu, %llu\n", (unsigned long long)(submitted - completed), (unsigned long long)x.offset_alignment, (unsigned long long)x.size_alignment);
+				failed++;
+			}
+			while (!allocated)
+			{
+				// Waits for the oldest decode:
+				if (ring.allocations.empty())
+				{
+					printf("Bitstream ring check failed: an empty ring was full, capacity: %llu, size: %llu\n", (unsigned long long)ring.capacity, (unsigned long long)size);
+					failed++;
+					break;
+				}
+				completed = ring.oldest_completion_value();
+				ring.reclaim(completed);
+				allocated = ring.allocate(size, submitted + 1, offset);
+			}
+			if (!allocated)
+				continue;
+			submitted++;
+			checked++;
+
+			const BitstreamRing::Allocation& allocation = ring.allocations.back();
+			bool valid = offset % x.offset_alignment == 0 && allocation.size % x.size_alignment == 0 && allocation.size >= size && offset + allocation.size <= ring.capacity;
+			for (size_t j = 0; j + 1 < ring.allocations.size(); ++j)
+			{
+				const BitstreamRing::Allocation& other = ring.allocations[j];
+				valid = valid && (offset + allocation.size <= other.offset || other.offset + other.size <= offset);
+			}
+			if (!valid)
+			{
+				printf("Bitstream ring check failed: allocation at offset %llu, size %llu is misaligned, outside the buffer or overlaps a decode in flight\n", (unsigned long long)offset, (unsigned long long)allocation.size);
+				failed++;
+			}
+		}
+	}
+	printf("Bitstream ring: %u cases, %llu allocations checked, %u failed\n", (uint32_t)arraysize(cases), (unsigned long long)checked, failed);
+	return failed;
+}
+
+// Checks the timebase conversions of the raw H264 loaders, then simulates 24 hours of display loop at 30000/1001 frames per second with the integer timebase, returns the number of failures:
+//	the framerates that are 1000/1001 of an integer rate and the VUI timing info must give the exact rational timebase, 29.97 fps must be 30000/1001 and not 29970/1000
+//	the playback time of every iteration comes from Timer::nanoseconds_to_ticks(), and the pictures are swapped with VideoDecoderCore::advance_frame_time(), like update_display() does it
+//	the presented frame count must be exactly the number of frames that start within the 24 hours, and the swap time must stay exactly on the frame grid (zero accumulated drift), every swap must happen within one refresh of its frame time
+//	a display slower than the video drops frames by resyncing, so at least 30 Hz is simulated
+static uint32_t check_timebase(uint32_t refresh_rate)
+{
+	refresh_rate = std::max(refresh_rate, 30u);
+	uint32_t failed = 0;
+	struct Case
+	{
+		const char* name;
+		float framerate; // 0: from the VUI timing info
+		int time_scale;
+		int num_units_in_tick;
+		uint32_t timescale; // expected
+		uint64_t frame_duration;
+	};
+	const Case cases[] = {
+		{ "29.97 fps", 29.97f, 0, 0, 30000, 1001 },
+		{ "23.976 fps", 23.976f, 0, 0, 24000, 1001 },
+		{ "59.94 fps", 59.94f, 0, 0, 60000, 1001 },
+		{ "30 fps", 30.0f, 0, 0, 30000, 1000 },
+		{ "12.5 fps", 12.5f, 0, 0, 12500, 1000 },
+		{ "VUI time_scale 60000, num_units_in_tick 1001", 0, 60000, 1001, 60000, 2002 },
+		{ "VUI time_scale 50, num_units_in_tick 1", 0, 50, 1, 50, 2 },
+	};
+	for (const Case& x : cases)
+	{
+		uint32_t timescale = 0;
+		uint64_t frame_duration = 0;
+		if (x.framerate > 0)
+		{
+			Video::Framerate_to_timebase(x.framerate, timescale, frame_duration);
+		}
+		else
+		{
+			h264::SPS sps = {};
+			sps.vui_parameters_present_flag = 1;
+			sps.vui.timing_info_present_flag = 1;
+			sps.vui.time_scale = x.time_scale;
+			sps.vui.num_units_in_tick = x.num_units_in_tick;
+			if (!Video::Get_vui_timebase(sps, timescale, frame_duration))
+			{
+				timescale = 0;
+			}
+		}
+		if (timescale != x.timescale || frame_duration != x.frame_duration)
+		{
+			printf("Timebase check failed: %s became %u / %llu instead of %u / %llu\n", x.name, timescale, (unsigned long long)frame_duration, x.timescale, (unsigned long long)x.frame_duration);
+			failed++;
+		}
+	}
+	printf("Timebase conversions: %u cases, %u failed\n", (uint32_t)arraysize(cases), failed);
+
+	// The simulated video has the timebase that the loaders give for 29.97 fps:
+	uint32_t timescale = 0;
+	uint64_t frame_duration = 0;
+	Video::Framerate_to_timebase(29.97f, timescale, frame_duration);
+	const uint64_t seconds = 24ull * 60ull * 60ull;
+	const uint64_t iterations = seconds * refresh_rate; // the last one is at exactly 24 hours
+	VideoDecoderCore core;
+	uint64_t presented_count = 0;
+	uint64_t max_lateness = 0; // nanoseconds from the start of a frame until its swap
+	uint64_t resync_count = 0;
+	float float_time = 0; // the previous float timestamps, accumulated the same way for comparison
+	for (uint64_t iteration = 0; iteration <= iterations; ++iteration)
+	{
+		const uint64_t now = iteration * 1000000000ull / refresh_rate;
+		const uint64_t playback_time = Video::Timer::nanoseconds_to_ticks(now, timescale);
+		if (playback_time < core.next_frame_time)
+			continue;
+		const uint64_t frame_time = presented_count * frame_duration;
+		if (core.next_frame_time != frame_time)
+		{
+			resync_count++;
+		}
+		max_lateness = std::max(max_lateness, now - Video::Timer::ticks_to_nanoseconds(core.next_frame_time, timescale));
+		core.advance_frame_time(frame_duration, playback_time);
+		float_time += float(frame_duration) / float(timescale);
+		presented_count++;
+	}
+	const uint64_t expected_count = seconds * timescale / frame_duration + 1;
+	const int64_t drift = int64_t(core.next_frame_time) - int64_t(presented_count * frame_duration);
+	const uint64_t refresh_period = 1000000000ull / refresh_rate;
+	if (presented_count != expected_count || drift != 0 || resync_count > 0 || max_lateness > refresh_period + 2) // the nanoseconds are rounded down
+	{
+		printf("Timebase check failed: presented frames: %llu instead of %llu, accumulated drift: %lld ticks, resyncs: %llu, largest swap lateness: %.3f ms\n", (unsigned long long)presented_count, (unsigned long long)expected_count, (long long)drift, (unsigned long long)resync_count, double(max_lateness) / 1000000.0);
+		failed++;
+	}
+	printf("Timebase: 24 hours at %u/%llu fps with %u Hz display: presented frames: %llu (expected: %llu), accumulated drift: %lld ticks, largest swap lateness: %.3f ms, float timestamps would drift: %.1f ms\n", timescale, (unsigned long long)frame_duration, refresh_rate, (unsigned long long)presented_count, (unsigned long long)expected_count, (long long)drift, double(max_lateness) / 1000000.0, (double(float_time) - double(presented_count * frame_duration) / double(timescale)) * 1000.0);
+	return failed;
+}
+
+// Measures the throughput of reading the video samples of an MP4 file, returns false if the file can't be read:
+//	the samples are read in file order (sequential) and in a shuffled order (scattered), like the windows of Video::Load_mp4() and like random access
+//	with FileReader::read_batch() through io_uring, with its pread fallback, and with one std::ifstream read per sample like the loader did before FileReader
+//	every pass is run after dropping the file from the page cache (if the OS allows it), and again with the file cached, and the bytes of every pass are compared with the first one
+static bool bench_sample_reads(const char* filename)
+{
+	FileReader reader;
+	if (!reader.open(filename) || reader.size() == 0)
+	{
+		printf("File not found: %s\n", filename);
+		return false;
+	}
+	MP4D_demux_t mp4 = {};
+	auto read_callback = [](int64_t offset, void* buffer, size_t size, void* token) -> int
+		{
+			FileReader* reader = (FileReader*)token;
+			return reader->read((uint64_t)offset, buffer, size) ? 0 : 1;
+		};
+	if (MP4D_open(&mp4, read_callback, &reader, (int64_t)reader.size()) != 1)
+	{
+		printf("The sample read benchmark needs an MP4 file: %s\n", filename);
+		return false;
+	}
+
+	// The samples of the video track, at most 1 GB of them:
+	std::vector<FileReader::Request> sequential;
+	uint64_t total_size = 0;
+	for (uint32_t ntrack = 0; ntrack < mp4.track_count && sequential.empty(); ntrack++)
+	{
+		const MP4D_track_t& track = mp4.track[ntrack];
+		if (track.handler_type != MP4D_HANDLER_TYPE_VIDE || track.object_type_indication != MP4_OBJECT_TYPE_AVC)
+			continue;
+		for (uint32_t i = 0; i < track.sample_count; ++i)
+		{
+			unsigned frame_bytes, timestamp, duration;
+			const MP4D_file_offset_t ofs = MP4D_frame_offset(&mp4, ntrack, i, &frame_bytes, &timestamp, &duration);
+			if (total_size + frame_bytes > (1ull << 30))
+				break;
+			FileReader::Request& request = sequential.emplace_back();
+			request.offset = (uint64_t)ofs;
+			request.size = frame_bytes;
+			request.dst = (void*)total_size; // offset within the destination memory
+			total_size += frame_bytes;
+		}
+	}
+	MP4D_close(&mp4);
+	reader.close();
+	if (sequential.empty())
+	{
+		printf("The sample read benchmark found no H264 samples in: %s\n", filename);
+		return false;
+	}
+	std::sort(sequential.begin(), sequential.end(), [](const FileReader::Request& a, const FileReader::Request& b) { return a.offset < b.offset; });
+	std::vector<FileReader::Request> scattered = sequential;
+	uint32_t random = 0x9E3779B9; // xorshift state, so the order is the same in every run
+	for (size_t i = scattered.size(); i > 1; --i)
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		std::swap(scattered[i - 1], scattered[random % i]);
+	}
+
+	std::vector<uint8_t> memory(total_size);
+	std::vector<uint8_t> reference;
+	std::vector<FileReader::Request> requests;
+	enum class Method { io_uring, pread, ifstream };
+	const char* method_names[] = { "io_uring", "pread", "ifstream" };
+	const char* order_names[] = { "sequential", "scattered" };
+	uint32_t mismatch_count = 0;
+	printf("Sample reads: %u samples, %.1f MB, each pass reads all of them\n", (uint32_t)sequential.size(), double(total_size) / 1000000.0);
+	for (int order = 0; order < 2; ++order)
+	{
+		for (Method method : { Method::io_uring, Method::pread, Method::ifstream })
+		{
+			double megabytes_per_second[2] = {}; // after dropping the page cache, cached
+			for (int cached = 0; cached < 2; ++cached)
+			{
+#ifdef __linux__
+				if (!cached)
+				{
+					const int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+					if (fd >= 0)
+					{
+						posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED); // only evicts clean pages, and tmpfs keeps them anyway
+						::close(fd);
+					}
+				}
+#endif // __linux__
+				std::fill(memory.begin(), memory.end(), uint8_t(0));
+				requests = order == 0 ? sequential : scattered;
+				for (FileReader::Request& request : requests)
+				{
+					request.dst = memory.data() + (uint64_t)request.dst;
+				}
+				Video::Timer timer;
+				bool success = true;
+				if (method == Method::ifstream)
+				{
+					std::ifstream file(filename, std::ios::binary);
+					for (const FileReader::Request& request : requests)
+					{
+						file.seekg((std::streampos)request.offset);
+						file.read((char*)request.dst, (std::streamsize)request.size);
+						success = success && file.good();
+					}
+				}
+				else
+				{
+					FileReader batch_reader;
+					batch_reader.allow_io_uring = method == Method::io_uring;
+					success = batch_reader.open(filename);
+					if (success && method == Method::io_uring && !batch_reader.is_async())
+					{
+						printf("Sample reads: io_uring is not available, skipped\n");
+						break;
+					}
+					batch_reader.register_buffer(memory.data(), memory.size());
+					success = success && batch_reader.read_batch(requests.data(), requests.size());
+				}
+				const uint64_t nanoseconds = std::max(uint64_t(1), timer.elapsed_nanoseconds());
+				if (!success)
+				{
+					printf("Sample reads: %s %s failed\n", order_names[order], method_names[(int)method]);
+					return false;
+				}
+				if (reference.empty())
+				{
+					reference = memory;
+				}
+				else if (memory != reference)
+				{
+					printf("Sample reads: %s %s read different bytes\n", order_names[order], method_names[(int)method]);
+					mismatch_count++;
+				}
+				megabytes_per_second[cached] = double(total_size) / 1000000.0 / (double(nanoseconds) / 1000000000.0);
+			}
+			if (megabytes_per_second[0] > 0)
+			{
+				printf("Sample reads: %-10s %-8s: %9.1f MB/s, cached: %9.1f MB/s\n", order_names[order], method_names[(int)method], megabytes_per_second[0], megabytes_per_second[1]);
+			}
+		}
+	}
+	return mismatch_count == 0;
+}
+
+// Plans a seek to every frame of the video, and prints the average cost of the plans and of the simpler strategies, returns the number of failed plans:
+//	every plan is executed on a DPB with the slots of the video, like VideoDecoderCore does it, and the active reference list entries of a decoded frame must only be slots that were decoded, not the ones of the frames that were only marked
+static uint32_t check_seek_plans(const Video& video)
+{
+	SeekPlanner planner;
+	SeekPlanner::Plan plan;
+	SeekPlanner::Cost minimal, references_only, all_frames;
+	uint32_t max_frames = 0;
+	uint32_t failed = 0;
+	uint64_t planner_nanoseconds = 0;
+	Video::Timer timer;
+	DecodedPictureBuffer dpb;
+	const int frame_count = (int)video.frame_infos.size();
+	for (int target = 0; target < frame_count; ++target)
+	{
+		const uint64_t begin = timer.elapsed_nanoseconds();
+		const bool planned = planner.plan(video, target, plan);
+		planner_nanoseconds += timer.elapsed_nanoseconds() - begin;
+		if (!planned || plan.actions.back() != SeekPlanner::Action::decode)
+		{
+			failed++;
+			continue;
+		}
+		minimal.frames += plan.minimal.frames;
+		minimal.estimate += plan.minimal.estimate;
+		references_only.frames += plan.references_only.frames;
+		references_only.estimate += plan.references_only.estimate;
+		all_frames.frames += plan.all_frames.frames;
+		all_frames.estimate += plan.all_frames.estimate;
+		max_frames = std::max(max_frames, plan.minimal.frames);
+
+		bool decoded_slots[DecodedPictureBuffer::max_slots] = {};
+		dpb.reset(video.num_dpb_slots);
+		for (int i = plan.begin; i <= plan.target; ++i)
+		{
+			const SeekPlanner::Action action = plan.actions[i - plan.begin];
+			if (action == SeekPlanner::Action::skip)
+				continue;
+			const Video::FrameInfo frame_info = video.frame_infos[i];
+			const h264::SliceHeader slice_header = video.frame_infos.slice_header(i);
+			const h264::PPS& pps = video.pps_array[slice_header.pic_parameter_set_id];
+			const h264::SPS& sps = video.sps_array[pps.seq_parameter_set_id];
+			DecodedPictureBuffer::Frame frame;
+			dpb.begin_frame(sps, slice_header, frame_info.is_intra, frame_info.reference_priority > 0, frame_info.poc, frame);
+			if (action == SeekPlanner::Action::decode)
+			{
+				uint8_t reference_slots[DecodedPictureBuffer::max_references];
+				const uint32_t reference_count = SeekPlanner::active_reference_slots(sps, slice_header, dpb, frame, reference_slots);
+				for (uint32_t r = 0; r < reference_count; ++r)
+				{
+					if (!decoded_slots[reference_slots[r]])
+					{
+						printf("Seek plan failure: the plan of frame_index: %d decodes frame_index: %d, which references a frame that was not decoded\n", target, i);
+						failed++;
+						break;
+					}
+				}
+			}
+			dpb.end_frame(slice_header, frame);
+			decoded_slots[frame.current_slot] = action == SeekPlanner::Action::decode;
+		}
+	}
+	const double count = double(std::max(1, frame_count));
+	printf("Seek plans: %d targets, decoded frames per seek: %.2f minimal (at most %u), %.2f references only, %.2f all frames from the IDR frame\n", frame_count, double(minimal.frames) / count, max_frames, double(references_only.frames) / count, double(all_frames.frames) / count);
+	printf("Seek plans: estimated cost per seek in average frame decodes: %.2f minimal, %.2f references only, %.2f all frames, planner CPU time: %.1f ns per seek, %u failed\n", minimal.estimate / count, references_only.estimate / count, all_frames.estimate / count, double(planner_nanoseconds) / count, failed);
+	return failed;
+}
+
+// Returns the largest number of frames that precede a frame in decode order but follow it in display order, this is the reorder depth that the stream really uses:
+static int measure_reorder_depth(const Video& video)
+{
+	// Fenwick tree of the display orders that were decoded:
+	const int frame_count = (int)video.frame_infos.size();
+	std::vector<int> tree(frame_count + 1, 0);
+	int depth = 0;
+	for (int i = 0; i < frame_count; ++i)
+	{
+		const int display_order = video.frame_infos.display_orders[i];
+		int earlier = 0; // decoded frames with smaller display order
+		for (int x = display_order; x > 0; x -= x & -x)
+		{
+			earlier += tree[x];
+		}
+		depth = std::max(depth, i - earlier);
+		for (int x = display_order + 1; x <= frame_count; x += x & -x)
+		{
+			tree[x]++;
+		}
+	}
+	return depth;
+}
+
+// Records the commands, and checks that they are valid for the DPB and the reordering pictures:
+struct RecordingBackend : VideoDecoderCore::Backend
+{
+	bool print = true;
+	uint32_t num_dpb_slots = 0;
+	const VideoDecoderCore* core = nullptr; // for printing the reference info of the slots, and detecting late pictures
+	uint64_t decode_count = 0;
+	uint64_t display_count = 0;
+	uint64_t repeat_count = 0; // display loop iterations that presented the same picture again
+	uint64_t late_count = 0; // display loop iterations where the next picture should have been displayed, but it wasn't decoded yet
+	int loop_frame_count = 0; // if set, the late iterations and the display order continuity are also checked at the video loops
+	int loop_lead_in = 0; // display orders of the first GOP of a loop, the late iterations before these are counted as stalls at the loop
+	uint64_t loop_late_count = 0; // late display iterations in the first GOP of the video loops after the first one
+	int last_display_order = -1;
+	uint64_t discontinuity_count = 0; // displayed pictures that didn't follow the previous one in display order, while no frames were skipped
+	uint32_t picture_count = 0; // number of reordering pictures that were created
+	uint32_t reserved_picture_count = 0; // number of reordering pictures that were created before playback
+	uint64_t playback_time = 0; // simulated time of the current display loop iteration
+
+	// Simulated GPU, decodes are executed one after the other, each takes decode_latency * frame size / average_frame_size ticks:
+	uint64_t decode_latency = 0; // 0: decodes complete immediately
+	uint64_t intra_cost = 1; // intra frames take this many times longer, because real encoders make them much larger than the other frames
+	uint64_t average_frame_size = 1;
+	bool running_average = false; // the frame sizes of live streams are not known in advance, so the average of the decoded ones is used
+	uint64_t decoded_bytes = 0;
+	uint64_t gpu_time = 0; // when the last submitted decode completes
+	uint64_t* shared_gpu_time = nullptr; // if set, the decodes of multiple backends are executed one after the other on the same simulated GPU
+	std::vector<uint64_t> completion_times; // per picture
+	uint32_t max_in_flight = 0;
+	uint32_t in_flight = 0;
+	uint8_t slot_contents[DecodedPictureBuffer::max_slots] = {}; // 0: unknown, 1: the slot was last decoded by a non-reference frame, it must not be referenced, 2: by a reference frame
+	int slot_pocs[DecodedPictureBuffer::max_slots] = {}; // the POC of the frame that was last decoded into the slot
+	uint64_t stale_reference_count = 0; // referenced slots whose POC in the DPB is not the one of the decoded frame, because a frame that was only marked took the slot
+
+	// DXVA parameter check, if set, the DXVA parameters of every decode are built with the DXVAPictureParametersH264 and compared with the field by field filling:
+	DXVAPictureParametersH264* dxva = nullptr;
+	uint64_t dxva_mismatch_count = 0;
+	uint64_t dxva_nanoseconds = 0;
+	uint64_t dxva_reference_nanoseconds = 0;
+	Video::Timer dxva_timer;
+
+	// Vulkan slot check, if set, the reference slots of every decode are updated with the VulkanParametersH264 and compared with refilling every slot:
+	VulkanParametersH264* vulkan = nullptr;
+	VkExtent2D vulkan_coded_extent = {};
+	uint64_t vulkan_mismatch_count = 0;
+	uint64_t vulkan_inactive_count = 0; // reference slots given to vkCmdBeginVideoCodingKHR that are not active with the picture of the DPB
+	bool vulkan_active_slots[DecodedPictureBuffer::max_slots] = {}; // slots activated by a decode since the last VK_VIDEO_CODING_CONTROL_RESET_BIT_KHR
+	uint64_t vulkan_nanoseconds = 0;
+	uint64_t vulkan_reference_nanoseconds = 0;
+
+	// Bitstream ring check, if set, every decoded frame is copied into a simulated ring buffer just in time, and its bytes are compared when its decode completes, so a range that was reused while its decode was in flight is detected:
+	BitstreamRing* ring = nullptr;
+	std::vector<uint8_t> ring_memory;
+	std::vector<uint64_t> ring_offsets; // per picture, the offset of its frame in the ring, ~0 if it didn't fit
+	uint64_t completed_count = 0; // the simulated decode timeline, the number of completed decodes
+	uint64_t ring_mismatch_count = 0;
+	uint64_t ring_full_count = 0;
+
+	bool is_decode_completed(int picture) override
+	{
+		if (completion_times[picture] > playback_time)
+			return false;
+		in_flight--;
+		completed_count++;
+		if (ring != nullptr && ring_offsets[picture] != ~0ull)
+		{
+			const int frame_index = core->pictures[picture].frame_index;
+			const Video& video = *core->video;
+			if (std::memcmp(ring_memory.data() + ring_offsets[picture], video.h264_data.data() + video.frame_infos.offsets[frame_index], video.frame_infos.sizes[frame_index]) != 0)
+			{
+				printf("Bitstream ring mismatch at frame_index: %d, its range was overwritten while it was decoding\n", frame_index);
+				ring_mismatch_count++;
+			}
+		}
+		return true;
+	}
+
+	void decode(const VideoDecoderCore::DecodeCommand& command) override
+	{
+		assert(command.current_slot < num_dpb_slots);
+		assert(command.reference_count < num_dpb_slots);
+		if (command.picture_created)
+		{
+			assert(command.picture == (int)picture_count);
+			picture_count++;
+			completion_times.push_back(0);
+		}
+		// Only the slots in the active reference lists are read, the other references are only listed, after a seek they can be the slots of frames that were only marked:
+		uint8_t read_slots[DecodedPictureBuffer::max_references];
+		const uint32_t read_count = SeekPlanner::active_reference_slots(*command.sps, command.slice_header, core->dpb, command.dpb_frame, read_slots);
+		for (uint32_t i = 0; i < read_count; ++i)
+		{
+			assert(slot_contents[read_slots[i]] != 1); // this also checks that the frames skipped by temporal decimation are never referenced
+			if (slot_pocs[read_slots[i]] != core->dpb.poc_status[read_slots[i]])
+			{
+				printf("Stale reference at frame_index: %d, slot %u wasn't decoded by the frame that the DPB has in it\n", command.frame_index, (uint32_t)read_slots[i]);
+				stale_reference_count++;
+			}
+		}
+		slot_contents[command.current_slot] = command.frame_info.reference_priority > 0 ? 2 : 1;
+		slot_pocs[command.current_slot] = command.frame_info.poc;
+		for (int operation : command.slice_header.drpm.memory_management_control_operation)
+		{
+			if (operation == 0)
+				break;
+			if (operation == 5)
+			{
+				slot_pocs[command.current_slot] = 0; // the frame is referenced with POC 0 after marking all references as unused
+			}
+		}
+		if (ring != nullptr)
+		{
+			// The completion value of this decode is the number of decodes when it completes:
+			ring->reclaim(completed_count);
+			ring_offsets.resize(completion_times.size(), ~0ull);
+			uint64_t offset = 0;
+			if (ring->allocate(command.frame_info.size, decode_count + 1, offset))
+			{
+				std::memcpy(ring_memory.data() + offset, core->video->h264_data.data() + command.frame_info.offset, command.frame_info.size);
+				ring_offsets[command.picture] = offset;
+			}
+			else
+			{
+				printf("Bitstream ring full at frame_index: %d, with %u decodes in flight\n", command.frame_index, in_flight);
+				ring_offsets[command.picture] = ~0ull;
+				ring_full_count++;
+			}
+		}
+		if (dxva != nullptr)
+		{
+			DXVA_PicParams_H264 pic_params = {};
+			DXVA_Qmatrix_H264 qmatrix = {};
+			DXVA_Slice_H264_Short slice = {};
+			uint64_t begin = dxva_timer.elapsed_nanoseconds();
+			fill_dxva_reference(*core, command, pic_params, qmatrix, slice);
+			uint64_t end = dxva_timer.elapsed_nanoseconds();
+			dxva_reference_nanoseconds += end - begin;
+			begin = end;
+			const DXVA_PicParams_H264& built_pic_params = dxva->build(*core->video, command, core->dpb);
+			const DXVA_Qmatrix_H264& built_qmatrix = dxva->qmatrix(*core->video, command);
+			const DXVA_Slice_H264_Short built_slice = DXVAPictureParametersH264::slice_control(command);
+			end = dxva_timer.elapsed_nanoseconds();
+			dxva_nanoseconds += end - begin;
+			if (std::memcmp(&pic_params, &built_pic_params, sizeof(pic_params)) != 0 || std::memcmp(&qmatrix, &built_qmatrix, sizeof(qmatrix)) != 0 || std::memcmp(&slice, &built_slice, sizeof(slice)) != 0)
+			{
+				printf("DXVA parameter mismatch at frame_index: %d\n", command.frame_index);
+				dxva_mismatch_count++;
+			}
+		}
+		if (vulkan != nullptr)
+		{
+			static VulkanParametersH264 reference; // static, because it's large, and only its slot arrays are used
+			uint64_t begin = dxva_timer.elapsed_nanoseconds();
+			fill_vulkan_slots_reference(*core, command, vulkan_coded_extent, VK_NULL_HANDLE, reference);
+			uint64_t end = dxva_timer.elapsed_nanoseconds();
+			vulkan_reference_nanoseconds += end - begin;
+			begin = end;
+			vulkan->update_slots(command, core->dpb);
+			end = dxva_timer.elapsed_nanoseconds();
+			vulkan_nanoseconds += end - begin;
+			if (!compare_vulkan_slots(reference.reference_slots, vulkan->reference_slots, command.reference_count + 1))
+			{
+				printf("Vulkan reference slot mismatch at frame_index: %d\n", command.frame_index);
+				vulkan_mismatch_count++;
+			}
+			// Like the Vulkan backend, the coding begins with the reference slots, then the first frame resets the session, which deactivates every slot, and the decode activates its setup slot:
+			for (uint32_t i = 0; i < command.reference_count; ++i)
+			{
+				const int32_t slot = vulkan->reference_slots[i].slotIndex;
+				if (slot < 0 || !vulkan_active_slots[slot] || slot_pocs[slot] != core->dpb.poc_status[slot])
+				{
+					printf("Vulkan inactive reference slot at frame_index: %d, slot %d was not activated by the frame that the DPB has in it\n", command.frame_index, slot);
+					vulkan_inactive_count++;
+				}
+			}
+			if (command.frame_index == 0)
+			{
+				std::fill(std::begin(vulkan_active_slots), std::end(vulkan_active_slots), false);
+			}
+			vulkan_active_slots[command.current_slot] = true;
+		}
+		decode_count++;
+		decoded_bytes += command.frame_info.size;
+		if (running_average)
+		{
+			average_frame_size = std::max(uint64_t(1), decoded_bytes / decode_count);
+		}
+		in_flight++;
+		max_in_flight = std::max(max_in_flight, in_flight);
+		if (decode_latency > 0)
+		{
+			uint64_t& gpu = shared_gpu_time != nullptr ? *shared_gpu_time : gpu_time;
+			gpu = std::max(gpu, playback_time) + decode_latency * command.frame_info.size * (command.frame_info.is_intra ? intra_cost : 1) / average_frame_size;
+			gpu_time = gpu;
+		}
+		completion_times[command.picture] = decode_latency > 0 ? gpu_time : 0;
+		if (!print)
+			return;
+		char references[16 * 5 + 1] = {};
+		int length = 0;
+		for (uint32_t i = 0; i < command.reference_count; ++i)
+		{
+			assert(command.reference_slots[i] != command.current_slot);
+			length += snprintf(references + length, sizeof(references) - length, i == 0 ? "%u%s" : ",%u%s", (uint32_t)command.reference_slots[i], core->dpb.longterm_status[command.reference_slots[i]] ? "L" : ""); // L: long-term reference
+		}
+		printf("[%llu] decode frame_index: %d, display_order: %d, poc: %d, frame_num: %d, slot: %u, references: [%s], picture: %d%s", (unsigned long long)playback_time, command.frame_index, command.frame_info.display_order, command.frame_info.poc, command.slice_header.frame_num, command.current_slot, references, command.picture, command.picture_created ? " (created)" : "");
+		if (decode_latency > 0)
+		{
+			printf(", completes at: %llu", (unsigned long long)gpu_time);
+		}
+		printf("\n");
+		if (command.dpb_frame.gap_count > 0)
+		{
+			printf("\tframe_num gap: %u non-existing frames were inferred\n", command.dpb_frame.gap_count);
+		}
+	}
+
+	void display(const VideoDecoderCore::DisplayCommand& command) override
+	{
+		assert(command.picture < (int)picture_count);
+		if (!command.changed)
+		{
+			repeat_count++;
+			if (command.picture >= 0 && playback_time >= core->next_frame_time)
+			{
+				late_count++;
+				if (loop_frame_count > 0 && core->target_display_order >= loop_frame_count && core->target_display_order % loop_frame_count < loop_lead_in)
+				{
+					loop_late_count++;
+				}
+			}
+			return;
+		}
+		display_count++;
+		const int display_order = core->pictures[command.picture].display_order;
+		if (loop_frame_count > 0 && core->skipped_count == 0 && last_display_order >= 0 && display_order != last_display_order + 1)
+		{
+			discontinuity_count++;
+		}
+		last_display_order = display_order;
+		if (print)
+		{
+			printf("[%llu] display picture: %d, frame_index: %d\n", (unsigned long long)playback_time, command.picture, core->pictures[command.picture].frame_index);
+		}
+	}
+};
+
+// Plays the video in several configurations through the reordering pictures, and checks their queues, returns the number of failures:
+//	after the first loop (the warm-up), the pictures, their free and decoding queues, display_order_lookup and the skipped frames must not allocate any more, their sizes and storage must stay the same until the end
+//	in every display loop iteration, every entry of display_order_lookup must be at the position of its display order, and the lookup must have exactly the decoding and decoded pictures that are waiting to be displayed
+static uint32_t check_picture_pool(Video& video)
+{
+	struct Case
+	{
+		const char* name;
+		uint32_t ahead;
+		uint32_t latency_ms;
+		uint32_t preroll;
+		bool decimate;
+		double max_frame_rate_factor; // of the frame rate of the video, 0: no cap
+		bool reverse;
+		double scan_speed;
+		uint32_t seek_interval;
+	};
+	const Case cases[] = {
+		{ "in order", 0, 0, 0, false, 0, false, 0, 0 },
+		{ "decode ahead", 8, 12, 0, false, 0, false, 0, 0 },
+		{ "loop pre-roll", 2, 12, 16, false, 0, false, 0, 0 },
+		{ "adaptive decimation", 4, 40, 0, true, 0, false, 0, 0 },
+		{ "frame rate cap", 4, 4, 0, false, 0.4, false, 0, 0 },
+		{ "reverse", 0, 4, 0, false, 0, true, 0, 0 },
+		{ "scan", 2, 4, 0, false, 0, false, 4, 0 },
+		{ "seek", 4, 4, 0, false, 0, false, 0, 20 },
+	};
+	struct Allocations
+	{
+		size_t pictures = 0;
+		const void* picture_storage = nullptr;
+		const void* free_storage = nullptr;
+		const void* decoding_storage = nullptr;
+		size_t lookup_size = 0;
+		const void* lookup_storage = nullptr;
+		const void* skipped_storage = nullptr;
+		bool operator!=(const Allocations& other) const
+		{
+			return pictures != other.pictures || picture_storage != other.picture_storage || free_storage != other.free_storage || decoding_storage != other.decoding_storage || lookup_size != other.lookup_size || lookup_storage != other.lookup_storage || skipped_storage != other.skipped_storage;
+		}
+	};
+	const int frame_count = (int)video.frame_infos.size();
+	const uint32_t refresh_rate = 60;
+	const double frame_rate = double(frame_count) * double(video.timescale) / double(std::max(uint64_t(1), video.duration));
+	const uint32_t num_dpb_slots = video.num_dpb_slots; // the cases with decode ahead add slots, the playback after the check gets the original DPB
+	uint32_t failed = 0;
+	for (const Case& x : cases)
+	{
+		video.frameIndex = 0;
+		VideoDecoderCore core;
+		core.video = &video;
+		const uint32_t frames_in_flight = core.enable_decode_ahead(x.ahead);
+		if (x.preroll > 0)
+		{
+			core.enable_loop_preroll(x.preroll);
+		}
+		if (x.scan_speed > 0)
+		{
+			core.set_scan_speed(x.scan_speed);
+		}
+		if (x.reverse)
+		{
+			core.reverse_cache_budget = 16;
+			core.set_reverse(true);
+		}
+		const uint32_t reserved_pictures = core.reserve_pictures();
+		if (x.decimate || x.max_frame_rate_factor > 0)
+		{
+			core.enable_decimation(frame_rate * x.max_frame_rate_factor, x.decimate);
+		}
+
+		RecordingBackend backend;
+		backend.print = false;
+		backend.num_dpb_slots = video.num_dpb_slots;
+		backend.core = &core;
+		backend.picture_count = reserved_pictures;
+		backend.reserved_picture_count = reserved_pictures;
+		backend.completion_times.resize(reserved_pictures);
+		backend.decode_latency = Video::Timer::nanoseconds_to_ticks(x.latency_ms * 1000000ull, video.timescale);
+		backend.average_frame_size = std::max(uint64_t(1), uint64_t(video.h264_data.size()) / uint64_t(std::max(1, frame_count)));
+
+		const int loops = 4;
+		const uint64_t max_iterations = uint64_t(frame_count) * loops * refresh_rate * 4; // enough for a frame rate of 1 fps, even if the scanned intra frames are displayed for 4 frames
+		uint32_t seek_random = 0x2545F491;
+		Allocations warm;
+		bool warmed_up = false;
+		uint64_t lookup_errors = 0;
+		uint64_t iteration = 0;
+		for (; core.target_display_order < frame_count * loops && iteration < max_iterations; ++iteration)
+		{
+			backend.playback_time = Video::Timer::nanoseconds_to_ticks(iteration * 1000000000ull / refresh_rate, video.timescale);
+			if (x.seek_interval > 0 && iteration > 0 && iteration % x.seek_interval == 0)
+			{
+				seek_random ^= seek_random << 13;
+				seek_random ^= seek_random >> 17;
+				seek_random ^= seek_random << 5;
+				core.seek(int(seek_random % (uint32_t)frame_count));
+			}
+			core.update(backend, backend.playback_time);
+
+			uint32_t entry_count = 0;
+			for (size_t i = 0; i < core.display_order_lookup.size(); ++i)
+			{
+				const int entry = core.display_order_lookup[i];
+				if (entry < 0)
+					continue;
+				entry_count++;
+				const int display_order = core.pictures[entry].display_order;
+				if (display_order < core.target_display_order || size_t(display_order & (core.display_order_lookup.size() - 1)) != i || core.find_picture(display_order) != entry)
+				{
+					lookup_errors++;
+				}
+			}
+			uint32_t waiting_count = core.working_count;
+			for (int picture : core.decoding_pictures)
+			{
+				waiting_count += core.pictures[picture].display_order >= core.target_display_order ? 1 : 0;
+			}
+			if (entry_count != waiting_count)
+			{
+				lookup_errors++;
+			}
+
+			Allocations now;
+			now.pictures = core.pictures.size();
+			now.picture_storage = core.pictures.data();
+			now.free_storage = core.free_pictures.data();
+			now.decoding_storage = core.decoding_pictures.data();
+			now.lookup_size = core.display_order_lookup.size();
+			now.lookup_storage = core.display_order_lookup.data();
+			now.skipped_storage = core.skipped_frames.data();
+			if (!warmed_up && core.target_display_order >= frame_count)
+			{
+				warm = now;
+				warmed_up = true;
+			}
+			else if (warmed_up && now != warm)
+			{
+				printf("Picture pool check failed: %s: the reordering pictures allocated after the warm-up, at display order %d\n", x.name, core.target_display_order);
+				warm = now;
+				failed++;
+			}
+		}
+		if (!warmed_up || core.target_display_order < frame_count * loops)
+		{
+			printf("Picture pool check failed: %s: the playback stopped at display order %d\n", x.name, core.target_display_order);
+			failed++;
+		}
+		if (lookup_errors > 0)
+		{
+			printf("Picture pool check failed: %s: %llu display_order_lookup errors\n", x.name, (unsigned long long)lookup_errors);
+			failed++;
+		}
+		printf("Picture pool: %s: %u reordering pictures (%u reserved), display_order_lookup: %u entries, decoded frames: %llu, frames in flight: %u, skipped frames: %llu\n", x.name, backend.picture_count, reserved_pictures, (uint32_t)core.display_order_lookup.size(), (unsigned long long)backend.decode_count, frames_in_flight, (unsigned long long)core.skipped_count);
+	}
+	video.frameIndex = 0;
+	video.num_dpb_slots = num_dpb_slots;
+	printf("Picture pool: %u cases, %u failed\n", (uint32_t)arraysize(cases), failed);
+	return failed;
+}
+
+// Forwards the commands of the scheduled streams to their own RecordingBackend:
+struct SchedulerBackend : DecodeScheduler::Backend
+{
+	std::vector<RecordingBackend> streams;
+
+	void decode(uint32_t stream, const VideoDecoderCore::DecodeCommand& command) override
+	{
+		streams[stream].decode(command);
+	}
+	void display(uint32_t stream, const VideoDecoderCore::DisplayCommand& command) override
+	{
+		streams[stream].display(command);
+	}
+	bool is_decode_completed(uint32_t stream, int picture) override
+	{
+		return streams[stream].is_decode_completed(picture);
+	}
+};
+
+// Tracks the decoder sessions of a SessionPool, and checks that only existing sessions are destroyed:
+struct RecordingSessionBackend : SessionPool::Backend
+{
+	bool print = true;
+	std::vector<SessionPool::Key> keys; // per session index
+	std::vector<uint8_t> alive; // per session index
+	uint32_t max_alive = 0;
+
+	void create_session(uint32_t session, const SessionPool::Key& key) override
+	{
+		if (session >= alive.size())
+		{
+			keys.resize(session + 1);
+			alive.resize(session + 1);
+		}
+		assert(!alive[session]);
+		keys[session] = key;
+		alive[session] = 1;
+		uint32_t count = 0;
+		for (uint8_t x : alive)
+		{
+			count += x;
+		}
+		max_alive = std::max(max_alive, count);
+		if (print)
+		{
+			printf("create session: %u, profile: %u, level: %u, max coded extent: %u x %u, DPB slots: %u\n", session, key.profile_idc, key.level_idc, key.max_width, key.max_height, key.dpb_slots);
+		}
+	}
+	void destroy_session(uint32_t session) override
+	{
+		assert(session < alive.size() && alive[session]);
+		alive[session] = 0;
+		if (print)
+		{
+			printf("destroy session: %u\n", session);
+		}
+	}
+};
+
+// Plays the items of a Playlist with a RecordingBackend each, their decoder sessions come from a SessionPool:
+struct RecordingPlaylistBackend : Playlist::Backend
+{
+	SessionPool pool;
+	RecordingSessionBackend sessions;
+	RecordingBackend recorders[2]; // by Item::id % 2, at most two items are used at the same time
+	uint32_t item_sessions[2] = {};
+	bool reused[2] = {};
+	uint64_t now = 0; // simulated time of the current display loop iteration
+	uint64_t decode_count = 0;
+	uint64_t display_count = 0;
+	uint64_t discontinuity_count = 0;
+
+	void begin_item(Playlist::Item& item) override
+	{
+		// Like the Vulkan backend, the simulated backend decodes the baseline, main and high profiles with a high profile session, the picture format comes from the chroma format and bit depth:
+		const h264::SPS& sps = item.video.sps_array[0];
+		const uint32_t profile_idc = sps.profile_idc <= 100 ? 100 : (uint32_t)sps.profile_idc;
+		const SessionPool::Key key = SessionPool::Key::from_video(item.video, profile_idc, uint32_t(sps.chroma_format_idc << 8) | uint32_t(8 + sps.bit_depth_luma_minus8));
+		const uint32_t slot = item.id % 2;
+		item_sessions[slot] = pool.acquire(sessions, key, &reused[slot]);
+		assert(sessions.alive[item_sessions[slot]] && sessions.keys[item_sessions[slot]].is_compatible(key));
+
+		RecordingBackend& recorder = recorders[slot];
+		recorder = RecordingBackend();
+		recorder.print = false;
+		recorder.num_dpb_slots = item.video.num_dpb_slots;
+		recorder.core = &item.core;
+		recorder.picture_count = (uint32_t)item.core.pictures.size();
+		recorder.reserved_picture_count = recorder.picture_count;
+		recorder.completion_times.resize(recorder.picture_count);
+		recorder.loop_frame_count = (int)item.video.frame_infos.size(); // checks the display order continuity
+	}
+	void end_decoding(Playlist::Item& item) override
+	{
+		pool.release(item_sessions[item.id % 2]); // the next item can take over the session, while the pictures of this one are still displayed
+	}
+	void end_item(Playlist::Item& item) override
+	{
+		const uint32_t slot = item.id % 2;
+		const RecordingBackend& recorder = recorders[slot];
+		decode_count += recorder.decode_count;
+		display_count += recorder.display_count;
+		discontinuity_count += recorder.discontinuity_count;
+		printf("Playlist item: %s, %u x %u, DPB slots: %u, session: %u (%s), decoded frames: %llu, displayed frames: %llu, starts at: %.3f ms\n", item.filename.c_str(), item.video.padded_width, item.video.padded_height, item.video.num_dpb_slots, item_sessions[slot], reused[slot] ? "reused" : "created", (unsigned long long)recorder.decode_count, (unsigned long long)recorder.display_count, double(item.start_nanoseconds) / 1000000.0);
+	}
+	void decode(Playlist::Item& item, const VideoDecoderCore::DecodeCommand& command) override
+	{
+		recorders[item.id % 2].decode(command);
+	}
+	void display(Playlist::Item& item, const VideoDecoderCore::DisplayCommand& command) override
+	{
+		RecordingBackend& recorder = recorders[item.id % 2];
+		recorder.playback_time = now > item.start_nanoseconds ? Video::Timer::nanoseconds_to_ticks(now - item.start_nanoseconds, item.video.timescale) : 0;
+		recorder.display(command);
+	}
+};
+
+// Plays a RenditionSet with one RecordingBackend, and checks that every switch starts with an IDR frame of the new rendition:
+struct RecordingRenditionBackend : RenditionSet::Backend
+{
+	RecordingBackend recorder;
+	const RenditionSet* set = nullptr;
+	uint32_t timescale = 1; // of the current rendition, the simulated times of the recorder are converted at the switches
+	bool print = true;
+	bool switched = false; // the next decode is the first one of the new rendition
+	uint64_t non_idr_switch_count = 0;
+
+	void switch_rendition(uint32_t rendition, bool reconfigure) override
+	{
+		const Video& video = *set->renditions[rendition];
+		if (reconfigure)
+		{
+			assert(recorder.in_flight == 0);
+			std::fill(std::begin(recorder.slot_contents), std::end(recorder.slot_contents), 0); // the DPB is created again
+		}
+		recorder.num_dpb_slots = video.num_dpb_slots;
+		for (uint64_t& time : recorder.completion_times)
+		{
+			time = RenditionSet::convert_ticks(time, timescale, video.timescale);
+		}
+		recorder.gpu_time = RenditionSet::convert_ticks(recorder.gpu_time, timescale, video.timescale);
+		recorder.playback_time = RenditionSet::convert_ticks(recorder.playback_time, timescale, video.timescale);
+		recorder.decode_latency = RenditionSet::convert_ticks(recorder.decode_latency, timescale, video.timescale);
+		timescale = video.timescale;
+		switched = true;
+		if (print)
+		{
+			printf("[%llu] switch to rendition: %u, %u x %u, DPB slots: %u, frame_index: %d, display_order: %d%s\n", (unsigned long long)recorder.playback_time, rendition, video.padded_width, video.padded_height, video.num_dpb_slots, video.frameIndex, video.frame_infos.display_orders[video.frameIndex] + set->core.display_order_offset, reconfigure ? ", DPB reconfigured" : "");
+		}
+	}
+	void decode(const VideoDecoderCore::DecodeCommand& command) override
+	{
+		if (switched)
+		{
+			non_idr_switch_count += command.frame_info.is_intra ? 0 : 1;
+			switched = false;
+		}
+		recorder.decode(command);
+	}
+	void display(const VideoDecoderCore::DisplayCommand& command) override
+	{
+		recorder.display(command);
+	}
+	bool is_decode_completed(int picture) override
+	{
+		return recorder.is_decode_completed(picture);
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	bool quiet = false;
+	uint32_t loops = 1;
+	uint32_t refresh_rate = 60;
+	uint32_t latency_ms = 0;
+	uint32_t ahead = 0;
+	bool bench = false;
+	bool dxva_check = false;
+	bool vulkan_check = false;
+	bool sizing_check = false;
+	bool presentation_clock_enabled = false;
+	uint32_t jitter_us = 0;
+	double drift_ppm = 0;
+	uint32_t preroll = 0;
+	uint32_t intra_cost = 1;
+	bool decimate = false;
+	double max_frame_rate = 0;
+	double scan_speed = 0;
+	bool reverse = false;
+	uint32_t reverse_cache = 0;
+	uint32_t stream_count = 1;
+	int priority = 0;
+	uint32_t session_limit = 2;
+	uint32_t switch_interval = 0;
+	uint32_t ring_alignment = 0;
+	uint32_t seek_interval = 0;
+	bool pool_check = false;
+	bool timebase_check = false;
+	bool read_bench = false;
+	uint64_t capacity_macroblocks = 0;
+	double capacity_dpb_megabytes = 0;
+	int arg = 1;
+	for (; arg < argc - 1; ++arg)
+	{
+		if (argv[arg][0] != '-' || argv[arg][1] == 0)
+		{
+			break; // the rest of the arguments are videos
+		}
+		else if (std::strcmp(argv[arg], "-quiet") == 0)
+		{
+			quiet = true;
+		}
+		else if (std::strcmp(argv[arg], "-bench") == 0 || std::strcmp(argv[arg], "--bench") == 0)
+		{
+			bench = true;
+		}
+		else if (std::strcmp(argv[arg], "-dxva") == 0)
+		{
+			dxva_check = true;
+		}
+		else if (std::strcmp(argv[arg], "-vulkan") == 0)
+		{
+			vulkan_check = true;
+		}
+		else if (std::strcmp(argv[arg], "-sizing") == 0)
+		{
+			sizing_check = true;
+		}
+		else if (std::strcmp(argv[arg], "-pool") == 0)
+		{
+			pool_check = true;
+		}
+		else if (std::strcmp(argv[arg], "-timebase") == 0)
+		{
+			timebase_check = true;
+		}
+		else if (std::strcmp(argv[arg], "-readbench") == 0)
+		{
+			read_bench = true;
+		}
+		else if (std::strcmp(argv[arg], "-clock") == 0)
+		{
+			presentation_clock_enabled = true;
+		}
+		else if (std::strcmp(argv[arg], "-jitter") == 0 && arg + 2 < argc)
+		{
+			jitter_us = (uint32_t)std::max(0.0, atof(argv[++arg]) * 1000.0);
+		}
+		else if (std::strcmp(argv[arg], "-drift") == 0 && arg + 2 < argc)
+		{
+			drift_ppm = atof(argv[++arg]);
+		}
+		else if (std::strcmp(argv[arg], "-preroll") == 0 && arg + 2 < argc)
+		{
+			preroll = std::max(0, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-intracost") == 0 && arg + 2 < argc)
+		{
+			intra_cost = std::max(1, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-decimate") == 0)
+		{
+			decimate = true;
+		}
+		else if (std::strcmp(argv[arg], "-maxfps") == 0 && arg + 2 < argc)
+		{
+			max_frame_rate = std::max(0.0, atof(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-scan") == 0 && arg + 2 < argc)
+		{
+			scan_speed = std::max(0.0, atof(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-reverse") == 0)
+		{
+			reverse = true;
+		}
+		else if (std::strcmp(argv[arg], "-cache") == 0 && arg + 2 < argc)
+		{
+			reverse_cache = std::max(2, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-streams") == 0 && arg + 2 < argc)
+		{
+			stream_count = std::max(1, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-priority") == 0 && arg + 2 < argc)
+		{
+			priority = atoi(argv[++arg]);
+		}
+		else if (std::strcmp(argv[arg], "-capacity") == 0 && arg + 2 < argc)
+		{
+			capacity_macroblocks = (uint64_t)std::max(0.0, atof(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-dpbmemory") == 0 && arg + 2 < argc)
+		{
+			capacity_dpb_megabytes = std::max(0.0, atof(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-sessions") == 0 && arg + 2 < argc)
+		{
+			session_limit = std::max(1, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-ring") == 0 && arg + 2 < argc)
+		{
+			ring_alignment = std::max(1, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-seek") == 0 && arg + 2 < argc)
+		{
+			seek_interval = std::max(0, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-switch") == 0 && arg + 2 < argc)
+		{
+			switch_interval = std::max(0, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-loops") == 0 && arg + 2 < argc)
+		{
+			loops = std::max(1, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-refresh") == 0 && arg + 2 < argc)
+		{
+			refresh_rate = std::max(1, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-latency") == 0 && arg + 2 < argc)
+		{
+			latency_ms = std::max(0, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-ahead") == 0 && arg + 2 < argc)
+		{
+			ahead = std::max(0, atoi(argv[++arg]));
+		}
+		else
+		{
+			printf("Usage: mini_video_null [-quiet] [-bench] [-dxva] [-vulkan] [-sizing] [-loops <count>] [-refresh <Hz>] [-clock] [-jitter <ms>] [-drift <ppm>] [-latency <ms>] [-intracost <factor>] [-ahead <frames>] [-preroll <frames>] [-decimate] [-maxfps <fps>] [-scan <speed>] [-reverse] [-cache <pictures>] [-streams <count>] [-priority <level>] [-capacity <macroblocks/s>] [-dpbmemory <MB>] [-sessions <count>] [-switch <iterations>] [-ring <alignment>] [-seek <iterations>] [-pool] [-timebase] [-readbench] <video.mp4 or - for stdin> [more videos...]\n");
+			return -1;
+		}
+	}
+
+	if (arg < argc - 1 && switch_interval > 0)
+	{
+		// Renditions of the same content: a switch to the next rendition is requested every switch_interval display loop iterations, it takes effect at the next common IDR frame:
+		std::vector<std::string> filenames(argv + arg, argv + argc);
+		RenditionSet set;
+		if (!set.load(filenames))
+			return -1;
+		set.check_alignment();
+		const uint32_t frames_in_flight = set.enable_decode_ahead(ahead);
+		const uint32_t reserved_pictures = set.reserve_pictures();
+
+		RecordingRenditionBackend backend;
+		const Video& first = *set.renditions[0];
+		backend.set = &set;
+		backend.print = !quiet;
+		backend.timescale = first.timescale;
+		RecordingBackend& recorder = backend.recorder;
+		recorder.print = !quiet;
+		recorder.num_dpb_slots = first.num_dpb_slots;
+		recorder.core = &set.core;
+		recorder.picture_count = reserved_pictures;
+		recorder.reserved_picture_count = reserved_pictures;
+		recorder.completion_times.resize(reserved_pictures);
+		recorder.decode_latency = Video::Timer::nanoseconds_to_ticks(latency_ms * 1000000ull, first.timescale);
+		recorder.intra_cost = intra_cost;
+		recorder.loop_frame_count = (int)first.frame_infos.size(); // checks the display order continuity, also across the switches
+		uint64_t total_size = 0;
+		for (uint32_t size : first.frame_infos.sizes)
+		{
+			total_size += size;
+		}
+		recorder.average_frame_size = std::max(uint64_t(1), total_size / first.frame_infos.size());
+
+		const int display_target = int(first.frame_infos.size() * loops);
+		uint64_t iteration = 0;
+		while (set.core.target_display_order < display_target)
+		{
+			if (iteration > 0 && iteration % switch_interval == 0)
+			{
+				set.request_switch((set.current + 1) % (uint32_t)set.renditions.size());
+			}
+			const uint64_t now = iteration * 1000000000ull / refresh_rate;
+			recorder.playback_time = Video::Timer::nanoseconds_to_ticks(now, set.core.video->timescale);
+			set.update(backend, now);
+			iteration++;
+		}
+		set.print_statistics();
+		printf("Decoded frames: %llu, displayed frames: %llu, display loop iterations: %llu, reordering pictures: %u (created during playback: %u), frames in flight: %u (limit: %u)\n", (unsigned long long)recorder.decode_count, (unsigned long long)recorder.display_count, (unsigned long long)iteration, recorder.picture_count, recorder.picture_count - recorder.reserved_picture_count, recorder.max_in_flight, frames_in_flight);
+		printf("Late display iterations: %llu, display order discontinuities: %llu, switches that didn't start with an IDR frame: %llu\n", (unsigned long long)recorder.late_count, (unsigned long long)recorder.discontinuity_count, (unsigned long long)backend.non_idr_switch_count);
+		return 0;
+	}
+
+	if (arg < argc - 1)
+	{
+		// Gapless playlist: the videos are played one after the other on one timeline, the next one is loaded in the background, and their decoder sessions come from a SessionPool, so a compatible session is reused instead of created again:
+		Playlist playlist;
+		for (uint32_t loop = 0; loop < loops; ++loop)
+		{
+			for (int item = arg; item < argc; ++item)
+			{
+				playlist.items.push_back(argv[item]);
+			}
+		}
+		playlist.decode_ahead = ahead;
+		RecordingPlaylistBackend backend;
+		backend.pool.max_sessions = session_limit;
+		backend.sessions.print = !quiet;
+		uint64_t iteration = 0;
+		for (;;)
+		{
+			backend.now = iteration * 1000000000ull / refresh_rate;
+			playlist.wait_for_load(); // the simulated time doesn't pass while loading, so the trace doesn't depend on the load time
+			if (!playlist.update(backend, backend.now))
+				break;
+			iteration++;
+		}
+		playlist.print_statistics();
+		backend.pool.print_statistics();
+		printf("Decoded frames: %llu, displayed frames: %llu, display order discontinuities: %llu, display loop iterations: %llu, most sessions at the same time: %u\n", (unsigned long long)backend.decode_count, (unsigned long long)backend.display_count, (unsigned long long)backend.discontinuity_count, (unsigned long long)iteration, backend.sessions.max_alive);
+		backend.pool.clear(backend.sessions);
+		return playlist.played_count > 0 ? 0 : -1;
+	}
+
+	const char* filename = argc > 1 ? argv[argc - 1] : "test.mp4";
+	if (read_bench)
+		return bench_sample_reads(filename) ? 0 : -1; // only the samples are read, the video is not loaded
+	DecodeBenchmark benchmark;
+	benchmark.begin_load();
+	Video video;
+	if (StreamReader::is_stream(filename) ? !video.Open_h264_stream(filename) : !video.Load_mp4(filename))
+	{
+		printf("Video load failure, exiting.\n");
+		return -1;
+	}
+	benchmark.end_load();
+	if (video.frame_infos.empty())
+	{
+		printf("Video was loaded, but there are no frames, exiting.\n");
+		return -1;
+	}
+
+	if (sizing_check)
+	{
+		// The sizing rules are checked on their own cases, then the sizes of this video are compared with the reorder depth that it really uses:
+		if (check_dpb_sizing_rules() > 0 || check_dpb_full() > 0)
+			return -1;
+		int reorder_depth = 0;
+		for (const h264::SPS& sps : video.sps_array)
+		{
+			const Video::DPBSizing sizing = Video::Get_dpb_sizing(sps);
+			printf("DPB sizing: profile: %d, level: %d, MaxDpbFrames: %d, num_ref_frames: %d, max_dec_frame_buffering: %d, reorder depth: %d (%s), DPB slots: %d\n", sps.profile_idc, sps.level_idc, h264::get_max_dpb_frames(&sps), sps.num_ref_frames, sizing.max_dec_frame_buffering, sizing.reorder_depth, sps.vui_parameters_present_flag && sps.vui.bitstream_restriction_flag ? "VUI" : "inferred", sizing.dpb_slots);
+			reorder_depth = std::max(reorder_depth, sizing.reorder_depth);
+		}
+		if (!video.live)
+		{
+			const int measured = measure_reorder_depth(video);
+			printf("Measured reorder depth: %d, %s\n", measured, measured <= reorder_depth ? "within the declared depth" : "exceeds the declared depth, reordering pictures will be created during playback");
+		}
+	}
+
+	const bool capacity_check = capacity_macroblocks > 0 || capacity_dpb_megabytes > 0;
+	if (stream_count > 1 || capacity_check)
+	{
+		// Multiple streams: copies of the video are played at the same time by the DecodeScheduler, their decodes are executed on one simulated GPU:
+		if (video.live)
+		{
+			printf("Multiple streams need a video file, exiting.\n");
+			return -1;
+		}
+		std::vector<Video> videos(stream_count - 1);
+		for (Video& x : videos)
+		{
+			if (!x.Load_mp4(filename))
+			{
+				printf("Video load failure, exiting.\n");
+				return -1;
+			}
+		}
+
+		// With a device budget, the CapacityPlanner decides which streams are played, and the frame rate of the degraded ones:
+		CapacityPlanner planner;
+		planner.budget.macroblocks_per_second = capacity_macroblocks;
+		planner.budget.dpb_bytes = uint64_t(capacity_dpb_megabytes * 1000000.0);
+		planner.add_stream(video);
+		for (Video& x : videos)
+		{
+			planner.add_stream(x);
+		}
+		planner.admit();
+		if (capacity_check)
+		{
+			planner.print();
+		}
+
+		DecodeScheduler scheduler;
+		for (uint32_t i = 0; i < stream_count; ++i)
+		{
+			const CapacityPlanner::Stream& planned = planner.streams[i];
+			if (capacity_check && planned.decision == CapacityPlanner::Decision::reject)
+				continue;
+			const uint32_t stream = scheduler.add_stream(planned.video, 0, i == 0 ? priority : 0, decimate ? DecodeScheduler::SkipPolicy::decimate : DecodeScheduler::SkipPolicy::wait, ahead > 0 ? ahead : 2);
+			if (capacity_check && planned.decision == CapacityPlanner::Decision::degrade)
+			{
+				scheduler.streams[stream].core.enable_decimation(planned.max_frame_rate, decimate);
+			}
+		}
+		if (scheduler.streams.empty())
+		{
+			printf("No stream was admitted, exiting.\n");
+			return -1;
+		}
+
+		uint64_t total_size = 0;
+		for (uint32_t size : video.frame_infos.sizes)
+		{
+			total_size += size;
+		}
+		uint64_t shared_gpu_time = 0;
+		SchedulerBackend backend;
+		backend.streams.resize(scheduler.streams.size());
+		for (uint32_t i = 0; i < (uint32_t)scheduler.streams.size(); ++i)
+		{
+			RecordingBackend& recorder = backend.streams[i];
+			const VideoDecoderCore& core = scheduler.streams[i].core;
+			recorder.print = false;
+			recorder.num_dpb_slots = core.video->num_dpb_slots;
+			recorder.core = &core;
+			recorder.picture_count = (uint32_t)core.pictures.size();
+			recorder.reserved_picture_count = recorder.picture_count;
+			recorder.completion_times.resize(recorder.picture_count);
+			recorder.decode_latency = Video::Timer::nanoseconds_to_ticks(latency_ms * 1000000ull, video.timescale);
+			recorder.average_frame_size = std::max(uint64_t(1), total_size / video.frame_infos.size());
+			recorder.shared_gpu_time = &shared_gpu_time; // every stream has the same timescale, because they play the same file
+		}
+
+		const int display_target = int(video.frame_infos.size() * loops);
+		uint64_t iteration = 0;
+		for (;;)
+		{
+			bool finished = true;
+			for (const DecodeScheduler::Stream& stream : scheduler.streams)
+			{
+				finished = finished && stream.core.target_display_order >= display_target;
+			}
+			if (finished)
+				break;
+			const uint64_t now = iteration * 1000000000ull / refresh_rate;
+			for (RecordingBackend& recorder : backend.streams)
+			{
+				recorder.playback_time = Video::Timer::nanoseconds_to_ticks(now, video.timescale);
+			}
+			scheduler.update(backend, now);
+			iteration++;
+		}
+		scheduler.print_statistics();
+		printf("Display loop iterations: %llu\n", (unsigned long long)iteration);
+		return 0;
+	}
+
+	VideoDecoderCore core;
+	core.video = &video;
+	const uint32_t frames_in_flight = core.enable_decode_ahead(ahead);
+	const uint32_t preroll_frames = preroll > 0 ? core.enable_loop_preroll(preroll) : 0;
+	if (scan_speed > 0 && !video.live)
+	{
+		core.set_scan_speed(scan_speed);
+	}
+	if (reverse && !video.live)
+	{
+		if (reverse_cache > 0)
+		{
+			core.reverse_cache_budget = reverse_cache;
+		}
+		core.set_reverse(true);
+	}
+	const uint32_t reserved_pictures = core.reserve_pictures();
+	if (decimate || max_frame_rate > 0)
+	{
+		const uint32_t layer = core.enable_decimation(max_frame_rate, decimate);
+		printf("Temporal decimation: decoding temporal layers 0-%u%s\n", layer, decimate ? ", adaptive" : "");
+	}
+
+	RecordingBackend backend;
+	backend.print = !quiet && !bench;
+	backend.num_dpb_slots = video.num_dpb_slots;
+	backend.core = &core;
+	backend.picture_count = reserved_pictures;
+	backend.reserved_picture_count = reserved_pictures;
+	backend.completion_times.resize(reserved_pictures);
+	backend.decode_latency = bench ? 0 : Video::Timer::nanoseconds_to_ticks(latency_ms * 1000000ull, video.timescale); // the benchmark has no simulated clock, decodes complete immediately
+	backend.intra_cost = intra_cost;
+	backend.running_average = video.live;
+	if (loops > 1 && !video.live && scan_speed == 0 && !reverse)
+	{
+		// The stalls at the loops are the late iterations until the second intra frame is displayed:
+		backend.loop_frame_count = (int)video.frame_infos.size();
+		backend.loop_lead_in = backend.loop_frame_count;
+		for (size_t i = 1; i < video.frame_infos.size(); ++i)
+		{
+			if (video.frame_infos[i].is_intra)
+			{
+				backend.loop_lead_in = video.frame_infos.display_orders[i];
+				break;
+			}
+		}
+	}
+	DXVAPictureParametersH264 dxva;
+	if (dxva_check)
+	{
+		backend.dxva = &dxva;
+	}
+	BitstreamRing ring;
+	if (ring_alignment > 0)
+	{
+		// The allocator is checked on its own cases, then the frames of this video are uploaded through it like the Vulkan backend does:
+		if (check_bitstream_ring() > 0)
+			return -1;
+		ring.configure(video, frames_in_flight, ring_alignment, ring_alignment);
+		backend.ring = &ring;
+		backend.ring_memory.resize(ring.capacity);
+	}
+	if (seek_interval > 0)
+	{
+		// The plans are checked for every frame, then the playback seeks to random frames:
+		if (video.live)
+		{
+			printf("Seeking needs a video file, exiting.\n");
+			return -1;
+		}
+		if (check_seek_plans(video) > 0)
+			return -1;
+	}
+	if (timebase_check && check_timebase(refresh_rate) > 0)
+		return -1;
+	if (pool_check)
+	{
+		// The reordering pictures are checked in their own playbacks, then the playback starts from the beginning:
+		if (video.live)
+		{
+			printf("The picture pool check needs a video file, exiting.\n");
+			return -1;
+		}
+		if (check_picture_pool(video) > 0)
+			return -1;
+	}
+	VulkanParametersH264 vulkan_parameters;
+	if (vulkan_check)
+	{
+		const VkExtent2D coded_extent = { video.padded_width, video.padded_height };
+		vulkan_parameters.convert(video);
+		vulkan_parameters.init_slots(video.num_dpb_slots, coded_extent, VK_NULL_HANDLE);
+		printf("Vulkan parameter sets: SPS: %u, PPS: %u\n", (uint32_t)vulkan_parameters.sps_array_h264.size(), (uint32_t)vulkan_parameters.pps_array_h264.size());
+		backend.vulkan = &vulkan_parameters;
+		backend.vulkan_coded_extent = coded_extent;
+	}
+	if (!video.live)
+	{
+		uint64_t total_size = 0;
+		for (uint32_t size : video.frame_infos.sizes)
+		{
+			total_size += size;
+		}
+		backend.average_frame_size = std::max(uint64_t(1), total_size / video.frame_infos.size());
+	}
+
+	if (bench)
+	{
+		// Benchmark: decodes are submitted as fast as possible, and every completed picture is displayed right away, so there is no display timing:
+		benchmark.frame_limit = video.live ? ~0ull : video.frame_infos.size() * loops;
+		while (video.live ? !(video.live_ended && !video.Is_frame_ready() && core.decoding_pictures.empty()) : (benchmark.can_submit() || !core.decoding_pictures.empty()))
+		{
+			if (video.live)
+			{
+				video.Update_h264_stream();
+			}
+			while (!core.decoding_pictures.empty() && backend.is_decode_completed(core.decoding_pictures.front()))
+			{
+				core.finish_decode();
+			}
+			while (core.update_display(core.next_frame_time))
+			{
+				backend.display_count++;
+			}
+			VideoDecoderCore::DecodeCommand decode;
+			benchmark.begin_submit();
+			if (benchmark.can_submit() && core.begin_decode(decode))
+			{
+				backend.decode(decode);
+				core.end_decode(decode);
+				benchmark.end_submit(decode.frame_info.size);
+			}
+			else if (video.live && core.decoding_pictures.empty())
+			{
+				video.stream.wait(1);
+			}
+		}
+		benchmark.end_decode();
+		benchmark.print_json("null", filename, frames_in_flight);
+		return 0;
+	}
+
+	// The display loop runs as fast as possible, but the playback time is advanced by one display refresh interval in every iteration:
+	const uint64_t display_target = video.frame_infos.size() * loops;
+	uint64_t iteration = 0;
+	uint64_t core_nanoseconds = 0;
+	Video::Timer timer;
+
+	// Simulated vsync timeline: the display refreshes drift_ppm slower than the refresh rate, and the loop wakes up at most jitter_us after each refresh:
+	const bool vsync_simulation = presentation_clock_enabled || jitter_us > 0 || drift_ppm != 0;
+	const double display_period = 1000000000.0 / double(refresh_rate) * (1.0 + drift_ppm / 1000000.0);
+	uint32_t jitter_random = 0x9E3779B9; // xorshift state, so the timeline is the same in every run
+	PresentationClock presentation_clock;
+	presentation_clock.refresh_period = 1000000000ull / refresh_rate;
+	PresentationClock::CadenceStatistics cadence;
+
+	// Seek state, the first picture displayed after a seek must be the target frame:
+	uint32_t seek_random = 0x2545F491;
+	uint64_t seek_count = 0;
+	uint64_t seek_landed_count = 0;
+	uint64_t seek_mismatch_count = 0;
+	uint64_t seek_iterations = 0; // display loop iterations from the seeks until their target was displayed
+	uint64_t seek_planned_frames = 0;
+	uint64_t seek_iteration = 0;
+	int seek_frame = -1; // frame index of the target that wasn't displayed yet, -1 if there is none
+	int seek_display_order = 0;
+	while (video.live ? !(video.live_ended && !video.Is_frame_ready() && core.decoding_pictures.empty() && core.working_count == 0) : core.target_display_order < (int)display_target) // skipped frames are not displayed, but their display order is passed
+	{
+		if (video.live)
+		{
+			video.Update_h264_stream();
+		}
+		uint64_t now = iteration * 1000000000ull / refresh_rate;
+		if (vsync_simulation)
+		{
+			now = uint64_t(double(iteration) * display_period);
+			if (jitter_us > 0)
+			{
+				jitter_random ^= jitter_random << 13;
+				jitter_random ^= jitter_random >> 17;
+				jitter_random ^= jitter_random << 5;
+				now += uint64_t(jitter_random % (jitter_us + 1)) * 1000ull;
+			}
+			if (presentation_clock_enabled)
+			{
+				// The loop wakes up after a vsync, like after a blocking present:
+				if (iteration == 0)
+				{
+					presentation_clock.start(now);
+				}
+				else
+				{
+					presentation_clock.vsync(now);
+				}
+			}
+		}
+		backend.playback_time = Video::Timer::nanoseconds_to_ticks(presentation_clock_enabled ? presentation_clock.media_time(now) : now, video.timescale);
+		const uint64_t display_count = backend.display_count;
+		const uint64_t begin = timer.elapsed_nanoseconds();
+		if (seek_interval > 0 && iteration > 0 && iteration % seek_interval == 0)
+		{
+			seek_random ^= seek_random << 13;
+			seek_random ^= seek_random >> 17;
+			seek_random ^= seek_random << 5;
+			core.seek(int(seek_random % video.frame_infos.size()));
+			seek_frame = core.seek_plan.target;
+			seek_display_order = core.target_display_order;
+			seek_iteration = iteration;
+			seek_planned_frames += core.seek_plan.minimal.frames;
+			seek_count++;
+		}
+		const bool decoded = core.update(backend, backend.playback_time) > 0;
+		core_nanoseconds += timer.elapsed_nanoseconds() - begin;
+		if (seek_frame >= 0 && core.displayed_picture >= 0 && core.pictures[core.displayed_picture].display_order >= seek_display_order)
+		{
+			const VideoDecoderCore::Picture& picture = core.pictures[core.displayed_picture];
+			if (picture.display_order != seek_display_order || picture.frame_index != seek_frame)
+			{
+				printf("Seek mismatch: displayed frame_index: %d instead of the target frame_index: %d\n", picture.frame_index, seek_frame);
+				seek_mismatch_count++;
+			}
+			seek_iterations += iteration - seek_iteration;
+			seek_landed_count++;
+			seek_frame = -1;
+		}
+		if (vsync_simulation && backend.display_count > display_count)
+		{
+			// The selected picture is shown at the next refresh:
+			cadence.add(uint64_t(double(iteration + 1) * display_period), Video::Timer::ticks_to_nanoseconds(core.pictures[core.displayed_picture].duration, video.timescale), display_period);
+		}
+		iteration++;
+		if (video.live && !decoded && !video.Is_frame_ready())
+		{
+			video.stream.wait(1); // the simulated clock keeps running while waiting for the stream
+		}
+	}
+
+	printf("Decoded frames: %llu, displayed frames: %llu, repeated displays: %llu, display loop iterations: %llu\n", (unsigned long long)backend.decode_count, (unsigned long long)backend.display_count, (unsigned long long)backend.repeat_count, (unsigned long long)iteration);
+	printf("Reordering pictures: %u (created during playback: %u), DPB slots: %u, frames in flight: %u (limit: %u), late display iterations: %llu\n", backend.picture_count, backend.picture_count - backend.reserved_picture_count, video.num_dpb_slots, backend.max_in_flight, frames_in_flight, (unsigned long long)backend.late_count);
+	if (backend.loop_frame_count > 0)
+	{
+		printf("Video loops: %u, loop pre-roll: %u pictures, late display iterations in the first GOP of the loops: %llu, display order discontinuities: %llu\n", loops, preroll_frames, (unsigned long long)backend.loop_late_count, (unsigned long long)backend.discontinuity_count);
+	}
+	if (decimate || max_frame_rate > 0)
+	{
+		printf("Skipped frames: %llu, decoded temporal layers at the end: 0-%u\n", (unsigned long long)core.skipped_count, core.temporal_layer_limit);
+	}
+	if (dxva_check)
+	{
+		printf("DXVA parameters: mismatches: %llu, CPU time per decoded frame: %.1f ns with the precomputed builder, %.1f ns with field by field filling\n", (unsigned long long)backend.dxva_mismatch_count, double(backend.dxva_nanoseconds) / double(std::max(uint64_t(1), backend.decode_count)), double(backend.dxva_reference_nanoseconds) / double(std::max(uint64_t(1), backend.decode_count)));
+	}
+	if (vulkan_check)
+	{
+		printf("Vulkan reference slots: mismatches: %llu, inactive references: %llu, CPU time per decoded frame: %.1f ns updating the used slots, %.1f ns refilling every slot\n", (unsigned long long)backend.vulkan_mismatch_count, (unsigned long long)backend.vulkan_inactive_count, double(backend.vulkan_nanoseconds) / double(std::max(uint64_t(1), backend.decode_count)), double(backend.vulkan_reference_nanoseconds) / double(std::max(uint64_t(1), backend.decode_count)));
+	}
+	if (ring_alignment > 0)
+	{
+		uint64_t whole_size = 0;
+		for (uint32_t size : video.frame_infos.sizes)
+		{
+			whole_size += BitstreamRing::align(size, ring_alignment);
+		}
+		ring.print_statistics();
+		printf("Bitstream ring check: mismatches: %llu, full: %llu", (unsigned long long)backend.ring_mismatch_count, (unsigned long long)backend.ring_full_count);
+		if (!video.live)
+		{
+			printf(", whole video upload: %.1f KB", double(whole_size) / 1024.0);
+		}
+		printf("\n");
+	}
+	if (seek_interval > 0)
+	{
+		printf("Seeks: %llu, planned decodes per seek: %.2f, display loop iterations until the target was displayed: %.2f, mismatches: %llu, stale references: %llu\n", (unsigned long long)seek_count, double(seek_planned_frames) / double(std::max(uint64_t(1), seek_count)), double(seek_iterations) / double(std::max(uint64_t(1), seek_landed_count)), (unsigned long long)seek_mismatch_count, (unsigned long long)backend.stale_reference_count);
+	}
+	if (vsync_simulation)
+	{
+		cadence.print();
+		if (presentation_clock_enabled)
+		{
+			printf("Presentation clock: refresh period: %.4f ms (display: %.4f ms), largest vsync prediction error: %.3f ms\n", presentation_clock.period / 1000000.0, display_period / 1000000.0, presentation_clock.max_vsync_error / 1000000.0);
+		}
+	}
+	printf("Decoder core CPU time: %.1f ns per decoded frame, %.1f ns per display loop iteration%s\n", double(core_nanoseconds) / double(std::max(uint64_t(1), backend.decode_count)), double(core_nanoseconds) / double(std::max(uint64_t(1), iteration)), quiet ? "" : " (including printing)");
+	return 0;
+}
@@ -0,0 +1,499 @@
+// Remux tool that rewrites H264 MP4 (or raw Annex-B H264) into faststart MP4 layout, without re-encoding
+//
+// What this does:
+//	- the samples are streamed through the minimp4 muxer (MP4E_*) with fixed size staging memory, the file index (moov) is kept in memory
+//	- after all samples are written, the sample data is moved forward in place to make space, and the moov box is written right after the ftyp box
+//	- so players can start without seeking to the end of the file, which is slow on network or optical storage
+//
+// How to use:
+//	mini_video_remux.exe input.mp4 output.mp4
+//	mini_video_remux.exe -fps 30 input.h264 output.mp4 // raw Annex-B input, the framerate is used for timestamps (default: 60)
+//	mini_video_remux.exe -verify input.mp4 output.mp4 // also loads both files afterwards and checks that the frame index is identical
+#include "include/common.h"
+
+#include <string>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define remux_fseek _fseeki64
+#else
+#define remux_fseek fseeko
+#endif // _WIN32
+
+// Output file with random access writes, the minimp4 muxer writes some headers after the data:
+struct OutputFile
+{
+	FILE* file = nullptr;
+	uint64_t data_end = 0; // everything was written up to this offset
+	bool capture = false; // if true, the writes after data_end are captured to memory instead of the file
+	std::vector<uint8_t> captured;
+
+	bool write(uint64_t offset, const void* data, uint64_t size)
+	{
+		if (capture && offset >= data_end)
+		{
+			captured.insert(captured.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+			return true;
+		}
+		if (remux_fseek(file, (int64_t)offset, SEEK_SET) != 0 || fwrite(data, 1, (size_t)size, file) != size)
+			return false;
+		data_end = std::max(data_end, offset + size);
+		return true;
+	}
+	bool read(uint64_t offset, void* data, uint64_t size)
+	{
+		return remux_fseek(file, (int64_t)offset, SEEK_SET) == 0 && fread(data, 1, (size_t)size, file) == size;
+	}
+};
+
+static constexpr uint32_t read_be32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]; }
+static constexpr uint32_t fourcc(const char* s) { return ((uint32_t)(uint8_t)s[0] << 24) | ((uint32_t)(uint8_t)s[1] << 16) | ((uint32_t)(uint8_t)s[2] << 8) | (uint8_t)s[3]; }
+static void write_be32(std::vector<uint8_t>& dst, uint32_t value)
+{
+	const uint8_t bytes[] = { uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value) };
+	dst.insert(dst.end(), bytes, bytes + sizeof(bytes));
+}
+
+// Copies the boxes of the moov, while adding shift to the chunk offsets, 32-bit chunk offsets (stco) are converted to 64-bit (co64) if use_co64 is true:
+static bool relocate_boxes(const uint8_t* src, uint64_t size, uint64_t shift, bool use_co64, std::vector<uint8_t>& dst)
+{
+	while (size >= 8)
+	{
+		const uint32_t box_size = read_be32(src);
+		const uint32_t box_type = read_be32(src + 4);
+		if (box_size < 8 || box_size > size)
+			return false; // 64-bit box sizes are not written by minimp4 inside the moov
+		const size_t box_begin = dst.size();
+		if (box_type == fourcc("moov") || box_type == fourcc("trak") || box_type == fourcc("mdia") || box_type == fourcc("minf") || box_type == fourcc("stbl"))
+		{
+			dst.insert(dst.end(), src, src + 8);
+			if (!relocate_boxes(src + 8, box_size - 8, shift, use_co64, dst))
+				return false;
+		}
+		else if (box_type == fourcc("stco") || box_type == fourcc("co64"))
+		{
+			const bool src_co64 = box_type == fourcc("co64");
+			const uint32_t count = read_be32(src + 12);
+			const uint32_t entry_size = src_co64 ? 8 : 4;
+			if (16 + uint64_t(count) * entry_size > box_size)
+				return false;
+			const bool dst_co64 = src_co64 || use_co64;
+			write_be32(dst, 0); // size is patched below
+			write_be32(dst, dst_co64 ? fourcc("co64") : fourcc("stco"));
+			write_be32(dst, 0); // version and flags
+			write_be32(dst, count);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const uint8_t* entry = src + 16 + i * entry_size;
+				uint64_t offset = src_co64 ? ((uint64_t)read_be32(entry) << 32) | read_be32(entry + 4) : read_be32(entry);
+				offset += shift;
+				if (dst_co64)
+				{
+					write_be32(dst, uint32_t(offset >> 32));
+				}
+				else if (offset > 0xffffffffull)
+					return false;
+				write_be32(dst, uint32_t(offset));
+			}
+		}
+		else
+		{
+			dst.insert(dst.end(), src, src + box_size);
+		}
+		const uint32_t new_size = uint32_t(dst.size() - box_begin);
+		dst[box_begin + 0] = uint8_t(new_size >> 24);
+		dst[box_begin + 1] = uint8_t(new_size >> 16);
+		dst[box_begin + 2] = uint8_t(new_size >> 8);
+		dst[box_begin + 3] = uint8_t(new_size);
+		src += box_size;
+		size -= box_size;
+	}
+	return size == 0;
+}
+
+// Returns the number of 32-bit chunk offsets, and the largest chunk offset in the moov:
+static void scan_chunk_offsets(const uint8_t* src, uint64_t size, uint64_t& stco_count, uint64_t& max_offset)
+{
+	while (size >= 8)
+	{
+		const uint32_t box_size = read_be32(src);
+		const uint32_t box_type = read_be32(src + 4);
+		if (box_size < 8 || box_size > size)
+			return;
+		if (box_type == fourcc("moov") || box_type == fourcc("trak") || box_type == fourcc("mdia") || box_type == fourcc("minf") || box_type == fourcc("stbl"))
+		{
+			scan_chunk_offsets(src + 8, box_size - 8, stco_count, max_offset);
+		}
+		else if (box_type == fourcc("stco") && box_size >= 16)
+		{
+			const uint32_t count = std::min(read_be32(src + 12), (box_size - 16) / 4);
+			stco_count += count;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				max_offset = std::max(max_offset, uint64_t(read_be32(src + 16 + i * 4)));
+			}
+		}
+		else if (box_type == fourcc("co64") && box_size >= 16)
+		{
+			const uint32_t count = std::min(read_be32(src + 12), (box_size - 16) / 8);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const uint8_t* entry = src + 16 + i * 8;
+				max_offset = std::max(max_offset, ((uint64_t)read_be32(entry) << 32) | read_be32(entry + 4));
+			}
+		}
+		src += box_size;
+		size -= box_size;
+	}
+}
+
+static bool frame_index_equal(const Video& a, const Video& b, bool compare_data)
+{
+	if (a.frame_infos.size() != b.frame_infos.size() || a.timescale != b.timescale || a.duration != b.duration)
+		return false;
+	for (size_t i = 0; i < a.frame_infos.size(); ++i)
+	{
+		const Video::FrameInfo fa = a.frame_infos[i];
+		const Video::FrameInfo fb = b.frame_infos[i];
+		if (fa.timestamp != fb.timestamp || fa.duration != fb.duration || fa.reference_priority != fb.reference_priority || fa.poc != fb.poc || fa.gop != fb.gop || fa.display_order != fb.display_order || fa.is_intra != fb.is_intra)
+			return false;
+		const h264::SliceHeader sa = a.frame_infos.slice_header(i);
+		const h264::SliceHeader sb = b.frame_infos.slice_header(i);
+		if (std::memcmp(&sa, &sb, sizeof(sa)) != 0)
+			return false;
+		if (compare_data && (fa.offset != fb.offset || fa.size != fb.size))
+			return false;
+	}
+	return !compare_data || a.h264_data == b.h264_data;
+}
+
+int main(int argc, char* argv[])
+{
+	float framerate = 60.0f;
+	bool verify = false;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != 0; ++arg)
+	{
+		if (std::strcmp(argv[arg], "-fps") == 0 && arg + 1 < argc)
+		{
+			framerate = (float)atof(argv[++arg]);
+		}
+		else if (std::strcmp(argv[arg], "-verify") == 0)
+		{
+			verify = true;
+		}
+		else
+		{
+			printf("Unknown option: %s\n", argv[arg]);
+			return -1;
+		}
+	}
+	if (argc - arg != 2 || framerate <= 0)
+	{
+		printf("Usage: mini_video_remux [-fps <framerate>] [-verify] <input.mp4 or input.h264> <output.mp4>\n");
+		return -1;
+	}
+	const char* input_filename = argv[arg];
+	const char* output_filename = argv[arg + 1];
+	const bool raw_input = Video::Is_h264_raw(input_filename) || StreamReader::is_stream(input_filename);
+
+	OutputFile output;
+	output.file = fopen(output_filename, "wb+");
+	if (output.file == nullptr)
+	{
+		printf("Failed to create output file: %s\n", output_filename);
+		return -1;
+	}
+
+	auto write_callback = [](int64_t offset, const void* buffer, size_t size, void* token) -> int
+		{
+			OutputFile* output = (OutputFile*)token;
+			return output->write((uint64_t)offset, buffer, size) ? 0 : 1;
+		};
+	// Non-sequential mode: each sample is written as soon as it's given to the muxer, so the staging memory doesn't grow with the file:
+	MP4E_mux_t* mux = MP4E_open(0, 0, &output, write_callback);
+	if (mux == nullptr)
+	{
+		printf("Failed to initialize MP4 muxer\n");
+		fclose(output.file);
+		return -1;
+	}
+
+	uint64_t sample_count = 0;
+	bool success = true;
+	if (raw_input)
+	{
+		// The NAL units are grouped into access units (samples), and the start codes are replaced with 4 byte sizes (AVCC layout):
+		const uint32_t frame_duration = 1000;
+		const uint32_t timescale = std::max(1u, uint32_t(framerate * frame_duration + 0.5f));
+		StreamReader stream;
+		if (!stream.open(input_filename))
+		{
+			printf("File not found: %s\n", input_filename);
+			MP4E_close(mux);
+			fclose(output.file);
+			return -1;
+		}
+		int track = -1;
+		bool found_idr = false;
+		std::vector<uint8_t> nal;
+		std::vector<uint8_t> sample;
+		bool sample_has_slice = false;
+		bool sample_is_idr = false;
+		auto flush_sample = [&]() {
+			if (sample_has_slice && found_idr && success)
+			{
+				success = MP4E_put_sample(mux, track, sample.data(), (int)sample.size(), frame_duration, sample_is_idr ? MP4E_SAMPLE_RANDOM_ACCESS : MP4E_SAMPLE_DEFAULT) == MP4E_STATUS_OK;
+				sample_count++;
+			}
+			sample.clear();
+			sample_has_slice = false;
+			sample_is_idr = false;
+		};
+		while (success && stream.update())
+		{
+			while (success && stream.next_nal(nal))
+			{
+				if (nal.empty())
+					continue;
+				h264::Bitstream bs = {};
+				bs.init(nal.data(), nal.size());
+				h264::NALHeader nal_header = {};
+				if (!h264::read_nal_header(&nal_header, &bs))
+				{
+					nal.clear();
+					continue;
+				}
+				switch (nal_header.type)
+				{
+				case h264::NAL_UNIT_TYPE_CODED_SLICE_IDR:
+				case h264::NAL_UNIT_TYPE_CODED_SLICE_NON_IDR:
+				{
+					const uint32_t first_mb_in_slice = bs.ue();
+					if (first_mb_in_slice == 0 && sample_has_slice)
+					{
+						flush_sample();
+					}
+					if (track < 0)
+						break; // slices before the first SPS can't be decoded
+					sample_has_slice = true;
+					if (nal_header.type == h264::NAL_UNIT_TYPE_CODED_SLICE_IDR)
+					{
+						sample_is_idr = true;
+						found_idr = true;
+					}
+					write_be32(sample, (uint32_t)nal.size());
+					sample.insert(sample.end(), nal.begin(), nal.end());
+				}
+				break;
+				case h264::NAL_UNIT_TYPE_SPS:
+				{
+					flush_sample();
+					if (track < 0)
+					{
+						// The emulation prevention bytes are removed before parsing the resolution:
+						std::vector<uint8_t> rbsp(nal.size());
+						bs.init(rbsp.data(), h264::nal_to_rbsp(nal.data(), nal.size(), rbsp.data()));
+						h264::read_nal_header(&nal_header, &bs);
+						h264::SPS sps = {};
+						h264::read_sps(&sps, &bs);
+
+						MP4E_track_t track_info = {};
+						track_info.object_type_indication = MP4_OBJECT_TYPE_AVC;
+						std::memcpy(track_info.language, "und", 4);
+						track_info.track_media_kind = e_video;
+						track_info.time_scale = timescale;
+						track_info.default_duration = frame_duration;
+						track_info.u.v.width = ((sps.pic_width_in_mbs_minus1 + 1) * 16) - sps.frame_crop_left_offset * 2 - sps.frame_crop_right_offset * 2;
+						track_info.u.v.height = ((2 - sps.frame_mbs_only_flag) * (sps.pic_height_in_map_units_minus1 + 1) * 16) - (sps.frame_crop_top_offset * 2) - (sps.frame_crop_bottom_offset * 2);
+						track = MP4E_add_track(mux, &track_info);
+						success = track >= 0;
+					}
+					success = success && MP4E_set_sps(mux, track, nal.data(), (int)nal.size()) == MP4E_STATUS_OK;
+				}
+				break;
+				case h264::NAL_UNIT_TYPE_PPS:
+					flush_sample();
+					success = track >= 0 && MP4E_set_pps(mux, track, nal.data(), (int)nal.size()) == MP4E_STATUS_OK;
+					break;
+				case h264::NAL_UNIT_TYPE_AUD:
+				case h264::NAL_UNIT_TYPE_END_OF_SEQUENCE:
+				case h264::NAL_UNIT_TYPE_END_OF_STREAM:
+				case h264::NAL_UNIT_TYPE_FILLER:
+					flush_sample(); // these are not stored in MP4 samples
+					break;
+				default:
+					if (nal_header.type == h264::NAL_UNIT_TYPE_SEI && sample_has_slice)
+					{
+						flush_sample(); // SEI begins the next access unit
+					}
+					if (track >= 0)
+					{
+						write_be32(sample, (uint32_t)nal.size());
+						sample.insert(sample.end(), nal.begin(), nal.end());
+					}
+					break;
+				}
+				nal.clear();
+			}
+			stream.wait(10);
+		}
+		flush_sample();
+		if (track < 0)
+		{
+			printf("No SPS was found in the H264 stream: %s\n", input_filename);
+			success = false;
+		}
+	}
+	else
+	{
+		FileReader reader;
+		if (!reader.open(input_filename) || reader.size() == 0)
+		{
+			printf("File not found: %s\n", input_filename);
+			MP4E_close(mux);
+			fclose(output.file);
+			return -1;
+		}
+		MP4D_demux_t mp4 = {};
+		auto read_callback = [](int64_t offset, void* buffer, size_t size, void* token) -> int
+			{
+				FileReader* reader = (FileReader*)token;
+				return reader->read((uint64_t)offset, buffer, size) ? 0 : 1;
+			};
+		if (MP4D_open(&mp4, read_callback, &reader, (int64_t)reader.size()) != 1)
+		{
+			printf("MP4 parsing failure: %s\n", input_filename);
+			MP4E_close(mux);
+			fclose(output.file);
+			return -1;
+		}
+
+		// Only the AVC video tracks are copied, because only those can be played by the mini_video players:
+		for (uint32_t ntrack = 0; ntrack < mp4.track_count && success; ntrack++)
+		{
+			const MP4D_track_t& mp4_track = mp4.track[ntrack];
+			if (mp4_track.handler_type != MP4D_HANDLER_TYPE_VIDE || mp4_track.object_type_indication != MP4_OBJECT_TYPE_AVC)
+				continue;
+
+			MP4E_track_t track_info = {};
+			track_info.object_type_indication = MP4_OBJECT_TYPE_AVC;
+			std::memcpy(track_info.language, mp4_track.language, 3);
+			track_info.language[3] = 0;
+			if (track_info.language[0] == 0)
+			{
+				std::memcpy(track_info.language, "und", 4);
+			}
+			track_info.track_media_kind = e_video;
+			track_info.time_scale = mp4_track.timescale;
+			track_info.u.v.width = mp4_track.SampleDescription.video.width;
+			track_info.u.v.height = mp4_track.SampleDescription.video.height;
+			const int track = MP4E_add_track(mux, &track_info);
+			success = track >= 0;
+
+			int size = 0;
+			const void* data = nullptr;
+			for (int index = 0; success && (data = MP4D_read_sps(&mp4, ntrack, index, &size)); ++index)
+			{
+				success = MP4E_set_sps(mux, track, data, size) == MP4E_STATUS_OK;
+			}
+			for (int index = 0; success && (data = MP4D_read_pps(&mp4, ntrack, index, &size)); ++index)
+			{
+				success = MP4E_set_pps(mux, track, data, size) == MP4E_STATUS_OK;
+			}
+
+			// The samples are copied in windows of fixed size, the same way as Video::Load_mp4() reads them:
+			bool muxed = success;
+			success = success && Video::Read_mp4_samples(reader, mp4, ntrack, [&](const uint8_t* sample, uint32_t sample_size, uint32_t duration)
+				{
+					// The sync samples are not exposed by minimp4, so the random access flag is recovered from the NAL unit types:
+					bool random_access = false;
+					for (uint64_t pos = 0; pos + 4 < sample_size; pos += 4 + read_be32(sample + pos))
+					{
+						random_access |= (sample[pos + 4] & 0x1F) == h264::NAL_UNIT_TYPE_CODED_SLICE_IDR;
+					}
+					muxed = MP4E_put_sample(mux, track, sample, (int)sample_size, (int)duration, random_access ? MP4E_SAMPLE_RANDOM_ACCESS : MP4E_SAMPLE_DEFAULT) == MP4E_STATUS_OK;
+					sample_count++;
+					return muxed;
+				});
+			if (!success && muxed)
+			{
+				printf("Failed to read video samples from file: %s\n", input_filename);
+			}
+		}
+		MP4D_close(&mp4);
+	}
+
+	// The muxer writes the mdat header to the beginning and the moov box after the data, the moov is captured to memory instead:
+	const uint64_t data_begin = 24; // size of the ftyp box written by minimp4
+	const uint64_t data_end = output.data_end;
+	output.capture = true;
+	success = MP4E_close(mux) == MP4E_STATUS_OK && success;
+	output.capture = false;
+	if (!success || output.captured.empty() || sample_count == 0)
+	{
+		printf("Remuxing failed: %s\n", output_filename);
+		fclose(output.file);
+		return -1;
+	}
+
+	// Every byte after the ftyp box will move forward by the size of the moov box, the chunk offsets must be updated with that.
+	//	The moov box grows if 32-bit chunk offsets would overflow and must be converted to 64-bit:
+	uint64_t stco_count = 0;
+	uint64_t max_offset = 0;
+	scan_chunk_offsets(output.captured.data(), output.captured.size(), stco_count, max_offset);
+	const bool use_co64 = max_offset + output.captured.size() > 0xffffffffull;
+	const uint64_t shift = output.captured.size() + (use_co64 ? stco_count * 4 : 0);
+	std::vector<uint8_t> moov;
+	if (!relocate_boxes(output.captured.data(), output.captured.size(), shift, use_co64, moov) || moov.size() != shift)
+	{
+		printf("Unexpected moov layout, remuxing failed: %s\n", output_filename);
+		fclose(output.file);
+		return -1;
+	}
+	output.captured.clear();
+	output.captured.shrink_to_fit();
+
+	// The data is moved from the end towards the beginning, so the source is never overwritten before it's read:
+	std::vector<uint8_t> block(Video::raw_read_block_size * 4);
+	uint64_t end = data_end;
+	while (end > data_begin && success)
+	{
+		const uint64_t size = std::min(uint64_t(block.size()), end - data_begin);
+		end -= size;
+		success = output.read(end, block.data(), size) && output.write(end + shift, block.data(), size);
+	}
+	success = success && output.write(data_begin, moov.data(), moov.size());
+	success = fclose(output.file) == 0 && success;
+	if (!success)
+	{
+		printf("Failed to write output file: %s\n", output_filename);
+		return -1;
+	}
+	printf("Remuxed %llu samples to faststart layout: %s (moov: %llu bytes)\n", (unsigned long long)sample_count, output_filename, (unsigned long long)moov.size());
+
+	if (verify && StreamReader::is_stream(input_filename))
+	{
+		printf("Verification was skipped, because the input stream can't be read again\n");
+	}
+	else if (verify)
+	{
+		// Both files are loaded fully, so the verification needs memory for the whole video:
+		Video original;
+		Video remuxed;
+		if (!(raw_input ? original.Load_h264_raw(input_filename, framerate) : original.Load_mp4(input_filename)) || !remuxed.Load_mp4(output_filename))
+		{
+			printf("Verification failed, the files couldn't be loaded\n");
+			return -1;
+		}
+		// The raw H264 loader keeps the original start codes and the following parameter sets in the frame data, so only the decoded frame informations are compared then:
+		if (!frame_index_equal(original, remuxed, !raw_input))
+		{
+			printf("Verification failed, the frame index is different after remuxing\n");
+			return -1;
+		}
+		printf("Verification passed, the frame index is identical for %d frames\n", (int)remuxed.frame_infos.size());
+	}
+
+	return 0;
+}
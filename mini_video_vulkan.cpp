@@ -1,4 +1,8 @@
 #include "include/common.h"
+#include "include/decoder_core.h"
+#include "include/bench.h"
+#include "include/presentation_clock.h"
+#include "include/bitstream_ring.h"
 
 #if defined(_WIN32)
 #define VK_USE_PLATFORM_WIN32_KHR
@@ -14,6 +18,8 @@
 #define VOLK_IMPLEMENTATION
 #include "include/volk.h"
 
+#include "include/vulkan_h264.h"
+
 int main(int argc, char* argv[])
 {
 	if (argc < 2)
@@ -21,12 +27,62 @@ int main(int argc, char* argv[])
 		printf("Loading test.mp4 because file name was not provided with a startup argument\n");
 	}
 
+	// With the "-bench" argument no window is created, the video is decoded once as fast as possible and the throughput is printed as JSON:
+	bool bench = false;
+	// With the "-decimate" argument non-reference frames are skipped when the display falls behind, "-maxfps <fps>" skips the ones above a frame rate:
+	bool decimate = false;
+	double max_frame_rate = 0;
+	// With the "-scan <speed>" argument the video is fast forwarded by only decoding the intra frames:
+	double scan_speed = 0;
+	// With the "-reverse" argument the video is played backwards, "-cache <pictures>" sets how many decoded pictures can wait for display:
+	bool reverse = false;
+	uint32_t reverse_cache = 0;
+	// With the "-start <frame>" argument the playback starts at the frame with this display order, only the frames that it needs are decoded from its IDR frame:
+	int start_frame = 0;
+	for (int arg = 1; arg < argc - 1; ++arg)
+	{
+		if (std::strcmp(argv[arg], "-bench") == 0 || std::strcmp(argv[arg], "--bench") == 0)
+		{
+			bench = true;
+		}
+		else if (std::strcmp(argv[arg], "-decimate") == 0)
+		{
+			decimate = true;
+		}
+		else if (std::strcmp(argv[arg], "-maxfps") == 0 && arg + 2 < argc)
+		{
+			max_frame_rate = std::max(0.0, atof(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-scan") == 0 && arg + 2 < argc)
+		{
+			scan_speed = std::max(0.0, atof(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-reverse") == 0)
+		{
+			reverse = true;
+		}
+		else if (std::strcmp(argv[arg], "-cache") == 0 && arg + 2 < argc)
+		{
+			reverse_cache = std::max(2, atoi(argv[++arg]));
+		}
+		else if (std::strcmp(argv[arg], "-start") == 0 && arg + 2 < argc)
+		{
+			start_frame = std::max(0, atoi(argv[++arg]));
+		}
+	}
+	DecodeBenchmark benchmark;
+	benchmark.begin_load();
+
+	// The video is loaded from an MP4 file, or received as a raw H264 stream if the argument is "-" (stdin) or a pipe:
+	const char* filename = argc > 1 ? argv[argc - 1] : "test.mp4";
 	Video video;
-	if (!video.Load_mp4(argc > 1 ? argv[argc - 1] : "test.mp4"))
+	if (StreamReader::is_stream(filename) ? !video.Open_h264_stream(filename) : !video.Load_mp4(filename))
 	{
 		printf("Video load failure, exiting.\n");
 		return -1;
 	}
+	benchmark.end_load();
+	benchmark.frame_limit = video.live ? ~0ull : video.frame_infos.size();
 
 	if (video.frame_infos.empty())
 	{
@@ -34,7 +90,14 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	printf("Video was loaded successfully and contains %d frames in total.\n", (int)video.frame_infos.size());
+	if (video.live)
+	{
+		printf("Live stream was opened successfully, frames will be decoded as they are received.\n");
+	}
+	else
+	{
+		printf("Video was loaded successfully and contains %d frames in total.\n", (int)video.frame_infos.size());
+	}
 
 	// Below this will be all the Vulkan code:
 	VkResult res;
@@ -295,8 +358,14 @@ int main(int argc, char* argv[])
 			queueCreateInfos[1].pQueuePriorities = &queuePriority;
 		}
 
+		// Timeline semaphore is core in Vulkan 1.2, it is used to track the completion of each decode in flight:
+		VkPhysicalDeviceVulkan12Features features_1_2 = {};
+		features_1_2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		features_1_2.timelineSemaphore = VK_TRUE;
+
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &features_1_2;
 		createInfo.queueCreateInfoCount = arraysize(queueCreateInfos);
 		createInfo.pQueueCreateInfos = queueCreateInfos;
 		createInfo.pEnabledFeatures = nullptr;
@@ -331,21 +400,45 @@ int main(int argc, char* argv[])
 		assert(res == VK_SUCCESS);
 	};
 
-	// Create bitstream GPU buffer and copy compressed video data into it:
-	VkBuffer bitstream_buffer = VK_NULL_HANDLE;
-	VkDeviceMemory bitstream_buffer_memory = VK_NULL_HANDLE;
-	const VkDeviceSize bitstream_alignment = align(video_capability_h264.video_capabilities.minBitstreamBufferOffsetAlignment, video_capability_h264.video_capabilities.minBitstreamBufferSizeAlignment);
+	// The decoder core can decode ahead of the display, this returns how many decodes can be in flight on the GPU at the same time:
+	//	Each decode in flight will use its own command buffer, bitstream ring range and decode output layer
+	VideoDecoderCore core;
+	core.video = &video;
+	const uint32_t decode_frames_in_flight = core.enable_decode_ahead(4, video_capability_h264.video_capabilities.maxDpbSlots);
+	core.enable_loop_preroll(8); // the first GOP of the next loop is decoded ahead while the end of the loop is displayed, so looping doesn't stall on the intra frame
+	if (!bench && (decimate || max_frame_rate > 0))
+	{
+		printf("Temporal decimation: decoding temporal layers 0-%u\n", core.enable_decimation(max_frame_rate, decimate));
+	}
+	if (!bench && !video.live && start_frame > 0)
+	{
+		core.seek(start_frame);
+		printf("Seek to display order %d: decoding %u of the %u frames from the IDR frame\n", start_frame, core.seek_plan.minimal.frames, core.seek_plan.all_frames.frames);
+	}
+	if (!bench && !video.live && scan_speed > 0)
 	{
-		// The bitstream offsets are at this point pointing into the H264 data that was loaded, but we need to change it to point to aligned GPU data:
-		uint64_t aligned_size = 0;
-		for (Video::FrameInfo& frame_info : video.frame_infos)
+		core.set_scan_speed(scan_speed);
+	}
+	if (!bench && !video.live && reverse)
+	{
+		if (reverse_cache > 0)
 		{
-			aligned_size += align(frame_info.size, bitstream_alignment);
+			core.reverse_cache_budget = reverse_cache;
 		}
+		core.set_reverse(true); // before the reordering pictures are created, so the reverse cache is created up front
+	}
 
+	// Create bitstream GPU buffer, the frames are copied into it just in time before their decode:
+	//	It's a ring buffer that holds the frames of the decodes in flight, so its size doesn't depend on the video length, and the startup doesn't copy the whole video
+	VkBuffer bitstream_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory bitstream_buffer_memory = VK_NULL_HANDLE;
+	void* bitstream_mapped_data = nullptr;
+	BitstreamRing bitstream_ring;
+	bitstream_ring.configure(video, decode_frames_in_flight, video_capability_h264.video_capabilities.minBitstreamBufferOffsetAlignment, video_capability_h264.video_capabilities.minBitstreamBufferSizeAlignment);
+	{
 		VkBufferCreateInfo buffer_info = {};
 		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		buffer_info.size = aligned_size;
+		buffer_info.size = bitstream_ring.capacity;
 		buffer_info.usage = VK_BUFFER_USAGE_VIDEO_DECODE_SRC_BIT_KHR;
 		VkVideoProfileListInfoKHR profile_list_info = {};
 		profile_list_info.sType = VK_STRUCTURE_TYPE_VIDEO_PROFILE_LIST_INFO_KHR;
@@ -374,23 +467,8 @@ int main(int argc, char* argv[])
 		res = vkBindBufferMemory(device, bitstream_buffer, bitstream_buffer_memory, 0);
 		assert(res == VK_SUCCESS);
 
-		void* mapped_data = nullptr;
-		res = vkMapMemory(device, bitstream_buffer_memory, 0, buffer_info.size, 0, &mapped_data);
+		res = vkMapMemory(device, bitstream_buffer_memory, 0, buffer_info.size, 0, &bitstream_mapped_data); // stays mapped for the whole playback
 		assert(res == VK_SUCCESS);
-
-		// Write the slice datas into the aligned offsets, and store the aligned offsets in frame_infos, from here they will be storing offsets into the bitstream buffer, and not the source file:
-		uint64_t aligned_offset = 0;
-		for (Video::FrameInfo& frame_info : video.frame_infos)
-		{
-			std::memcpy((uint8_t*)mapped_data + aligned_offset, video.h264_data.data() + frame_info.offset, frame_info.size); // copy into GPU buffer through mapped_data ptr
-			frame_info.offset = aligned_offset;
-			aligned_offset += align(frame_info.size, bitstream_alignment);
-		}
-
-		// The h264_data is not required any longer to be in RAM because it has been copied to the GPU buffer, so I delete it:
-		video.h264_data.clear();
-
-		vkUnmapMemory(device, bitstream_buffer_memory);
 	}
 
 	// This sample implementation only supports the following texture format when decoding. It has two planes: Luminance and Chrominance. It can be combined to an RGB image by a shader by sampling from both planes.
@@ -404,7 +482,6 @@ int main(int argc, char* argv[])
 	//		for example you could keep the reordered picture buffer in RGB resolved format, and resolve into it directly from DPB or decode output
 	//		but in this example I resolve directly to the swap chain instead, and keep the reordered pictures in YUV format
 	const bool dpb_output_coincide_supported = video_capability_h264.decode_capabilities.flags & VK_VIDEO_DECODE_CAPABILITY_DPB_AND_OUTPUT_COINCIDE_BIT_KHR;
-	const bool dpb_output_distinct_supported = video_capability_h264.decode_capabilities.flags & VK_VIDEO_DECODE_CAPABILITY_DPB_AND_OUTPUT_DISTINCT_BIT_KHR;
 
 	// Create DPB texture:
 	VkImage dpb_image = VK_NULL_HANDLE;
@@ -490,7 +567,7 @@ int main(int argc, char* argv[])
 		image_info.extent.width = video.padded_width;
 		image_info.extent.height = video.padded_height;
 		image_info.extent.depth = 1;
-		image_info.arrayLayers = 1;
+		image_info.arrayLayers = decode_frames_in_flight; // one output layer for each decode in flight
 		image_info.mipLevels = 1;
 		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
 		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -525,11 +602,11 @@ int main(int argc, char* argv[])
 		view_desc.image = decode_output_image;
 		view_desc.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		view_desc.subresourceRange.baseArrayLayer = 0;
-		view_desc.subresourceRange.layerCount = 1;
+		view_desc.subresourceRange.layerCount = decode_frames_in_flight;
 		view_desc.subresourceRange.baseMipLevel = 0;
 		view_desc.subresourceRange.levelCount = 1;
 		view_desc.format = image_info.format;
-		view_desc.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_desc.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
 
 		VkImageViewUsageCreateInfo viewUsageInfo = {};
 		viewUsageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
@@ -546,8 +623,6 @@ int main(int argc, char* argv[])
 		VkDeviceMemory memory = VK_NULL_HANDLE;
 		VkImageView image_view_luminance = VK_NULL_HANDLE;
 		VkImageView image_view_chrominance = VK_NULL_HANDLE;
-		int display_order = -1;
-		int frame_index = 0;
 		void create(VkDevice device, uint32_t padded_width, uint32_t padded_height)
 		{
 			VkImageCreateInfo image_info = {};
@@ -618,242 +693,40 @@ int main(int argc, char* argv[])
 			vkFreeMemory(device, memory, nullptr);
 		}
 	};
-	std::vector<DecodeResultReordered> reordered_results_free; // free image slots that can be reused as reordering image displaying
-	std::vector<DecodeResultReordered> reordered_results_working; // image slots that are currently in use for reordering
-	DecodeResultReordered displayed_image; // the latest reordered picture
+	std::vector<DecodeResultReordered> reordered_pictures; // images of the VideoDecoderCore::pictures, used for reordering decoded images to display order
+	const DecodeResultReordered no_picture; // used for displaying before the first picture is available
+
+	// All the reordering pictures that the stream needs are created up front, so that no images are created during playback:
+	reordered_pictures.resize(core.reserve_pictures());
+	for (DecodeResultReordered& x : reordered_pictures)
+	{
+		x.create(device, video.padded_width, video.padded_height);
+	}
 
 	VkExtent2D codedExtent = {};
 	codedExtent.width = std::min(video.padded_width, video_capability_h264.video_capabilities.maxCodedExtent.width);
 	codedExtent.height = std::min(video.padded_height, video_capability_h264.video_capabilities.maxCodedExtent.height);
 
+	// The Vulkan parameter sets and the reference slots of the DPB are kept for the whole playback, only the slots used by a frame are updated when it's decoded:
+	VulkanParametersH264 parameters_h264;
+	parameters_h264.init_slots(video.num_dpb_slots, codedExtent, dpb_image_view);
+
 	// Create video decoder:
 	VkVideoSessionKHR video_session = VK_NULL_HANDLE;
 	std::vector<VkDeviceMemory> video_session_allocations;
 	VkVideoSessionParametersKHR session_parameters = VK_NULL_HANDLE;
 	{
-		std::vector<StdVideoH264PictureParameterSet> pps_array_h264(video.pps_array.size());
-		std::vector<StdVideoH264ScalingLists> scalinglist_array_h264(video.pps_array.size());
-		for (uint32_t i = 0; i < pps_array_h264.size(); ++i)
-		{
-			const h264::PPS& pps = video.pps_array[i];
-			StdVideoH264PictureParameterSet& vk_pps = pps_array_h264[i];
-			StdVideoH264ScalingLists& vk_scalinglist = scalinglist_array_h264[i];
-
-			vk_pps.flags.transform_8x8_mode_flag = pps.transform_8x8_mode_flag;
-			vk_pps.flags.redundant_pic_cnt_present_flag = pps.redundant_pic_cnt_present_flag;
-			vk_pps.flags.constrained_intra_pred_flag = pps.constrained_intra_pred_flag;
-			vk_pps.flags.deblocking_filter_control_present_flag = pps.deblocking_filter_control_present_flag;
-			vk_pps.flags.weighted_pred_flag = pps.weighted_pred_flag;
-			vk_pps.flags.bottom_field_pic_order_in_frame_present_flag = pps.pic_order_present_flag;
-			vk_pps.flags.entropy_coding_mode_flag = pps.entropy_coding_mode_flag;
-			vk_pps.flags.pic_scaling_matrix_present_flag = pps.pic_scaling_matrix_present_flag;
-
-			vk_pps.seq_parameter_set_id = pps.seq_parameter_set_id;
-			vk_pps.pic_parameter_set_id = pps.pic_parameter_set_id;
-			vk_pps.num_ref_idx_l0_default_active_minus1 = pps.num_ref_idx_l0_active_minus1;
-			vk_pps.num_ref_idx_l1_default_active_minus1 = pps.num_ref_idx_l1_active_minus1;
-			vk_pps.weighted_bipred_idc = (StdVideoH264WeightedBipredIdc)pps.weighted_bipred_idc;
-			vk_pps.pic_init_qp_minus26 = pps.pic_init_qp_minus26;
-			vk_pps.pic_init_qs_minus26 = pps.pic_init_qs_minus26;
-			vk_pps.chroma_qp_index_offset = pps.chroma_qp_index_offset;
-			vk_pps.second_chroma_qp_index_offset = pps.second_chroma_qp_index_offset;
-
-			vk_pps.pScalingLists = &vk_scalinglist;
-			for (int j = 0; j < arraysize(pps.pic_scaling_list_present_flag); ++j)
-			{
-				vk_scalinglist.scaling_list_present_mask |= pps.pic_scaling_list_present_flag[j] << j;
-			}
-			for (int j = 0; j < arraysize(pps.UseDefaultScalingMatrix4x4Flag); ++j)
-			{
-				vk_scalinglist.use_default_scaling_matrix_mask |= pps.UseDefaultScalingMatrix4x4Flag[j] << j;
-			}
-			for (int j = 0; j < arraysize(pps.ScalingList4x4); ++j)
-			{
-				for (int k = 0; k < arraysize(pps.ScalingList4x4[j]); ++k)
-				{
-					vk_scalinglist.ScalingList4x4[j][k] = (uint8_t)pps.ScalingList4x4[j][k];
-				}
-			}
-			for (int j = 0; j < arraysize(pps.ScalingList8x8); ++j)
-			{
-				for (int k = 0; k < arraysize(pps.ScalingList8x8[j]); ++k)
-				{
-					vk_scalinglist.ScalingList8x8[j][k] = (uint8_t)pps.ScalingList8x8[j][k];
-				}
-			}
-		}
+		// The parameter sets are converted once, and they stay alive with the session parameters:
+		parameters_h264.convert(video, decode_h264_capabilities.maxLevelIdc);
+		VkVideoDecodeH264SessionParametersAddInfoKHR session_parameters_add_info_h264 = parameters_h264.add_info();
 
 		uint32_t num_reference_frames = 0;
-		std::vector<StdVideoH264SequenceParameterSet> sps_array_h264(video.sps_array.size());
-		std::vector<StdVideoH264SequenceParameterSetVui> vui_array_h264(video.sps_array.size());
-		std::vector<StdVideoH264HrdParameters> hrd_array_h264(video.sps_array.size());
-		for (uint32_t i = 0; i < sps_array_h264.size(); ++i)
+		for (auto& sps : video.sps_array)
 		{
-			const h264::SPS& sps = video.sps_array[i];
-			StdVideoH264SequenceParameterSet& vk_sps = sps_array_h264[i];
-
-			vk_sps.flags.constraint_set0_flag = sps.constraint_set0_flag;
-			vk_sps.flags.constraint_set1_flag = sps.constraint_set1_flag;
-			vk_sps.flags.constraint_set2_flag = sps.constraint_set2_flag;
-			vk_sps.flags.constraint_set3_flag = sps.constraint_set3_flag;
-			vk_sps.flags.constraint_set4_flag = sps.constraint_set4_flag;
-			vk_sps.flags.constraint_set5_flag = sps.constraint_set5_flag;
-			vk_sps.flags.direct_8x8_inference_flag = sps.direct_8x8_inference_flag;
-			vk_sps.flags.mb_adaptive_frame_field_flag = sps.mb_adaptive_frame_field_flag;
-			vk_sps.flags.frame_mbs_only_flag = sps.frame_mbs_only_flag;
-			vk_sps.flags.delta_pic_order_always_zero_flag = sps.delta_pic_order_always_zero_flag;
-			vk_sps.flags.separate_colour_plane_flag = sps.separate_colour_plane_flag;
-			vk_sps.flags.gaps_in_frame_num_value_allowed_flag = sps.gaps_in_frame_num_value_allowed_flag;
-			vk_sps.flags.qpprime_y_zero_transform_bypass_flag = sps.qpprime_y_zero_transform_bypass_flag;
-			vk_sps.flags.frame_cropping_flag = sps.frame_cropping_flag;
-			vk_sps.flags.seq_scaling_matrix_present_flag = sps.seq_scaling_matrix_present_flag;
-			vk_sps.flags.vui_parameters_present_flag = sps.vui_parameters_present_flag;
-
-			if (vk_sps.flags.vui_parameters_present_flag)
-			{
-				StdVideoH264SequenceParameterSetVui& vk_vui = vui_array_h264[i];
-				vk_sps.pSequenceParameterSetVui = &vk_vui;
-				vk_vui.flags.aspect_ratio_info_present_flag = sps.vui.aspect_ratio_info_present_flag;
-				vk_vui.flags.overscan_info_present_flag = sps.vui.overscan_info_present_flag;
-				vk_vui.flags.overscan_appropriate_flag = sps.vui.overscan_appropriate_flag;
-				vk_vui.flags.video_signal_type_present_flag = sps.vui.video_signal_type_present_flag;
-				vk_vui.flags.video_full_range_flag = sps.vui.video_full_range_flag;
-				vk_vui.flags.color_description_present_flag = sps.vui.colour_description_present_flag;
-				vk_vui.flags.chroma_loc_info_present_flag = sps.vui.chroma_loc_info_present_flag;
-				vk_vui.flags.timing_info_present_flag = sps.vui.timing_info_present_flag;
-				vk_vui.flags.fixed_frame_rate_flag = sps.vui.fixed_frame_rate_flag;
-				vk_vui.flags.bitstream_restriction_flag = sps.vui.bitstream_restriction_flag;
-				vk_vui.flags.nal_hrd_parameters_present_flag = sps.vui.nal_hrd_parameters_present_flag;
-				vk_vui.flags.vcl_hrd_parameters_present_flag = sps.vui.vcl_hrd_parameters_present_flag;
-
-				vk_vui.aspect_ratio_idc = (StdVideoH264AspectRatioIdc)sps.vui.aspect_ratio_idc;
-				vk_vui.sar_width = sps.vui.sar_width;
-				vk_vui.sar_height = sps.vui.sar_height;
-				vk_vui.video_format = sps.vui.video_format;
-				vk_vui.colour_primaries = sps.vui.colour_primaries;
-				vk_vui.transfer_characteristics = sps.vui.transfer_characteristics;
-				vk_vui.matrix_coefficients = sps.vui.matrix_coefficients;
-				vk_vui.num_units_in_tick = sps.vui.num_units_in_tick;
-				vk_vui.time_scale = sps.vui.time_scale;
-				vk_vui.max_num_reorder_frames = sps.vui.num_reorder_frames;
-				vk_vui.max_dec_frame_buffering = sps.vui.max_dec_frame_buffering;
-				vk_vui.chroma_sample_loc_type_top_field = sps.vui.chroma_sample_loc_type_top_field;
-				vk_vui.chroma_sample_loc_type_bottom_field = sps.vui.chroma_sample_loc_type_bottom_field;
-
-				StdVideoH264HrdParameters& vk_hrd = hrd_array_h264[i];
-				vk_vui.pHrdParameters = &vk_hrd;
-				vk_hrd.cpb_cnt_minus1 = sps.hrd.cpb_cnt_minus1;
-				vk_hrd.bit_rate_scale = sps.hrd.bit_rate_scale;
-				vk_hrd.cpb_size_scale = sps.hrd.cpb_size_scale;
-				for (int j = 0; j < arraysize(sps.hrd.bit_rate_value_minus1); ++j)
-				{
-					vk_hrd.bit_rate_value_minus1[j] = sps.hrd.bit_rate_value_minus1[j];
-					vk_hrd.cpb_size_value_minus1[j] = sps.hrd.cpb_size_value_minus1[j];
-					vk_hrd.cbr_flag[j] = sps.hrd.cbr_flag[j];
-				}
-				vk_hrd.initial_cpb_removal_delay_length_minus1 = sps.hrd.initial_cpb_removal_delay_length_minus1;
-				vk_hrd.cpb_removal_delay_length_minus1 = sps.hrd.cpb_removal_delay_length_minus1;
-				vk_hrd.dpb_output_delay_length_minus1 = sps.hrd.dpb_output_delay_length_minus1;
-				vk_hrd.time_offset_length = sps.hrd.time_offset_length;
-			}
-
-			vk_sps.profile_idc = (StdVideoH264ProfileIdc)sps.profile_idc;
-			switch (sps.level_idc)
-			{
-			case 0:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_1_0;
-				break;
-			case 11:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_1_1;
-				break;
-			case 12:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_1_2;
-				break;
-			case 13:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_1_3;
-				break;
-			case 20:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_2_0;
-				break;
-			case 21:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_2_1;
-				break;
-			case 22:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_2_2;
-				break;
-			case 30:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_3_0;
-				break;
-			case 31:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_3_1;
-				break;
-			case 32:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_3_2;
-				break;
-			case 40:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_4_0;
-				break;
-			case 41:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_4_1;
-				break;
-			case 42:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_4_2;
-				break;
-			case 50:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_5_0;
-				break;
-			case 51:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_5_1;
-				break;
-			case 52:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_5_2;
-				break;
-			case 60:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_6_0;
-				break;
-			case 61:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_6_1;
-				break;
-			case 62:
-				vk_sps.level_idc = STD_VIDEO_H264_LEVEL_IDC_6_2;
-				break;
-			default:
-				assert(0);
-				break;
-			}
-			assert(vk_sps.level_idc <= decode_h264_capabilities.maxLevelIdc);
-			//vk_sps.chroma_format_idc = (StdVideoH264ChromaFormatIdc)sps.chroma_format_idc;
-			vk_sps.chroma_format_idc = STD_VIDEO_H264_CHROMA_FORMAT_IDC_420; // only one we support currently
-			vk_sps.seq_parameter_set_id = sps.seq_parameter_set_id;
-			vk_sps.bit_depth_luma_minus8 = sps.bit_depth_luma_minus8;
-			vk_sps.bit_depth_chroma_minus8 = sps.bit_depth_chroma_minus8;
-			vk_sps.log2_max_frame_num_minus4 = sps.log2_max_frame_num_minus4;
-			vk_sps.pic_order_cnt_type = (StdVideoH264PocType)sps.pic_order_cnt_type;
-			vk_sps.offset_for_non_ref_pic = sps.offset_for_non_ref_pic;
-			vk_sps.offset_for_top_to_bottom_field = sps.offset_for_top_to_bottom_field;
-			vk_sps.log2_max_pic_order_cnt_lsb_minus4 = sps.log2_max_pic_order_cnt_lsb_minus4;
-			vk_sps.num_ref_frames_in_pic_order_cnt_cycle = sps.num_ref_frames_in_pic_order_cnt_cycle;
-			vk_sps.max_num_ref_frames = sps.num_ref_frames;
-			vk_sps.pic_width_in_mbs_minus1 = sps.pic_width_in_mbs_minus1;
-			vk_sps.pic_height_in_map_units_minus1 = sps.pic_height_in_map_units_minus1;
-			vk_sps.frame_crop_left_offset = sps.frame_crop_left_offset;
-			vk_sps.frame_crop_right_offset = sps.frame_crop_right_offset;
-			vk_sps.frame_crop_top_offset = sps.frame_crop_top_offset;
-			vk_sps.frame_crop_bottom_offset = sps.frame_crop_bottom_offset;
-			vk_sps.pOffsetForRefFrame = sps.offset_for_ref_frame;
-
 			num_reference_frames = std::max(num_reference_frames, (uint32_t)sps.num_ref_frames);
 		}
-
 		num_reference_frames = std::min(num_reference_frames, video_capability_h264.video_capabilities.maxActiveReferencePictures);
 
-		VkVideoDecodeH264SessionParametersAddInfoKHR session_parameters_add_info_h264 = {};
-		session_parameters_add_info_h264.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_H264_SESSION_PARAMETERS_ADD_INFO_KHR;
-		session_parameters_add_info_h264.stdPPSCount = (uint32_t)pps_array_h264.size();
-		session_parameters_add_info_h264.pStdPPSs = pps_array_h264.data();
-		session_parameters_add_info_h264.stdSPSCount = (uint32_t)sps_array_h264.size();
-		session_parameters_add_info_h264.pStdSPSs = sps_array_h264.data();
-
 		VkVideoSessionCreateInfoKHR info = {};
 		info.sType = VK_STRUCTURE_TYPE_VIDEO_SESSION_CREATE_INFO_KHR;
 		info.queueFamilyIndex = videoFamily;
@@ -905,8 +778,8 @@ int main(int argc, char* argv[])
 
 		VkVideoDecodeH264SessionParametersCreateInfoKHR session_parameters_info_h264 = {};
 		session_parameters_info_h264.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_H264_SESSION_PARAMETERS_CREATE_INFO_KHR;
-		session_parameters_info_h264.maxStdPPSCount = (uint32_t)pps_array_h264.size();
-		session_parameters_info_h264.maxStdSPSCount = (uint32_t)sps_array_h264.size();
+		session_parameters_info_h264.maxStdPPSCount = session_parameters_add_info_h264.stdPPSCount;
+		session_parameters_info_h264.maxStdSPSCount = session_parameters_add_info_h264.stdSPSCount;
 		session_parameters_info_h264.pParametersAddInfo = &session_parameters_add_info_h264;
 
 		VkVideoSessionParametersCreateInfoKHR session_parameters_info = {};
@@ -1113,6 +986,7 @@ int main(int argc, char* argv[])
 #if defined(_WIN32)
 	HINSTANCE hInstance = NULL;
 	HWND hWnd = NULL;
+	if (!bench)
 	{
 		static auto WndProc = [](HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) -> LRESULT
 		{
@@ -1146,15 +1020,21 @@ int main(int argc, char* argv[])
 		ShowWindow(hWnd, SW_SHOWDEFAULT);
 	}
 #elif defined(__linux__)
-	Display* display = XOpenDisplay(NULL);
-	if(display == nullptr) printf("XOpenDisplay failed!\n");
-	Window root = DefaultRootWindow(display);
-	if(root == None) printf("DefaultRootWindow failed!\n");
-	Window window = XCreateSimpleWindow(display, root, 0, 0, video.width, video.height, 0, 0, 0xffffffff);
-	if(window == None) printf("XCreateSimpleWindow failed!\n");
-	XMapWindow(display, window);
-	Atom wm_delete_window = XInternAtom(display, "WM_DELETE_WINDOW", False);
-	XSetWMProtocols(display, window, & wm_delete_window, 1);
+	Display* display = nullptr;
+	Window window = None;
+	Atom wm_delete_window = None;
+	if (!bench)
+	{
+		display = XOpenDisplay(NULL);
+		if(display == nullptr) printf("XOpenDisplay failed!\n");
+		Window root = DefaultRootWindow(display);
+		if(root == None) printf("DefaultRootWindow failed!\n");
+		window = XCreateSimpleWindow(display, root, 0, 0, video.width, video.height, 0, 0, 0xffffffff);
+		if(window == None) printf("XCreateSimpleWindow failed!\n");
+		XMapWindow(display, window);
+		wm_delete_window = XInternAtom(display, "WM_DELETE_WINDOW", False);
+		XSetWMProtocols(display, window, & wm_delete_window, 1);
+	}
 #endif // _WIN32
 
 	// Create swap chain for the window to display the video:
@@ -1317,25 +1197,40 @@ int main(int argc, char* argv[])
 
 		printf("swapchain resized, new size: %d x %d\n", (int)swapchain_extent.width, (int)swapchain_extent.height);
 	};
-	create_swapchain();
+	if (!bench)
+	{
+		create_swapchain();
+	}
 
 	// Create command buffers:
-	VkCommandPool video_command_pool = VK_NULL_HANDLE;
+	//	Every decode in flight is recorded into its own video command buffer, the index of these is the decode context
+	std::vector<VkCommandPool> video_command_pools(decode_frames_in_flight);
 	VkCommandPool graphics_command_pool = VK_NULL_HANDLE;
-	VkCommandBuffer video_cmd = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> video_cmds(decode_frames_in_flight);
 	VkCommandBuffer graphics_cmd = VK_NULL_HANDLE;
 	VkCommandBufferBeginInfo cmd_begin_info = {};
-	VkSemaphore video_semaphore = VK_NULL_HANDLE;
+	VkSemaphore decode_timeline = VK_NULL_HANDLE; // timeline semaphore, every video submit signals it with the number of submitted decodes
+	uint64_t decode_submit_count = 0;
+	struct DecodeInFlight
+	{
+		uint32_t context = 0;
+		uint64_t timeline_value = 0; // the decode is completed when decode_timeline reached this value
+	};
+	std::vector<DecodeInFlight> decodes_in_flight; // in the same order as core.decoding_pictures
 	VkFence fence = VK_NULL_HANDLE;
 	std::vector<VkSemaphore> wait_semaphores;
+	std::vector<uint64_t> wait_values;
 	{
 		VkCommandPoolCreateInfo poolInfo = {};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 		poolInfo.queueFamilyIndex = videoFamily;
-		res = vkCreateCommandPool(device, &poolInfo, nullptr, &video_command_pool);
-		assert(res == VK_SUCCESS);
-		set_name((uint64_t)video_command_pool, VK_OBJECT_TYPE_COMMAND_POOL, "video_command_pool");
+		for (auto& x : video_command_pools)
+		{
+			res = vkCreateCommandPool(device, &poolInfo, nullptr, &x);
+			assert(res == VK_SUCCESS);
+			set_name((uint64_t)x, VK_OBJECT_TYPE_COMMAND_POOL, "video_command_pool");
+		}
 		poolInfo.queueFamilyIndex = graphicsFamily;
 		res = vkCreateCommandPool(device, &poolInfo, nullptr, &graphics_command_pool);
 		assert(res == VK_SUCCESS);
@@ -1345,9 +1240,12 @@ int main(int argc, char* argv[])
 		commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 		commandBufferInfo.commandBufferCount = 1;
-		commandBufferInfo.commandPool = video_command_pool;
-		res = vkAllocateCommandBuffers(device, &commandBufferInfo, &video_cmd);
-		assert(res == VK_SUCCESS);
+		for (uint32_t i = 0; i < decode_frames_in_flight; ++i)
+		{
+			commandBufferInfo.commandPool = video_command_pools[i];
+			res = vkAllocateCommandBuffers(device, &commandBufferInfo, &video_cmds[i]);
+			assert(res == VK_SUCCESS);
+		}
 		commandBufferInfo.commandPool = graphics_command_pool;
 		res = vkAllocateCommandBuffers(device, &commandBufferInfo, &graphics_cmd);
 		assert(res == VK_SUCCESS);
@@ -1355,11 +1253,16 @@ int main(int argc, char* argv[])
 		cmd_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		cmd_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
+		VkSemaphoreTypeCreateInfo type_info = {};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		type_info.initialValue = 0;
 		VkSemaphoreCreateInfo info = {};
 		info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		res = vkCreateSemaphore(device, &info, nullptr, &video_semaphore);
+		info.pNext = &type_info;
+		res = vkCreateSemaphore(device, &info, nullptr, &decode_timeline);
 		assert(res == VK_SUCCESS);
-		set_name((uint64_t)video_semaphore, VK_OBJECT_TYPE_SEMAPHORE, "video_semaphore");
+		set_name((uint64_t)decode_timeline, VK_OBJECT_TYPE_SEMAPHORE, "decode_timeline");
 
 		VkFenceCreateInfo fenceInfo = {};
 		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
@@ -1369,6 +1272,11 @@ int main(int argc, char* argv[])
 	}
 
 	// Do the display frame loop:
+	bool dpb_initialized = false;
+	video.timer.record();
+	PresentationClock presentation_clock;
+	presentation_clock.refresh_period = 0; // the refresh rate is not known, it's measured from the vsyncs
+	presentation_clock.start(0);
 	bool exiting = false;
 	while (!exiting)
 	{
@@ -1383,7 +1291,7 @@ int main(int argc, char* argv[])
 		}
 #elif defined(__linux__)
 		XEvent event;
-		if(XPending(display) > 0)
+		if(display != nullptr && XPending(display) > 0)
 		{
 			XNextEvent(display, &event);
 			if(event.type == ClientMessage) {
@@ -1394,52 +1302,53 @@ int main(int argc, char* argv[])
 #endif // WIN32
 
 		wait_semaphores.clear();
+		wait_values.clear();
 
-		if (video.frameIndex == 0)
+		if (video.live)
 		{
-			// At video beginning, reset the state of picture display reordering: 
-			for (DecodeResultReordered& used : reordered_results_working)
-			{
-				used.display_order = -1;
-				reordered_results_free.push_back(used);
-			}
-			reordered_results_working.clear();
-			video.target_display_order = 0;
+			// Receive the next access units of the live stream without blocking:
+			video.Update_h264_stream();
 		}
 
-		bool must_decode = true;
-		for (auto& x : reordered_results_working)
-		{
-			if (x.display_order == video.target_display_order)
-				must_decode = false;
-		}
-
-		if (must_decode)
+		// The decoder core decides whether new frames must be decoded, and which DPB slots they use:
+		//	The graphics work of the previous iteration completed, so the decode context and DPB slot of a copied picture can be reused
+		VideoDecoderCore::DecodeCommand decode;
+		benchmark.begin_submit();
+		while ((!bench || benchmark.can_submit()) && core.begin_decode(decode))
 		{
 			// Decoding a new video frame is required:
-			const Video::FrameInfo& frame_info = video.frame_infos[video.frameIndex];
-			const h264::SliceHeader& slice_header = video.slice_headers[video.frameIndex];
-			const h264::PPS& pps = video.pps_array[slice_header.pic_parameter_set_id];
-			const h264::SPS& sps = video.sps_array[pps.seq_parameter_set_id];
+			const Video::FrameInfo& frame_info = decode.frame_info;
+			const h264::SliceHeader& slice_header = decode.slice_header;
+			const h264::PPS& pps = *decode.pps;
 
-			if (frame_info.is_intra)
+			if (decode.picture_created)
 			{
-				video.reference_usage.clear();
-				video.next_ref = 0;
-				video.next_slot = 0;
+				// Create new image, because the stream reorders more frames than its SPS declares, so the reserved ones are all in use:
+				assert(decode.picture == (int)reordered_pictures.size());
+				reordered_pictures.emplace_back();
+				reordered_pictures.back().create(device, video.padded_width, video.padded_height);
 			}
-			video.current_slot = video.next_slot;
-			video.poc_status[video.current_slot] = frame_info.poc;
-			video.framenum_status[video.current_slot] = slice_header.frame_num;
 
-			res = vkResetCommandPool(device, video_command_pool, 0);
+			// The decodes complete in submission order, and there are never more than decode_frames_in_flight of them, so the context of the oldest one is free:
+			const uint32_t context = uint32_t(decode_submit_count % decode_frames_in_flight);
+			VkCommandBuffer video_cmd = video_cmds[context];
+			res = vkResetCommandPool(device, video_command_pools[context], 0);
 			assert(res == VK_SUCCESS);
 			res = vkBeginCommandBuffer(video_cmd, &cmd_begin_info);
 			assert(res == VK_SUCCESS);
 
-			if (video.frameIndex == 0)
 			{
-				// whole DPB is initialized to DPB layout at first frame:
+				// The previous decodes on the video queue write the DPB slots that this decode references:
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+				vkCmdPipelineBarrier(video_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			}
+			if (!dpb_initialized)
+			{
+				// whole DPB is initialized to DPB layout at first frame, but not when the video loops, because the slots of the previous loop might still be copied:
+				dpb_initialized = true;
 				VkImageMemoryBarrier barrier = {};
 				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 				barrier.image = dpb_image;
@@ -1460,7 +1369,7 @@ int main(int argc, char* argv[])
 					dpb_layouts[i] = VK_IMAGE_LAYOUT_VIDEO_DECODE_DPB_KHR;
 				}
 			}
-			if (dpb_layouts[video.current_slot] != VK_IMAGE_LAYOUT_VIDEO_DECODE_DPB_KHR)
+			if (dpb_layouts[decode.current_slot] != VK_IMAGE_LAYOUT_VIDEO_DECODE_DPB_KHR)
 			{
 				// if current DPB slot is not in DPB layout, transition it now:
 				VkImageMemoryBarrier barrier = {};
@@ -1473,16 +1382,16 @@ int main(int argc, char* argv[])
 				barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 				barrier.subresourceRange.baseMipLevel = 0;
 				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-				barrier.subresourceRange.baseArrayLayer = video.current_slot;
+				barrier.subresourceRange.baseArrayLayer = decode.current_slot;
 				barrier.subresourceRange.layerCount = 1;
 				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 				vkCmdPipelineBarrier(video_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
-				dpb_layouts[video.current_slot] = VK_IMAGE_LAYOUT_VIDEO_DECODE_DPB_KHR;
+				dpb_layouts[decode.current_slot] = VK_IMAGE_LAYOUT_VIDEO_DECODE_DPB_KHR;
 			}
 			if (!dpb_output_coincide_supported)
 			{
-				// No-coincide output image needs to be in DECODE_DST layout, and it's always overwritten from undefined:
+				// No-coincide output layer of the context needs to be in DECODE_DST layout, and it's always overwritten from undefined:
 				VkImageMemoryBarrier barrier = {};
 				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 				barrier.image = decode_output_image;
@@ -1493,8 +1402,8 @@ int main(int argc, char* argv[])
 				barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 				barrier.subresourceRange.baseMipLevel = 0;
 				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-				barrier.subresourceRange.baseArrayLayer = 0;
-				barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+				barrier.subresourceRange.baseArrayLayer = context;
+				barrier.subresourceRange.layerCount = 1;
 				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 				vkCmdPipelineBarrier(video_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
@@ -1514,60 +1423,18 @@ int main(int argc, char* argv[])
 			std_picture_info_h264.flags.bottom_field_flag = slice_header.bottom_field_flag;
 			std_picture_info_h264.flags.complementary_field_pair = 0;
 
-			VkVideoReferenceSlotInfoKHR reference_slot_infos[17] = {};
-			VkVideoPictureResourceInfoKHR reference_slot_pictures[17] = {};
-			VkVideoDecodeH264DpbSlotInfoKHR dpb_slots_h264[17] = {};
-			StdVideoDecodeH264ReferenceInfo reference_infos_h264[17] = {};
-			for (uint32_t i = 0; i < video.num_dpb_slots; ++i)
-			{
-				VkVideoReferenceSlotInfoKHR& slot = reference_slot_infos[i];
-				VkVideoPictureResourceInfoKHR& pic = reference_slot_pictures[i];
-				VkVideoDecodeH264DpbSlotInfoKHR& dpb = dpb_slots_h264[i];
-				StdVideoDecodeH264ReferenceInfo& ref = reference_infos_h264[i];
-
-				slot.sType = VK_STRUCTURE_TYPE_VIDEO_REFERENCE_SLOT_INFO_KHR;
-				slot.pPictureResource = &pic;
-				slot.slotIndex = i;
-				slot.pNext = &dpb;
-
-				pic.sType = VK_STRUCTURE_TYPE_VIDEO_PICTURE_RESOURCE_INFO_KHR;
-				pic.codedOffset.x = 0;
-				pic.codedOffset.y = 0;
-				pic.codedExtent = codedExtent;
-				pic.baseArrayLayer = i;
-				pic.imageViewBinding = dpb_image_view;
-
-				dpb.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_H264_DPB_SLOT_INFO_KHR;
-				dpb.pStdReferenceInfo = &ref;
-
-				ref.flags.bottom_field_flag = 0;
-				ref.flags.top_field_flag = 0;
-				ref.flags.is_non_existing = 0;
-				ref.flags.used_for_long_term_reference = 0;
-				ref.FrameNum = video.framenum_status[i];
-				ref.PicOrderCnt[0] = video.poc_status[i];
-				ref.PicOrderCnt[1] = video.poc_status[i];
-			}
-
-			VkVideoReferenceSlotInfoKHR reference_slots[17] = {};
-			for (size_t i = 0; i < video.reference_usage.size(); ++i)
-			{
-				uint32_t ref_slot = video.reference_usage[i];
-				assert(ref_slot != video.current_slot);
-				reference_slots[i] = reference_slot_infos[ref_slot];
-			}
-			reference_slots[video.reference_usage.size()] = reference_slot_infos[video.current_slot];
-			reference_slots[video.reference_usage.size()].slotIndex = -1;
+			parameters_h264.update_slots(decode, core.dpb);
+			VkVideoReferenceSlotInfoKHR* reference_slots = parameters_h264.reference_slots;
 
 			VkVideoBeginCodingInfoKHR begin_info = {};
 			begin_info.sType = VK_STRUCTURE_TYPE_VIDEO_BEGIN_CODING_INFO_KHR;
 			begin_info.videoSession = video_session;
 			begin_info.videoSessionParameters = session_parameters;
-			begin_info.referenceSlotCount = uint32_t(video.reference_usage.size() + 1); // add in the current reconstructed DPB image
+			begin_info.referenceSlotCount = decode.reference_count + 1; // add in the current reconstructed DPB image
 			begin_info.pReferenceSlots = begin_info.referenceSlotCount == 0 ? nullptr : reference_slots;
 			vkCmdBeginVideoCodingKHR(video_cmd, &begin_info);
 
-			if (video.frameIndex == 0)
+			if (decode.frame_index == 0)
 			{
 				VkVideoCodingControlInfoKHR control_info = {};
 				control_info.sType = VK_STRUCTURE_TYPE_VIDEO_CODING_CONTROL_INFO_KHR;
@@ -1575,14 +1442,44 @@ int main(int argc, char* argv[])
 				vkCmdControlVideoCodingKHR(video_cmd, &control_info);
 			}
 
+			// The frame is copied into the bitstream ring, the ranges of the completed decodes are reused:
+			uint64_t bitstream_offset = 0;
+			{
+				uint64_t decode_completed_value = 0;
+				res = vkGetSemaphoreCounterValue(device, decode_timeline, &decode_completed_value);
+				assert(res == VK_SUCCESS);
+				bitstream_ring.reclaim(decode_completed_value);
+				while (!bitstream_ring.allocate(frame_info.size, decode_submit_count + 1, bitstream_offset))
+				{
+					// Only if the ring is smaller than the decodes in flight need, the oldest one is waited for:
+					const uint64_t oldest_value = bitstream_ring.oldest_completion_value();
+					VkSemaphoreWaitInfo wait_info = {};
+					wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+					wait_info.semaphoreCount = 1;
+					wait_info.pSemaphores = &decode_timeline;
+					wait_info.pValues = &oldest_value;
+					res = vkWaitSemaphores(device, &wait_info, ~0ull);
+					assert(res == VK_SUCCESS);
+					bitstream_ring.reclaim(oldest_value);
+				}
+				std::memcpy((uint8_t*)bitstream_mapped_data + bitstream_offset, video.h264_data.data() + frame_info.offset, frame_info.size);
+				VkMappedMemoryRange range = {};
+				range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+				range.memory = bitstream_buffer_memory;
+				range.offset = 0;
+				range.size = VK_WHOLE_SIZE;
+				res = vkFlushMappedMemoryRanges(device, 1, &range);
+				assert(res == VK_SUCCESS);
+			}
+
 			VkVideoDecodeInfoKHR decode_info = {};
 			decode_info.sType = VK_STRUCTURE_TYPE_VIDEO_DECODE_INFO_KHR;
 			decode_info.srcBuffer = bitstream_buffer;
-			decode_info.srcBufferOffset = (VkDeviceSize)frame_info.offset;
-			decode_info.srcBufferRange = (VkDeviceSize)align(frame_info.size, bitstream_alignment);
+			decode_info.srcBufferOffset = bitstream_offset;
+			decode_info.srcBufferRange = (VkDeviceSize)bitstream_ring.aligned_size(frame_info.size);
 			if (dpb_output_coincide_supported)
 			{
-				decode_info.dstPictureResource = *reference_slot_infos[video.current_slot].pPictureResource;
+				decode_info.dstPictureResource = *parameters_h264.reference_slot_infos[decode.current_slot].pPictureResource;
 			}
 			else
 			{
@@ -1590,12 +1487,12 @@ int main(int argc, char* argv[])
 				decode_info.dstPictureResource.codedOffset.x = 0;
 				decode_info.dstPictureResource.codedOffset.y = 0;
 				decode_info.dstPictureResource.codedExtent = codedExtent;
-				decode_info.dstPictureResource.baseArrayLayer = 0;
+				decode_info.dstPictureResource.baseArrayLayer = context;
 				decode_info.dstPictureResource.imageViewBinding = decode_output_image_view;
 			}
-			decode_info.referenceSlotCount = uint32_t(video.reference_usage.size());
+			decode_info.referenceSlotCount = decode.reference_count;
 			decode_info.pReferenceSlots = decode_info.referenceSlotCount == 0 ? nullptr : reference_slots;
-			decode_info.pSetupReferenceSlot = &reference_slot_infos[video.current_slot];
+			decode_info.pSetupReferenceSlot = &parameters_h264.reference_slot_infos[decode.current_slot];
 
 			uint32_t slice_offset = 0;
 
@@ -1615,7 +1512,7 @@ int main(int argc, char* argv[])
 
 			if (dpb_output_coincide_supported)
 			{
-				if (dpb_layouts[video.current_slot] != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+				if (dpb_layouts[decode.current_slot] != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
 				{
 					// if current DPB slot is not in copy src layout, transition it now:
 					VkImageMemoryBarrier barrier = {};
@@ -1628,17 +1525,17 @@ int main(int argc, char* argv[])
 					barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 					barrier.subresourceRange.baseMipLevel = 0;
 					barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-					barrier.subresourceRange.baseArrayLayer = video.current_slot;
+					barrier.subresourceRange.baseArrayLayer = decode.current_slot;
 					barrier.subresourceRange.layerCount = 1;
 					barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 					barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 					vkCmdPipelineBarrier(video_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
-					dpb_layouts[video.current_slot] = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+					dpb_layouts[decode.current_slot] = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 				}
 			}
 			else
 			{
-				// No-coincide output image needs will be used as copy src:
+				// No-coincide output layer will be used as copy src:
 				VkImageMemoryBarrier barrier = {};
 				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 				barrier.image = decode_output_image;
@@ -1649,8 +1546,8 @@ int main(int argc, char* argv[])
 				barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 				barrier.subresourceRange.baseMipLevel = 0;
 				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-				barrier.subresourceRange.baseArrayLayer = 0;
-				barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+				barrier.subresourceRange.baseArrayLayer = context;
+				barrier.subresourceRange.layerCount = 1;
 				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 				vkCmdPipelineBarrier(video_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
@@ -1659,31 +1556,62 @@ int main(int argc, char* argv[])
 			res = vkEndCommandBuffer(video_cmd);
 			assert(res == VK_SUCCESS);
 
+			// The timeline value signaled by this decode tells the display loop when it completed:
+			decode_submit_count++;
+			VkTimelineSemaphoreSubmitInfo timeline_info = {};
+			timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timeline_info.pSignalSemaphoreValues = &decode_submit_count;
+			timeline_info.signalSemaphoreValueCount = 1;
+
 			VkSubmitInfo submitInfo = {};
 			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.pNext = &timeline_info;
 			submitInfo.pCommandBuffers = &video_cmd;
 			submitInfo.commandBufferCount = 1;
-			submitInfo.pSignalSemaphores = &video_semaphore; // signals for graphics that it needs to wait for video decode to complete
+			submitInfo.pSignalSemaphores = &decode_timeline;
 			submitInfo.signalSemaphoreCount = 1;
 			res = vkQueueSubmit(videoQueue, 1, &submitInfo, VK_NULL_HANDLE);
 			assert(res == VK_SUCCESS);
 
-			wait_semaphores.push_back(video_semaphore);
-			printf("Decoded frame_index = %d, display_order: %d\n", video.frameIndex, frame_info.display_order);
+			DecodeInFlight in_flight;
+			in_flight.context = context;
+			in_flight.timeline_value = decode_submit_count;
+			decodes_in_flight.push_back(in_flight);
+			core.end_decode(decode);
+			if (bench)
+			{
+				benchmark.end_submit(frame_info.size);
+			}
+			else
+			{
+				printf("Decoded frame_index = %d, display_order: %d\n", decode.frame_index, frame_info.display_order);
+			}
+			benchmark.begin_submit();
+		}
 
-			// DPB slot management:
-			//	When current frame was a reference, then the next frame can not overwrite its DPB slot, so increment next_slot as a ring buffer
-			//	However, the ring buffer will wrap around so older reference frames can be overwritten by this
-			if (frame_info.reference_priority > 0)
+		if (bench)
+		{
+			// Headless benchmark: the oldest decode in flight is waited for, and it's displayed right away without copying or presenting it, so its picture is freed:
+			if (!decodes_in_flight.empty())
 			{
-				if (video.next_ref >= video.reference_usage.size())
-				{
-					video.reference_usage.resize(video.next_ref + 1);
-				}
-				video.reference_usage[video.next_ref] = video.current_slot;
-				video.next_ref = (video.next_ref + 1) % (video.num_dpb_slots - 1);
-				video.next_slot = (video.next_slot + 1) % video.num_dpb_slots;
+				VkSemaphoreWaitInfo wait_info = {};
+				wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+				wait_info.semaphoreCount = 1;
+				wait_info.pSemaphores = &decode_timeline;
+				wait_info.pValues = &decodes_in_flight.front().timeline_value;
+				res = vkWaitSemaphores(device, &wait_info, ~0ull);
+				assert(res == VK_SUCCESS);
+				core.finish_decode();
+				decodes_in_flight.erase(decodes_in_flight.begin());
+				benchmark.end_decode();
 			}
+			else if (video.live && !video.Is_frame_ready())
+			{
+				video.stream.wait(1);
+			}
+			while (core.update_display(core.next_frame_time));
+			exiting = decodes_in_flight.empty() && (video.live ? (video.live_ended && !video.Is_frame_ready()) : !benchmark.can_submit());
+			continue;
 		}
 
 		// Resolve latest video frame to RGB onto the swapchain with a compute shader every frame, even if decoding didn't happen, the presentation loop is running independently of video decoder frame rate:
@@ -1692,21 +1620,17 @@ int main(int argc, char* argv[])
 		res = vkBeginCommandBuffer(graphics_cmd, &cmd_begin_info);
 		assert(res == VK_SUCCESS);
 
-		if (must_decode)
+		// The decodes in flight complete in submission order, the completed ones are copied to their reordering pictures:
+		uint64_t decode_completed_value = 0;
+		res = vkGetSemaphoreCounterValue(device, decode_timeline, &decode_completed_value);
+		assert(res == VK_SUCCESS);
+		while (!decodes_in_flight.empty() && decodes_in_flight.front().timeline_value <= decode_completed_value)
 		{
-			// If decode happened this frame, then copy the latest output to the reordering picture queue:
-			if (reordered_results_free.empty())
-			{
-				// Request new image, because there is no more free ones that we can use:
-				reordered_results_free.emplace_back();
-				reordered_results_free.back().create(device, video.padded_width, video.padded_height);
-			}
+			const DecodeInFlight& finished = decodes_in_flight.front();
+			const VideoDecoderCore::Picture& picture = core.pictures[core.decoding_pictures.front()];
 
-			// Copy will be done from decoder output to the newly allocated reordered picture:
-			DecodeResultReordered reordered_current = reordered_results_free.back();
-			reordered_results_free.pop_back();
-			reordered_current.display_order = video.frame_infos[video.frameIndex].display_order;
-			reordered_current.frame_index = video.frameIndex;
+			// Copy will be done from decoder output to the reordered picture that was selected by the decoder core:
+			const DecodeResultReordered& reordered_current = reordered_pictures[core.decoding_pictures.front()];
 
 			VkImageMemoryBarrier barrier = {};
 			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1738,13 +1662,13 @@ int main(int argc, char* argv[])
 			{
 				// Copy from DPB:
 				src = dpb_image;
-				cpy.srcSubresource.baseArrayLayer = video.current_slot;
+				cpy.srcSubresource.baseArrayLayer = picture.slot;
 			}
 			else
 			{
-				// Copy from distinct output:
+				// Copy from distinct output, each decode context has its own layer:
 				src = decode_output_image;
-				cpy.srcSubresource.baseArrayLayer = 0;
+				cpy.srcSubresource.baseArrayLayer = finished.context;
 			}
 			vkCmdCopyImage(graphics_cmd, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, reordered_current.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy);
 			cpy.extent.width = codedExtent.width / 2;
@@ -1760,44 +1684,11 @@ int main(int argc, char* argv[])
 			vkCmdPipelineBarrier(graphics_cmd, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
 
 			// Current latest reordered is pushed to the reorder working queue:
-			reordered_results_working.push_back(reordered_current);
-
-			video.frameIndex = (video.frameIndex + 1) % video.frame_infos.size();
-		}
-
-		video.time_until_next_frame -= video.timer.elapsed_seconds();
-		video.timer.record();
-		if (video.time_until_next_frame <= 0)
-		{
-			// Search for the next displayable:
-			int display_order_changed = -1;
-			for (int i = 0; i < (int)reordered_results_working.size(); ++i)
-			{
-				if (reordered_results_working[i].display_order == video.target_display_order)
-				{
-					display_order_changed = i;
-				}
-			}
-			if (display_order_changed >= 0)
-			{
-				// Free current output texture:
-				if (displayed_image.image != VK_NULL_HANDLE)
-				{
-					reordered_results_free.push_back(displayed_image);
-				}
-				// Take this used texture as current output:
-				displayed_image = std::move(reordered_results_working[display_order_changed]);
-				// Remove this used texture:
-				std::swap(reordered_results_working[display_order_changed], reordered_results_working.back());
-				reordered_results_working.pop_back();
-
-				video.time_until_next_frame = video.frame_infos[displayed_image.frame_index].duration_seconds;
-
-				assert(displayed_image.image != VK_NULL_HANDLE);
-				printf("\tDisplayed image changed, frame_index: %d, display_order: %d\n", displayed_image.frame_index, displayed_image.display_order);
-				video.target_display_order++;
-			}
+			core.finish_decode();
+			decodes_in_flight.erase(decodes_in_flight.begin());
 		}
+		wait_semaphores.push_back(decode_timeline); // the graphics queue waits for the video queue to make the copied decode outputs visible
+		wait_values.push_back(decode_completed_value);
 
 		// Request free swapchain image:
 		swapchain_acquire_semaphore_index = (swapchain_acquire_semaphore_index + 1) % (uint32_t)swapchain_acquire_semaphores.size();
@@ -1817,7 +1708,19 @@ int main(int argc, char* argv[])
 			}
 		} while (res != VK_SUCCESS);
 
+		// With the FIFO present mode, the acquire returns when a vsync released a swapchain image, so it corrects the vsync timeline of the presentation clock:
+		presentation_clock.vsync(video.timer.elapsed_nanoseconds());
+
+		// The displayed picture is swapped when its time comes, the presentation clock selects the picture that is nearest to the next vsync:
+		if (core.update_display(Video::Timer::nanoseconds_to_ticks(presentation_clock.media_time(video.timer.elapsed_nanoseconds()), video.timescale)))
+		{
+			const VideoDecoderCore::Picture& picture = core.pictures[core.displayed_picture];
+			printf("\tDisplayed image changed, frame_index: %d, display_order: %d\n", picture.frame_index, picture.display_order);
+		}
+		const DecodeResultReordered& displayed_image = core.displayed_picture >= 0 ? reordered_pictures[core.displayed_picture] : no_picture;
+
 		wait_semaphores.push_back(swapchain_acquire_semaphores[swapchain_acquire_semaphore_index]);
+		wait_values.push_back(0); // binary semaphore, the value is ignored
 
 		VkImageMemoryBarrier barrier = {};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1904,8 +1807,14 @@ int main(int argc, char* argv[])
 			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
 		};
 
+		VkTimelineSemaphoreSubmitInfo timeline_info = {};
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timeline_info.pWaitSemaphoreValues = wait_values.data();
+		timeline_info.waitSemaphoreValueCount = (uint32_t)wait_values.size();
+
 		VkSubmitInfo submitInfo = {};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timeline_info;
 		submitInfo.pCommandBuffers = &graphics_cmd;
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pSignalSemaphores = &swapchain_release_semaphores[swapchain_image_index];
@@ -1937,8 +1846,17 @@ int main(int argc, char* argv[])
 		assert(res == VK_SUCCESS);
 	}
 
+	if (bench)
+	{
+		benchmark.print_json("vulkan", filename, decode_frames_in_flight);
+	}
+
 	// Clean up everything:
 	vkDeviceWaitIdle(device);
+	if (bitstream_mapped_data != nullptr)
+	{
+		vkUnmapMemory(device, bitstream_buffer_memory);
+	}
 	vkDestroyBuffer(device, bitstream_buffer, nullptr);
 	vkFreeMemory(device, bitstream_buffer_memory, nullptr);
 	vkDestroyImageView(device, dpb_image_view, nullptr);
@@ -1947,15 +1865,10 @@ int main(int argc, char* argv[])
 	vkDestroyImageView(device, decode_output_image_view, nullptr);
 	vkDestroyImage(device, decode_output_image, nullptr);
 	vkFreeMemory(device, decode_output_image_memory, nullptr);
-	for (auto& x : reordered_results_free)
+	for (auto& x : reordered_pictures)
 	{
 		x.destroy(device);
 	}
-	for (auto& x : reordered_results_working)
-	{
-		x.destroy(device);
-	}
-	displayed_image.destroy(device);
 	vkDestroyVideoSessionKHR(device, video_session, nullptr);
 	for (auto& x : video_session_allocations)
 	{
@@ -1981,9 +1894,12 @@ int main(int argc, char* argv[])
 		vkDestroySemaphore(device, x, nullptr);
 	}
 	vkDestroySwapchainKHR(device, swapchain, nullptr);
-	vkDestroyCommandPool(device, video_command_pool, nullptr);
+	for (auto& x : video_command_pools)
+	{
+		vkDestroyCommandPool(device, x, nullptr);
+	}
 	vkDestroyCommandPool(device, graphics_command_pool, nullptr);
-	vkDestroySemaphore(device, video_semaphore, nullptr);
+	vkDestroySemaphore(device, decode_timeline, nullptr);
 	vkDestroyFence(device, fence, nullptr);
 	vkDestroyDevice(device, nullptr);
 	if (debugUtilsMessenger != VK_NULL_HANDLE)
@@ -1992,8 +1908,11 @@ int main(int argc, char* argv[])
 	}
 
 #ifdef __linux__
-	XDestroyWindow(display, window);
-	XCloseDisplay(display);
+	if (display != nullptr)
+	{
+		XDestroyWindow(display, window);
+		XCloseDisplay(display);
+	}
 #endif // __linux__
 
 	return 0;